@@ -0,0 +1,663 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file bench.cxx
+ * @author Max Rodriguez
+ * @date 2023-07-02
+ */
+
+/* Microbenchmarks of the library's hot paths, against the sample schema in bench.dc.
+ *
+ *     astron_bench [--dc bench.dc] [--time ms] [--filter text] [--json out.json] [--baseline old.json]
+ *                  [--log file] [--help]
+ *
+ * Under Emscripten, run it with `node astron_bench.js ...`. Each benchmark is repeated until it
+ * has run for at least --time milliseconds (default 250), three times over; the fastest of the
+ * three is reported, with the heap allocations made per operation. --json writes the results so
+ * that a later run can be compared against them with --baseline.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "../src/dc/Class.h"
+#include "../src/dc/Field.h"
+#include "../src/dc/File.h"
+#include "../src/dc/value/format.h"
+#include "../src/dc/value/parse.h"
+#include "../src/file/hash.h"
+#include "../src/file/read.h"
+#include "../src/network/DatagramIterator.hxx"
+#include "../src/object/Interpolator.hxx"
+#include "../src/util/Logger.hxx"
+#ifdef __EMSCRIPTEN__
+#include "../src/object/ObjectFactory.hxx"
+#endif
+
+using namespace astron;
+
+#ifndef BENCH_DC
+#define BENCH_DC "bench.dc"
+#endif
+
+// Every allocation made through operator new is counted; the benchmarks are single-threaded.
+// The replacements aren't inlined, as GCC would then see new paired with free() and warn.
+static uint64_t g_allocations = 0;
+static uint64_t g_allocated_bytes = 0;
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    ++g_allocations;
+    g_allocated_bytes += size;
+    void *ptr = malloc(size ? size : 1);
+    if(ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+// Results are added to g_sink so that the compiler can't remove the work being measured.
+static volatile uint64_t g_sink = 0;
+
+struct Result
+{
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+class Bench
+{
+  public:
+    Bench(double min_ms, const std::string &filter) : m_min_ms(min_ms), m_filter(filter)
+    {
+    }
+
+    // run times <body>, a function of the number of operations to perform, and records the result.
+    // A <body> that returns a double times itself, and returns the milliseconds it took.
+    // <max_iterations> limits the operations of a benchmark which uses up memory as it runs.
+    template <typename F>
+    void run(const std::string &name, F body, uint64_t max_iterations = UINT64_MAX)
+    {
+        if(!m_filter.empty() && name.find(m_filter) == std::string::npos) {
+            return;
+        }
+
+        // Grow the number of operations until a run takes long enough to be timed.
+        uint64_t n = 1;
+        double elapsed = time(body, n);
+        // A body the compiler removed entirely (such as a log line below ASTRON_MIN_LOG_LEVEL) takes
+        // no time for any n, so n stops growing at <max_iterations> rather than overflowing.
+        while(elapsed < m_min_ms && n < max_iterations) {
+            double scale = elapsed > 0.0 ? m_min_ms * 1.2 / elapsed : 100.0;
+            double next = double(n) * std::min(std::max(scale, 2.0), 100.0);
+            n = next < double(max_iterations) ? uint64_t(next) : max_iterations;
+            elapsed = time(body, n);
+        }
+
+        Result result;
+        result.name = name;
+        result.iterations = n;
+        result.ns_per_op = elapsed * 1e6 / n;
+        for(int round = 0; round < 2; ++round) {
+            result.ns_per_op = std::min(result.ns_per_op, time(body, n) * 1e6 / n);
+        }
+
+        uint64_t allocations = g_allocations, bytes = g_allocated_bytes;
+        body(n);
+        result.allocs_per_op = double(g_allocations - allocations) / n;
+        result.bytes_per_op = double(g_allocated_bytes - bytes) / n;
+
+        printf("%-36s %12.1f %10.2f %10.1f %12llu\n", name.c_str(), result.ns_per_op,
+               result.allocs_per_op, result.bytes_per_op, (unsigned long long)n);
+        fflush(stdout);
+        m_results.push_back(result);
+    }
+
+    // skip reports that the benchmark <name> isn't available in this build, and why.
+    void skip(const std::string &name, const std::string &reason)
+    {
+        if(!m_filter.empty() && name.find(m_filter) == std::string::npos) {
+            return;
+        }
+        printf("%-36s (%s)\n", name.c_str(), reason.c_str());
+        fflush(stdout);
+    }
+
+    const std::vector<Result>& get_results() const
+    {
+        return m_results;
+    }
+
+  private:
+    template <typename F>
+    static auto time(F &body, uint64_t n) -> typename std::enable_if<std::is_void<decltype(body(n))>::value,
+                                                                    double>::type
+    {
+        auto start = std::chrono::steady_clock::now();
+        body(n);
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    }
+    template <typename F>
+    static auto time(F &body, uint64_t n) -> typename std::enable_if<!std::is_void<decltype(body(n))>::value,
+                                                                     double>::type
+    {
+        return body(n);
+    }
+
+    double m_min_ms;
+    std::string m_filter;
+    std::vector<Result> m_results;
+};
+
+// A Sample is the packed value of a field of the sample schema, as it would arrive in an update.
+struct Sample
+{
+    const char *dclass;
+    const char *field;
+    DatagramPtr packed;
+};
+
+static void add_friend(DatagramPtr dg, uint32_t doid, const std::string &name, uint8_t flags)
+{
+    dg->add_uint32(doid);
+    dg->add_string(name);
+    dg->add_uint8(flags);
+}
+
+static std::vector<Sample> make_samples()
+{
+    std::vector<Sample> samples;
+
+    DatagramPtr xyh = Datagram::create(); // setXYH : setX, setY, setH
+    xyh->add_int16(1254);
+    xyh->add_int16(-387);
+    xyh->add_int16(1800);
+    samples.push_back({"DistributedNode", "setXYH", xyh});
+
+    DatagramPtr locomotion = Datagram::create(); // setLocomotion(Vec3, angle, int16/100, uint32)
+    locomotion->add_int16(1254);
+    locomotion->add_int16(-387);
+    locomotion->add_int16(5);
+    locomotion->add_int16(1800);
+    locomotion->add_int16(1250);
+    locomotion->add_uint32(3141592653u);
+    samples.push_back({"DistributedAvatar", "setLocomotion", locomotion});
+
+    DatagramPtr chat = Datagram::create(); // setTalk(doId, uint32, string, string, uint8[], uint8)
+    chat->add_uint32(100000042);
+    chat->add_uint32(0);
+    chat->add_string("Captain Flapjack");
+    chat->add_string("Anyone want to go to the playground?");
+    chat->add_blob(std::vector<uint8_t>{ 1, 2, 3, 4 });
+    chat->add_uint8(0);
+    samples.push_back({"DistributedPlayer", "setTalk", chat});
+
+    DatagramPtr inventory = Datagram::create(); // setInventory(InventoryItem[])
+    inventory->add_size(24 * 7);
+    for(uint16_t i = 0; i < 24; ++i) {
+        inventory->add_uint16(100 + i * 3);
+        inventory->add_uint8(1 + i % 5);
+        inventory->add_uint32(i % 4 ? 0 : 86400 * i);
+    }
+    samples.push_back({"DistributedPlayer", "setInventory", inventory});
+
+    DatagramPtr friends = Datagram::create(); // setFriendsList(FriendEntry[])
+    DatagramPtr entries = Datagram::create();
+    const char *names[] = { "Flippy", "Lil Oldman", "Professor Pete", "Sticky Lou", "Banker Bob", "Clerk Clara" };
+    for(uint32_t i = 0; i < 12; ++i) {
+        add_friend(entries, 100000100 + i, names[i % 6], uint8_t(i & 3));
+    }
+    friends->add_size(entries->size());
+    friends->add_data(entries);
+    samples.push_back({"DistributedPlayer", "setFriendsList", friends});
+
+    DatagramPtr appearance = Datagram::create(); // setAppearance(Appearance)
+    appearance->add_uint8(3);
+    appearance->add_uint8(12);
+    appearance->add_uint8(4);
+    appearance->add_uint8(2);
+    appearance->add_uint8(255);
+    appearance->add_uint8(128);
+    appearance->add_uint8(0);
+    appearance->add_string("shirt:24,shorts:7,gloves:1");
+    samples.push_back({"DistributedAvatar", "setAppearance", appearance});
+
+    return samples;
+}
+
+// make_hierarchy_dc generates a schema whose classes are deep (a chain of <depth> classes) and
+// wide (<width> classes deriving from its middle, some also from a second parent), each class
+// declaring <fields> fields of its own.
+static std::string make_hierarchy_dc(unsigned int depth, unsigned int width, unsigned int fields)
+{
+    std::ostringstream dc;
+    dc << "keyword broadcast;\nkeyword ram;\n\n";
+    for(unsigned int c = 0; c < depth; ++c) {
+        dc << "dclass Deep" << c;
+        if(c > 0) {
+            dc << " : Deep" << c - 1;
+        }
+        dc << " {\n";
+        for(unsigned int f = 0; f < fields; ++f) {
+            dc << "    setDeep" << c << "_" << f << "(uint32, int16/10) broadcast ram;\n";
+        }
+        dc << "};\n";
+    }
+    for(unsigned int c = 0; c < width; ++c) {
+        dc << "dclass Wide" << c << " : Deep" << depth / 2;
+        if(c % 4 == 3) {
+            dc << ", Wide" << c - 1;
+        }
+        dc << " {\n";
+        for(unsigned int f = 0; f < fields; ++f) {
+            dc << "    setWide" << c << "_" << f << "(string, uint8) broadcast;\n";
+        }
+        dc << "};\n";
+    }
+    return dc.str();
+}
+
+#ifdef __EMSCRIPTEN__
+class BenchObject : public DistributedObject
+{
+  public:
+    BenchObject(std::string dclass_name) : DistributedObject(dclass_name)
+    {
+    }
+};
+static ObjectType<BenchObject> bench_object_type("DistributedDoor");
+#endif
+
+static void run_benchmarks(Bench &bench, dclass::File *dcfile, const std::string &dc_text)
+{
+    // Datagram / DatagramIterator
+    DatagramPtr dg = Datagram::create();
+    bench.run("datagram.add_scalars", [&](uint64_t n) {
+        for(uint64_t i = 0; i < n; ++i) {
+            dg->clear();
+            dg->add_uint32(100000042);
+            dg->add_uint16(uint16_t(i));
+            dg->add_int16(1254);
+            dg->add_int16(-387);
+            dg->add_int16(1800);
+            dg->add_uint8(1);
+            dg->add_uint64(i);
+            dg->add_float64(0.5);
+        }
+        g_sink += dg->size();
+    });
+    bench.run("datagram.add_string_blob", [&](uint64_t n) {
+        std::string name = "Captain Flapjack";
+        std::vector<uint8_t> blob(32, 7);
+        for(uint64_t i = 0; i < n; ++i) {
+            dg->clear();
+            dg->add_string(name);
+            dg->add_blob(blob);
+        }
+        g_sink += dg->size();
+    });
+
+    DatagramPtr scalars = Datagram::create();
+    scalars->add_uint32(100000042);
+    scalars->add_uint16(1);
+    scalars->add_int16(1254);
+    scalars->add_int16(-387);
+    scalars->add_int16(1800);
+    scalars->add_uint8(1);
+    scalars->add_uint64(2);
+    scalars->add_float64(0.5);
+    bench.run("iterator.read_scalars", [&](uint64_t n) {
+        DatagramIterator dgi(scalars);
+        uint64_t sum = 0;
+        for(uint64_t i = 0; i < n; ++i) {
+            dgi.seek(0);
+            sum += dgi.read_uint32();
+            sum += dgi.read_uint16();
+            sum += dgi.read_int16();
+            sum += dgi.read_int16();
+            sum += dgi.read_int16();
+            sum += dgi.read_uint8();
+            sum += dgi.read_uint64();
+            sum += uint64_t(dgi.read_float64());
+        }
+        g_sink += sum;
+    });
+
+    DatagramPtr strings = Datagram::create();
+    strings->add_string("Captain Flapjack");
+    strings->add_string("Anyone want to go to the playground?");
+    bench.run("iterator.read_string", [&](uint64_t n) {
+        DatagramIterator dgi(strings);
+        uint64_t sum = 0;
+        for(uint64_t i = 0; i < n; ++i) {
+            dgi.seek(0);
+            sum += dgi.read_string().size();
+            sum += dgi.read_string().size();
+        }
+        g_sink += sum;
+    });
+
+    // Fields of the sample schema
+    std::vector<Sample> samples = make_samples();
+    std::vector<uint8_t> buffer;
+    std::string text;
+    for(const Sample &sample : samples) {
+        const dclass::Class *cls = dcfile->get_class_by_name(sample.dclass);
+        const dclass::Field *field = cls ? cls->get_field_by_name(sample.field) : nullptr;
+        if(field == nullptr) {
+            fprintf(stderr, "No field %s.%s in the schema.\n", sample.dclass, sample.field);
+            continue;
+        }
+        std::string suffix = std::string("/") + sample.field;
+        DatagramPtr packed = sample.packed;
+
+        bench.run("iterator.unpack_field" + suffix, [&](uint64_t n) {
+            DatagramIterator dgi(packed);
+            for(uint64_t i = 0; i < n; ++i) {
+                dgi.seek(0);
+                buffer.clear();
+                dgi.unpack_field(field, buffer);
+            }
+            g_sink += buffer.size();
+        });
+        bench.run("iterator.skip_field" + suffix, [&](uint64_t n) {
+            DatagramIterator dgi(packed);
+            for(uint64_t i = 0; i < n; ++i) {
+                dgi.seek(0);
+                dgi.skip_field(field);
+            }
+            g_sink += dgi.tell();
+        });
+        bench.run("value.format_value" + suffix, [&](uint64_t n) {
+            for(uint64_t i = 0; i < n; ++i) {
+                text.clear();
+                dclass::format_value(field->get_type(), packed->get_data(), packed->size(), text);
+            }
+            g_sink += text.size();
+        });
+    }
+
+    // Large array literals, as written by format_value(), parsed back into their packed form.
+    DatagramPtr times = Datagram::create(); // setEventTimes(uint32[]), 4096 elements
+    times->add_size(4096 * 4);
+    for(uint32_t i = 0; i < 4096; ++i) {
+        times->add_uint32(1688169600u + i * 3607u);
+    }
+    DatagramPtr items = Datagram::create(); // setInventory(InventoryItem[]), 1024 elements
+    items->add_size(1024 * 7);
+    for(uint16_t i = 0; i < 1024; ++i) {
+        items->add_uint16(100 + i);
+        items->add_uint8(1 + i % 99);
+        items->add_uint32(i % 4 ? 0 : 86400u * i);
+    }
+    std::vector<Sample> arrays = { {"DistributedDistrict", "setEventTimes", times},
+                                   {"DistributedPlayer", "setInventory", items} };
+    for(const Sample &sample : arrays) {
+        const dclass::Class *cls = dcfile->get_class_by_name(sample.dclass);
+        const dclass::Field *field = cls ? cls->get_field_by_name(sample.field) : nullptr;
+        if(field == nullptr) {
+            fprintf(stderr, "No field %s.%s in the schema.\n", sample.dclass, sample.field);
+            continue;
+        }
+        std::string literal, error;
+        size_t offset = 0;
+        dclass::format_value(field->get_type(), sample.packed->get_data(), sample.packed->size(), literal);
+        buffer.clear();
+        if(!dclass::parse_value(field->get_type(), literal.data(), literal.size(), buffer, error, offset)
+           || buffer.size() != sample.packed->size()) {
+            fprintf(stderr, "%s.%s doesn't parse back: %s\n", sample.dclass, sample.field, error.c_str());
+            continue;
+        }
+        bench.run("value.parse_value/" + std::string(sample.field) + "_large", [&](uint64_t n) {
+            for(uint64_t i = 0; i < n; ++i) {
+                buffer.clear();
+                dclass::parse_value(field->get_type(), literal.data(), literal.size(), buffer, error, offset);
+            }
+            g_sink += buffer.size();
+        });
+    }
+
+    // dclass files
+    bench.run("file.read", [&](uint64_t n) {
+        for(uint64_t i = 0; i < n; ++i) {
+            std::istringstream in(dc_text);
+            dclass::File *file = dclass::read(in, "bench.dc");
+            g_sink += file ? file->get_num_classes() : 0;
+            // Not deleted, as ~File() frees molecular fields twice; hence the limit of 50 reads.
+        }
+    }, 50);
+    std::string hierarchy_text = make_hierarchy_dc(64, 256, 8);
+    bench.run("file.read_deep_hierarchy", [&](uint64_t n) {
+        for(uint64_t i = 0; i < n; ++i) {
+            std::istringstream in(hierarchy_text);
+            dclass::File *file = dclass::read(in, "hierarchy.dc");
+            g_sink += file ? file->get_num_classes() : 0;
+            // Not deleted, like the files of file.read.
+        }
+    }, 50);
+    bench.run("file.legacy_hash", [&](uint64_t n) {
+        for(uint64_t i = 0; i < n; ++i) {
+            g_sink += dclass::legacy_hash(dcfile);
+        }
+    });
+
+#ifdef __EMSCRIPTEN__
+    bench.run("object.instantiate_object", [&](uint64_t n) {
+        for(uint64_t i = 0; i < n; ++i) {
+            DistributedObject *obj = ObjectFactory::singleton.instantiate_object("DistributedDoor");
+            g_sink += obj != nullptr;
+            delete obj;
+        }
+    });
+#else
+    bench.skip("object.instantiate_object", "skipped: DistributedObject needs Emscripten");
+#endif
+
+    // Smoothed movement of 10,000 objects, each with a snapshot every 100 ms; every sample blends
+    // a pair of them, as the render time moves between snapshots.
+    const dclass::Class *node = dcfile->get_class_by_name("DistributedNode");
+    const dclass::Field *smooth = node ? node->get_field_by_name("setSmPosHpr") : nullptr;
+    if(smooth != nullptr) {
+        Interpolator interpolator(smooth, 4, 100.0);
+        for(unsigned int c = 3; c < 6; ++c) {
+            interpolator.set_wrap(c, 360.0f);
+        }
+        for(doid_t doid = 0; doid < 10000; ++doid) {
+            for(int n = 0; n < 4; ++n) {
+                float values[6] = { float(doid % 100) + n * 1.5f, float(doid / 100) - n * 0.5f, 0.0f,
+                                    float((doid * 7 + n * 45) % 360), 0.0f, 0.0f };
+                interpolator.add_snapshot(doid, n * 100.0, values);
+            }
+        }
+        bench.run("object.interpolator_sample_10k", [&](uint64_t n) {
+            for(uint64_t i = 0; i < n; ++i) {
+                interpolator.sample(200.0 + double(i % 200));
+            }
+            g_sink += uint64_t(interpolator.get_output(0)[9999]);
+        });
+    }
+
+    // Logger
+    LogCategory category("bench", "Bench");
+    bench.run("logger.line", [&](uint64_t n) {
+        for(uint64_t i = 0; i < n; ++i) {
+            ASTRON_LOG(category, LSEVERITY_INFO) << "Received update for field " << "setXYH"
+                                                 << " of object " << 100000042 << " (" << i << ").";
+        }
+        g_logger->flush();
+    });
+    // The cost on the logging thread alone, when messages are formatted later (as with Emscripten,
+    // once the current event is handled): lines are logged in bursts that fit in the ring, which
+    // is flushed between them, outside the timing.
+    g_logger->set_auto_flush(true, SIZE_MAX);
+    bench.run("logger.line_record", [&](uint64_t n) {
+        double elapsed = 0.0;
+        for(uint64_t i = 0; i < n;) {
+            uint64_t burst_end = std::min(n, i + 256);
+            auto start = std::chrono::steady_clock::now();
+            for(; i < burst_end; ++i) {
+                ASTRON_LOG(category, LSEVERITY_INFO) << "Received update for field " << "setXYH"
+                                                     << " of object " << 100000042 << " (" << i << ").";
+            }
+            auto end = std::chrono::steady_clock::now();
+            elapsed += std::chrono::duration<double, std::milli>(end - start).count();
+            g_logger->flush();
+        }
+        return elapsed;
+    });
+    g_logger->set_auto_flush(true);
+    // A line filtered out at run time by the severity of its category. A debug line would be
+    // compiled out entirely in Release builds, below ASTRON_MIN_LOG_LEVEL.
+    LogCategory quiet_category("bench_quiet", "BenchQuiet");
+    g_logger->set_category_severity("bench_quiet", LSEVERITY_WARNING);
+    bench.run("logger.line_filtered", [&](uint64_t n) {
+        for(uint64_t i = 0; i < n; ++i) {
+            ASTRON_LOG(quiet_category, LSEVERITY_INFO) << "Received update for field " << "setXYH"
+                                                       << " of object " << 100000042 << " (" << i << ").";
+        }
+    });
+}
+
+// read_baseline reads the ns/op of each benchmark from JSON written by write_json().
+static std::map<std::string, double> read_baseline(const std::string &filename)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream in(filename);
+    std::string line;
+    while(std::getline(in, line)) {
+        size_t name = line.find("\"name\": \""), ns = line.find("\"ns_per_op\": ");
+        if(name == std::string::npos || ns == std::string::npos) {
+            continue;
+        }
+        name += strlen("\"name\": \"");
+        baseline[line.substr(name, line.find('"', name) - name)] =
+            atof(line.c_str() + ns + strlen("\"ns_per_op\": "));
+    }
+    return baseline;
+}
+
+// write_json writes the results with one benchmark per line, as read_baseline() expects.
+static bool write_json(const std::string &filename, const std::vector<Result> &results,
+                       uint32_t hash, double min_ms)
+{
+    FILE *out = fopen(filename.c_str(), "w");
+    if(out == nullptr) {
+        return false;
+    }
+    fprintf(out, "{\n  \"schema_hash\": %u,\n  \"min_time_ms\": %g,\n", hash, min_ms);
+#ifdef __EMSCRIPTEN__
+    fprintf(out, "  \"platform\": \"emscripten\",\n");
+#else
+    fprintf(out, "  \"platform\": \"native\",\n");
+#endif
+    fprintf(out, "  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, "
+                     "\"bytes_per_op\": %.1f, \"iterations\": %llu}%s\n",
+                r.name.c_str(), r.ns_per_op, r.allocs_per_op, r.bytes_per_op,
+                (unsigned long long)r.iterations, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string dc_path = BENCH_DC, json_path, baseline_path, filter, log_path = "astron_bench.log";
+    double min_ms = 250.0;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--help" || arg == "-h") {
+            printf("usage: %s [--dc file] [--time ms] [--filter text] [--json out.json] [--baseline old.json]\n"
+                   "       [--log file]\n\n"
+                   "  --dc        the schema to benchmark against (default %s)\n"
+                   "  --time      the minimum time of each run, in milliseconds (default 250)\n"
+                   "  --filter    only run the benchmarks whose name contains <text>\n"
+                   "  --json      write the results to <out.json>\n"
+                   "  --baseline  compare the results with those written to <old.json> by an earlier run\n"
+                   "  --log       where the logger benchmarks write their lines (default astron_bench.log)\n",
+                   argv[0], BENCH_DC);
+            return 0;
+        }
+        if(i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s.\n", arg.c_str());
+            return 2;
+        }
+        if(arg == "--dc") {
+            dc_path = argv[++i];
+        } else if(arg == "--time") {
+            min_ms = atof(argv[++i]);
+        } else if(arg == "--filter") {
+            filter = argv[++i];
+        } else if(arg == "--json") {
+            json_path = argv[++i];
+        } else if(arg == "--baseline") {
+            baseline_path = argv[++i];
+        } else if(arg == "--log") {
+            log_path = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown option %s.\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    // Log lines go to a file only, so the timings include formatting and writing but not a terminal.
+    g_logger.reset(new Logger(log_path, LSEVERITY_INFO, false));
+    g_logger->set_color_enabled(false);
+
+    std::ifstream dc_file(dc_path);
+    std::stringstream dc_text;
+    dc_text << dc_file.rdbuf();
+    dclass::File *dcfile = dclass::read(dc_text, dc_path);
+    if(dcfile == nullptr) {
+        fprintf(stderr, "Failed to read %s.\n", dc_path.c_str());
+        return 1;
+    }
+    uint32_t hash = dclass::legacy_hash(dcfile);
+    printf("schema %s (hash %u), at least %g ms per benchmark\n\n", dc_path.c_str(), hash, min_ms);
+    printf("%-36s %12s %10s %10s %12s\n", "benchmark", "ns/op", "allocs/op", "bytes/op", "iterations");
+
+    Bench bench(min_ms, filter);
+    run_benchmarks(bench, dcfile, dc_text.str());
+
+    if(!baseline_path.empty()) {
+        std::map<std::string, double> baseline = read_baseline(baseline_path);
+        printf("\n%-36s %12s %12s %8s\n", "compared to baseline", "before", "after", "change");
+        for(const Result &r : bench.get_results()) {
+            auto it = baseline.find(r.name);
+            if(it != baseline.end() && it->second > 0.0) {
+                printf("%-36s %12.1f %12.1f %+7.1f%%\n", r.name.c_str(), it->second, r.ns_per_op,
+                       (r.ns_per_op / it->second - 1.0) * 100.0);
+            }
+        }
+    }
+    if(!json_path.empty() && !write_json(json_path, bench.get_results(), hash, min_ms)) {
+        fprintf(stderr, "Failed to write %s.\n", json_path.c_str());
+        return 1;
+    }
+    return 0;
+}
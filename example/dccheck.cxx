@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file dccheck.cxx
+ * @author Max Rodriguez
+ * @date 2023-06-30
+ */
+
+/* Checks the .dc file a client is built with against the server's, before deploying it.
+ *
+ *     node dccheck.js client.dc server.dc
+ *
+ * Prints every difference with its effect on the wire, then the verdict. Exits with:
+ *     0  the dc hashes match; the client will be accepted
+ *     1  the dc hashes differ, but every message reads the same (the Client Agent will still
+ *        eject the client with CLIENT_DISCONNECT_BAD_DCHASH unless it doesn't check the hash)
+ *     2  some messages can't be read by one side
+ *     3  a file couldn't be read
+ */
+
+#include <iostream>
+#include "../src/dc/File.h"
+#include "../src/file/read.h"
+#include "../src/file/diff.h"
+
+int main(int argc, char* argv[])
+{
+    if(argc != 3) {
+        std::cerr << "usage: dccheck client.dc server.dc\n";
+        return 3;
+    }
+
+    dclass::File *client = dclass::read(argv[1]);
+    dclass::File *server = dclass::read(argv[2]);
+    if(client == nullptr || server == nullptr) {
+        return 3;
+    }
+
+    dclass::SchemaDiff diff = dclass::diff_files(client, server);
+    dclass::write_diff(std::cout, diff);
+
+    if(!diff.is_wire_compatible()) {
+        return 2;
+    }
+    return diff.hashes_match ? 0 : 1;
+}
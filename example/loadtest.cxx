@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file loadtest.cxx
+ * @author Max Rodriguez
+ * @date 2023-06-30
+ */
+
+/* Load tests a ClientRepository against an in-process LoopbackAgent; no server needed.
+ *
+ *     node loadtest.js [file.dc workload.txt [seconds]]
+ *
+ * Without arguments, a built-in schema and workload (1000 avatars, 50k updates/s) are used.
+ * Every second it prints the update rate handled by the client, the time spent polling and
+ * the backlog (messages received but not handled yet).
+ */
+
+#include <fstream>
+#include <sstream>
+#include <emscripten.h>
+#include "../src/client/ClientRepository.hxx"
+#include "../src/client/LoopbackAgent.hxx"
+#include "../src/file/read.h"
+
+using namespace astron;
+
+static const char *DEFAULT_DC =
+    "keyword required; keyword broadcast; keyword ram; keyword clsend; keyword ownsend;\n"
+    "dclass DistributedAvatar {\n"
+    "    setName(string) required broadcast ram;\n"
+    "    setXYH(int16/10, int16/10, int16(0-360)) required broadcast ram clsend;\n"
+    "    setAnim(uint8) broadcast;\n"
+    "    chat(string) broadcast clsend;\n"
+    "};\n";
+static const char *DEFAULT_WORKLOAD = "DistributedAvatar objects=1000 rate=50000 fields=setXYH,setAnim\n";
+
+class LoadTest : public ClientRepository
+{
+  public:
+    LoadTest(LoopbackAgent *agent, double seconds) : m_agent(agent), m_seconds(seconds)
+    {
+    }
+
+    // frame is the main loop: it handles everything received, and reports once a second.
+    static void frame(void *arg)
+    {
+        LoadTest *test = static_cast<LoadTest*>(arg);
+        double start = emscripten_get_now();
+        test->poll(std::numeric_limits<double>::infinity());
+        double now = emscripten_get_now();
+        test->m_busy += now - start;
+
+        if(test->m_start == 0.0) {
+            test->m_start = test->m_last_report = now;
+        } else if(now - test->m_last_report >= 1000.0) {
+            test->report(now);
+        }
+    }
+
+  private:
+    void report(double now)
+    {
+        const LoopbackAgent::Stats &agent = m_agent->get_stats();
+        const PollStats &polls = get_poll_stats();
+        double elapsed = (now - m_last_report) / 1000.0;
+        logger().info() << "updates sent " << (agent.updates_sent - m_last_sent) / elapsed << "/s, handled "
+                        << polls.messages / elapsed << "/s, polling " << m_busy / elapsed << " ms/s, max poll "
+                        << polls.max_time << " ms, backlog " << get_backlog() << ", skipped " << agent.updates_skipped;
+        m_last_sent = agent.updates_sent;
+        m_last_report = now;
+        m_busy = 0.0;
+        reset_poll_stats();
+
+        if(now - m_start >= m_seconds * 1000.0) {
+            emscripten_cancel_main_loop();
+            emscripten_force_exit(0);
+        }
+    }
+
+    LoopbackAgent *m_agent;
+    double m_seconds;
+    double m_start = 0.0;
+    double m_last_report = 0.0;
+    double m_busy = 0.0; // milliseconds spent polling since the last report
+    uint64_t m_last_sent = 0;
+};
+
+int main(int argc, char* argv[])
+{
+    g_logger->set_color_enabled(false);
+
+    std::stringstream dc_text(DEFAULT_DC), workload_text(DEFAULT_WORKLOAD);
+    if(argc >= 3) {
+        std::ifstream dc_file(argv[1]), workload_file(argv[2]);
+        dc_text.str(std::string());
+        workload_text.str(std::string());
+        dc_text << dc_file.rdbuf();
+        workload_text << workload_file.rdbuf();
+    }
+    double seconds = argc >= 4 ? atof(argv[3]) : 10.0;
+
+    dclass::File *dcfile = dclass::read(dc_text, argc >= 3 ? argv[1] : "loadtest.dc");
+    if(dcfile == nullptr) {
+        return 1;
+    }
+    LoopbackAgent *agent = new LoopbackAgent(dcfile);
+    if(!agent->load_workloads(workload_text)) {
+        g_logger->log(LSEVERITY_ERROR) << "Failed to load the workload description.";
+        return 1;
+    }
+
+    LoadTest *test = new LoadTest(agent, seconds);
+    test->set_dcfile(dcfile);
+    test->connect_loopback(agent);
+    emscripten_set_main_loop_arg(LoadTest::frame, test, 60, 0);
+    return 0;
+}
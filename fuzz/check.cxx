@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file check.cxx
+ * @author Max Rodriguez
+ * @date 2023-07-03
+ */
+
+#include <algorithm>
+#include <vector>
+#include "check.hxx"
+#include "../src/dc/ArrayType.h"
+#include "../src/dc/Field.h"
+#include "../src/dc/Method.h"
+#include "../src/dc/Parameter.h"
+#include "../src/dc/Struct.h"
+#include "../src/dc/value/format.h"
+#include "../src/dc/value/parse.h"
+#include "../src/network/DatagramIterator.hxx"
+
+using namespace astron;
+
+// has_float returns true if a value of <dtype> contains a floating-point number, whose formatted
+// text (%g) is rounded, so that it only parses back to a nearby value.
+static bool has_float(const dclass::DistributedType *dtype)
+{
+    switch(dtype->get_type()) {
+    case dclass::T_FLOAT32:
+    case dclass::T_FLOAT64:
+        return true;
+    case dclass::T_ARRAY:
+    case dclass::T_VARARRAY:
+        return has_float(dtype->as_array()->get_element_type());
+    case dclass::T_STRUCT: {
+        const dclass::Struct *strct = dtype->as_struct();
+        for(unsigned int i = 0; i < strct->get_num_fields(); ++i) {
+            if(has_float(strct->get_field(i)->get_type())) {
+                return true;
+            }
+        }
+        return false;
+    }
+    case dclass::T_METHOD: {
+        const dclass::Method *method = dtype->as_method();
+        for(unsigned int i = 0; i < method->get_num_parameters(); ++i) {
+            if(has_float(method->get_parameter(i)->get_type())) {
+                return true;
+            }
+        }
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+bool check_packed_value(const dclass::DistributedType *dtype, const uint8_t *data, size_t length,
+                        std::string &error)
+{
+    if(length > DGSIZE_MAX) {
+        length = DGSIZE_MAX;
+    }
+    // The datagram holds exactly <length> bytes, so the sanitizers see any read past them.
+    DatagramPtr dg = Datagram::create(data, dgsize_t(length));
+
+    DatagramIterator unpacker(dg);
+    std::vector<uint8_t> unpacked;
+    bool unpacked_ok = true;
+    try {
+        unpacker.unpack_dtype(dtype, unpacked);
+    } catch(const DatagramIteratorEOF&) {
+        unpacked_ok = false;
+    } catch(const FieldConstraintViolation&) {
+        unpacked_ok = false;
+    }
+
+    DatagramIterator skipper(dg);
+    bool skipped_ok = true;
+    try {
+        skipper.skip_dtype(dtype);
+    } catch(const DatagramIteratorEOF&) {
+        skipped_ok = false;
+    }
+
+    std::string formatted;
+    bool formatted_ok = dclass::format_value(dtype, data, length, formatted);
+
+    // format_value() only checks the structure of the value, not its ranges; skip_dtype() checks
+    // less, as it skips a variable-length value by its length tag without looking inside.
+    if(formatted_ok && !skipped_ok) {
+        error = "format_value() accepted a value that skip_dtype() didn't";
+        return false;
+    }
+    if(!unpacked_ok) {
+        return true;
+    }
+    if(!formatted_ok) {
+        error = "unpack_dtype() accepted a value that format_value() didn't";
+        return false;
+    }
+    if(unpacker.tell() != skipper.tell()) {
+        error = "unpack_dtype() read " + std::to_string(unpacker.tell()) + " bytes, but skip_dtype() "
+                + std::to_string(skipper.tell());
+        return false;
+    }
+    if(unpacked.size() != unpacker.tell() || !std::equal(unpacked.begin(), unpacked.end(), data)) {
+        error = "unpack_dtype() didn't copy the bytes it read";
+        return false;
+    }
+
+    std::vector<uint8_t> reparsed;
+    std::string parse_error;
+    size_t offset;
+    if(!dclass::parse_value(dtype, formatted.data(), formatted.size(), reparsed, parse_error, offset)) {
+        // An infinity or NaN has no .dc syntax.
+        if(has_float(dtype) && (formatted.find("inf") != std::string::npos ||
+                                formatted.find("nan") != std::string::npos)) {
+            return true;
+        }
+        error = "formatted value " + formatted + " doesn't parse: " + parse_error;
+        return false;
+    }
+    if(has_float(dtype)) {
+        std::string reformatted;
+        if(!dclass::format_value(dtype, reparsed.data(), reparsed.size(), reformatted)
+           || reformatted != formatted) {
+            error = "formatted value " + formatted + " parses back to " + reformatted;
+            return false;
+        }
+    } else if(reparsed != unpacked) {
+        std::string reformatted;
+        dclass::format_value(dtype, reparsed.data(), reparsed.size(), reformatted);
+        error = "formatted value " + formatted + " parses back to " + reformatted;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file check.hxx
+ * @author Max Rodriguez
+ * @date 2023-07-03
+ */
+
+#ifndef ASTRON_LIBWASM_FUZZ_CHECK_HXX
+#define ASTRON_LIBWASM_FUZZ_CHECK_HXX
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "../src/dc/DistributedType.h"
+
+// check_packed_value reads the <length> bytes at <data> as a value of <dtype> with each of the
+// byte walkers (DatagramIterator::unpack_dtype() and skip_dtype(), and format_value()), and
+// returns false with the disagreement in <error> if they don't agree on where the value ends
+// and whether it is valid. A value that unpacks must also format, and parse back to itself.
+// Malformed data may only raise DatagramIteratorEOF or FieldConstraintViolation.
+bool check_packed_value(const dclass::DistributedType *dtype, const uint8_t *data, size_t length,
+                        std::string &error);
+
+#endif // ASTRON_LIBWASM_FUZZ_CHECK_HXX
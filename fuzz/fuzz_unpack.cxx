@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file fuzz_unpack.cxx
+ * @author Max Rodriguez
+ * @date 2023-07-03
+ */
+
+/* Fuzz target for the packed value walkers, against the schema in fuzz.dc.
+ *
+ * The first two bytes of an input pick a field (or struct) of the schema, and the rest is read as
+ * its packed value by check_packed_value(), which aborts on any disagreement. Built with Clang,
+ * this is a libFuzzer target:
+ *
+ *     astron_fuzz_unpack [corpus directory] [libFuzzer options]
+ *
+ * With other compilers, FUZZ_STANDALONE gives it a main() that runs each file named on the
+ * command line, or standard input if there are none, so that it can be run by AFL.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include "check.hxx"
+#include "../src/dc/Class.h"
+#include "../src/dc/Field.h"
+#include "../src/dc/File.h"
+#include "../src/file/read.h"
+
+#ifndef FUZZ_DC
+#define FUZZ_DC "fuzz.dc"
+#endif
+
+// The types of the fields and structs of the schema, read once.
+static const std::vector<const dclass::DistributedType*>& schema_types()
+{
+    static std::vector<const dclass::DistributedType*> types;
+    if(!types.empty()) {
+        return types;
+    }
+
+    // The file is kept until exit, as the types belong to it.
+    dclass::File *dcfile = dclass::read(FUZZ_DC);
+    if(dcfile == nullptr) {
+        fprintf(stderr, "Failed to read %s.\n", FUZZ_DC);
+        abort();
+    }
+    for(unsigned int i = 0; i < dcfile->get_num_structs(); ++i) {
+        types.push_back(dcfile->get_struct(i));
+    }
+    for(unsigned int i = 0; i < dcfile->get_num_classes(); ++i) {
+        const dclass::Class *cls = dcfile->get_class(i);
+        for(unsigned int n = 0; n < cls->get_num_fields(); ++n) {
+            types.push_back(cls->get_field(n)->get_type());
+        }
+    }
+    return types;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const std::vector<const dclass::DistributedType*> &types = schema_types();
+    if(size < 2) {
+        return 0;
+    }
+    const dclass::DistributedType *dtype = types[(data[0] | data[1] << 8) % types.size()];
+
+    std::string error;
+    if(!check_packed_value(dtype, data + 2, size - 2, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        abort();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static void run_input(std::istream &in)
+{
+    std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2) {
+        run_input(std::cin);
+        return 0;
+    }
+    for(int i = 1; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ios::binary);
+        if(!file) {
+            fprintf(stderr, "Failed to open %s.\n", argv[i]);
+            return 1;
+        }
+        run_input(file);
+    }
+    return 0;
+}
+#endif // FUZZ_STANDALONE
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file golden.cxx
+ * @author Max Rodriguez
+ * @date 2023-07-05
+ */
+
+/* Golden tests of format_value(), against the schema in fuzz.dc.
+ *
+ * The round trips only check that formatted values parse back to themselves; these pin the exact
+ * text of values whose formatting is easy to get subtly wrong: floats at the edges of %g,
+ * escaped characters, hex blobs, and nested structs and arrays. Each case is packed by hand,
+ * formatted, and compared with the text the ostream-based formatter used to write.
+ */
+
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+#include "../src/dc/Class.h"
+#include "../src/dc/Field.h"
+#include "../src/dc/File.h"
+#include "../src/dc/value/format.h"
+#include "../src/file/read.h"
+#include "../src/network/Datagram.hxx"
+
+using namespace astron;
+
+#ifndef FUZZ_DC
+#define FUZZ_DC "fuzz.dc"
+#endif
+
+// A GoldenCase is a value of a field of FuzzObject, packed by <pack>, and the text it formats to.
+struct GoldenCase
+{
+    const char *field;
+    std::function<void(DatagramPtr)> pack;
+    const char *expected;
+};
+
+static void add_item(DatagramPtr dg, uint16_t id, uint8_t quantity, const std::string &label)
+{
+    dg->add_uint16(id);
+    dg->add_uint8(quantity);
+    dg->add_string(label);
+}
+
+static void add_vec3(DatagramPtr dg, int16_t x, int16_t y, int16_t z)
+{
+    dg->add_int16(x);
+    dg->add_int16(y);
+    dg->add_int16(z);
+}
+
+static std::vector<GoldenCase> golden_cases()
+{
+    return {
+        // Integers at their limits
+        {"setInts", [](DatagramPtr dg) {
+            dg->add_int8(INT8_MIN);
+            dg->add_int16(INT16_MIN);
+            dg->add_int32(INT32_MIN);
+            dg->add_int64(INT64_MIN);
+        }, "(-128, -32768, -2147483648, -9223372036854775808)"},
+        {"setUints", [](DatagramPtr dg) {
+            dg->add_uint8(UINT8_MAX);
+            dg->add_uint16(UINT16_MAX);
+            dg->add_uint32(UINT32_MAX);
+            dg->add_uint64(UINT64_MAX);
+        }, "(255, 65535, 4294967295, 18446744073709551615)"},
+        {"setRanges", [](DatagramPtr dg) {
+            dg->add_int8(-5);
+            dg->add_uint16(1000);
+            dg->add_int32(-5000);
+            dg->add_uint64(1);
+        }, "(-5, 1000, -5000, 1)"},
+
+        // Floats: %g switches to an exponent below 1e-4 and from 1e6, and rounds to 6 digits
+        {"setFloats", [](DatagramPtr dg) {
+            dg->add_float32(0.0f);
+            dg->add_float64(-0.0);
+        }, "(0, -0)"},
+        {"setFloats", [](DatagramPtr dg) {
+            dg->add_float32(0.0001f);
+            dg->add_float64(0.00001);
+        }, "(0.0001, 1e-05)"},
+        {"setFloats", [](DatagramPtr dg) {
+            dg->add_float32(999999.0f);
+            dg->add_float64(1000000.0);
+        }, "(999999, 1e+06)"},
+        {"setFloats", [](DatagramPtr dg) {
+            dg->add_float32(1.0f / 3.0f);
+            dg->add_float64(123456789.0);
+        }, "(0.333333, 1.23457e+08)"},
+        {"setFloats", [](DatagramPtr dg) {
+            dg->add_float32(FLT_MAX);
+            dg->add_float64(DBL_MIN);
+        }, "(3.40282e+38, 2.22507e-308)"},
+        {"setFloats", [](DatagramPtr dg) {
+            dg->add_float32(std::numeric_limits<float>::denorm_min());
+            dg->add_float64(-2.5e-300);
+        }, "(1.4013e-45, -2.5e-300)"},
+        {"setFloats", [](DatagramPtr dg) {
+            dg->add_float32(-std::numeric_limits<float>::infinity());
+            dg->add_float64(std::numeric_limits<double>::infinity());
+        }, "(-inf, inf)"},
+        {"setAngle", [](DatagramPtr dg) { // scaled types are written as their packed integers
+            dg->add_int16(3599);
+        }, "(3599)"},
+        {"setNested", [](DatagramPtr dg) { // and so are fixed-point coordinates
+            add_vec3(dg, -1, 10, -32768);
+            dg->add_size(0);
+            dg->add_size(8);
+            dg->add_int32(0);
+            dg->add_int32(-1);
+            dg->add_size(0);
+        }, "({{-1, 10, -32768}, [], {}, [0, -1]}, [])"},
+
+        // Characters and strings with escapes
+        {"setChars", [](DatagramPtr dg) {
+            dg->add_uint8('\'');
+            dg->add_data(std::string("a\"\\b", 4));
+            dg->add_string(std::string("\n\t\r", 3));
+            dg->add_string(std::string("\0\x7f", 2));
+        }, "('\\'', ['a', '\"', '\\\\', 'b'], ['\\x0a', '\\x09', '\\x0d'], ['\\x00', '\\x7f'])"},
+        {"setStrings", [](DatagramPtr dg) {
+            dg->add_string("say \"hi\"\\n");
+            dg->add_data(std::string("tab\there", 8));
+            dg->add_string(std::string("\x01\xff\xc3\xa9", 4));
+        }, "(\"say \\\"hi\\\"\\\\n\", \"tab\\x09here\", \"\\x01\\xff\\xc3\\xa9\")"},
+        {"setStrings", [](DatagramPtr dg) {
+            dg->add_string("");
+            dg->add_data(std::string("\0\0\0\0\0\0\0\0", 8));
+            dg->add_string("'q'");
+        }, "(\"\", \"\\x00\\x00\\x00\\x00\\x00\\x00\\x00\\x00\", \"'q'\")"},
+
+        // Blobs, in hex
+        {"setBlobs", [](DatagramPtr dg) {
+            dg->add_blob(std::vector<uint8_t>{ 0x00, 0x0f, 0xf0, 0xff, 0x7f, 0x80 });
+            dg->add_data(std::vector<uint8_t>{ 0xde, 0xad, 0xbe, 0xef });
+            dg->add_blob(std::vector<uint8_t>{ 0x01 });
+            dg->add_blob(std::vector<uint8_t>{ 0xab, 0xcd });
+            dg->add_data(std::vector<uint8_t>{ 0x00, 0x01, 0x02 });
+        }, "(<0600000ff0ff7f80>, <deadbeef>, <010001>, [171, 205], [0, 1, 2])"},
+        {"setBlobs", [](DatagramPtr dg) {
+            dg->add_size(0);
+            dg->add_data(std::vector<uint8_t>{ 0, 0, 0, 0 });
+            dg->add_blob(std::vector<uint8_t>{ 0x20, 0x41, 0x0a, 0x22, 0x5c, 0x27, 0x7e, 0x7f });
+            dg->add_size(0);
+            dg->add_data(std::vector<uint8_t>{ 0xff, 0xfe, 0xfd });
+        }, "(<0000>, <00000000>, <080020410a225c277e7f>, [], [255, 254, 253])"},
+
+        // Arrays, empty and nested
+        {"setArrays", [](DatagramPtr dg) {
+            dg->add_size(6);
+            dg->add_int16(-1);
+            dg->add_int16(0);
+            dg->add_int16(32767);
+            dg->add_uint32(0);
+            dg->add_uint32(4294967295u);
+            dg->add_size(0);
+            dg->add_size(2 + 4 + 2);
+            dg->add_size(4);
+            dg->add_uint16(1);
+            dg->add_uint16(2);
+            dg->add_size(0);
+            dg->add_size(16);
+            dg->add_float64(0.5);
+            dg->add_float64(1e100);
+        }, "([-1, 0, 32767], [0, 4294967295], [], [[1, 2], []], [0.5, 1e+100])"},
+
+        // Structs, nested in structs and arrays
+        {"setStructs", [](DatagramPtr dg) {
+            add_vec3(dg, 15, -25, 0);
+            add_item(dg, 7, 99, "sword");
+            dg->add_size(2 * (3 + 2) + 1 + 1);
+            add_item(dg, 1, 1, "a");
+            add_item(dg, 2, 2, "\"");
+            dg->add_size(5 + 6); // elements of variable size, so the array has a length tag
+            add_item(dg, 3, 3, "");
+            add_item(dg, 4, 4, "\\");
+        }, "({15, -25, 0}, {7, 99, \"sword\"}, [{1, 1, \"a\"}, {2, 2, \"\\\"\"}], "
+           "[{3, 3, \"\"}, {4, 4, \"\\\\\"}], {})"},
+        {"setNested", [](DatagramPtr dg) {
+            add_vec3(dg, 1, 2, 3);
+            dg->add_size(3 + 2 + 4);
+            add_item(dg, 500, 50, "cape");
+            dg->add_size(3 * 4);
+            dg->add_int32(-7);
+            dg->add_int32(0);
+            dg->add_int32(7);
+            dg->add_size(2 * (6 + 2 + 2 + 4 * 2));
+            for(int i = 0; i < 2; ++i) {
+                add_vec3(dg, int16_t(-i), int16_t(i * 10), 5);
+                dg->add_size(0);
+                dg->add_size(8);
+                dg->add_int32(i);
+                dg->add_int32(-i);
+            }
+        }, "({{1, 2, 3}, [{500, 50, \"cape\"}], {}, [-7, 0, 7]}, "
+           "[{{0, 0, 5}, [], {}, [0, 0]}, {{-1, 10, 5}, [], {}, [1, -1]}])"},
+        {"setDoIds", [](DatagramPtr dg) {
+            dg->add_size(8);
+            dg->add_uint32(100000000);
+            dg->add_uint32(4000000000u);
+            dg->add_uint8(1);
+        }, "([100000000, 4000000000], 1)"},
+        {"setNothing", [](DatagramPtr dg) {
+        }, "()"},
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    // The file is kept until exit, as the types belong to it.
+    dclass::File *dcfile = dclass::read(FUZZ_DC);
+    const dclass::Class *cls = dcfile ? dcfile->get_class_by_name("FuzzObject") : nullptr;
+    if(cls == nullptr) {
+        fprintf(stderr, "Failed to read FuzzObject from %s.\n", FUZZ_DC);
+        return 1;
+    }
+
+    int failures = 0;
+    std::vector<GoldenCase> cases = golden_cases();
+    for(size_t i = 0; i < cases.size(); ++i) {
+        const GoldenCase &c = cases[i];
+        const dclass::Field *field = cls->get_field_by_name(c.field);
+        if(field == nullptr) {
+            fprintf(stderr, "case %zu: no field %s\n", i, c.field);
+            ++failures;
+            continue;
+        }
+
+        DatagramPtr dg = Datagram::create();
+        c.pack(dg);
+        std::string text;
+        if(!dclass::format_value(field->get_type(), dg->get_data(), dg->size(), text)) {
+            fprintf(stderr, "case %zu (%s): packed value is incomplete\n", i, c.field);
+            ++failures;
+        } else if(text != c.expected) {
+            fprintf(stderr, "case %zu (%s):\n    expected %s\n    got      %s\n", i, c.field,
+                    c.expected, text.c_str());
+            ++failures;
+        }
+    }
+
+    if(failures > 0) {
+        fprintf(stderr, "%d of %zu cases failed.\n", failures, cases.size());
+        return 1;
+    }
+    printf("%zu cases passed.\n", cases.size());
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file hash_check.cxx
+ * @author Max Rodriguez
+ * @date 2023-07-05
+ */
+
+/* Bit-exactness tests of the dc hash, which a Client Agent compares with its own in CLIENT_HELLO.
+ *
+ *     astron_hash_check bench.dc fuzz.dc
+ *
+ * The sieved prime table must match the primes the trial-division generator used to compute on
+ * demand, HashGenerator::add_string() must match hashing the string one character at a time, and
+ * File::get_hash() and legacy_hash() must give the values the previous hash code gave for the two
+ * schemas. If a schema is changed, its pinned values must be recomputed with that code.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../src/dc/File.h"
+#include "../src/file/hash.h"
+#include "../src/file/read.h"
+#include "../src/util/HashGenerator.h"
+#include "../src/util/PrimeNumberGenerator.h"
+
+// trial_division_primes returns the first <count> primes, found as PrimeNumberGenerator used to.
+static std::vector<unsigned int> trial_division_primes(unsigned int count)
+{
+    std::vector<unsigned int> primes(1, 2);
+    for(unsigned int candidate = 3; primes.size() < count; ++candidate) {
+        bool maybe_prime = true;
+        for(unsigned int j = 0; maybe_prime && primes[j] * primes[j] <= candidate; ++j) {
+            maybe_prime = (primes[j] * (candidate / primes[j])) != candidate;
+        }
+        if(maybe_prime) {
+            primes.push_back(candidate);
+        }
+    }
+    return primes;
+}
+
+static bool check_primes()
+{
+    const unsigned int *primes = dclass::PrimeNumberGenerator::get_primes();
+    std::vector<unsigned int> expected = trial_division_primes(dclass::PrimeNumberGenerator::NUM_PRIMES);
+    for(unsigned int i = 0; i < expected.size(); ++i) {
+        if(primes[i] != expected[i]) {
+            fprintf(stderr, "prime %u is %u, expected %u\n", i, primes[i], expected[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// check_add_string hashes <str> after <skip> ints, both with add_string() and one character at a
+// time, as add_string() used to.
+static bool check_add_string(const std::string &str, unsigned int skip)
+{
+    dclass::HashGenerator whole, by_char;
+    for(unsigned int i = 0; i < skip; ++i) {
+        whole.add_int(int(i));
+        by_char.add_int(int(i));
+    }
+    whole.add_string(str);
+    by_char.add_int(int(str.length()));
+    for(size_t i = 0; i < str.length(); ++i) {
+        by_char.add_int(str[i]);
+    }
+    if(whole.get_hash() != by_char.get_hash()) {
+        fprintf(stderr, "add_string of %zu characters after %u ints: %u, expected %u\n", str.length(),
+                skip, whole.get_hash(), by_char.get_hash());
+        return false;
+    }
+    return true;
+}
+
+static bool check_strings()
+{
+    std::string bytes;
+    for(int c = 0; c < 256; ++c) {
+        bytes += char(c); // including the negative chars, on platforms where char is signed
+    }
+    std::string long_string;
+    while(long_string.size() < 3 * dclass::PrimeNumberGenerator::NUM_PRIMES) {
+        long_string += bytes;
+    }
+
+    bool ok = true;
+    const unsigned int skips[] = { 0, 1, 17, dclass::PrimeNumberGenerator::NUM_PRIMES - 300,
+                                   dclass::PrimeNumberGenerator::NUM_PRIMES - 2,
+                                   dclass::PrimeNumberGenerator::NUM_PRIMES - 1 };
+    for(unsigned int skip : skips) {
+        ok = check_add_string("", skip) && ok;
+        ok = check_add_string("DistributedAvatar", skip) && ok;
+        ok = check_add_string(bytes, skip) && ok; // wraps around the prime table after the larger skips
+        ok = check_add_string(long_string, skip) && ok;
+    }
+    return ok;
+}
+
+// check_file compares the hashes of the schema in <filename> with their pinned values.
+static bool check_file(const char *filename, uint32_t expected_hash, uint32_t expected_legacy_hash)
+{
+    // The file isn't deleted, as ~File() frees molecular fields twice.
+    dclass::File *file = dclass::read(filename);
+    if(file == nullptr) {
+        fprintf(stderr, "Failed to read %s.\n", filename);
+        return false;
+    }
+    uint32_t hash = file->get_hash(), legacy = dclass::legacy_hash(file);
+    if(hash != expected_hash || legacy != expected_legacy_hash) {
+        fprintf(stderr, "%s: get_hash %u, legacy_hash %u; expected %u and %u\n", filename, hash, legacy,
+                expected_hash, expected_legacy_hash);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s bench.dc fuzz.dc\n", argv[0]);
+        return 2;
+    }
+
+    bool ok = check_primes();
+    ok = check_strings() && ok;
+    ok = check_file(argv[1], 1919258938u, 1047857972u) && ok;
+    ok = check_file(argv[2], 428055786u, 54394248u) && ok;
+    if(!ok) {
+        return 1;
+    }
+    printf("Hashes match.\n");
+    return 0;
+}
@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file roundtrip.cxx
+ * @author Max Rodriguez
+ * @date 2023-07-03
+ */
+
+/* Property-based round trips of the packed value walkers, over randomly generated schemas.
+ *
+ *     astron_roundtrip [--seed n] [--schemas n]
+ *
+ * Each schema is a .dc file of random structs and dclass fields: integers (scaled and ranged),
+ * floats, chars, strings, blobs, arrays and nested structs. For every field, random values are
+ * written as .dc text and packed with parse_value(); unpack_dtype() must read exactly the packed
+ * bytes back, and check_packed_value() must find the walkers in agreement and the value formatting
+ * back to itself. Each value is then mutated (bytes changed, dropped or added) and checked again,
+ * where the walkers must still agree and may only fail with DatagramIteratorEOF or
+ * FieldConstraintViolation. Built with the sanitizers, a read past the packed data fails the test.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "check.hxx"
+#include "../src/dc/Class.h"
+#include "../src/dc/Field.h"
+#include "../src/dc/File.h"
+#include "../src/dc/Struct.h"
+#include "../src/dc/value/format.h"
+#include "../src/dc/value/parse.h"
+#include "../src/file/read.h"
+#include "../src/network/DatagramIterator.hxx"
+
+using namespace astron;
+
+class Random
+{
+  public:
+    explicit Random(uint64_t seed) : m_engine(seed)
+    {
+    }
+
+    uint64_t bits()
+    {
+        return m_engine();
+    }
+
+    // range returns a number from <lo> to <hi>, inclusive.
+    int64_t range(int64_t lo, int64_t hi)
+    {
+        return std::uniform_int_distribution<int64_t>(lo, hi)(m_engine);
+    }
+
+    bool chance(int percent)
+    {
+        return range(0, 99) < percent;
+    }
+
+  private:
+    std::mt19937_64 m_engine;
+};
+
+// A TypeSpec describes a generated type: how it is written in the .dc file, and which values it
+// holds, so that values can be generated without going through the dclass types under test.
+struct TypeSpec
+{
+    enum Kind { INT, FLOAT, CHAR, STRING, BLOB, ARRAY, STRUCT };
+
+    Kind kind;
+    std::string text; // as written in the .dc file
+
+    unsigned int width = 0; // INT and FLOAT, in bytes
+    bool is_signed = false;
+    bool ranged = false;
+    int64_t min = 0; // of the packed value, when ranged
+    int64_t max = 0;
+
+    bool fixed = false; // STRING, BLOB and ARRAY: the number of elements is <min_count>
+    unsigned int min_count = 0;
+    unsigned int max_count = 0;
+    std::shared_ptr<TypeSpec> element; // ARRAY
+
+    std::vector<TypeSpec> fields; // STRUCT
+    bool zero_size = false;       // STRUCT: takes no space, so can't be an array element
+};
+
+class SchemaGenerator
+{
+  public:
+    explicit SchemaGenerator(Random &random) : m_random(random)
+    {
+    }
+
+    // generate returns the text of a new schema, with the specs of its structs and fields.
+    std::string generate()
+    {
+        m_structs.clear();
+        m_fields.clear();
+        std::ostringstream out;
+
+        int num_structs = int(m_random.range(0, 4));
+        for(int i = 0; i < num_structs; ++i) {
+            TypeSpec spec;
+            spec.kind = TypeSpec::STRUCT;
+            spec.text = "S" + std::to_string(i);
+            spec.zero_size = true;
+            out << "struct " << spec.text << " {\n";
+            int num_fields = int(m_random.range(0, 4));
+            for(int n = 0; n < num_fields; ++n) {
+                TypeSpec field = generate_type(1);
+                spec.zero_size = spec.zero_size && field.zero_size;
+                out << "    " << field.text << " f" << n << ";\n";
+                spec.fields.push_back(field);
+            }
+            out << "};\n\n";
+            m_structs.push_back(spec);
+        }
+
+        out << "dclass Generated {\n";
+        int num_fields = int(m_random.range(1, 6));
+        for(int i = 0; i < num_fields; ++i) {
+            TypeSpec method;
+            method.kind = TypeSpec::STRUCT;
+            out << "    m" << i << "(";
+            int num_params = int(m_random.range(0, 3));
+            for(int n = 0; n < num_params; ++n) {
+                TypeSpec param = generate_type(1);
+                out << (n > 0 ? ", " : "") << param.text;
+                method.fields.push_back(param);
+            }
+            out << ");\n";
+            m_fields.push_back(method);
+        }
+        out << "};\n";
+        return out.str();
+    }
+
+    const std::vector<TypeSpec>& get_structs() const
+    {
+        return m_structs;
+    }
+    // get_fields returns the parameters of the methods of dclass Generated, as STRUCT specs.
+    const std::vector<TypeSpec>& get_fields() const
+    {
+        return m_fields;
+    }
+
+    // generate_value returns a random .dc formatted value of <spec>.
+    std::string generate_value(const TypeSpec &spec, char open = '{', char close = '}')
+    {
+        switch(spec.kind) {
+        case TypeSpec::INT:
+            return generate_int(spec);
+        case TypeSpec::FLOAT:
+            return generate_float(spec);
+        case TypeSpec::CHAR:
+            return "'" + generate_char('\'') + "'";
+        case TypeSpec::STRING: {
+            std::string value = "\"";
+            for(unsigned int i = generate_count(spec); i > 0; --i) {
+                value += generate_char('"');
+            }
+            return value + "\"";
+        }
+        case TypeSpec::BLOB: {
+            // The hex constant of a variable-length blob starts with its length tag.
+            unsigned int count = generate_count(spec);
+            std::string bytes;
+            if(!spec.fixed) {
+                for(size_t i = 0; i < sizeof(dclass::sizetag_t); ++i) {
+                    bytes += char(count >> (i * 8));
+                }
+            }
+            for(unsigned int i = 0; i < count; ++i) {
+                bytes += char(m_random.bits());
+            }
+            return dclass::format_hex(bytes);
+        }
+        case TypeSpec::ARRAY: {
+            std::string value = "[";
+            for(unsigned int i = generate_count(spec); i > 0; --i) {
+                value += generate_value(*spec.element);
+                value += i > 1 ? ", " : "";
+            }
+            return value + "]";
+        }
+        case TypeSpec::STRUCT: {
+            std::string value(1, open);
+            for(size_t i = 0; i < spec.fields.size(); ++i) {
+                value += i > 0 ? ", " : "";
+                value += generate_value(spec.fields[i]);
+            }
+            return value + close;
+        }
+        }
+        return "";
+    }
+
+  private:
+    TypeSpec generate_type(int depth)
+    {
+        int kind = int(m_random.range(0, 99));
+        if(kind < 40) {
+            return generate_int_type();
+        } else if(kind < 50) {
+            TypeSpec spec;
+            spec.kind = TypeSpec::FLOAT;
+            spec.width = m_random.chance(50) ? 4 : 8;
+            spec.text = spec.width == 4 ? "float32" : "float64";
+            return spec;
+        } else if(kind < 55) {
+            TypeSpec spec;
+            spec.kind = TypeSpec::CHAR;
+            spec.text = "char";
+            return spec;
+        } else if(kind < 65) {
+            TypeSpec spec;
+            spec.kind = TypeSpec::STRING;
+            std::string size = generate_size(spec, 8);
+            spec.text = size.empty() ? "string" : "string(" + size + ")";
+            return spec;
+        } else if(kind < 75) {
+            TypeSpec spec;
+            spec.kind = TypeSpec::BLOB;
+            std::string size = generate_size(spec, 8);
+            spec.text = size.empty() ? "blob" : "blob(" + size + ")";
+            return spec;
+        } else if(kind < 90 && depth < 3) {
+            TypeSpec spec;
+            spec.kind = TypeSpec::ARRAY;
+            do {
+                spec.element.reset(new TypeSpec(generate_type(depth + 1)));
+            } while(spec.element->kind == TypeSpec::ARRAY || spec.element->zero_size);
+            spec.text = spec.element->text + "[" + generate_size(spec, 4) + "]";
+            return spec;
+        } else if(!m_structs.empty()) {
+            return m_structs[size_t(m_random.range(0, int64_t(m_structs.size()) - 1))];
+        }
+        return generate_int_type();
+    }
+
+    TypeSpec generate_int_type()
+    {
+        static const unsigned int widths[] = { 1, 2, 4, 8 };
+        static const char* const names[2][4] = {
+            { "uint8", "uint16", "uint32", "uint64" },
+            { "int8", "int16", "int32", "int64" },
+        };
+        TypeSpec spec;
+        spec.kind = TypeSpec::INT;
+        int index = int(m_random.range(0, 3));
+        spec.width = widths[index];
+        spec.is_signed = m_random.chance(50);
+        spec.text = names[spec.is_signed][index];
+
+        // Scaled integers are written, formatted and packed as the scaled value, so the divisor
+        // only changes the packed range.
+        int64_t divisor = 1;
+        if(m_random.chance(30)) {
+            divisor = m_random.chance(50) ? 10 : 100;
+            spec.text += "/" + std::to_string(divisor);
+        }
+        if(m_random.chance(30)) {
+            int64_t limit = spec.width == 8 ? INT64_MAX : (int64_t(1) << (spec.width * 8 - 1)) - 1;
+            limit = std::min<int64_t>(limit / divisor, 1000);
+            int64_t lo = spec.is_signed && m_random.chance(50) ? -m_random.range(0, limit)
+                                                               : m_random.range(0, limit);
+            int64_t hi = m_random.range(std::max<int64_t>(lo, 0), limit);
+            spec.ranged = true;
+            spec.min = lo * divisor;
+            spec.max = hi * divisor;
+            spec.text += "(" + std::to_string(lo) + "-" + std::to_string(hi) + ")";
+        }
+        return spec;
+    }
+
+    // generate_size picks the number of elements of a STRING, BLOB or ARRAY, and returns how it
+    // is written in the type's brackets: a fixed count, a range, or nothing.
+    std::string generate_size(TypeSpec &spec, unsigned int max_count)
+    {
+        int kind = int(m_random.range(0, 2));
+        if(kind == 0) {
+            spec.fixed = true;
+            spec.min_count = spec.max_count = unsigned(m_random.range(1, max_count));
+            return std::to_string(spec.min_count);
+        } else if(kind == 1) {
+            spec.min_count = unsigned(m_random.range(0, max_count / 2));
+            spec.max_count = unsigned(m_random.range(spec.min_count, max_count));
+            spec.fixed = spec.min_count == spec.max_count && spec.min_count > 0;
+            return std::to_string(spec.min_count) + "-" + std::to_string(spec.max_count);
+        }
+        spec.min_count = 0;
+        spec.max_count = max_count;
+        return "";
+    }
+
+    unsigned int generate_count(const TypeSpec &spec)
+    {
+        return unsigned(m_random.range(spec.min_count, spec.max_count));
+    }
+
+    std::string generate_int(const TypeSpec &spec)
+    {
+        if(spec.ranged) {
+            return std::to_string(m_random.range(spec.min, spec.max));
+        }
+        // Favour the edges of the type's range.
+        uint64_t bits;
+        switch(m_random.range(0, 4)) {
+        case 0:
+            bits = 0;
+            break;
+        case 1:
+            bits = ~uint64_t(0); // -1, or the largest unsigned value
+            break;
+        case 2:
+            bits = uint64_t(1) << (spec.width * 8 - 1); // the smallest signed value
+            break;
+        default:
+            bits = m_random.bits();
+            break;
+        }
+        unsigned int shift = 64 - spec.width * 8;
+        if(spec.is_signed) {
+            return std::to_string(int64_t(bits << shift) >> shift);
+        }
+        return std::to_string((bits << shift) >> shift);
+    }
+
+    std::string generate_float(const TypeSpec &spec)
+    {
+        double value;
+        if(m_random.chance(20)) {
+            value = double(m_random.range(-1000, 1000));
+        } else {
+            int64_t exponent = spec.width == 4 ? 30 : 300;
+            value = double(m_random.range(1, 999999)) * pow(10.0, double(m_random.range(-exponent, exponent)));
+            value = m_random.chance(50) ? -value : value;
+        }
+        char text[32];
+        snprintf(text, sizeof(text), spec.width == 4 ? "%.9g" : "%.17g", value);
+        return text;
+    }
+
+    std::string generate_char(char quote_mark)
+    {
+        if(m_random.chance(10)) {
+            // any ASCII character (strings may only hold ASCII), as an escaped hexadecimal constant
+            static const char digits[] = "0123456789abcdef";
+            uint8_t c = uint8_t(m_random.range(0, 0x7f));
+            return std::string("\\x") + digits[c >> 4] + digits[c & 0xf];
+        }
+        char c = char(m_random.range(0x20, 0x7e));
+        if(c == quote_mark || c == '\\') {
+            return std::string("\\") + c;
+        }
+        return std::string(1, c);
+    }
+
+    Random &m_random;
+    std::vector<TypeSpec> m_structs;
+    std::vector<TypeSpec> m_fields;
+};
+
+// A RoundTrip runs the checks of one schema, and reports what fails.
+class RoundTrip
+{
+  public:
+    RoundTrip(Random &random, const std::string &schema) : m_random(random), m_schema(schema)
+    {
+    }
+
+    // check packs <values> random values of the type, and checks them and <mutations> mutations
+    // of each. Returns false if one fails.
+    bool check(const dclass::DistributedType *dtype, const std::string &name, const TypeSpec &spec,
+               SchemaGenerator &generator, char open, char close, int values, int mutations)
+    {
+        for(int i = 0; i < values; ++i) {
+            std::string text = generator.generate_value(spec, open, close);
+            std::vector<uint8_t> packed;
+            std::string error;
+            size_t offset;
+            if(!dclass::parse_value(dtype, text.data(), text.size(), packed, error, offset)) {
+                return fail(name, text, packed, "the generated value doesn't parse: " + error);
+            }
+            ++m_values;
+
+            DatagramPtr dg = Datagram::create(packed);
+            DatagramIterator dgi(dg);
+            std::vector<uint8_t> unpacked;
+            try {
+                dgi.unpack_dtype(dtype, unpacked);
+            } catch(const std::exception &e) {
+                return fail(name, text, packed, std::string("unpack_dtype() failed: ") + e.what());
+            }
+            if(dgi.tell() != packed.size()) {
+                return fail(name, text, packed, "unpack_dtype() read " + std::to_string(dgi.tell())
+                            + " of the " + std::to_string(packed.size()) + " packed bytes");
+            }
+            if(!check_packed_value(dtype, packed.data(), packed.size(), error)) {
+                return fail(name, text, packed, error);
+            }
+
+            for(int n = 0; n < mutations; ++n) {
+                std::vector<uint8_t> mutated = mutate(packed);
+                ++m_mutations;
+                if(!check_packed_value(dtype, mutated.data(), mutated.size(), error)) {
+                    return fail(name, text, mutated, "mutated: " + error);
+                }
+            }
+        }
+        return true;
+    }
+
+    uint64_t get_values() const
+    {
+        return m_values;
+    }
+    uint64_t get_mutations() const
+    {
+        return m_mutations;
+    }
+
+  private:
+    std::vector<uint8_t> mutate(std::vector<uint8_t> data)
+    {
+        for(int64_t edits = m_random.range(1, 3); edits > 0; --edits) {
+            size_t at = data.empty() ? 0 : size_t(m_random.range(0, int64_t(data.size()) - 1));
+            switch(m_random.range(0, 4)) {
+            case 0: // change a byte
+                if(!data.empty()) {
+                    data[at] = uint8_t(m_random.bits());
+                }
+                break;
+            case 1: // make a small length tag (or count) larger or smaller
+                if(!data.empty()) {
+                    data[at] = uint8_t(data[at] + m_random.range(-2, 2));
+                }
+                break;
+            case 2: // cut off the end
+                data.resize(at);
+                break;
+            case 3: // drop a byte
+                if(!data.empty()) {
+                    data.erase(data.begin() + at);
+                }
+                break;
+            default: // add a byte
+                data.insert(data.begin() + at, uint8_t(m_random.bits()));
+                break;
+            }
+        }
+        return data;
+    }
+
+    bool fail(const std::string &name, const std::string &text, const std::vector<uint8_t> &packed,
+              const std::string &error)
+    {
+        std::string hex;
+        dclass::format_hex((const char*)packed.data(), packed.size(), hex);
+        fprintf(stderr, "FAILED %s: %s\n    value: %s\n    packed: %s\nin the schema:\n%s\n",
+                name.c_str(), error.c_str(), text.c_str(), hex.c_str(), m_schema.c_str());
+        return false;
+    }
+
+    Random &m_random;
+    const std::string &m_schema;
+    uint64_t m_values = 0;
+    uint64_t m_mutations = 0;
+};
+
+int main(int argc, char* argv[])
+{
+    uint64_t seed = 1;
+    int num_schemas = 300;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s.\n", arg.c_str());
+            return 2;
+        }
+        if(arg == "--seed") {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if(arg == "--schemas") {
+            num_schemas = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown option %s.\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    Random random(seed);
+    SchemaGenerator generator(random);
+    uint64_t values = 0, mutations = 0;
+    for(int i = 0; i < num_schemas; ++i) {
+        // The files are never deleted, as the parser shares the types of "string" and "blob"
+        // between them, and each File deletes them with its fields.
+        std::string schema = generator.generate();
+        std::istringstream in(schema);
+        dclass::File *dcfile = dclass::read(in, "generated.dc");
+        if(dcfile == nullptr) {
+            fprintf(stderr, "FAILED to read the generated schema:\n%s\n", schema.c_str());
+            return 1;
+        }
+
+        RoundTrip round_trip(random, schema);
+        const std::vector<TypeSpec> &structs = generator.get_structs();
+        for(unsigned int n = 0; n < structs.size(); ++n) {
+            if(!round_trip.check(dcfile->get_struct(n), structs[n].text, structs[n], generator,
+                                 '{', '}', 8, 16)) {
+                return 1;
+            }
+        }
+        const dclass::Class *cls = dcfile->get_class(0);
+        const std::vector<TypeSpec> &fields = generator.get_fields();
+        for(unsigned int n = 0; n < fields.size(); ++n) {
+            const dclass::Field *field = cls->get_field(n);
+            if(!round_trip.check(field->get_type(), field->get_name(), fields[n], generator,
+                                 '(', ')', 8, 16)) {
+                return 1;
+            }
+        }
+        values += round_trip.get_values();
+        mutations += round_trip.get_mutations();
+    }
+
+    printf("%d schemas (seed %llu): %llu values and %llu mutations round trip\n", num_schemas,
+           (unsigned long long)seed, (unsigned long long)values, (unsigned long long)mutations);
+    return 0;
+}
@@ -17,12 +17,21 @@
 #define EMSCRIPTEN_KEEPALIVE
 #endif
 
+#include <algorithm>
+#include <limits>
+
 #include "ClientRepository.hxx"
 #include "messageTypes.hxx"
+#include "../network/DatagramIterator.hxx"
+#include "../dc/Class.h"
 
 namespace astron   // open namespace
 {
 
+// The order key of interest completions, which objects entering are grouped under.
+// Doids never reach DOID_MAX in practice, so it is free for this.
+static const uint64_t INTEREST_ORDER_KEY = uint64_t(DOID_MAX);
+
 ClientRepository::ClientRepository()
 {
 }
@@ -34,12 +43,324 @@ ClientRepository::~ClientRepository()
 void ClientRepository::connect(std::string uri, uint32_t dc_hash, std::string version)
 {
     logger().info() << "Connecting to Client Agent at '" << uri << "' with version '" << version << "'";
-    g_logger->js_flush();
     std::stringstream ss;
     ss << std::hex << dc_hash; // convert uint32_t to hex string
     logger().info() << "Client DC File Hash: 0x" << ss.str();
-    g_logger->js_flush();
     connect_socket(uri); // connect websocket
 }
 
-} // close namespace
\ No newline at end of file
+void ClientRepository::handle_datagram()
+{
+    DatagramPtr dg = next_datagram();
+    if(!dg) return; // nothing received yet
+
+    DatagramIterator dgi(dg);
+    uint16_t msg_type = dgi.read_uint16();
+
+    switch(msg_type) {
+    case CLIENT_ENTER_OBJECT_REQUIRED:
+        handle_enter_object(dgi, false, false);
+        break;
+    case CLIENT_ENTER_OBJECT_REQUIRED_OTHER:
+        handle_enter_object(dgi, false, true);
+        break;
+    case CLIENT_ENTER_OBJECT_REQUIRED_OWNER:
+        handle_enter_object(dgi, true, false);
+        break;
+    case CLIENT_ENTER_OBJECT_REQUIRED_OTHER_OWNER:
+        handle_enter_object(dgi, true, true);
+        break;
+    case CLIENT_OBJECT_SET_FIELD:
+        handle_set_field(dgi);
+        break;
+    case CLIENT_OBJECT_LEAVING:
+    case CLIENT_OBJECT_LEAVING_OWNER: {
+        doid_t doid = dgi.read_doid();
+        handle_object_leaving(doid, msg_type == CLIENT_OBJECT_LEAVING_OWNER);
+        release_outbox_slots(doid);
+        break;
+    }
+    default:
+        logger().warning() << "Received unhandled message type: " << msg_type;
+        break;
+    }
+}
+
+void ClientRepository::classify_datagram(const uint8_t *data, size_t length, Classification &c)
+{
+    if(length < sizeof(uint16_t)) return;
+    uint16_t msg_type = uint16_t(data[0] | data[1] << 8);
+    switch(msg_type) {
+    case CLIENT_HELLO_RESP:
+    case CLIENT_EJECT:
+    case CLIENT_DISCONNECT:
+    case CLIENT_HEARTBEAT:
+        c.priority = PRIORITY_CONTROL;
+        return;
+    case CLIENT_DONE_INTEREST_RESP:
+        // An interest is only complete once the objects entering before it have been handled,
+        // even those held behind an object's earlier updates in a less important lane.
+        c.priority = PRIORITY_INTEREST;
+        c.order_key = INTEREST_ORDER_KEY;
+        return;
+    default:
+        break;
+    }
+
+    // The remaining object messages all start with the doid.
+    doid_t doid;
+    if(length < sizeof(uint16_t) + sizeof(doid_t)) return;
+    memcpy(&doid, data + sizeof(uint16_t), sizeof(doid_t));
+    doid = doid_t(swap_le(doid));
+
+    switch(msg_type) {
+    case CLIENT_ENTER_OBJECT_REQUIRED:
+    case CLIENT_ENTER_OBJECT_REQUIRED_OTHER:
+    case CLIENT_ENTER_OBJECT_REQUIRED_OWNER:
+    case CLIENT_ENTER_OBJECT_REQUIRED_OTHER_OWNER:
+        c.priority = PRIORITY_INTEREST;
+        c.order_key = doid;
+        c.group_key = INTEREST_ORDER_KEY;
+        break;
+    case CLIENT_OBJECT_SET_FIELD: {
+        // Nothing will be there to handle an update to an object that isn't known or entering.
+        if(get_object(doid) == nullptr && get_owner_view(doid) == nullptr && !is_order_key_queued(doid, false)) {
+            c.drop = true;
+            return;
+        }
+        c.order_key = doid;
+        c.droppable = true;
+
+        uint16_t field_id;
+        if(length < sizeof(uint16_t) + sizeof(doid_t) + sizeof(uint16_t)) return;
+        memcpy(&field_id, data + sizeof(uint16_t) + sizeof(doid_t), sizeof(uint16_t));
+        field_id = uint16_t(swap_le(field_id));
+        if(field_id < m_field_priorities.size() && m_field_priorities[field_id] < NUM_PRIORITIES) {
+            c.priority = m_field_priorities[field_id];
+        }
+        break;
+    }
+    case CLIENT_OBJECT_LEAVING:
+    case CLIENT_OBJECT_LEAVING_OWNER: {
+        // The queued updates are only useless if no other view of the object remains,
+        // and none is about to enter.
+        bool owner = (msg_type == CLIENT_OBJECT_LEAVING_OWNER);
+        c.order_key = doid;
+        c.retires = (owner ? get_object(doid) : get_owner_view(doid)) == nullptr && !is_order_key_queued(doid, false);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void ClientRepository::set_dcfile(dclass::File *dcfile)
+{
+    m_field_priorities.clear();
+    m_coalesce_rules.clear();
+    ObjectRepository::set_dcfile(dcfile);
+}
+
+void ClientRepository::class_resolved(const dclass::Class *cls)
+{
+    update_field_priorities(cls);
+
+    uint64_t coalesce_bit = get_dcfile()->get_keyword_bit("coalesce");
+    if(coalesce_bit == 0) return; // keyword not declared by the file
+
+    for(unsigned int n = 0; n < cls->get_num_fields(); ++n) {
+        const dclass::Field *field = cls->get_field(n);
+        if(field->has_keywords(coalesce_bit)) {
+            set_coalesced(field, true);
+        }
+    }
+}
+
+void ClientRepository::set_keyword_priority(const std::string &keyword, unsigned int priority)
+{
+    for(auto it = m_keyword_priorities.begin(); it != m_keyword_priorities.end(); ++it) {
+        if(it->first == keyword) {
+            it->second = priority;
+            update_field_priorities();
+            return;
+        }
+    }
+    m_keyword_priorities.push_back(std::make_pair(keyword, priority));
+    update_field_priorities();
+}
+
+void ClientRepository::update_field_priorities()
+{
+    m_field_priorities.clear();
+    const std::vector<const dclass::Class*> &classes = get_resolved_classes();
+    for(auto it = classes.begin(); it != classes.end(); ++it) {
+        update_field_priorities(*it);
+    }
+}
+
+void ClientRepository::update_field_priorities(const dclass::Class *cls)
+{
+    if(m_keyword_priorities.empty()) return;
+
+    for(unsigned int n = 0; n < cls->get_num_fields(); ++n) {
+        const dclass::Field *field = cls->get_field(n);
+        unsigned int priority = NUM_PRIORITIES;
+        for(auto it = m_keyword_priorities.begin(); it != m_keyword_priorities.end(); ++it) {
+            if(it->second < priority && field->has_keyword(it->first)) {
+                priority = it->second;
+            }
+        }
+        if(priority == NUM_PRIORITIES) continue;
+
+        if(field->get_id() >= m_field_priorities.size()) {
+            m_field_priorities.resize(field->get_id() + 1, uint8_t(NUM_PRIORITIES));
+        }
+        m_field_priorities[field->get_id()] = uint8_t(priority);
+    }
+}
+
+void ClientRepository::set_coalesced(const dclass::Field *field, bool coalesced, double min_interval_ms)
+{
+    if(field->get_id() >= m_coalesce_rules.size()) {
+        m_coalesce_rules.resize(field->get_id() + 1);
+    }
+    CoalesceRule &rule = m_coalesce_rules[field->get_id()];
+    rule.coalesced = coalesced;
+    rule.min_interval = min_interval_ms;
+}
+
+void ClientRepository::send_field_update(DistributedObject *obj, const dclass::Field *field, const DatagramPtr &dg)
+{
+    unsigned int field_id = field->get_id();
+    if(field_id >= m_coalesce_rules.size() || !m_coalesce_rules[field_id].coalesced) {
+        send_datagram(dg);
+        return;
+    }
+
+    // Find the slot for this object's field, creating it on first use (an object has few
+    // coalesced fields, so its slots are searched in order). Slots keep their datagram, even
+    // once freed for reuse, so queueing an update doesn't allocate once warmed up.
+    std::vector<size_t> &slots = m_outbox_index[obj->get_doid()];
+    size_t index = std::numeric_limits<size_t>::max();
+    for(auto it = slots.begin(); it != slots.end(); ++it) {
+        if(m_outbox_slots[*it].field_id == field_id) {
+            index = *it;
+            break;
+        }
+    }
+    if(index == std::numeric_limits<size_t>::max()) {
+        if(m_outbox_free.empty()) {
+            index = m_outbox_slots.size();
+            m_outbox_slots.push_back(OutboxSlot());
+            m_outbox_slots[index].dg = Datagram::create();
+        } else {
+            index = m_outbox_free.back();
+            m_outbox_free.pop_back();
+        }
+        OutboxSlot &slot = m_outbox_slots[index];
+        slot.doid = obj->get_doid();
+        slot.field_id = uint16_t(field_id);
+        slot.pending = false;
+        slot.last_sent = -std::numeric_limits<double>::infinity();
+        slots.push_back(index);
+    }
+
+    OutboxSlot &slot = m_outbox_slots[index];
+    if(slot.pending) {
+        ++m_outbox_stats.suppressed;
+    } else {
+        slot.pending = true;
+        m_outbox_pending.push_back(index);
+    }
+    slot.dg->clear();
+    slot.dg->add_data(dg);
+    ++m_outbox_stats.queued;
+    request_poll(); // the outbox is flushed at the end of a poll
+}
+
+void ClientRepository::flush_outbox()
+{
+    if(m_outbox_pending.empty()) return;
+
+    double now = emscripten_get_now();
+    size_t budget = m_outbox_budget ? m_outbox_budget : std::numeric_limits<size_t>::max();
+    size_t flushed = 0;
+
+    m_outbox_held.clear();
+    for(auto it = m_outbox_pending.begin(); it != m_outbox_pending.end(); ++it) {
+        OutboxSlot &slot = m_outbox_slots[*it];
+
+        // Drop updates for objects that are gone while the update was waiting.
+        if(get_object(slot.doid) == nullptr && get_owner_view(slot.doid) == nullptr) {
+            slot.pending = false;
+            free_outbox_slot(*it);
+            continue;
+        }
+
+        // An update bigger than the whole budget is still sent, on its own, so it can't starve.
+        size_t length = slot.dg->size();
+        if(now - slot.last_sent < m_coalesce_rules[slot.field_id].min_interval ||
+           (flushed > 0 && flushed + length > budget)) {
+            ++m_outbox_stats.deferred;
+            m_outbox_held.push_back(*it);
+            continue;
+        }
+
+        send_datagram(slot.dg);
+        slot.pending = false;
+        slot.last_sent = now;
+        flushed += length;
+        ++m_outbox_stats.sent;
+        m_outbox_stats.bytes_sent += length;
+    }
+    m_outbox_pending.swap(m_outbox_held);
+}
+
+void ClientRepository::release_outbox_slots(doid_t doid)
+{
+    auto it = m_outbox_index.find(doid);
+    if(it == m_outbox_index.end()) return;
+    if(get_object(doid) != nullptr || get_owner_view(doid) != nullptr) return; // another view remains
+
+    bool pending = false;
+    for(auto slot = it->second.begin(); slot != it->second.end(); ++slot) {
+        pending = pending || m_outbox_slots[*slot].pending;
+        m_outbox_slots[*slot].pending = false;
+        m_outbox_slots[*slot].dg->clear();
+        m_outbox_free.push_back(*slot);
+    }
+    m_outbox_index.erase(it);
+
+    if(pending) {
+        m_outbox_pending.erase(std::remove_if(m_outbox_pending.begin(), m_outbox_pending.end(),
+            [this](size_t index) { return !m_outbox_slots[index].pending; }), m_outbox_pending.end());
+    }
+}
+
+void ClientRepository::free_outbox_slot(size_t index)
+{
+    OutboxSlot &slot = m_outbox_slots[index];
+    auto it = m_outbox_index.find(slot.doid);
+    if(it != m_outbox_index.end()) {
+        std::vector<size_t> &slots = it->second;
+        slots.erase(std::find(slots.begin(), slots.end(), index));
+        if(slots.empty()) {
+            m_outbox_index.erase(it);
+        }
+    }
+    slot.dg->clear();
+    m_outbox_free.push_back(index);
+}
+
+void ClientRepository::handle_poll_end()
+{
+    flush_outbox();
+}
+
+bool ClientRepository::has_pending_output() const
+{
+    // Includes updates held back by their interval or the byte budget, which are sent by a later poll.
+    return !m_outbox_pending.empty();
+}
+
+} // close namespace
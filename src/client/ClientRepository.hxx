@@ -14,6 +14,8 @@
 #ifndef ASTRON_LIBWASM_CLIENTCONNECTION_HXX
 #define ASTRON_LIBWASM_CLIENTCONNECTION_HXX
 
+#include <unordered_map>
+#include <vector>
 #include "../util/Logger.hxx"
 #include "../object/ObjectRepository.hxx"
 
@@ -32,6 +34,98 @@ class ClientRepository : public ObjectRepository
     // connect starts a connection to the server, negotiates Hello and starts sending
     // heartbeats periodically. It returns after negotiation is complete.
     void connect(std::string uri, uint32_t dc_hash, std::string version);
+
+    // handle_datagram reads the next received message and dispatches it by message type.
+    virtual void handle_datagram();
+
+    // set_dcfile sets the dc file and marks every field with the "coalesce" keyword as coalesced.
+    // With a lazily read file, this happens to the fields of each dclass as it is resolved.
+    virtual void set_dcfile(dclass::File *dcfile);
+
+    // set_keyword_priority queues received updates of the fields with <keyword> (such as
+    // "broadcast", or one declared by the dc file) in the lane of <priority>, instead of
+    // PRIORITY_NORMAL. A field with several such keywords uses the most important priority.
+    // Updates to one object are still handled in the order they were received.
+    void set_keyword_priority(const std::string &keyword, unsigned int priority);
+
+    // OutboxStats counts what happened to updates of coalesced fields.
+    struct OutboxStats {
+        uint64_t queued = 0;     // updates put in the outbox
+        uint64_t suppressed = 0; // updates replaced by a newer value before they were sent
+        uint64_t sent = 0;       // updates sent from the outbox
+        uint64_t deferred = 0;   // times a pending update was held back by its interval or the byte budget
+        uint64_t bytes_sent = 0;
+    };
+
+    // set_coalesced marks <field> as coalesced (or not). Updates of a coalesced field are held in
+    // the outbox until the next flush, and only the latest value for each object is sent.
+    // An update of the field is sent at most once every <min_interval_ms> per object.
+    void set_coalesced(const dclass::Field *field, bool coalesced, double min_interval_ms = 0.0);
+    // set_outbox_budget limits the bytes sent by each flush of the outbox; 0 is unlimited.
+    // Updates over the budget stay in the outbox for the next flush.
+    inline void set_outbox_budget(size_t bytes_per_flush)
+    {
+        m_outbox_budget = bytes_per_flush;
+    }
+    // flush_outbox sends the pending updates of coalesced fields. It is called after each poll.
+    void flush_outbox();
+
+    inline const OutboxStats& get_outbox_stats() const
+    {
+        return m_outbox_stats;
+    }
+    inline void reset_outbox_stats()
+    {
+        m_outbox_stats = OutboxStats();
+    }
+
+  protected:
+    // classify_datagram gives connection state messages (CLIENT_EJECT, CLIENT_HELLO_RESP, ...)
+    // PRIORITY_CONTROL, and objects entering and interest completions PRIORITY_INTEREST.
+    // Object messages are ordered by doid: an object leaving retires its queued updates, and
+    // updates to an object that isn't known or about to enter are dropped. Interest completions
+    // are ordered behind all of the objects entering before them.
+    virtual void classify_datagram(const uint8_t *data, size_t length, Classification &c);
+    virtual void send_field_update(DistributedObject *obj, const dclass::Field *field, const DatagramPtr &dg);
+    virtual void handle_poll_end();
+    virtual bool has_pending_output() const;
+    virtual void class_resolved(const dclass::Class *cls);
+
+  private:
+    struct CoalesceRule {
+        bool coalesced = false;
+        double min_interval = 0.0; // in milliseconds
+    };
+
+    // An OutboxSlot holds the latest update of one field of one object.
+    struct OutboxSlot {
+        doid_t doid;
+        uint16_t field_id;
+        bool pending;
+        double last_sent;
+        DatagramPtr dg;
+    };
+
+    // update_field_priorities resolves the keyword priorities against the resolved dclasses.
+    void update_field_priorities();
+    void update_field_priorities(const dclass::Class *cls);
+
+    // release_outbox_slots frees the outbox slots of an object which has left (with both of its
+    // views), dropping any updates still pending for it. free_outbox_slot frees a single slot.
+    void release_outbox_slots(doid_t doid);
+    void free_outbox_slot(size_t index);
+
+    std::vector<std::pair<std::string, unsigned int>> m_keyword_priorities;
+    std::vector<uint8_t> m_field_priorities; // indexed by field id; NUM_PRIORITIES if not set
+
+    std::vector<CoalesceRule> m_coalesce_rules; // indexed by field id
+    std::vector<OutboxSlot> m_outbox_slots;
+    std::unordered_map<doid_t, std::vector<size_t>> m_outbox_index; // the slots of each object's fields
+    std::vector<size_t> m_outbox_free; // slots of objects that left, to reuse
+    std::vector<size_t> m_outbox_pending; // slot indices, in the order they were first queued
+    std::vector<size_t> m_outbox_held;
+    size_t m_outbox_budget = 0;
+    OutboxStats m_outbox_stats;
 };
 } // close namespace
 
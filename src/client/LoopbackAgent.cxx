@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file LoopbackAgent.cxx
+ * @author Max Rodriguez
+ * @date 2023-06-30
+ */
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#endif
+
+#include <math.h>
+#include <sstream>
+#include "LoopbackAgent.hxx"
+#include "messageTypes.hxx"
+#include "../dc/Class.h"
+#include "../network/DatagramIterator.hxx"
+
+namespace astron   // open namespace
+{
+
+LoopbackAgent::LoopbackAgent(dclass::File *dcfile) : m_dcfile(dcfile)
+{
+}
+
+bool LoopbackAgent::add_workload(const Workload &workload)
+{
+    WorkloadState state;
+    state.workload = workload;
+    state.dclass = m_dcfile->get_class_by_name(workload.dclass_name);
+    if(state.dclass == nullptr) {
+        return false;
+    }
+
+    const dclass::Class *cls = state.dclass;
+    for(unsigned int n = 0; workload.fields.empty() && n < cls->get_num_fields(); ++n) {
+        const dclass::Field *field = cls->get_field(n);
+        if(field->as_molecular() == nullptr && field->has_keywords(dclass::KW_BROADCAST)) {
+            state.fields.push_back(field);
+        }
+    }
+    for(auto it = workload.fields.begin(); it != workload.fields.end(); ++it) {
+        const dclass::Field *field = cls->get_field_by_name(*it);
+        if(field == nullptr) {
+            return false;
+        }
+        state.fields.push_back(field);
+    }
+
+    state.first_doid = m_next_doid;
+    state.entered = false;
+    state.owed = 0.0;
+    state.next = 0;
+    m_next_doid += workload.num_objects;
+    m_workloads.push_back(state);
+    return true;
+}
+
+bool LoopbackAgent::load_workloads(std::istream &in)
+{
+    std::string line;
+    while(std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        Workload workload;
+        if(!(words >> workload.dclass_name)) continue; // blank line
+
+        std::string word;
+        while(words >> word) {
+            size_t equals = word.find('=');
+            if(equals == std::string::npos) {
+                return false;
+            }
+            std::string key = word.substr(0, equals);
+            std::istringstream value(word.substr(equals + 1));
+            bool ok = true;
+            if(key == "objects") {
+                ok = bool(value >> workload.num_objects);
+            } else if(key == "rate") {
+                ok = bool(value >> workload.updates_per_second);
+            } else if(key == "parent") {
+                ok = bool(value >> workload.parent);
+            } else if(key == "zone") {
+                ok = bool(value >> workload.zone);
+            } else if(key == "owner") {
+                ok = bool(value >> workload.owner);
+            } else if(key == "enter") {
+                ok = bool(value >> workload.enter_on_connect);
+            } else if(key == "fields") {
+                std::string name;
+                while(std::getline(value, name, ',')) {
+                    workload.fields.push_back(name);
+                }
+            } else {
+                ok = false;
+            }
+            if(!ok) {
+                return false;
+            }
+        }
+        if(!add_workload(workload)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void LoopbackAgent::handle_datagram(Connection &conn, const DatagramPtr &dg)
+{
+    ++m_stats.datagrams_received;
+    DatagramIterator dgi(dg);
+    uint16_t msg_type = dgi.read_uint16();
+
+    switch(msg_type) {
+    case CLIENT_HELLO: {
+        ++m_stats.hellos;
+        uint32_t dc_hash = dgi.read_uint32();
+        m_dg->clear();
+        if(dc_hash != m_dcfile->get_hash()) {
+            m_dg->add_uint16(CLIENT_EJECT);
+            m_dg->add_uint16(CLIENT_DISCONNECT_BAD_DCHASH);
+            m_dg->add_string("The DC hash does not match.");
+        } else {
+            m_dg->add_uint16(CLIENT_HELLO_RESP);
+        }
+        queue(conn, m_dg);
+        break;
+    }
+    case CLIENT_ADD_INTEREST: {
+        uint32_t context = dgi.read_uint32();
+        uint16_t interest_id = dgi.read_uint16();
+        doid_t parent = dgi.read_doid();
+        std::vector<zone_t> zones(1, dgi.read_zone());
+        handle_add_interest(conn, context, interest_id, parent, zones);
+        break;
+    }
+    case CLIENT_ADD_INTEREST_MULTIPLE: {
+        uint32_t context = dgi.read_uint32();
+        uint16_t interest_id = dgi.read_uint16();
+        doid_t parent = dgi.read_doid();
+        std::vector<zone_t> zones(dgi.read_uint16());
+        for(auto it = zones.begin(); it != zones.end(); ++it) {
+            *it = dgi.read_zone();
+        }
+        handle_add_interest(conn, context, interest_id, parent, zones);
+        break;
+    }
+    case CLIENT_REMOVE_INTEREST: {
+        uint32_t context = dgi.read_uint32();
+        uint16_t interest_id = dgi.read_uint16();
+        handle_remove_interest(conn, context, interest_id);
+        break;
+    }
+    default:
+        break; // updates sent by the client, heartbeats, ...
+    }
+    flush(conn);
+}
+
+void LoopbackAgent::handle_add_interest(Connection &conn, uint32_t context, uint16_t interest_id,
+                                        doid_t parent, const std::vector<zone_t> &zones)
+{
+    ++m_stats.interests;
+    std::vector<size_t> &interest = m_interests[interest_id];
+    for(size_t i = 0; i < m_workloads.size(); ++i) {
+        WorkloadState &state = m_workloads[i];
+        if(state.workload.parent != parent) continue;
+        for(auto it = zones.begin(); it != zones.end(); ++it) {
+            if(*it == state.workload.zone) {
+                enter_objects(conn, state);
+                interest.push_back(i);
+                break;
+            }
+        }
+    }
+    send_done_interest(conn, context, interest_id);
+}
+
+void LoopbackAgent::handle_remove_interest(Connection &conn, uint32_t context, uint16_t interest_id)
+{
+    auto it = m_interests.find(interest_id);
+    if(it != m_interests.end()) {
+        for(auto index = it->second.begin(); index != it->second.end(); ++index) {
+            leave_objects(conn, m_workloads[*index]);
+        }
+        m_interests.erase(it);
+    }
+    send_done_interest(conn, context, interest_id);
+}
+
+void LoopbackAgent::send_done_interest(Connection &conn, uint32_t context, uint16_t interest_id)
+{
+    m_dg->clear();
+    m_dg->add_uint16(CLIENT_DONE_INTEREST_RESP);
+    m_dg->add_uint32(context);
+    m_dg->add_uint16(interest_id);
+    queue(conn, m_dg);
+}
+
+void LoopbackAgent::enter_objects(Connection &conn, WorkloadState &state)
+{
+    if(state.entered) return;
+    state.entered = true;
+
+    const Workload &workload = state.workload;
+    for(unsigned int i = 0; i < workload.num_objects; ++i) {
+        m_dg->clear();
+        m_dg->add_uint16(workload.owner ? CLIENT_ENTER_OBJECT_REQUIRED_OWNER : CLIENT_ENTER_OBJECT_REQUIRED);
+        m_dg->add_doid(state.first_doid + i);
+        m_dg->add_doid(workload.parent);
+        m_dg->add_zone(workload.zone);
+        m_dg->add_uint16(state.dclass->get_id());
+        m_dg->add_data(state.dclass->get_client_required_defaults(workload.owner));
+        queue(conn, m_dg);
+    }
+    m_stats.objects_entered += workload.num_objects;
+}
+
+void LoopbackAgent::leave_objects(Connection &conn, WorkloadState &state)
+{
+    if(!state.entered) return;
+    state.entered = false;
+
+    const Workload &workload = state.workload;
+    for(unsigned int i = 0; i < workload.num_objects; ++i) {
+        m_dg->clear();
+        m_dg->add_uint16(workload.owner ? CLIENT_OBJECT_LEAVING_OWNER : CLIENT_OBJECT_LEAVING);
+        m_dg->add_doid(state.first_doid + i);
+        queue(conn, m_dg);
+    }
+}
+
+void LoopbackAgent::update(Connection &conn)
+{
+    double now = emscripten_get_now();
+    if(!m_connected) {
+        m_connected = true;
+        m_last_update = now;
+        for(auto it = m_workloads.begin(); it != m_workloads.end(); ++it) {
+            if(it->workload.enter_on_connect) {
+                enter_objects(conn, *it);
+            }
+        }
+    }
+
+    double elapsed = now - m_last_update;
+    double skipped = 0.0;
+    if(elapsed > m_max_lag) {
+        skipped = elapsed - m_max_lag;
+        elapsed = m_max_lag;
+    }
+    m_last_update = now;
+
+    for(auto it = m_workloads.begin(); it != m_workloads.end(); ++it) {
+        WorkloadState &state = *it;
+        if(!state.entered || state.fields.empty() || state.workload.num_objects == 0) continue;
+
+        double rate = state.workload.updates_per_second / 1000.0; // per millisecond
+        m_stats.updates_skipped += uint64_t(skipped * rate);
+        state.owed += elapsed * rate;
+        uint64_t count = uint64_t(floor(state.owed));
+        state.owed -= double(count);
+
+        // Objects are updated in turn, one field each time around.
+        size_t num_objects = state.workload.num_objects;
+        size_t pairs = num_objects * state.fields.size();
+        for(uint64_t n = 0; n < count; ++n) {
+            size_t next = state.next;
+            state.next = (next + 1 == pairs) ? 0 : next + 1;
+            const dclass::Field *field = state.fields[next / num_objects];
+
+            m_dg->clear();
+            m_dg->add_uint16(CLIENT_OBJECT_SET_FIELD);
+            m_dg->add_doid(state.first_doid + doid_t(next % num_objects));
+            m_dg->add_uint16(field->get_id());
+            m_dg->add_data(field->get_default_value());
+            queue(conn, m_dg);
+        }
+        m_stats.updates_sent += count;
+    }
+    flush(conn);
+}
+
+void LoopbackAgent::queue(Connection &conn, const DatagramPtr &dg)
+{
+    size_t size = dg->size();
+    m_message.push_back(uint8_t(size));
+    m_message.push_back(uint8_t(size >> 8));
+    m_message.insert(m_message.end(), dg->get_data(), dg->get_data() + size);
+    if(++m_batched >= m_batch) {
+        flush(conn);
+    }
+}
+
+void LoopbackAgent::flush(Connection &conn)
+{
+    if(m_message.empty()) return;
+    ++m_stats.messages_sent;
+    m_stats.bytes_sent += m_message.size();
+    deliver(conn, &m_message[0], m_message.size());
+    m_message.clear();
+    m_batched = 0;
+}
+
+} // close namespace astron
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file LoopbackAgent.hxx
+ * @author Max Rodriguez
+ * @date 2023-06-30
+ */
+
+#ifndef ASTRON_LIBWASM_LOOPBACKAGENT_HXX
+#define ASTRON_LIBWASM_LOOPBACKAGENT_HXX
+
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../network/LoopbackPeer.hxx"
+#include "../dc/File.h"
+#include "../util/types.hxx"
+
+namespace astron   // open namespace
+{
+
+// A LoopbackAgent is an in-process stand-in for an Astron Client Agent, for load testing a
+// ClientRepository without a server; connect to it with Connection::connect_loopback().
+//
+// It answers CLIENT_HELLO (ejecting on a dc hash mismatch), opens and closes interests, and
+// generates the traffic of its workloads: each workload is a number of objects of one dclass,
+// which enter with their required fields and then receive CLIENT_OBJECT_SET_FIELD updates at a
+// steady rate. Field values are the default values of the fields in the dc file.
+class LoopbackAgent : public LoopbackPeer
+{
+  public:
+    struct Workload {
+        std::string dclass_name;
+        unsigned int num_objects = 100;
+        doid_t parent = 1000;
+        zone_t zone = 1;
+        bool owner = false; // enter the objects as owner views
+        // enter the objects as soon as the client connects; otherwise when the client
+        // adds an interest in their location
+        bool enter_on_connect = true;
+        double updates_per_second = 1000.0; // over all objects
+        std::vector<std::string> fields; // updated in turn; if empty, every broadcast field
+    };
+
+    struct Stats {
+        uint64_t hellos = 0;
+        uint64_t interests = 0;
+        uint64_t objects_entered = 0;
+        uint64_t updates_sent = 0;
+        uint64_t updates_skipped = 0; // updates not generated because the client fell behind
+        uint64_t messages_sent = 0;   // websocket messages, each of up to <batch> datagrams
+        uint64_t bytes_sent = 0;
+        uint64_t datagrams_received = 0;
+    };
+
+    // <dcfile> must have been finalized, and must outlive the agent.
+    LoopbackAgent(dclass::File *dcfile);
+
+    // add_workload adds a workload; its objects get the next free doids.
+    // Returns false if the dclass or a field is unknown.
+    bool add_workload(const Workload &workload);
+
+    // load_workloads reads workloads from a description with one workload per line:
+    //
+    //     DistributedAvatar objects=1000 rate=50000 fields=setXYH,setAnim parent=1000 zone=1 owner=0 enter=1
+    //
+    // Omitted settings keep the defaults of Workload; '#' starts a comment.
+    // Returns false (having added the workloads up to the bad line) if a line can't be used.
+    bool load_workloads(std::istream &in);
+
+    // set_batch sets the most datagrams sent in one websocket message. The default is 64.
+    inline void set_batch(unsigned int batch)
+    {
+        m_batch = batch ? batch : 1;
+    }
+    // set_max_lag sets the longest time, in milliseconds, that the agent makes up for when
+    // it isn't updated on time; older updates are skipped. The default is 250.
+    inline void set_max_lag(double max_lag_ms)
+    {
+        m_max_lag = max_lag_ms;
+    }
+
+    inline const Stats& get_stats() const
+    {
+        return m_stats;
+    }
+    inline void reset_stats()
+    {
+        m_stats = Stats();
+    }
+
+    virtual void handle_datagram(Connection &conn, const DatagramPtr &dg);
+    virtual void update(Connection &conn);
+
+  private:
+    struct WorkloadState {
+        Workload workload;
+        const dclass::Class *dclass;
+        std::vector<const dclass::Field*> fields;
+        doid_t first_doid;
+        bool entered;
+        double owed; // fractional updates carried to the next update
+        size_t next; // next (object, field) pair to update
+    };
+
+    void enter_objects(Connection &conn, WorkloadState &state);
+    void leave_objects(Connection &conn, WorkloadState &state);
+    void handle_add_interest(Connection &conn, uint32_t context, uint16_t interest_id,
+                             doid_t parent, const std::vector<zone_t> &zones);
+    void handle_remove_interest(Connection &conn, uint32_t context, uint16_t interest_id);
+    void send_done_interest(Connection &conn, uint32_t context, uint16_t interest_id);
+
+    // queue adds <dg> to the websocket message being built, sending it when it's full.
+    void queue(Connection &conn, const DatagramPtr &dg);
+    void flush(Connection &conn);
+
+    dclass::File *m_dcfile;
+    std::vector<WorkloadState> m_workloads;
+    std::unordered_map<uint16_t, std::vector<size_t>> m_interests; // interest id -> workloads
+    doid_t m_next_doid = 100000000;
+    bool m_connected = false;
+    double m_last_update = 0.0;
+    double m_max_lag = 250.0;
+
+    unsigned int m_batch = 64;
+    unsigned int m_batched = 0;
+    std::vector<uint8_t> m_message; // websocket message being built
+    DatagramPtr m_dg = Datagram::create();
+    Stats m_stats;
+};
+} // close namespace astron
+
+#endif //ASTRON_LIBWASM_LOOPBACKAGENT_HXX
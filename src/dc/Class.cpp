@@ -1,4 +1,6 @@
 // Filename: Class.cpp
+#include <algorithm>  // std::inplace_merge, std::push_heap
+#include <functional> // std::greater
 #include "util/HashGenerator.h"
 #include "dc/File.h"
 #include "dc/Field.h"
@@ -9,7 +11,8 @@ namespace dclass   // open namespace
 {
 
 // constructor
-Class::Class(File* file, const string &name) : Struct(file, name), m_constructor(nullptr)
+Class::Class(File* file, const string &name) : Struct(file, name), m_constructor(nullptr),
+    m_fields_inherited(false)
 {
 }
 
@@ -29,20 +32,51 @@ const Class* Class::as_class() const
     return this;
 }
 
+// update_required_defaults collects the required fields and packs their default values, so that
+//     an object can be given the defaults of all of its required fields with a single copy.
+//     Like Astron's append_required_data(), a client is only sent the required fields it can
+//     receive: broadcast or clrecv, or ownrecv for an owner.
+void Class::update_required_defaults()
+{
+    m_required_fields.clear();
+    m_required_defaults.clear();
+    m_required_offsets.clear();
+    for(int owner = 0; owner < 2; ++owner) {
+        m_client_required_fields[owner].clear();
+        m_client_required_defaults[owner].clear();
+    }
+    for(auto it = m_fields.begin(); it != m_fields.end(); ++it) {
+        const Field* field = *it;
+        if(!field->has_keywords(KW_REQUIRED) || field->as_molecular() != nullptr) {
+            continue;
+        }
+        m_required_fields.push_back(field);
+        m_required_offsets.push_back(m_required_defaults.length());
+        m_required_defaults += field->get_default_value();
+
+        uint64_t mask = field->get_keyword_mask();
+        bool visible = (mask & (KW_BROADCAST | KW_CLRECV)) != 0;
+        for(int owner = 0; owner < 2; ++owner) {
+            if(visible || (owner && (mask & KW_OWNRECV) != 0)) {
+                m_client_required_fields[owner].push_back(field);
+                m_client_required_defaults[owner] += field->get_default_value();
+            }
+        }
+    }
+    m_required_offsets.push_back(m_required_defaults.length());
+}
+
 // add_parent adds a new parent to the inheritance hierarchy of the class.
-//     Note: This is normally called only during parsing.
+//     Note: This is normally called only during parsing, before any field is added.
 void Class::add_parent(Class *parent)
 {
     parent->add_child(this);
     m_parents.push_back(parent);
+    m_file->invalidate_hash();
 
-    // We know there will be this many fields, so allocate ahead of time
-    const vector<Field*>& parent_fields = parent->m_fields;
-    m_fields.reserve(m_fields.size() + parent_fields.size());
-
-    // Add all of the parents fields
-    for(auto it = parent_fields.begin(); it != parent_fields.end(); ++it) {
-        add_inherited_field(parent, *it);
+    // The fields of all of the parents are merged at once, see inherit_fields.
+    if(m_fields_inherited) {
+        inherit_fields();
     }
 }
 
@@ -52,6 +86,14 @@ void Class::add_child(Class* child)
     m_children.push_back(child);
 }
 
+// resolve_fields merges the fields of the parents into the class, if it hasn't been done yet.
+void Class::resolve_fields()
+{
+    if(!m_fields_inherited) {
+        inherit_fields();
+    }
+}
+
 // add_field adds the newly-allocated field to the class.  The class becomes
 //     the owner of the pointer and will delete it when it destructs.
 //     Returns true if the field is successfully added, or false if the field cannot be added.
@@ -72,6 +114,9 @@ bool Class::add_field(Field *field)
         return false;
     }
 
+    // All of the parents are known by now; inherit their fields before adding our own.
+    resolve_fields();
+
     // If the field has the same name as the class, it is a constructor
     if(field->get_name() == m_name) {
         // Make sure we don't already have a constructor
@@ -109,92 +154,43 @@ bool Class::add_field(Field *field)
     }
     m_base_fields.push_back(field);
 
-    // If a parent has a field with the same name, shadow it
-    auto prev_field = m_fields_by_name.find(field->get_name());
-    if(prev_field != m_fields_by_name.end()) {
-        shadow_field(prev_field->second);
-    }
-
-    // Add the field to our full field list
     field->set_struct(this);
-    m_fields.push_back(field); // Don't have to try to sort; id is always last
-
-    // Add the field to the lookups
     m_file->add_field(field);
-    m_fields_by_id[field->get_id()] = field;
-    m_fields_by_name[field->get_name()] = field;
-
-    // Update our size
-    if(field->as_molecular() == nullptr
-       && (has_fixed_size() || m_fields.size() == 1)) {
-        if(field->get_type()->has_fixed_size()) {
-            m_size += field->get_type()->get_size();
-        } else {
-            m_size = 0;
-        }
-    }
+    add_base_field(field);
 
     // Tell our children about the new field
     for(auto it = m_children.begin(); it != m_children.end(); ++it) {
-        (*it)->add_inherited_field(this, field);
+        (*it)->inherit_fields();
     }
 
     return true;
 }
 
-// add_inherited_field updates a classes's fields after a parent adds a new field.
-void Class::add_inherited_field(Class* parent, Field* field)
+// add_base_field adds a field declared by the class to its full field list and lookups.
+void Class::add_base_field(Field* field)
 {
-    // If the field name matches any base field, it is shadowed.
-    if(m_base_fields_by_name.find(field->get_name()) != m_base_fields_by_name.end()) {
-        return;
-    }
-
-    // If another superclass provides a field with that name, the first parent takes precedence
+    // If a parent has a field with the same name, shadow it
     auto prev_field = m_fields_by_name.find(field->get_name());
     if(prev_field != m_fields_by_name.end()) {
-        Struct* parentB = prev_field->second->get_struct();
-        for(auto it = m_parents.begin(); it != m_parents.end(); ++it) {
-            if((*it) == parentB) {
-                // The early parent's field takes precedence over the new field
-                return;
-            } else if((*it) == parent) {
-                // This parent was added before the later parent, so shadow its field
-                shadow_field(prev_field->second);
-            }
-        }
+        shadow_field(prev_field->second);
     }
 
-    // Add the field to our lookup tables
+    // Add the field to our full field list
+    m_fields.push_back(field); // Don't have to try to sort; id is always last
+
+    // Add the field to the lookups
     m_fields_by_id[field->get_id()] = field;
     m_fields_by_name[field->get_name()] = field;
 
-    // Add the field to the list of fields, sorted by id
-    if(m_fields.size() == 0) {
-        m_fields.push_back(field);
-    } else {
-        // Note: Iterate in reverse because fields added later are more likely to be at the end
-        for(auto it = m_fields.rbegin(); it != m_fields.rend(); ++it) {
-            if((*it)->get_id() < field->get_id()) {
-                m_fields.insert(it.base(), field);
-                break;
-            }
-        }
-    }
-
     // Update our size
-    if(has_fixed_size() || m_fields.size() == 1) {
+    if(field->as_molecular() == nullptr
+       && (has_fixed_size() || m_fields.size() == 1)) {
         if(field->get_type()->has_fixed_size()) {
             m_size += field->get_type()->get_size();
         } else {
             m_size = 0;
         }
     }
-
-    // Tell our children about the new field
-    for(auto it = m_children.begin(); it != m_children.end(); ++it) {
-        (*it)->add_inherited_field(this, field);
-    }
 }
 
 // shadow_field removes the field from all of the Class's field accessors,
@@ -213,13 +209,141 @@ void Class::shadow_field(Field* field)
             break;
         }
     }
+}
 
-    // Tell our children to shadow the field
-    for(auto it = m_children.begin(); it != m_children.end(); ++it) {
-        Class* child = (*it);
-        if(child->get_field_by_id(field->get_id()) == field) {
-            child->shadow_field(field);
+static bool less_by_id(const Field* a, const Field* b)
+{
+    return a->get_id() < b->get_id();
+}
+
+// inherit_fields rebuilds the fields of the class from the fields of its parents, followed by
+//     its own fields, and then does the same for its children.
+//     The parents' fields are taken in the order they have always been: parent by parent, with
+//     the first parent to declare a name taking precedence, and the list kept sorted by id.
+//     A field with a smaller id than every field listed before it is only added to the lookups.
+//     Instead of inserting into and erasing from the list for each field, the fields of each
+//     parent are appended, shadowed fields are left as null, and the runs are merged once.
+void Class::inherit_fields()
+{
+    m_fields.clear();
+    m_fields_by_id.clear();
+    m_fields_by_name.clear();
+    m_size = 0;
+    m_fields_inherited = true;
+
+    size_t num_inherited = 0;
+    unsigned int max_id = 0;
+    for(auto it = m_parents.begin(); it != m_parents.end(); ++it) {
+        const vector<Field*>& parent_fields = (*it)->m_fields;
+        if(!parent_fields.empty()) {
+            num_inherited += parent_fields.size();
+            max_id = max(max_id, parent_fields.back()->get_id());
+        }
+    }
+    m_fields_by_id.reserve(num_inherited + m_base_fields.size() + 1);
+    m_fields_by_name.reserve(num_inherited + m_base_fields.size() + 1);
+
+    const size_t unlisted = size_t(-1);
+    vector<Field*> merged;
+    vector<size_t> positions(num_inherited > 0 ? max_id + 1 : 0, unlisted); // id -> index in merged
+    vector<unsigned int> ids; // min-heap of the ids in merged, including shadowed ones
+    vector<size_t> runs; // where the fields of each parent start in merged
+    merged.reserve(num_inherited);
+    size_t num_listed = 0;
+
+    for(size_t i = 0; i < m_parents.size(); ++i) {
+        Class* parent = m_parents[i];
+        runs.push_back(merged.size());
+        for(auto it = parent->m_fields.begin(); it != parent->m_fields.end(); ++it) {
+            Field* field = *it;
+
+            // If another superclass provides a field with that name, the first parent takes precedence
+            auto prev_ref = m_fields_by_name.find(field->get_name());
+            if(prev_ref != m_fields_by_name.end()) {
+                Field* prev_field = prev_ref->second;
+                Struct* parentB = prev_field->get_struct();
+                size_t n = 0;
+                for(; n <= i && m_parents[n] != parentB; ++n) {
+                    if(m_parents[n] != parent) {
+                        continue;
+                    }
+
+                    // This parent was added before the later parent, so shadow its field
+                    if(has_fixed_size()) {
+                        m_size -= prev_field->get_type()->get_size();
+                    }
+                    m_fields_by_id.erase(prev_field->get_id());
+                    m_fields_by_name.erase(prev_field->get_name());
+                    size_t& position = positions[prev_field->get_id()];
+                    if(position != unlisted) {
+                        merged[position] = nullptr;
+                        position = unlisted;
+                        --num_listed;
+                    }
+                }
+                if(n <= i) {
+                    // The early parent's field takes precedence over the new field
+                    continue;
+                }
+            }
+
+            // Add the field to our lookup tables
+            m_fields_by_id[field->get_id()] = field;
+            m_fields_by_name[field->get_name()] = field;
+
+            // Add the field to the list of fields, if a listed field has a smaller id
+            bool listed = (num_listed == 0);
+            if(!listed) {
+                while(positions[ids.front()] == unlisted) {
+                    pop_heap(ids.begin(), ids.end(), greater<unsigned int>());
+                    ids.pop_back();
+                }
+                listed = ids.front() < field->get_id();
+            }
+            if(listed) {
+                positions[field->get_id()] = merged.size();
+                merged.push_back(field);
+                ids.push_back(field->get_id());
+                push_heap(ids.begin(), ids.end(), greater<unsigned int>());
+                ++num_listed;
+            }
+
+            // Update our size
+            if(has_fixed_size() || num_listed == 1) {
+                if(field->get_type()->has_fixed_size()) {
+                    m_size += field->get_type()->get_size();
+                } else {
+                    m_size = 0;
+                }
+            }
+        }
+    }
+
+    // Each parent's fields are sorted by id, so merge them parent by parent.
+    m_fields.reserve(num_listed + m_base_fields.size());
+    runs.push_back(merged.size());
+    for(size_t i = 0; i + 1 < runs.size(); ++i) {
+        size_t middle = m_fields.size();
+        for(size_t n = runs[i]; n < runs[i + 1]; ++n) {
+            if(merged[n] != nullptr) {
+                m_fields.push_back(merged[n]);
+            }
         }
+        inplace_merge(m_fields.begin(), m_fields.begin() + middle, m_fields.end(), less_by_id);
+    }
+
+    // Then add our own fields, as they were declared
+    if(m_constructor != nullptr) {
+        m_fields_by_id[m_constructor->get_id()] = m_constructor;
+        m_fields_by_name[m_constructor->get_name()] = m_constructor;
+    }
+    for(auto it = m_base_fields.begin(); it != m_base_fields.end(); ++it) {
+        add_base_field(*it);
+    }
+
+    // Tell our children about the new fields
+    for(auto it = m_children.begin(); it != m_children.end(); ++it) {
+        (*it)->inherit_fields();
     }
 }
 
@@ -44,8 +44,39 @@ class Class : public Struct
     inline Field* get_base_field(unsigned int n);
     inline const Field* get_base_field(unsigned int n) const;
 
+    // get_num_required_fields returns the number of required atomic fields of the class,
+    //     including inherited ones.  These are set by File::finalize().
+    inline size_t get_num_required_fields() const;
+    // get_required_field returns the <n>th required field, in the order of get_field().
+    inline const Field* get_required_field(unsigned int n) const;
+    // get_required_defaults returns the default values of all the required fields packed back
+    //     to back.  Clients only receive some of them; see get_client_required_defaults().
+    inline const std::string& get_required_defaults() const;
+    // get_required_default_offset returns where the default value of the <n>th required field
+    //     starts in get_required_defaults(); <n> == get_num_required_fields() gives its length.
+    inline size_t get_required_default_offset(unsigned int n) const;
+
+    // get_num_client_required_fields returns the number of required fields sent to a client when
+    //     an object enters its interest: those which are also broadcast or clrecv, and with <owner>
+    //     (for the CLIENT_ENTER_OBJECT_REQUIRED[_OTHER]_OWNER messages) also those which are ownrecv.
+    inline size_t get_num_client_required_fields(bool owner) const;
+    // get_client_required_field returns the <n>th of those fields, in the order of get_field().
+    inline const Field* get_client_required_field(unsigned int n, bool owner) const;
+    // get_client_required_defaults returns the default values of those fields packed back to back,
+    //     as they appear in a CLIENT_ENTER_OBJECT_REQUIRED[_OWNER] message.
+    inline const std::string& get_client_required_defaults(bool owner) const;
+
+    // update_required_defaults collects the required fields (all of them, and those sent to
+    //     clients) and packs their default values.
+    //     This is called by File::finalize(), once the keywords of every field are known.
+    void update_required_defaults();
+
     // add_parent set this class as a subclass to target parent.
     void add_parent(Class *parent);
+    // resolve_fields merges the fields of the parents into the class, if it hasn't been done yet.
+    //     This is done when the first field is added, and by File::add_class() once the class
+    //     is complete, so that a class with several parents is merged in a single pass.
+    void resolve_fields();
 
     // add_field adds a new Field to the class.
     virtual bool add_field(Field* field);
@@ -56,8 +87,11 @@ class Class : public Struct
   private:
     // add_child marks a class as a child of this class.
     void add_child(Class* child);
-    // add_inherited_field updates a classes's fields after a parent adds a new field.
-    void add_inherited_field(Class* parent, Field* field);
+    // inherit_fields rebuilds the fields of the class from the fields of its parents and its
+    //     own fields, then does the same for its children.
+    void inherit_fields();
+    // add_base_field adds a field declared by the class to its full field list and lookups.
+    void add_base_field(Field* field);
     // shadow_field removes the field from all of the Class's field accessors,
     //     so that another field with the same name can be inserted.
     void shadow_field(Field* field);
@@ -68,6 +102,13 @@ class Class : public Struct
 
     std::vector<Class*> m_parents;
     std::vector<Class*> m_children;
+    bool m_fields_inherited; // the fields of the parents have been merged into m_fields
+
+    std::vector<const Field*> m_required_fields;
+    std::string m_required_defaults;
+    std::vector<size_t> m_required_offsets; // one per required field, plus the total length
+    std::vector<const Field*> m_client_required_fields[2]; // indexed by owner
+    std::string m_client_required_defaults[2];
 };
 
 } // close namespace dclass
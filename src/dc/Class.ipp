@@ -64,4 +64,46 @@ inline const Field* Class::get_base_field(unsigned int n) const
     return m_base_fields.at(n);
 }
 
+// get_num_required_fields returns the number of required atomic fields of the class,
+//     including inherited ones.
+inline size_t Class::get_num_required_fields() const
+{
+    return m_required_fields.size();
+}
+// get_required_field returns the <n>th required field, in the order of get_field().
+inline const Field* Class::get_required_field(unsigned int n) const
+{
+    return m_required_fields.at(n);
+}
+// get_required_defaults returns the default values of all the required fields packed back
+//     to back.
+inline const std::string& Class::get_required_defaults() const
+{
+    return m_required_defaults;
+}
+// get_required_default_offset returns where the default value of the <n>th required field
+//     starts in get_required_defaults().
+inline size_t Class::get_required_default_offset(unsigned int n) const
+{
+    return m_required_offsets.at(n);
+}
+
+// get_num_client_required_fields returns the number of required fields sent to a client when
+//     an object enters, with the ownrecv ones if <owner>.
+inline size_t Class::get_num_client_required_fields(bool owner) const
+{
+    return m_client_required_fields[owner].size();
+}
+// get_client_required_field returns the <n>th required field sent to a client.
+inline const Field* Class::get_client_required_field(unsigned int n, bool owner) const
+{
+    return m_client_required_fields[owner].at(n);
+}
+// get_client_required_defaults returns the default values of the required fields sent to a
+//     client, packed as they appear in a CLIENT_ENTER_OBJECT_REQUIRED[_OWNER] message.
+inline const std::string& Class::get_client_required_defaults(bool owner) const
+{
+    return m_client_required_defaults[owner];
+}
+
 } // close namespace dclass
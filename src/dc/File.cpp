@@ -11,7 +11,12 @@ namespace dclass   // open namespace
 typedef std::unordered_map<std::string, DistributedType*>::value_type TypeName;
 
 // constructor
-File::File()
+File::File() : m_hash(0), m_hash_valid(false), m_next_field_id(0), m_loader(nullptr),
+    m_loading(nullptr)
+{
+}
+
+ClassLoader::~ClassLoader()
 {
 }
 
@@ -28,6 +33,8 @@ File::~File()
         delete(*it);
     }
 
+    delete m_loader;
+
     m_classes.clear();
     m_structs.clear();
     m_imports.clear();
@@ -94,15 +101,34 @@ bool File::add_class(Class *cls)
         return false;
     }
 
+    // A reserved class can only be added by its loader, into the slot set aside for it.
+    auto reserved_ref = m_reserved_names.find(cls->get_name());
+    if(reserved_ref != m_reserved_names.end()) {
+        const ReservedClass& reserved = m_reserved[reserved_ref->second];
+        if(m_loading != &reserved) {
+            return false;
+        }
+
+        m_types_by_name[cls->get_name()] = cls;
+        cls->resolve_fields();
+        cls->set_id(reserved.type_id);
+        m_types_by_id[reserved.type_id] = cls;
+        m_classes[reserved.class_index] = cls;
+        invalidate_hash();
+        return true;
+    }
+
     // A Class can't share a name with any other type.
     bool inserted = m_types_by_name.insert(TypeName(cls->get_name(), cls)).second;
     if(!inserted) {
         return false;
     }
 
+    cls->resolve_fields();
     cls->set_id(m_types_by_id.size());
     m_types_by_id.push_back(cls);
     m_classes.push_back(cls);
+    invalidate_hash();
     return true;
 }
 
@@ -117,6 +143,9 @@ bool File::add_struct(Struct *strct)
     }
 
     // A Struct can't share a name with any other type.
+    if(m_reserved_names.count(strct->get_name()) > 0) {
+        return false;
+    }
     bool inserted = m_types_by_name.insert(TypeName(strct->get_name(), strct)).second;
     if(!inserted) {
         return false;
@@ -125,6 +154,7 @@ bool File::add_struct(Struct *strct)
     strct->set_id(m_types_by_id.size());
     m_types_by_id.push_back(strct);
     m_structs.push_back(strct);
+    invalidate_hash();
     return true;
 }
 
@@ -138,6 +168,9 @@ bool File::add_typedef(const std::string& name, DistributedType* type)
     }
 
     // A type alias can't share a name with any other type.
+    if(m_reserved_names.count(name) > 0) {
+        return false;
+    }
     return m_types_by_name.insert(TypeName(name, type)).second;
 }
 
@@ -154,29 +187,244 @@ void File::add_keyword(const std::string &keyword)
 {
     if(!has_keyword(keyword)) {
         m_keywords.push_back(keyword);
+        invalidate_hash();
     }
 }
 
 // add_field gives the field a unique id within the file.
 void File::add_field(Field *field)
 {
-    field->set_id((unsigned int)m_fields_by_id.size());
-    m_fields_by_id.push_back(field);
+    // Fields of a reserved class are given the ids set aside for them, see load_reserved().
+    unsigned int id = m_next_field_id++;
+    if(id >= m_fields_by_id.size()) {
+        m_fields_by_id.resize(id + 1, nullptr);
+    }
+    field->set_id(id);
+    m_fields_by_id[id] = field;
+    invalidate_hash();
+}
+
+// reserve_class sets aside the next type id for the class <name>, and the next <num_fields>
+//     field ids for the fields it declares.
+//     Returns false if there is a name conflict.
+bool File::reserve_class(const std::string& name, unsigned int num_fields)
+{
+    if(name.empty() || m_types_by_name.count(name) > 0) {
+        return false;
+    }
+    bool inserted = m_reserved_names.insert(
+                        std::unordered_map<std::string, unsigned int>::value_type(
+                            name, (unsigned int)m_reserved.size())).second;
+    if(!inserted) {
+        return false;
+    }
+
+    ReservedClass reserved;
+    reserved.type_id = (unsigned int)m_types_by_id.size();
+    reserved.class_index = (unsigned int)m_classes.size();
+    reserved.first_field = m_next_field_id;
+    reserved.num_fields = num_fields;
+    reserved.failed = false;
+    m_reserved.push_back(reserved);
+
+    m_types_by_id.push_back(nullptr);
+    m_classes.push_back(nullptr);
+    m_next_field_id += num_fields;
+    m_fields_by_id.resize(m_next_field_id, nullptr);
+    invalidate_hash();
+    return true;
+}
+
+// set_loader gives the file the ClassLoader that builds its reserved classes.
+void File::set_loader(ClassLoader* loader)
+{
+    delete m_loader;
+    m_loader = loader;
+}
+
+// load_all_classes builds every reserved class that hasn't been built yet.
+void File::load_all_classes() const
+{
+    if(m_loader == nullptr) {
+        return;
+    }
+    for(auto it = m_reserved.begin(); it != m_reserved.end(); ++it) {
+        load_class(it->type_id);
+    }
+}
+
+// find_reserved returns the last reservation whose <member> is at most <value>, or nullptr.
+//     Reservations are made in order, so each member increases along m_reserved.
+const File::ReservedClass* File::find_reserved(unsigned int ReservedClass::*member,
+        unsigned int value) const
+{
+    size_t low = 0, high = m_reserved.size();
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(m_reserved[mid].*member <= value) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low > 0 ? &m_reserved[low - 1] : nullptr;
+}
+
+// load_class builds the reserved class with the type id <id>, if it hasn't been built yet.
+void File::load_class(unsigned int id) const
+{
+    const ReservedClass* reserved = find_reserved(&ReservedClass::type_id, id);
+    if(reserved != nullptr && reserved->type_id == id) {
+        File* file = const_cast<File*>(this);
+        file->load_reserved(file->m_reserved[reserved - &m_reserved[0]]);
+    }
+}
+
+// load_type_by_name builds the reserved class <name>, returning nullptr if there is none.
+DistributedType* File::load_type_by_name(const std::string& name) const
+{
+    auto reserved_ref = m_reserved_names.find(name);
+    if(reserved_ref == m_reserved_names.end()) {
+        return nullptr;
+    }
+    unsigned int id = m_reserved[reserved_ref->second].type_id;
+    load_class(id);
+    return m_types_by_id[id];
 }
 
+// load_field_by_id builds the reserved class declaring the field <id>, and returns the field.
+Field* File::load_field_by_id(unsigned int id) const
+{
+    const ReservedClass* reserved = find_reserved(&ReservedClass::first_field, id);
+    if(reserved == nullptr || id >= reserved->first_field + reserved->num_fields) {
+        return nullptr;
+    }
+    load_class(reserved->type_id);
+    return m_fields_by_id[id];
+}
+
+// load_reserved builds a reserved class with the file's loader, after the classes it refers to.
+void File::load_reserved(ReservedClass& reserved)
+{
+    // Classes can't be built while another one is being built, because the parser is not
+    //     reentrant; the loader builds the dependencies of a class before it.
+    if(reserved.failed || m_types_by_id[reserved.type_id] != nullptr || m_loading != nullptr) {
+        return;
+    }
+
+    const std::vector<unsigned int>& dependencies = m_loader->get_dependencies(reserved.type_id);
+    for(auto it = dependencies.begin(); it != dependencies.end(); ++it) {
+        load_class(*it);
+    }
+
+    unsigned int next_field_id = m_next_field_id;
+    m_next_field_id = reserved.first_field;
+    m_loading = &reserved;
+    bool loaded = m_loader->load_class(this, reserved.type_id);
+    m_loading = nullptr;
+    loaded = loaded && m_next_field_id == reserved.first_field + reserved.num_fields;
+    m_next_field_id = next_field_id;
+
+    Class* cls = m_classes[reserved.class_index];
+    if(!loaded || cls == nullptr) {
+        // Leave the class out of lookups, as if it had not been declared.
+        //     Note: The class isn't deleted, because ~Struct also deletes inherited fields.
+        reserved.failed = true;
+        if(cls != nullptr) {
+            m_types_by_name.erase(cls->get_name());
+        }
+        m_types_by_id[reserved.type_id] = nullptr;
+        m_classes[reserved.class_index] = nullptr;
+        for(unsigned int id = reserved.first_field; id < reserved.first_field + reserved.num_fields; ++id) {
+            m_fields_by_id[id] = nullptr;
+        }
+        return;
+    }
+
+    finalize_fields(reserved.first_field, reserved.first_field + reserved.num_fields);
+    cls->update_required_defaults();
+}
+
+// get_keyword_bit returns the bit representing <keyword> in a field's keyword mask,
+//     or 0 if the keyword has no bit (see KeywordBits).
+uint64_t File::get_keyword_bit(const std::string& keyword) const
+{
+    auto it = m_keyword_bits.find(keyword);
+    if(it != m_keyword_bits.end()) {
+        return it->second;
+    }
+    return get_known_keyword_bit(keyword);
+}
+
+// finalize is called once the file has been completely read.  It interns the declared
+//     keywords, giving each a bit, computes the keyword mask of every field, and packs the
+//     default values of the required fields of every class.
+void File::finalize()
+{
+    invalidate_hash();
+
+    // Known keywords have fixed bits; other keywords get the next free bit in declaration order.
+    //     Any keywords past the 64th can only be checked by name.
+    m_keyword_bits.clear();
+    unsigned int next_bit = NUM_KNOWN_KEYWORDS;
+    for(auto it = m_keywords.begin(); it != m_keywords.end(); ++it) {
+        if(get_known_keyword_bit(*it) == 0 && next_bit < 64) {
+            m_keyword_bits[*it] = 1ULL << next_bit;
+            ++next_bit;
+        }
+    }
+
+    finalize_fields(0, (unsigned int)m_fields_by_id.size());
+
+    // Classes which are still reserved are finalized when they are built.
+    for(auto it = m_classes.begin(); it != m_classes.end(); ++it) {
+        if(*it != nullptr) {
+            (*it)->update_required_defaults();
+        }
+    }
+}
+
+// finalize_fields computes the keyword masks of the fields with ids in [begin, end).
+void File::finalize_fields(unsigned int begin, unsigned int end)
+{
+    for(unsigned int id = begin; id < end; ++id) {
+        Field* field = m_fields_by_id[id];
+        if(field == nullptr) {
+            continue;
+        }
+
+        uint64_t mask = 0;
+        for(unsigned int i = 0; i < field->get_num_keywords(); ++i) {
+            mask |= get_keyword_bit(field->get_keyword(i));
+        }
+        field->set_keyword_mask(mask);
+    }
+}
+
+// get_hash returns a 32-bit hash representing the file.
+//     The hash is computed once and kept until the file is changed again.
 uint32_t File::get_hash() const
 {
-    HashGenerator hashgen;
-    generate_hash(hashgen);
-    return hashgen.get_hash();
+    if(!m_hash_valid) {
+        HashGenerator hashgen;
+        generate_hash(hashgen);
+        m_hash = hashgen.get_hash();
+        m_hash_valid = true;
+    }
+    return m_hash;
 }
 
 // generate_hash accumulates the properties of this file into the hash.
 void File::generate_hash(HashGenerator& hashgen) const
 {
+    // The hash covers every class, so all of them have to be built.
+    load_all_classes();
+
     hashgen.add_int(m_classes.size());
     for(auto it = m_classes.begin(); it != m_classes.end(); ++it) {
-        (*it)->generate_hash(hashgen);
+        if(*it != nullptr) { // a reserved class which failed to build
+            (*it)->generate_hash(hashgen);
+        }
     }
 
     hashgen.add_int(m_structs.size());
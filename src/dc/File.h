@@ -13,6 +13,7 @@ class Class;
 class Struct;
 class Field;
 class HashGenerator;
+class File;
 
 struct Import {
     std::string module;
@@ -21,6 +22,21 @@ struct Import {
     inline Import(const std::string& module_name);
 };
 
+// A ClassLoader builds the classes a File has reserved, when they are first looked up.
+//     See read_lazy().
+class ClassLoader
+{
+  public:
+    virtual ~ClassLoader();
+
+    // get_dependencies returns the type ids of the reserved classes that have to be built
+    //     before the class with the type id <id>, i.e. the classes it refers to.
+    virtual const std::vector<unsigned int>& get_dependencies(unsigned int id) = 0;
+    // load_class parses the class with the type id <id> into <file>.
+    //     Returns false if the class has errors.
+    virtual bool load_class(File* file, unsigned int id) = 0;
+};
+
 // A File represents the complete list of Distributed Class descriptions as read from a .dc file.
 class File
 {
@@ -74,6 +90,9 @@ class File
     inline size_t get_num_keywords() const;
     // get_keyword returns the <n>th keyword declared in the file.
     inline const std::string& get_keyword(unsigned int n) const;
+    // get_keyword_bit returns the bit representing <keyword> in a field's keyword mask,
+    //     or 0 if the keyword has no bit (see KeywordBits).
+    uint64_t get_keyword_bit(const std::string& keyword) const;
 
     // add_class adds the newly-allocated class to the file.
     //     Returns false if there is a name conflict.
@@ -94,7 +113,27 @@ class File
     // add_keyword adds a keyword with the name <keyword> to the list of declared keywords.
     void add_keyword(const std::string &keyword);
 
+    // reserve_class sets aside the next type id for the class <name>, and the next <num_fields>
+    //     field ids for the fields it declares.  The class is built by the file's ClassLoader
+    //     the first time it is looked up, so that ids are the same as if it had been read.
+    //     Returns false if there is a name conflict.
+    //     Note: This is normally called only by read_lazy().
+    bool reserve_class(const std::string& name, unsigned int num_fields);
+    // set_loader gives the file the ClassLoader that builds its reserved classes.
+    //     The File becomes the owner of the loader and will delete it when it destructs.
+    void set_loader(ClassLoader* loader);
+    // is_lazy returns true if the file has a ClassLoader, i.e. classes may be built on lookup.
+    inline bool is_lazy() const;
+    // load_all_classes builds every reserved class that hasn't been built yet.
+    void load_all_classes() const;
+
+    // finalize is called once the file has been completely read.  It interns the declared
+    //     keywords, giving each a bit, computes the keyword mask of every field, and packs the
+    //     default values of the required fields of every class.
+    void finalize();
+
     // get_hash returns a 32-bit hash representing the file.
+    //     The hash is computed once and kept until the file is changed again.
     uint32_t get_hash() const;
 
     // generate_hash accumulates the properties of this file into the hash.
@@ -103,17 +142,51 @@ class File
   private:
     // add_field gives the field a unique id within the file.
     void add_field(Field *field);
+    // invalidate_hash discards the cached hash; it is called whenever the file is changed.
+    inline void invalidate_hash();
     friend class Class;
     friend class Struct;
 
+    // A ReservedClass is a class that has a type id, but may not have been built yet.
+    struct ReservedClass {
+        unsigned int type_id;
+        unsigned int class_index; // index in m_classes
+        unsigned int first_field; // id of its first field
+        unsigned int num_fields;
+        bool failed; // the loader couldn't build it
+    };
+
+    // load_class builds the reserved class with the type id <id>, if it hasn't been built yet.
+    //     Lookups of unbuilt classes while a class is being built return nullptr.
+    void load_class(unsigned int id) const;
+    void load_reserved(ReservedClass& reserved);
+    // find_reserved returns the last reservation whose <member> is at most <value>, or nullptr.
+    const ReservedClass* find_reserved(unsigned int ReservedClass::*member, unsigned int value) const;
+    // load_type_by_name builds the reserved class <name>, returning nullptr if there is none.
+    DistributedType* load_type_by_name(const std::string& name) const;
+    // load_field_by_id builds the reserved class declaring the field <id>, and returns the field.
+    Field* load_field_by_id(unsigned int id) const;
+    // finalize_fields computes the keyword masks of the fields with ids in [begin, end).
+    void finalize_fields(unsigned int begin, unsigned int end);
+
     std::vector<Struct*> m_structs;
     std::vector<Class*> m_classes;
     std::vector<Import*> m_imports; // list of python imports in the file
     std::vector<std::string> m_keywords;
+    std::unordered_map<std::string, uint64_t> m_keyword_bits;
 
     std::vector<Field*> m_fields_by_id;
     std::vector<DistributedType*> m_types_by_id;
     std::unordered_map<std::string, DistributedType*> m_types_by_name;
+
+    mutable uint32_t m_hash;
+    mutable bool m_hash_valid;
+
+    unsigned int m_next_field_id;
+    ClassLoader* m_loader;
+    mutable const ReservedClass* m_loading; // the class being built, if any
+    std::vector<ReservedClass> m_reserved; // in type id order, which is also field id order
+    std::unordered_map<std::string, unsigned int> m_reserved_names; // name -> index in m_reserved
 };
 
 } // close namespace dclass
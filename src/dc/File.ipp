@@ -15,11 +15,19 @@ inline size_t File::get_num_classes() const
 // get_class returns the <n>th class read from the .dc file(s).
 inline Class* File::get_class(unsigned int n)
 {
-    return m_classes.at(n);
+    Class* cls = m_classes.at(n);
+    if(cls == nullptr && m_loader != nullptr) {
+        const ReservedClass* reserved = find_reserved(&ReservedClass::class_index, n);
+        if(reserved != nullptr && reserved->class_index == n) {
+            load_class(reserved->type_id);
+            cls = m_classes[n];
+        }
+    }
+    return cls;
 }
 inline const Class* File::get_class(unsigned int n) const
 {
-    return m_classes.at(n);
+    return const_cast<File*>(this)->get_class(n);
 }
 
 // get_num_structs returns the number of structs in the file.
@@ -48,6 +56,9 @@ inline size_t File::get_num_types() const
 inline DistributedType* File::get_type_by_id(unsigned int id)
 {
     if(id < m_types_by_id.size()) {
+        if(m_types_by_id[id] == nullptr && m_loader != nullptr) {
+            load_class(id);
+        }
         return m_types_by_id[id];
     }
 
@@ -55,11 +66,7 @@ inline DistributedType* File::get_type_by_id(unsigned int id)
 }
 inline const DistributedType* File::get_type_by_id(unsigned int id) const
 {
-    if(id < m_types_by_id.size()) {
-        return m_types_by_id[id];
-    }
-
-    return nullptr;
+    return const_cast<File*>(this)->get_type_by_id(id);
 }
 // get_type_by_name returns the requested type or nullptr if there is no such type.
 inline DistributedType* File::get_type_by_name(const std::string &name)
@@ -69,34 +76,29 @@ inline DistributedType* File::get_type_by_name(const std::string &name)
         return type_ref->second;
     }
 
-    return nullptr;
+    return m_loader != nullptr ? load_type_by_name(name) : nullptr;
 }
 inline const DistributedType* File::get_type_by_name(const std::string &name) const
 {
-    auto type_ref = m_types_by_name.find(name);
-    if(type_ref != m_types_by_name.end()) {
-        return type_ref->second;
-    }
-
-    return nullptr;
+    return const_cast<File*>(this)->get_type_by_name(name);
 }
 
 // get_field_by_id returns the request field or nullptr if there is no such field.
 inline Field* File::get_field_by_id(unsigned int id)
 {
     if(id < m_fields_by_id.size()) {
-        return m_fields_by_id[id];
+        Field* field = m_fields_by_id[id];
+        if(field == nullptr && m_loader != nullptr) {
+            return load_field_by_id(id);
+        }
+        return field;
     }
 
     return nullptr;
 }
 inline const Field* File::get_field_by_id(unsigned int id) const
 {
-    if(id < m_fields_by_id.size()) {
-        return m_fields_by_id[id];
-    }
-
-    return nullptr;
+    return const_cast<File*>(this)->get_field_by_id(id);
 }
 
 // get_num_imports returns the number of imports in the file.
@@ -135,4 +137,16 @@ inline const std::string& File::get_keyword(unsigned int n) const
     return m_keywords.at(n);
 }
 
+// is_lazy returns true if the file has a ClassLoader, i.e. classes may be built on lookup.
+inline bool File::is_lazy() const
+{
+    return m_loader != nullptr;
+}
+
+// invalidate_hash discards the cached hash; it is called whenever the file is changed.
+inline void File::invalidate_hash()
+{
+    m_hash_valid = false;
+}
+
 } // close namespace dclass
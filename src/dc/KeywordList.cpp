@@ -4,14 +4,30 @@
 namespace dclass   // open namespace dclass
 {
 
+// get_known_keyword_bit returns the fixed bit of a known Astron keyword, or 0 otherwise.
+uint64_t get_known_keyword_bit(const std::string& keyword)
+{
+    static const char* known_keywords[NUM_KNOWN_KEYWORDS] = {
+        "required", "broadcast", "ram", "db", "clsend", "clrecv", "ownsend", "ownrecv", "airecv"
+    };
+
+    for(unsigned int i = 0; i < NUM_KNOWN_KEYWORDS; ++i) {
+        if(keyword == known_keywords[i]) {
+            return 1ULL << i;
+        }
+    }
+    return 0;
+}
+
 // empty list constructor
-KeywordList::KeywordList()
+KeywordList::KeywordList() : m_keyword_mask(0)
 {
 }
 
 // copy constructor
 KeywordList::KeywordList(const KeywordList& copy) :
-    m_keywords(copy.m_keywords), m_keywords_by_name(copy.m_keywords_by_name)
+    m_keywords(copy.m_keywords), m_keywords_by_name(copy.m_keywords_by_name),
+    m_keyword_mask(copy.m_keyword_mask)
 {
 }
 
@@ -20,6 +36,7 @@ void KeywordList::operator=(const KeywordList& copy)
 {
     m_keywords = copy.m_keywords;
     m_keywords_by_name = copy.m_keywords_by_name;
+    m_keyword_mask = copy.m_keyword_mask;
 }
 
 // has_keyword returns true if this list includes the indicated keyword, false otherwise.
@@ -59,6 +76,7 @@ bool KeywordList::add_keyword(const std::string& keyword)
     bool inserted = m_keywords_by_name.insert(keyword).second;
     if(inserted) {
         m_keywords.push_back(keyword);
+        m_keyword_mask |= get_known_keyword_bit(keyword);
     }
 
     return inserted;
@@ -1,5 +1,7 @@
 // Filename: KeywordList.h
 #pragma once
+#include <stdint.h>
+#include <string>        // std::string
 #include <vector>        // std::vector
 #include <unordered_set> // std::unordered_set
 namespace dclass   // open namespace dclass
@@ -7,6 +9,25 @@ namespace dclass   // open namespace dclass
 
 // Forward declaration
 class HashGenerator;
+class File;
+
+// KeywordBits are the fixed bits of the known Astron keywords in a KeywordList's keyword mask.
+//     Other keywords declared in a File are given the following bits when the File is finalized.
+enum KeywordBits : uint64_t {
+    KW_REQUIRED  = 1ULL << 0,
+    KW_BROADCAST = 1ULL << 1,
+    KW_RAM       = 1ULL << 2,
+    KW_DB        = 1ULL << 3,
+    KW_CLSEND    = 1ULL << 4,
+    KW_CLRECV    = 1ULL << 5,
+    KW_OWNSEND   = 1ULL << 6,
+    KW_OWNRECV   = 1ULL << 7,
+    KW_AIRECV    = 1ULL << 8,
+};
+const unsigned int NUM_KNOWN_KEYWORDS = 9;
+
+// get_known_keyword_bit returns the fixed bit of a known Astron keyword, or 0 otherwise.
+uint64_t get_known_keyword_bit(const std::string& keyword);
 
 // KeywordList this is a list of keywords (see Keyword) that may be set on a particular field.
 class KeywordList
@@ -26,6 +47,18 @@ class KeywordList
     // get_keyword returns the nth keyword in the list.
     const std::string& get_keyword(unsigned int n) const;
 
+    // get_keyword_mask returns the bitmask of the keywords in the list (see KeywordBits).
+    //     Keywords that are not known Astron keywords are only included once the File is finalized.
+    inline uint64_t get_keyword_mask() const
+    {
+        return m_keyword_mask;
+    }
+    // has_keywords returns true if the list includes all of the keywords in <mask>.
+    inline bool has_keywords(uint64_t mask) const
+    {
+        return (m_keyword_mask & mask) == mask;
+    }
+
     // has_matching_keywords returns true if this list has the same keywords as the other list,
     //     false if some keywords differ. Order is not considered important.
     bool has_matching_keywords(const KeywordList& other) const;
@@ -41,8 +74,16 @@ class KeywordList
     void generate_hash(HashGenerator& hashgen) const;
 
   private:
+    // set_keyword_mask is called when the File is finalized to include the interned keywords.
+    inline void set_keyword_mask(uint64_t mask)
+    {
+        m_keyword_mask = mask;
+    }
+    friend class File;
+
     std::vector<std::string> m_keywords; // the actual list of keywords
     std::unordered_set<std::string> m_keywords_by_name; // a map of name to keywords in list
+    uint64_t m_keyword_mask; // one bit per keyword in the list
 };
 
 } // close namespace dclass
@@ -1,13 +1,15 @@
 // Filename: format.cpp
-#include <cctype>  // std::isprint()
-#include <sstream> // std::ostringstream
+#include <stdio.h>  // snprintf()
+#include <string.h> // memcpy()
+#include <math.h>   // signbit(), fabs(), floor()
+#include <ostream>  // std::ostream
 #include "dc/DistributedType.h"
 #include "dc/ArrayType.h"
 #include "dc/Struct.h"
 #include "dc/Field.h"
 #include "dc/Method.h"
 #include "dc/Parameter.h"
-#include "util/byteorder.h"
+#include "util/byteorder.hxx"
 
 #if defined(_WIN32) && defined(_MSC_VER) && _MSC_VER <= 1800
 #define snprintf sprintf_s
@@ -19,25 +21,167 @@ using namespace std;
 namespace dclass   // open namespace dclass
 {
 
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+// DIGIT_PAIRS holds the two decimal digits of every number from 00 to 99, so integers
+//     can be converted two digits at a time.
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// append_uint appends the decimal digits of <v> to <out>.
+static void append_uint(uint64_t v, string &out)
+{
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    while(v >= 100) {
+        unsigned int pair = (unsigned int)(v % 100) * 2;
+        v /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if(v >= 10) {
+        *--p = DIGIT_PAIRS[v * 2 + 1];
+        *--p = DIGIT_PAIRS[v * 2];
+    } else {
+        *--p = char('0' + v);
+    }
+    out.append(p, digits + sizeof(digits) - p);
+}
+
+static inline void append_int(int64_t v, string &out)
+{
+    if(v < 0) {
+        out += '-';
+        append_uint(uint64_t(0) - uint64_t(v), out);
+    } else {
+        append_uint(uint64_t(v), out);
+    }
+}
+
+static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+// append_fixed appends <v> as %g does when %g picks fixed notation, ie. for magnitudes from 1e-4
+//     up to 1e6 once rounded to 6 significant digits.  Returns false, having appended nothing,
+//     for any other value or if rounding is too close to call without exact arithmetic.
+static bool append_fixed(double v, string &out)
+{
+    double magnitude = fabs(v);
+    if(!(magnitude >= 1e-4 && magnitude < 1e6)) {
+        return false;
+    }
+
+    // Find the decimal exponent, then scale the value to six digits before the point.
+    //     The scaling is a single rounding, so the digits are exact unless the fraction is
+    //     right at one half; a wrong guess of the exponent is corrected by the loop.
+    int exponent = 0;
+    if(magnitude >= 1.0) {
+        while(exponent < 5 && magnitude >= POWERS_OF_TEN[exponent + 1]) {
+            ++exponent;
+        }
+    } else {
+        exponent = -1;
+        while(exponent > -4 && magnitude * POWERS_OF_TEN[-exponent] < 1.0) {
+            --exponent;
+        }
+    }
+
+    uint64_t digits;
+    for(;;) {
+        double scaled = magnitude * POWERS_OF_TEN[5 - exponent];
+        double whole = floor(scaled);
+        double fraction = scaled - whole;
+        if(fabs(fraction - 0.5) < 1e-6) {
+            return false;
+        }
+        if(whole < 1e5) {
+            if(--exponent < -4) {
+                return false;
+            }
+            continue;
+        } else if(whole >= 1e6) {
+            if(++exponent > 5) {
+                return false;
+            }
+            continue;
+        }
+
+        digits = uint64_t(whole) + (fraction > 0.5 ? 1 : 0);
+        if(digits == 1000000) {
+            // Rounding carried into a seventh digit.
+            digits = 100000;
+            if(++exponent > 5) {
+                return false;
+            }
+        }
+        break;
+    }
+
+    char significand[6];
+    for(int i = 5; i >= 0; --i) {
+        significand[i] = char('0' + digits % 10);
+        digits /= 10;
+    }
+    int length = 6; // %g drops trailing zeros after the decimal point
+    int whole_digits = exponent >= 0 ? exponent + 1 : 0;
+    while(length > whole_digits && significand[length - 1] == '0') {
+        --length;
+    }
+
+    char buf[16];
+    char* p = buf;
+    if(v < 0) {
+        *p++ = '-';
+    }
+    if(exponent >= 0) {
+        memcpy(p, significand, whole_digits);
+        p += whole_digits;
+        if(length > whole_digits) {
+            *p++ = '.';
+            memcpy(p, significand + whole_digits, length - whole_digits);
+            p += length - whole_digits;
+        }
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        for(int i = -1; i > exponent; --i) {
+            *p++ = '0';
+        }
+        memcpy(p, significand, length);
+        p += length;
+    }
+    out.append(buf, p - buf);
+    return true;
+}
+
+// append_float appends <v> as an ostream with the default flags and precision would (ie. %g).
+static void append_float(double v, string &out)
+{
+    // Whole numbers below a million are printed by %g without an exponent or a fraction,
+    //     and are common enough to be worth a shortcut.
+    if(v > -1e6 && v < 1e6 && v == double(int64_t(v)) && (v != 0 || !signbit(v))) {
+        append_int(int64_t(v), out);
+        return;
+    }
+    if(append_fixed(v, out)) {
+        return;
+    }
+
+    char buf[32];
+    int length = snprintf(buf, sizeof(buf), "%g", v);
+    out.append(buf, length);
+}
+
 // A Formatter steps through packed data and unpacks it as a .dc file parameter format.
 //     This is created and called by format() to handle formatting.
 struct Formatter {
     const uint8_t* in;
-    ostream &out;
+    string &out;
     size_t offset;
     size_t end;
 
-    Formatter(const vector<uint8_t> &in, ostream &out) :
-        in(&in[0]), out(out), offset(0), end(in.size())
-    {
-    }
-
-    Formatter(const string &in, ostream &out) :
-        in((const uint8_t*)&in[0]), out(out), offset(0), end(in.size())
-    {
-    }
-
-    Formatter(const uint8_t* buffer, size_t length, ostream &out) :
+    Formatter(const uint8_t* buffer, size_t length, string &out) :
         in(buffer), out(out), offset(0), end(length)
     {
     }
@@ -47,11 +191,18 @@ struct Formatter {
         return (offset + length) <= end;
     }
 
+    template<typename T>
+    inline T read()
+    {
+        T v;
+        memcpy(&v, in + offset, sizeof(T));
+        offset += sizeof(T);
+        return swap_le(v);
+    }
+
     inline sizetag_t read_length()
     {
-        sizetag_t v = swap_le(*(sizetag_t*)(in + offset));
-        offset += sizeof(sizetag_t);
-        return v;
+        return read<sizetag_t>();
     }
 
     bool format(const DistributedType* dtype)
@@ -59,105 +210,90 @@ struct Formatter {
         Type type = dtype->get_type();
         switch(type) {
         case T_INVALID: {
-            out << "<invalid>";
+            out.append("<invalid>");
             break;
         }
         case T_INT8: {
             if(!remaining(sizeof(int8_t))) {
                 return false;
             }
-            int v = *(int8_t*)(in + offset);
-            offset += sizeof(int8_t);
-            out << v;
+            append_int(int8_t(read<uint8_t>()), out);
             break;
         }
         case T_INT16: {
             if(!remaining(sizeof(int16_t))) {
                 return false;
             }
-            int v = swap_le(*(int16_t*)(in + offset));
-            offset += sizeof(int16_t);
-            out << v;
+            append_int(int16_t(read<uint16_t>()), out);
             break;
         }
         case T_INT32: {
             if(!remaining(sizeof(int32_t))) {
                 return false;
             }
-            int v = swap_le(*(int32_t*)(in + offset));
-            offset += sizeof(int32_t);
-            out << v;
+            append_int(int32_t(read<uint32_t>()), out);
             break;
         }
         case T_INT64: {
             if(!remaining(sizeof(int64_t))) {
                 return false;
             }
-            int64_t v = swap_le(*(int64_t*)(in + offset));
-            offset += sizeof(int64_t);
-            out << v;
+            append_int(int64_t(read<uint64_t>()), out);
             break;
         }
         case T_UINT8: {
             if(!remaining(sizeof(uint8_t))) {
                 return false;
             }
-            unsigned int v = *(uint8_t*)(in + offset);
-            offset += sizeof(uint8_t);
-            out << v;
+            append_uint(read<uint8_t>(), out);
             break;
         }
         case T_UINT16: {
             if(!remaining(sizeof(uint16_t))) {
                 return false;
             }
-            unsigned int v = swap_le(*(uint16_t*)(in + offset));
-            offset += sizeof(uint16_t);
-            out << v;
+            append_uint(read<uint16_t>(), out);
             break;
         }
         case T_UINT32: {
             if(!remaining(sizeof(uint32_t))) {
                 return false;
             }
-            unsigned int v = swap_le(*(uint32_t*)(in + offset));
-            offset += sizeof(uint32_t);
-            out << v;
+            append_uint(read<uint32_t>(), out);
             break;
         }
         case T_UINT64: {
             if(!remaining(sizeof(uint64_t))) {
                 return false;
             }
-            uint64_t v = swap_le(*(uint64_t*)(in + offset));
-            offset += sizeof(uint64_t);
-            out << v;
+            append_uint(read<uint64_t>(), out);
             break;
         }
         case T_FLOAT32: {
             if(!remaining(sizeof(float))) {
                 return false;
             }
-            float v = (float)swap_le(*(float*)(in + offset));
-            offset += sizeof(float);
-            out << v;
+            uint32_t bits = read<uint32_t>();
+            float v;
+            memcpy(&v, &bits, sizeof(float));
+            append_float(v, out);
             break;
         }
         case T_FLOAT64: {
             if(!remaining(sizeof(double))) {
                 return false;
             }
-            double v = (double)swap_le(*(double*)(in + offset));
-            offset += sizeof(double);
-            out << v;
+            uint64_t bits = read<uint64_t>();
+            double v;
+            memcpy(&v, &bits, sizeof(double));
+            append_float(v, out);
             break;
         }
         case T_CHAR: {
             if(!remaining(sizeof(char))) {
                 return false;
             }
-            char v = *(char*)(in + offset);
-            format_quoted('\'', string(1, v), out);
+            format_quoted('\'', (const char*)in + offset, sizeof(char), out);
             offset += sizeof(char);
             break;
         }
@@ -172,28 +308,27 @@ struct Formatter {
                 if(!remaining(length)) {
                     return false;
                 }
-                string str((const char*)in + offset, length);
-                offset += length;
 
                 // Enquoute and escape string then output
-                format_quoted('"', str, out);
+                format_quoted('"', (const char*)in + offset, length, out);
+                offset += length;
             } else {
                 // Otherwise format as an array of char
-                out << '[';
+                out += '[';
                 const ArrayType* arr = dtype->as_array();
                 bool ok = format(arr->get_element_type());
                 if(!ok) {
                     return false;
                 }
                 for(unsigned int i = 1; i < arr->get_array_size(); ++i) {
-                    out << ", ";
+                    out.append(", ", 2);
                     ok = format(arr->get_element_type());
                     if(!ok) {
                         return false;
                     }
                 }
 
-                out << ']';
+                out += ']';
             }
             break;
         }
@@ -211,56 +346,15 @@ struct Formatter {
                 if(!remaining(length)) {
                     return false;
                 }
-                string str((const char*)in + offset, length);
-                offset += length;
 
                 // Enquoute and escape string then output
-                format_quoted('"', str, out);
+                format_quoted('"', (const char*)in + offset, length, out);
+                offset += length;
             } else {
                 // Otherwise format as an array of char
-                out << '[';
-                // Read array byte length
-                if(!remaining(sizeof(sizetag_t))) {
-                    out << ']';
-                    return false;
-                }
-                sizetag_t length = read_length();
-
-                if(length == 0) {
-                    out << ']';
-                    break;
-                }
-
-                // Read array
-                if(!remaining(length)) {
-                    out << ']';
-                    return false;
-                }
-                size_t array_end = offset + length;
-
-                const ArrayType* arr = dtype->as_array();
-                bool ok = format(arr->get_element_type());
-                if(!ok) {
-                    out << ']';
+                if(!format_var_array(dtype)) {
                     return false;
                 }
-
-                while(offset < array_end) {
-                    out << ", ";
-                    ok = format(arr->get_element_type());
-                    if(!ok) {
-                        out << ']';
-                        return false;
-                    }
-                }
-
-                // Check to make sure we didn't overshoot the array while reading
-                if(offset > array_end) {
-                    out << ']';
-                    return false;
-                }
-
-                out << ']';
             }
 
             break;
@@ -275,31 +369,15 @@ struct Formatter {
                 if(!remaining(length)) {
                     return false;
                 }
-                string blob((const char*)in + offset, length);
-                offset += length;
 
                 // Format blob as a hex constant then output
-                format_hex(blob, out);
+                format_hex((const char*)in + offset, length, out);
+                offset += length;
             } else {
                 // Otherwise format as an array of uint8
-                out << '[';
-                const ArrayType* arr = dtype->as_array();
-                bool ok = format(arr->get_element_type());
-                if(!ok) {
-                    out << ']';
+                if(!format_fixed_array(dtype)) {
                     return false;
                 }
-
-                for(unsigned int i = 1; i < arr->get_array_size(); ++i) {
-                    out << ", ";
-                    ok = format(arr->get_element_type());
-                    if(!ok) {
-                        out << ']';
-                        return false;
-                    }
-                }
-
-                out << ']';
             }
 
             break;
@@ -318,217 +396,211 @@ struct Formatter {
                 if(!remaining(length)) {
                     return false;
                 }
-                string blob((const char*)in + offset - 2, length + 2);
-                offset += length;
 
                 // Format blob and length as a hex constant then output
-                format_hex(blob, out);
+                format_hex((const char*)in + offset - sizeof(sizetag_t), length + sizeof(sizetag_t), out);
+                offset += length;
             } else {
                 // Otherwise format as an array of uint8
-                out << '[';
-                // Read array byte length
-                if(!remaining(sizeof(sizetag_t))) {
-                    out << ']';
+                if(!format_var_array(dtype)) {
                     return false;
                 }
-                sizetag_t length = read_length();
-
-                if(length == 0) {
-                    out << ']';
-                    break;
-                }
-                // Read array
-                if(!remaining(length)) {
-                    out << ']';
-                    return false;
-                }
-                size_t array_end = offset + length;
-
-                const ArrayType* arr = dtype->as_array();
-                bool ok = format(arr->get_element_type());
-                if(!ok) {
-                    out << ']';
-                    return false;
-                }
-                while(offset < array_end) {
-                    out << ", ";
-                    ok = format(arr->get_element_type());
-                    if(!ok) {
-                        out << ']';
-                        return false;
-                    }
-                }
-
-                // Check to make sure we didn't overshoot the array while reading
-                if(offset > array_end) {
-                    out << ']';
-                    return false;
-                }
-
-                out << ']';
             }
 
             break;
         }
         case T_ARRAY: {
-            out << '[';
-            const ArrayType* arr = dtype->as_array();
-            bool ok = format(arr->get_element_type());
-            if(!ok) {
-                out << ']';
+            if(!format_fixed_array(dtype)) {
                 return false;
             }
-            for(unsigned int i = 1; i < arr->get_array_size(); ++i) {
-                out << ", ";
-                ok = format(arr->get_element_type());
-                if(!ok) {
-                    out << ']';
-                    return false;
-                }
-            }
-
-            out << ']';
             break;
         }
         case T_VARARRAY: {
-            out << '[';
-            // Read array byte length
-            if(!remaining(sizeof(sizetag_t))) {
-                out << ']';
-                return false;
-            }
-            sizetag_t length = read_length();
-
-            if(length == 0) {
-                out << ']';
-                break;
-            }
-
-            // Read array
-            if(!remaining(length)) {
-                out << ']';
-                return false;
-            }
-            size_t array_end = offset + length;
-
-            const ArrayType* arr = dtype->as_array();
-            bool ok = format(arr->get_element_type());
-            if(!ok) {
-                out << ']';
-                return false;
-            }
-            while(offset < array_end) {
-                out << ", ";
-                ok = format(arr->get_element_type());
-                if(!ok) {
-                    out << ']';
-                    return false;
-                }
-            }
-
-            // Check to make sure we didn't overshoot the array while reading
-            if(offset > array_end) {
-                out << ']';
+            if(!format_var_array(dtype)) {
                 return false;
             }
-
-            out << ']';
             break;
         }
         case T_STRUCT: {
-            out << '{';
+            out += '{';
             const Struct* strct = dtype->as_struct();
             size_t num_fields = strct->get_num_fields();
             if(num_fields > 0) {
                 bool ok = format(strct->get_field(0)->get_type());
                 if(!ok) {
-                    out << '}';
+                    out += '}';
                     return false;
                 }
                 for(unsigned int i = 1; i < num_fields; ++i) {
-                    out << ", ";
+                    out.append(", ", 2);
                     ok = format(strct->get_field(i)->get_type());
                     if(!ok) {
-                        out << '}';
+                        out += '}';
                         return false;
                     }
                 }
             }
-            out << '}';
+            out += '}';
             break;
         }
         case T_METHOD: {
-            out << '(';
+            out += '(';
             const Method* method = dtype->as_method();
             size_t num_params = method->get_num_parameters();
             if(num_params > 0) {
                 bool ok = format(method->get_parameter(0)->get_type());
                 if(!ok) {
-                    out << ')';
+                    out += ')';
                     return false;
                 }
                 for(unsigned int i = 1; i < num_params; ++i) {
-                    out << ", ";
+                    out.append(", ", 2);
                     ok = format(method->get_parameter(i)->get_type());
                     if(!ok) {
-                        out << ')';
+                        out += ')';
                         return false;
                     }
                 }
             }
-            out << ')';
+            out += ')';
             break;
         }
         default: {
-            out << "<error>";
+            out.append("<error>");
             return false;
         }
         }
         return true;
     }
+
+    // format_fixed_array formats an array with a fixed number of elements as [ELEMENT, ...].
+    bool format_fixed_array(const DistributedType* dtype)
+    {
+        out += '[';
+        const ArrayType* arr = dtype->as_array();
+        bool ok = format(arr->get_element_type());
+        if(!ok) {
+            out += ']';
+            return false;
+        }
+        for(unsigned int i = 1; i < arr->get_array_size(); ++i) {
+            out.append(", ", 2);
+            ok = format(arr->get_element_type());
+            if(!ok) {
+                out += ']';
+                return false;
+            }
+        }
+
+        out += ']';
+        return true;
+    }
+
+    // format_var_array formats an array prefixed with its length in bytes as [ELEMENT, ...].
+    bool format_var_array(const DistributedType* dtype)
+    {
+        out += '[';
+        // Read array byte length
+        if(!remaining(sizeof(sizetag_t))) {
+            out += ']';
+            return false;
+        }
+        sizetag_t length = read_length();
+
+        if(length == 0) {
+            out += ']';
+            return true;
+        }
+
+        // Read array
+        if(!remaining(length)) {
+            out += ']';
+            return false;
+        }
+        size_t array_end = offset + length;
+
+        const ArrayType* arr = dtype->as_array();
+        bool ok = format(arr->get_element_type());
+        if(!ok) {
+            out += ']';
+            return false;
+        }
+        while(offset < array_end) {
+            // An element that takes no space would never reach the end of the array.
+            size_t element_start = offset;
+            out.append(", ", 2);
+            ok = format(arr->get_element_type());
+            if(!ok || offset == element_start) {
+                out += ']';
+                return false;
+            }
+        }
+
+        // Check to make sure we didn't overshoot the array while reading
+        if(offset > array_end) {
+            out += ']';
+            return false;
+        }
+
+        out += ']';
+        return true;
+    }
 };
 
 // format unpacks the packed data into a string formatted for a .dc file.
 //     This is used to produce default values when outputting a distributed class to a file.
 string format_value(const DistributedType *dtype, const vector<uint8_t> &packed)
 {
-    ostringstream ss;
-    format_value(dtype, packed, ss);
-    return ss.str();
+    string formatted;
+    format_value(dtype, packed.data(), packed.size(), formatted);
+    return formatted;
 }
 string format_value(const DistributedType *dtype, const string &packed)
 {
-    ostringstream ss;
-    format_value(dtype, packed, ss);
-    return ss.str();
+    string formatted;
+    format_value(dtype, (const uint8_t*)packed.data(), packed.size(), formatted);
+    return formatted;
 }
 void format_value(const DistributedType *dtype, const vector<uint8_t> &packed, ostream &out)
 {
-    Formatter formatter(packed, out);
-    formatter.format(dtype);
+    string formatted = format_value(dtype, packed);
+    out.write(formatted.data(), formatted.size());
 }
 void format_value(const DistributedType *dtype, const string &packed, ostream &out)
 {
-    Formatter formatter(packed, out);
-    formatter.format(dtype);
+    string formatted = format_value(dtype, packed);
+    out.write(formatted.data(), formatted.size());
+}
+bool format_value(const DistributedType *dtype, const uint8_t *packed, size_t length, string &out)
+{
+    Formatter formatter(packed, length, out);
+    return formatter.format(dtype);
 }
 
 // format_hex outputs <str> to <out> as a hexidecimal constant enclosed in angle-brackets (<>).
 void format_hex(const string &str, ostream &out)
 {
-    out << '<';
-    for(auto it = str.begin(); it != str.end(); ++it) {
-        char infer[10];
-        snprintf(infer, 10, "%02x", (unsigned char)(*it));
-        out << infer;
-    }
-    out << '>';
+    string formatted = format_hex(str);
+    out.write(formatted.data(), formatted.size());
 }
 string format_hex(const string &str)
 {
-    ostringstream ss;
-    format_hex(str, ss);
-    return ss.str();
+    string formatted;
+    format_hex(str.data(), str.size(), formatted);
+    return formatted;
+}
+void format_hex(const char *data, size_t length, string &out)
+{
+    size_t start = out.size();
+    out.resize(start + length * 2 + 2);
+    char* p = &out[start];
+    *p++ = '<';
+    for(size_t i = 0; i < length; ++i) {
+        unsigned char c = data[i];
+        *p++ = HEX_DIGITS[c >> 4];
+        *p++ = HEX_DIGITS[c & 0xf];
+    }
+    *p = '>';
 }
 
 // format_quoted outputs <str> to <out> quoted with the character <quote_mark>.
@@ -536,29 +608,41 @@ string format_hex(const string &str)
 //     Non-printable characters are replaced with an escaped hexidecimal constant.
 void format_quoted(char quote_mark, const string &str, ostream &out)
 {
-    out << quote_mark;
-    for(auto it = str.begin(); it != str.end(); ++it) {
-        char c = *it;
-        if(c == quote_mark || c == '\\') {
-            // escape the character
-            out << '\\' << c;
+    string formatted = format_quoted(quote_mark, str);
+    out.write(formatted.data(), formatted.size());
+}
+string format_quoted(char quote_mark, const string &str)
+{
+    string formatted;
+    format_quoted(quote_mark, str.data(), str.size(), formatted);
+    return formatted;
+}
+void format_quoted(char quote_mark, const char *data, size_t length, string &out)
+{
+    out += quote_mark;
+    const char* run = data; // characters that don't need escaping, not yet added
+    const char* end = data + length;
+    for(const char* p = data; p != end; ++p) {
+        unsigned char c = *p;
+        bool printable = (c >= 0x20 && c < 0x7f); // isprint() in the "C" locale
+        if(printable && c != quote_mark && c != '\\') {
+            continue;
+        }
 
-        } else if(!isprint(c)) { // character is not a printable ascii character
-            // print the character as an escaped hexidecimal character constant
-            char infer[10];
-            snprintf(infer, 10, "%02x", (unsigned char)c);
-            out << "\\x" << infer;
+        out.append(run, p - run);
+        run = p + 1;
+        if(printable) {
+            // escape the character
+            out += '\\';
+            out += char(c);
         } else {
-            out << c;
+            // print the character as an escaped hexidecimal character constant
+            char escaped[4] = {'\\', 'x', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xf]};
+            out.append(escaped, sizeof(escaped));
         }
     }
-    out << quote_mark;
-}
-string format_quoted(char quote_mark, const string &str)
-{
-    ostringstream ss;
-    format_quoted(quote_mark, str, ss);
-    return ss.str();
+    out.append(run, end - run);
+    out += quote_mark;
 }
 
 
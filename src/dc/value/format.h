@@ -1,5 +1,8 @@
 // Filename: format.h
 #pragma once
+#include <stdint.h> // uint8_t
+#include <stddef.h> // size_t
+#include <iosfwd> // std::ostream
 #include <string> // std::string
 #include <vector> // std::vector
 namespace dclass   // open namespace dclass
@@ -15,16 +18,22 @@ std::string format_value(const DistributedType*, const std::vector<uint8_t> &pac
 std::string format_value(const DistributedType*, const std::string &packed);
 void format_value(const DistributedType*, const std::vector<uint8_t> &packed, std::ostream &out);
 void format_value(const DistributedType*, const std::string &packed, std::ostream &out);
+// format_value appends the formatted value of the <length> bytes at <packed> to <out>, which
+//     can be cleared and reused between calls so that formatting doesn't have to allocate.
+//     Returns false if the packed data is shorter than the value's type requires.
+bool format_value(const DistributedType*, const uint8_t *packed, size_t length, std::string &out);
 
 // format_hex outputs <str> as a hexidecimal constant enclosed in angle-brackets (<>)
 std::string format_hex(const std::string &str);
 void format_hex(const std::string &str, std::ostream &out);
+void format_hex(const char *data, size_t length, std::string &out);
 
 // format_quoted outputs <str> enclosed in quotes after escaping the string.
 //     Any instances of backslash (\) or the quoute character in the string are escaped.
-//     Non-printable characters are replaced with an escaped hexidecimal constant.std::string format_quoted(const std::string &str);
+//     Non-printable characters are replaced with an escaped hexidecimal constant.
 std::string format_quoted(char quote_mark, const std::string &str);
 void format_quoted(char quote_mark, const std::string &str, std::ostream &out);
+void format_quoted(char quote_mark, const char *data, size_t length, std::string &out);
 
 
 } // close namespace dclass
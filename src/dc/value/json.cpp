@@ -0,0 +1,1235 @@
+// Filename: json.cpp
+#include <assert.h> // assert()
+#include <stdio.h>  // snprintf()
+#include <stdlib.h> // strtod()
+#include <string.h> // memcpy()
+#include <math.h>   // isfinite(), floor()
+#include <limits>   // std::numeric_limits
+#include <algorithm> // std::rotate, std::min
+#include "dc/DistributedType.h"
+#include "dc/ArrayType.h"
+#include "dc/Struct.h"
+#include "dc/Class.h"
+#include "dc/Field.h"
+#include "dc/Method.h"
+#include "dc/Parameter.h"
+#include "file/write.h" // format_type(Type);
+#include "util/byteorder.hxx"
+
+#if defined(_WIN32) && defined(_MSC_VER) && _MSC_VER <= 1800
+#define snprintf sprintf_s
+#endif
+
+
+#include "json.h"
+using namespace std;
+namespace dclass   // open namespace dclass
+{
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+// MAX_SAFE_INTEGER is the largest integer up to which every integer is exact in a double,
+//     and so in a JavaScript number.
+static const uint64_t MAX_SAFE_INTEGER = (uint64_t(1) << 53) - 1;
+
+static inline int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// append_bytes adds <length> bytes to the end of a packed value.
+static inline void append_bytes(string &out, const char *data, size_t length)
+{
+    out.append(data, length);
+}
+static inline void append_bytes(vector<uint8_t> &out, const char *data, size_t length)
+{
+    out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + length);
+}
+
+// numeric_width returns the packed size in bytes of a numeric type, or 0 for any other type.
+static inline size_t numeric_width(Type type)
+{
+    switch(type) {
+    case T_INT8:
+    case T_UINT8:
+    case T_CHAR:
+        return 1;
+    case T_INT16:
+    case T_UINT16:
+        return 2;
+    case T_INT32:
+    case T_UINT32:
+    case T_FLOAT32:
+        return 4;
+    case T_INT64:
+    case T_UINT64:
+    case T_FLOAT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+// utf8_sequence returns the length of the valid UTF-8 sequence at <p>, or 0 if it isn't one.
+static size_t utf8_sequence(const uint8_t* p, const uint8_t* end)
+{
+    uint8_t c = p[0];
+    size_t length;
+    uint32_t min;
+    uint32_t code;
+    if(c >= 0xc2 && c <= 0xdf) {
+        length = 2;
+        min = 0x80;
+        code = c & 0x1f;
+    } else if(c >= 0xe0 && c <= 0xef) {
+        length = 3;
+        min = 0x800;
+        code = c & 0x0f;
+    } else if(c >= 0xf0 && c <= 0xf4) {
+        length = 4;
+        min = 0x10000;
+        code = c & 0x07;
+    } else {
+        return 0;
+    }
+    if(size_t(end - p) < length) {
+        return 0;
+    }
+    for(size_t i = 1; i < length; ++i) {
+        if((p[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        code = (code << 6) | (p[i] & 0x3f);
+    }
+    if(code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) {
+        return 0;
+    }
+    return length;
+}
+
+// A JsonFormatter steps through packed data and writes it as JSON.
+//     This is created and called by format_json() to handle formatting.
+struct JsonFormatter {
+    const uint8_t* in;
+    string &out;
+    size_t offset;
+    size_t end;
+
+    JsonFormatter(const uint8_t* buffer, size_t length, string &out) :
+        in(buffer), out(out), offset(0), end(length)
+    {
+    }
+
+    inline bool remaining(size_t length)
+    {
+        return (offset + length) <= end;
+    }
+
+    template<typename T>
+    inline T read()
+    {
+        T v;
+        memcpy(&v, in + offset, sizeof(T));
+        offset += sizeof(T);
+        return swap_le(v);
+    }
+
+    void append_uint(uint64_t v)
+    {
+        char digits[20];
+        char* p = digits + sizeof(digits);
+        do {
+            *--p = char('0' + v % 10);
+            v /= 10;
+        } while(v > 0);
+        out.append(p, digits + sizeof(digits) - p);
+    }
+
+    void append_int(int64_t v)
+    {
+        if(v < 0) {
+            out += '-';
+            append_uint(uint64_t(0) - uint64_t(v));
+        } else {
+            append_uint(uint64_t(v));
+        }
+    }
+
+    // append_float appends <v> with the fewest significant digits that read back as the same value.
+    void append_float(double v, bool single)
+    {
+        if(!isfinite(v)) {
+            out.append("null", 4);
+            return;
+        }
+        if(v > -1e15 && v < 1e15 && v == floor(v) && (v != 0 || !signbit(v))) {
+            append_int(int64_t(v));
+            return;
+        }
+
+        char buf[32];
+        int length = 0;
+        for(int precision = single ? 6 : 15; precision <= (single ? 9 : 17); ++precision) {
+            length = snprintf(buf, sizeof(buf), "%.*g", precision, v);
+            double back = strtod(buf, nullptr);
+            if(single ? float(back) == float(v) : back == v) {
+                break;
+            }
+        }
+        out.append(buf, length);
+    }
+
+    // append_string appends <length> characters as a JSON string.
+    void append_string(const uint8_t* data, size_t length)
+    {
+        out += '"';
+        const uint8_t* run = data; // characters that don't need escaping, not yet added
+        const uint8_t* stop = data + length;
+        for(const uint8_t* p = data; p != stop;) {
+            uint8_t c = *p;
+            if(c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+                ++p;
+                continue;
+            } else if(c >= 0x80) {
+                size_t sequence = utf8_sequence(p, stop);
+                if(sequence > 0) {
+                    p += sequence;
+                    continue;
+                }
+            }
+
+            out.append((const char*)run, p - run);
+            run = ++p;
+            switch(c) {
+            case '"':
+                out.append("\\\"", 2);
+                break;
+            case '\\':
+                out.append("\\\\", 2);
+                break;
+            case '\n':
+                out.append("\\n", 2);
+                break;
+            case '\r':
+                out.append("\\r", 2);
+                break;
+            case '\t':
+                out.append("\\t", 2);
+                break;
+            default: {
+                char escaped[6] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xf]};
+                out.append(escaped, sizeof(escaped));
+                break;
+            }
+            }
+        }
+        out.append((const char*)run, stop - run);
+        out += '"';
+    }
+
+    bool format(const DistributedType* dtype)
+    {
+        switch(dtype->get_type()) {
+        case T_INT8: {
+            if(!remaining(sizeof(int8_t))) {
+                return false;
+            }
+            append_int(int8_t(read<uint8_t>()));
+            break;
+        }
+        case T_INT16: {
+            if(!remaining(sizeof(int16_t))) {
+                return false;
+            }
+            append_int(int16_t(read<uint16_t>()));
+            break;
+        }
+        case T_INT32: {
+            if(!remaining(sizeof(int32_t))) {
+                return false;
+            }
+            append_int(int32_t(read<uint32_t>()));
+            break;
+        }
+        case T_INT64: {
+            if(!remaining(sizeof(int64_t))) {
+                return false;
+            }
+            int64_t v = int64_t(read<uint64_t>());
+            bool safe = v >= -int64_t(MAX_SAFE_INTEGER) && v <= int64_t(MAX_SAFE_INTEGER);
+            if(!safe) {
+                out += '"';
+            }
+            append_int(v);
+            if(!safe) {
+                out += '"';
+            }
+            break;
+        }
+        case T_UINT8: {
+            if(!remaining(sizeof(uint8_t))) {
+                return false;
+            }
+            append_uint(read<uint8_t>());
+            break;
+        }
+        case T_UINT16: {
+            if(!remaining(sizeof(uint16_t))) {
+                return false;
+            }
+            append_uint(read<uint16_t>());
+            break;
+        }
+        case T_UINT32: {
+            if(!remaining(sizeof(uint32_t))) {
+                return false;
+            }
+            append_uint(read<uint32_t>());
+            break;
+        }
+        case T_UINT64: {
+            if(!remaining(sizeof(uint64_t))) {
+                return false;
+            }
+            uint64_t v = read<uint64_t>();
+            if(v > MAX_SAFE_INTEGER) {
+                out += '"';
+                append_uint(v);
+                out += '"';
+            } else {
+                append_uint(v);
+            }
+            break;
+        }
+        case T_FLOAT32: {
+            if(!remaining(sizeof(float))) {
+                return false;
+            }
+            uint32_t bits = read<uint32_t>();
+            float v;
+            memcpy(&v, &bits, sizeof(float));
+            append_float(v, true);
+            break;
+        }
+        case T_FLOAT64: {
+            if(!remaining(sizeof(double))) {
+                return false;
+            }
+            uint64_t bits = read<uint64_t>();
+            double v;
+            memcpy(&v, &bits, sizeof(double));
+            append_float(v, false);
+            break;
+        }
+        case T_CHAR: {
+            if(!remaining(sizeof(char))) {
+                return false;
+            }
+            append_string(in + offset, sizeof(char));
+            offset += sizeof(char);
+            break;
+        }
+        case T_STRING: {
+            sizetag_t length = dtype->get_size();
+            if(!remaining(length)) {
+                return false;
+            }
+            append_string(in + offset, length);
+            offset += length;
+            break;
+        }
+        case T_VARSTRING: {
+            if(!remaining(sizeof(sizetag_t))) {
+                return false;
+            }
+            sizetag_t length = read<sizetag_t>();
+            if(!remaining(length)) {
+                return false;
+            }
+            append_string(in + offset, length);
+            offset += length;
+            break;
+        }
+        case T_BLOB: {
+            if(dtype->has_alias() && dtype->get_alias() == "blob") {
+                sizetag_t length = dtype->get_size();
+                if(!remaining(length)) {
+                    return false;
+                }
+                append_hex(length);
+            } else if(!format_array(dtype, dtype->as_array()->get_array_size())) {
+                return false;
+            }
+            break;
+        }
+        case T_VARBLOB: {
+            if(dtype->has_alias() && dtype->get_alias() == "blob") {
+                if(!remaining(sizeof(sizetag_t))) {
+                    return false;
+                }
+                sizetag_t length = read<sizetag_t>();
+                if(!remaining(length)) {
+                    return false;
+                }
+                append_hex(length);
+            } else if(!format_var_array(dtype)) {
+                return false;
+            }
+            break;
+        }
+        case T_ARRAY: {
+            if(!format_array(dtype, dtype->as_array()->get_array_size())) {
+                return false;
+            }
+            break;
+        }
+        case T_VARARRAY: {
+            if(!format_var_array(dtype)) {
+                return false;
+            }
+            break;
+        }
+        case T_STRUCT: {
+            out += '[';
+            const Struct* strct = dtype->as_struct();
+            size_t num_fields = strct->get_num_fields();
+            for(unsigned int i = 0; i < num_fields; ++i) {
+                if(i > 0) {
+                    out += ',';
+                }
+                if(!format(strct->get_field(i)->get_type())) {
+                    return false;
+                }
+            }
+            out += ']';
+            break;
+        }
+        case T_METHOD: {
+            out += '[';
+            const Method* method = dtype->as_method();
+            size_t num_params = method->get_num_parameters();
+            for(unsigned int i = 0; i < num_params; ++i) {
+                if(i > 0) {
+                    out += ',';
+                }
+                if(!format(method->get_parameter(i)->get_type())) {
+                    return false;
+                }
+            }
+            out += ']';
+            break;
+        }
+        default: {
+            return false;
+        }
+        }
+        return true;
+    }
+
+    // append_hex appends the next <length> bytes as a string of hexadecimal digits.
+    void append_hex(size_t length)
+    {
+        size_t start = out.size();
+        out.resize(start + length * 2 + 2);
+        char* p = &out[start];
+        *p++ = '"';
+        for(size_t i = 0; i < length; ++i) {
+            uint8_t c = in[offset + i];
+            *p++ = HEX_DIGITS[c >> 4];
+            *p++ = HEX_DIGITS[c & 0xf];
+        }
+        *p = '"';
+        offset += length;
+    }
+
+    // format_array formats an array with <num_elements> elements.
+    bool format_array(const DistributedType* dtype, size_t num_elements)
+    {
+        out += '[';
+        const DistributedType* element = dtype->as_array()->get_element_type();
+        for(size_t i = 0; i < num_elements; ++i) {
+            if(i > 0) {
+                out += ',';
+            }
+            if(!format(element)) {
+                return false;
+            }
+        }
+        out += ']';
+        return true;
+    }
+
+    // format_var_array formats an array prefixed with its length in bytes.
+    bool format_var_array(const DistributedType* dtype)
+    {
+        if(!remaining(sizeof(sizetag_t))) {
+            return false;
+        }
+        sizetag_t length = read<sizetag_t>();
+        if(!remaining(length)) {
+            return false;
+        }
+        size_t array_end = offset + length;
+
+        out += '[';
+        const DistributedType* element = dtype->as_array()->get_element_type();
+        for(size_t start = offset; offset < array_end;) {
+            if(offset != start) {
+                out += ',';
+            }
+            // Don't let an element read past the end of the array, or take up no space.
+            size_t saved_end = end;
+            size_t element_start = offset;
+            end = array_end;
+            bool ok = format(element);
+            end = saved_end;
+            if(!ok || offset == element_start) {
+                return false;
+            }
+        }
+        out += ']';
+        return true;
+    }
+};
+
+bool format_json(const DistributedType *dtype, const uint8_t *packed, size_t length, string &out)
+{
+    JsonFormatter formatter(packed, length, out);
+    return formatter.format(dtype);
+}
+bool format_json(const Class *cls, bool owner, const uint8_t *packed, size_t length, string &out)
+{
+    JsonFormatter formatter(packed, length, out);
+    out += '{';
+    size_t num_fields = cls->get_num_client_required_fields(owner);
+    for(unsigned int i = 0; i < num_fields; ++i) {
+        const Field* field = cls->get_client_required_field(i, owner);
+        if(i > 0) {
+            out += ',';
+        }
+        formatter.append_string((const uint8_t*)field->get_name().data(), field->get_name().size());
+        out += ':';
+        if(!formatter.format(field->get_type())) {
+            return false;
+        }
+    }
+    out += '}';
+    return true;
+}
+
+// A JsonParser reads a JSON value by recursive descent, following the layout of the
+//     DistributedType it is read as, and packs each component into the output as it is read.
+template<typename Buffer>
+class JsonParser
+{
+  public:
+    JsonParser(const char *json, size_t length, Buffer &out) :
+        m_begin(json), m_cur(json), m_end(json + length), m_out(out), m_error_at(json)
+    {
+    }
+
+    // parse reads the whole of the text as a value of <dtype>.
+    bool parse(const DistributedType* dtype)
+    {
+        return parse_value(dtype) && parse_end();
+    }
+
+    // parse reads the whole of the text as an object of the required fields of <cls> sent to
+    //     a client, with those sent to its owner if <owner>.
+    bool parse(const Class* cls, bool owner)
+    {
+        return parse_object(cls, owner) && parse_end();
+    }
+
+    inline const string& get_error() const
+    {
+        return m_error;
+    }
+    inline size_t get_error_offset() const
+    {
+        return m_error_at - m_begin;
+    }
+
+  private:
+    bool parse_end()
+    {
+        skip_space();
+        if(m_cur != m_end) {
+            return fail("Unexpected text after the end of the value.");
+        }
+        return true;
+    }
+
+    bool parse_value(const DistributedType* dtype)
+    {
+        skip_space();
+        if(dtype == nullptr) {
+            return fail("Value has no type to be parsed as.");
+        }
+        if(m_cur == m_end) {
+            return fail("Expected a value.");
+        }
+
+        Type type = dtype->get_type();
+        switch(type) {
+        case T_CHAR: {
+            const char* start = m_cur;
+            size_t mark = m_out.size();
+            if(!parse_string()) {
+                return false;
+            }
+            if(m_out.size() - mark != 1) {
+                return fail_at(start, "Single character required.");
+            }
+            return true;
+        }
+        case T_STRING:
+        case T_VARSTRING:
+        case T_BLOB:
+        case T_VARBLOB:
+            if(*m_cur == '"') {
+                return parse_bytes(dtype);
+            }
+            return parse_array(dtype);
+        case T_ARRAY:
+        case T_VARARRAY:
+            return parse_array(dtype);
+        case T_STRUCT: {
+            const Struct* dstruct = dtype->as_struct();
+            size_t num_fields = dstruct->get_num_fields();
+            if(!expect('[')) {
+                return fail("Expected an array of " + to_string(num_fields) + " values for struct.");
+            }
+            for(unsigned int i = 0; i < num_fields; ++i) {
+                if(i > 0 && !expect(',')) {
+                    return fail("Too few values in struct value, expected " + to_string(num_fields) + ".");
+                }
+                if(!parse_value(dstruct->get_field(i)->get_type())) {
+                    return false;
+                }
+            }
+            if(!expect(']')) {
+                return fail("Too many values in struct value, expected " + to_string(num_fields) + ".");
+            }
+            return true;
+        }
+        case T_METHOD: {
+            const Method* method = dtype->as_method();
+            size_t num_params = method->get_num_parameters();
+            if(!expect('[')) {
+                return fail("Expected an array of " + to_string(num_params) + " values for method.");
+            }
+            for(unsigned int i = 0; i < num_params; ++i) {
+                if(i > 0 && !expect(',')) {
+                    return fail("Too few values in method value, expected " + to_string(num_params) + ".");
+                }
+                if(!parse_value(method->get_parameter(i)->get_type())) {
+                    return false;
+                }
+            }
+            if(!expect(']')) {
+                return fail("Too many values in method value, expected " + to_string(num_params) + ".");
+            }
+            return true;
+        }
+        default:
+            if(numeric_width(type) > 0) {
+                return parse_number(dtype);
+            }
+            return fail("Cannot parse a value for type '" + format_type(type) + "'.");
+        }
+    }
+
+    bool parse_object(const Class* cls, bool owner)
+    {
+        skip_space();
+        if(!expect('{')) {
+            return fail("Expected an object with the required fields of '" + cls->get_name() + "'.");
+        }
+
+        // Each value is packed at the end of the output, then moved in front of the values of
+        //     any later fields that came before it.  Objects written by format_json() are in order.
+        size_t num_fields = cls->get_num_client_required_fields(owner);
+        size_t start = m_out.size();
+        m_lengths.assign(num_fields, 0);
+        m_seen.assign(num_fields, false);
+        size_t num_seen = 0;
+
+        skip_space();
+        if(m_cur != m_end && *m_cur == '}') {
+            ++m_cur;
+        } else {
+            for(;;) {
+                skip_space();
+                const char* key_at = m_cur;
+                size_t key_mark = m_out.size();
+                if(m_cur == m_end || *m_cur != '"' || !parse_string()) {
+                    return m_error.empty() ? fail("Expected a field name.") : false;
+                }
+                size_t key_length = m_out.size() - key_mark;
+
+                unsigned int n = 0;
+                for(; n < num_fields; ++n) {
+                    const string& name = cls->get_client_required_field(n, owner)->get_name();
+                    if(name.size() == key_length
+                       && memcmp(name.data(), (const void*)(m_out.data() + key_mark), key_length) == 0) {
+                        break;
+                    }
+                }
+                m_out.resize(key_mark);
+                if(n == num_fields) {
+                    return fail_at(key_at, "'" + cls->get_name() + "' has no required field with this name.");
+                } else if(m_seen[n]) {
+                    return fail_at(key_at, "Field '" + cls->get_client_required_field(n, owner)->get_name()
+                                   + "' is given more than once.");
+                }
+                if(!expect(':')) {
+                    return fail("Expected ':' after the field name.");
+                }
+
+                size_t mark = m_out.size();
+                if(!parse_value(cls->get_client_required_field(n, owner)->get_type())) {
+                    return false;
+                }
+                m_lengths[n] = m_out.size() - mark;
+                m_seen[n] = true;
+                ++num_seen;
+
+                size_t position = start;
+                for(unsigned int i = 0; i < n; ++i) {
+                    position += m_lengths[i];
+                }
+                if(position != mark) {
+                    rotate(m_out.begin() + position, m_out.begin() + mark, m_out.end());
+                }
+
+                skip_space();
+                if(m_cur != m_end && *m_cur == ',') {
+                    ++m_cur;
+                } else if(m_cur != m_end && *m_cur == '}') {
+                    ++m_cur;
+                    break;
+                } else {
+                    return fail("Expected ',' or '}' in object.");
+                }
+            }
+        }
+
+        if(num_seen < num_fields) {
+            for(unsigned int n = 0; n < num_fields; ++n) {
+                if(!m_seen[n]) {
+                    return fail("Missing a value for required field '"
+                                + cls->get_client_required_field(n, owner)->get_name() + "'.");
+                }
+            }
+        }
+        return true;
+    }
+
+    bool parse_number(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        Type type = dtype->get_type();
+        bool is_float = (type == T_FLOAT32 || type == T_FLOAT64);
+
+        // 64-bit integers can be given as strings, and floats as null.
+        bool quoted = false;
+        if(*m_cur == '"' && !is_float) {
+            quoted = true;
+            ++m_cur;
+        } else if(is_float && m_end - m_cur >= 4 && memcmp(m_cur, "null", 4) == 0) {
+            m_cur += 4;
+            return pack_float(type, numeric_limits<double>::quiet_NaN(), start);
+        }
+
+        bool negative = false;
+        if(m_cur != m_end && *m_cur == '-') {
+            negative = true;
+            ++m_cur;
+        }
+        const char* digits = m_cur;
+        while(m_cur != m_end && *m_cur >= '0' && *m_cur <= '9') {
+            ++m_cur;
+        }
+        if(m_cur == digits) {
+            return fail_at(start, "Expected a number.");
+        }
+        bool whole = true;
+        if(m_cur != m_end && *m_cur == '.') {
+            whole = false;
+            ++m_cur;
+            const char* fraction = m_cur;
+            while(m_cur != m_end && *m_cur >= '0' && *m_cur <= '9') {
+                ++m_cur;
+            }
+            if(m_cur == fraction) {
+                return fail_at(start, "Expected digits after the decimal point.");
+            }
+        }
+        if(m_cur != m_end && (*m_cur == 'e' || *m_cur == 'E')) {
+            whole = false;
+            ++m_cur;
+            if(m_cur != m_end && (*m_cur == '+' || *m_cur == '-')) {
+                ++m_cur;
+            }
+            const char* exponent = m_cur;
+            while(m_cur != m_end && *m_cur >= '0' && *m_cur <= '9') {
+                ++m_cur;
+            }
+            if(m_cur == exponent) {
+                return fail_at(start, "Expected digits in the exponent.");
+            }
+        }
+        const char* number_end = m_cur;
+        if(quoted) {
+            if(m_cur == m_end || *m_cur != '"') {
+                return fail_at(start, "Expected a number in the string.");
+            }
+            ++m_cur;
+        }
+
+        if(whole) {
+            uint64_t number = 0;
+            for(const char* p = digits; p != number_end; ++p) {
+                uint64_t digit = *p - '0';
+                if(number > (numeric_limits<uint64_t>::max() - digit) / 10) {
+                    return fail_at(start, "Number out of range.");
+                }
+                number = number * 10 + digit;
+            }
+            if(is_float) {
+                return pack_float(type, negative ? -double(number) : double(number), start);
+            }
+            return pack_integer(type, negative, number, start);
+        }
+
+        // strtod needs a terminated string, and the text we're given might not be one.
+        double number;
+        const char* text_begin = negative ? digits - 1 : digits;
+        size_t length = number_end - text_begin;
+        if(length < 64) {
+            char text[64];
+            memcpy(text, text_begin, length);
+            text[length] = '\0';
+            number = strtod(text, nullptr);
+        } else {
+            number = strtod(string(text_begin, length).c_str(), nullptr);
+        }
+        if(is_float) {
+            return pack_float(type, number, start);
+        }
+
+        // An integer written with an exponent, as JavaScript does for large numbers.
+        double magnitude = negative ? -number : number;
+        if(magnitude != floor(magnitude)) {
+            return fail_at(start, "Cannot use a fractional value for integer type '"
+                           + format_type(type) + "'.");
+        } else if(!(magnitude < 18446744073709551616.0)) {
+            return fail_at(start, "Number out of range.");
+        }
+        return pack_integer(type, negative, uint64_t(magnitude), start);
+    }
+
+    bool pack_integer(Type type, bool negative, uint64_t number, const char* start)
+    {
+        size_t width = numeric_width(type);
+        bool is_signed = (type == T_INT8 || type == T_INT16 || type == T_INT32 || type == T_INT64);
+        if(negative && number != 0) {
+            if(!is_signed) {
+                return fail_at(start, "Can't use negative value for unsigned integer datatype.");
+            }
+            if(number > (uint64_t(1) << (width * 8 - 1))) {
+                return fail_at(start, "Signed integer out of range for type '" + format_type(type) + "'.");
+            }
+            write_le(uint64_t(0) - number, width);
+            return true;
+        }
+
+        uint64_t max = (width == 8) ? numeric_limits<uint64_t>::max() : (uint64_t(1) << (width * 8)) - 1;
+        if(is_signed) {
+            max >>= 1;
+        }
+        if(number > max) {
+            return fail_at(start, string(is_signed ? "Signed" : "Unsigned")
+                           + " integer out of range for type '" + format_type(type) + "'.");
+        }
+        write_le(number, width);
+        return true;
+    }
+
+    bool pack_float(Type type, double number, const char* start)
+    {
+        if(type == T_FLOAT32) {
+            float v = float(number);
+            if(isfinite(number) && !isfinite(v)) {
+                return fail_at(start, "Value is out of range for type 'float32'.");
+            }
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            write_le(bits, sizeof(bits));
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            write_le(bits, sizeof(bits));
+        }
+        return true;
+    }
+
+    // parse_bytes reads a string as the value of a string or blob type.
+    bool parse_bytes(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        Type type = dtype->get_type();
+        bool hex = (type == T_BLOB || type == T_VARBLOB) && dtype->has_alias()
+                   && dtype->get_alias() == "blob";
+        bool has_tag = (type == T_VARSTRING || type == T_VARBLOB);
+
+        size_t tag = has_tag ? begin_length_tag() : 0;
+        size_t mark = m_out.size();
+        if(!(hex ? parse_hex() : parse_string())) {
+            return false;
+        }
+        size_t length = m_out.size() - mark;
+
+        const ArrayType* array = dtype->as_array();
+        if(!has_tag) {
+            if(length != dtype->get_size()) {
+                return fail_at(start, "Value for fixed-length " + string(hex ? "blob" : "string")
+                               + " has incorrect length.");
+            }
+            return true;
+        } else if(array->has_range() && (length < array->get_range().min.uinteger
+                                         || length > array->get_range().max.uinteger)) {
+            return fail_at(start, "Length of value is outside of the range of its type.");
+        }
+        return end_length_tag(tag, start);
+    }
+
+    // parse_string reads a JSON string, with <m_cur> at the opening quote, and adds its
+    //     characters to the output in UTF-8.  A \u escape below \u0100 is added as a single
+    //     byte, which is how format_json() escapes bytes that aren't part of UTF-8 text.
+    bool parse_string()
+    {
+        const char* start = m_cur;
+        if(m_cur == m_end || *m_cur != '"') {
+            return fail("Expected a string.");
+        }
+        ++m_cur;
+        const char* run = m_cur; // characters not yet added to the output
+        for(;;) {
+            if(m_cur == m_end) {
+                return fail_at(start, "This quotation mark is unterminated.");
+            }
+
+            char c = *m_cur;
+            if(c == '"') {
+                append_bytes(m_out, run, m_cur - run);
+                ++m_cur;
+                return true;
+            } else if(c != '\\') {
+                ++m_cur;
+                continue;
+            }
+
+            append_bytes(m_out, run, m_cur - run);
+            ++m_cur;
+            if(m_cur == m_end) {
+                return fail_at(start, "This quotation mark is unterminated.");
+            }
+            if(!parse_escape()) {
+                return false;
+            }
+            run = m_cur;
+        }
+    }
+
+    // parse_escape reads the escape sequence after a backslash.
+    bool parse_escape()
+    {
+        char c = *m_cur++;
+        switch(c) {
+        case '"':
+        case '\\':
+        case '/':
+            m_out.push_back(typename Buffer::value_type(c));
+            return true;
+        case 'b':
+            m_out.push_back('\b');
+            return true;
+        case 'f':
+            m_out.push_back('\f');
+            return true;
+        case 'n':
+            m_out.push_back('\n');
+            return true;
+        case 'r':
+            m_out.push_back('\r');
+            return true;
+        case 't':
+            m_out.push_back('\t');
+            return true;
+        case 'u':
+            break;
+        default:
+            return fail_at(m_cur - 2, "Invalid escape sequence.");
+        }
+
+        uint32_t code;
+        if(!parse_code_unit(code)) {
+            return false;
+        }
+        if(code >= 0xd800 && code <= 0xdbff) {
+            uint32_t low;
+            if(m_end - m_cur < 2 || m_cur[0] != '\\' || m_cur[1] != 'u') {
+                return fail("Expected the second half of a surrogate pair.");
+            }
+            m_cur += 2;
+            if(!parse_code_unit(low)) {
+                return false;
+            }
+            if(low < 0xdc00 || low > 0xdfff) {
+                return fail("Expected the second half of a surrogate pair.");
+            }
+            code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        } else if(code >= 0xdc00 && code <= 0xdfff) {
+            return fail("Unexpected second half of a surrogate pair.");
+        }
+
+        char bytes[4];
+        size_t length;
+        if(code < 0x100) {
+            bytes[0] = char(code);
+            length = 1;
+        } else if(code < 0x800) {
+            bytes[0] = char(0xc0 | (code >> 6));
+            bytes[1] = char(0x80 | (code & 0x3f));
+            length = 2;
+        } else if(code < 0x10000) {
+            bytes[0] = char(0xe0 | (code >> 12));
+            bytes[1] = char(0x80 | ((code >> 6) & 0x3f));
+            bytes[2] = char(0x80 | (code & 0x3f));
+            length = 3;
+        } else {
+            bytes[0] = char(0xf0 | (code >> 18));
+            bytes[1] = char(0x80 | ((code >> 12) & 0x3f));
+            bytes[2] = char(0x80 | ((code >> 6) & 0x3f));
+            bytes[3] = char(0x80 | (code & 0x3f));
+            length = 4;
+        }
+        append_bytes(m_out, bytes, length);
+        return true;
+    }
+
+    // parse_code_unit reads the four hexadecimal digits of a \u escape.
+    bool parse_code_unit(uint32_t &code)
+    {
+        code = 0;
+        for(int i = 0; i < 4; ++i) {
+            int digit = (m_cur != m_end) ? hex_digit(*m_cur) : -1;
+            if(digit < 0) {
+                return fail("Expected four hexadecimal digits after '\\u'.");
+            }
+            code = code * 16 + digit;
+            ++m_cur;
+        }
+        return true;
+    }
+
+    // parse_hex reads a string of hexadecimal digits, and adds the bytes to the output.
+    bool parse_hex()
+    {
+        const char* start = m_cur;
+        ++m_cur; // '"'
+        for(;;) {
+            if(m_cur == m_end) {
+                return fail_at(start, "This quotation mark is unterminated.");
+            } else if(*m_cur == '"') {
+                break;
+            }
+            int high = hex_digit(*m_cur);
+            if(high < 0) {
+                return fail("Invalid hex digit.");
+            }
+            ++m_cur;
+            if(m_cur == m_end || *m_cur == '"') {
+                return fail_at(start, "Odd number of hex digits.");
+            }
+            int low = hex_digit(*m_cur);
+            if(low < 0) {
+                return fail("Invalid hex digit.");
+            }
+            ++m_cur;
+            m_out.push_back(typename Buffer::value_type((high << 4) | low));
+        }
+        ++m_cur; // '"'
+        return true;
+    }
+
+    bool parse_array(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        const ArrayType* array = dtype->as_array();
+        if(!expect('[')) {
+            return fail("Expected an array for type '" + format_type(dtype->get_type()) + "'.");
+        }
+
+        // A variable-sized array is prefixed with its length in bytes, as is an array of a fixed
+        // number of variable-sized elements.
+        bool has_tag = !array->has_fixed_size();
+        size_t tag = has_tag ? begin_length_tag() : 0;
+
+        const DistributedType* element = array->get_element_type();
+        uint64_t num_elements = 0;
+        skip_space();
+        if(m_cur != m_end && *m_cur == ']') {
+            ++m_cur;
+        } else {
+            for(;;) {
+                if(!parse_value(element)) {
+                    return false;
+                }
+                ++num_elements;
+
+                skip_space();
+                if(m_cur != m_end && *m_cur == ',') {
+                    ++m_cur;
+                } else if(m_cur != m_end && *m_cur == ']') {
+                    ++m_cur;
+                    break;
+                } else {
+                    return fail("Expected ',' or ']' in array.");
+                }
+            }
+        }
+
+        if(array->get_array_size() > 0) {
+            if(num_elements != array->get_array_size()) {
+                return fail_at(start, "Fixed-sized array of size " + to_string(array->get_array_size())
+                               + " can't have " + to_string(num_elements) + " elements.");
+            }
+        } else if(array->has_range() && (num_elements < array->get_range().min.uinteger
+                                         || num_elements > array->get_range().max.uinteger)) {
+            return fail_at(start, "Number of elements in array is outside of the range of its type.");
+        }
+        return !has_tag || end_length_tag(tag, start);
+    }
+
+    // skip_space skips JSON whitespace.
+    void skip_space()
+    {
+        while(m_cur != m_end && (*m_cur == ' ' || *m_cur == '\t' || *m_cur == '\r' || *m_cur == '\n')) {
+            ++m_cur;
+        }
+    }
+
+    // expect skips past the next character if it is <c>, returning false if it isn't.
+    bool expect(char c)
+    {
+        skip_space();
+        if(m_cur == m_end || *m_cur != c) {
+            return false;
+        }
+        ++m_cur;
+        return true;
+    }
+
+    void write_le(uint64_t value, size_t width)
+    {
+        char bytes[sizeof(uint64_t)] = {};
+        assert(width <= sizeof(bytes));
+        width = min(width, sizeof(bytes));
+        for(size_t i = 0; i < width; ++i) {
+            bytes[i] = char(value >> (i * 8));
+        }
+        append_bytes(m_out, bytes, width);
+    }
+
+    // begin_length_tag reserves space for a length tag, returning where it starts.
+    size_t begin_length_tag()
+    {
+        size_t tag = m_out.size();
+        write_le(0, sizeof(sizetag_t));
+        return tag;
+    }
+
+    // end_length_tag fills in the tag at <tag> with the length of everything packed after it.
+    bool end_length_tag(size_t tag, const char* start)
+    {
+        uint64_t length = m_out.size() - tag - sizeof(sizetag_t);
+        if(length > numeric_limits<sizetag_t>::max()) {
+            return fail_at(start, "Value is too long for its length tag.");
+        }
+        for(size_t i = 0; i < sizeof(sizetag_t); ++i) {
+            m_out[tag + i] = typename Buffer::value_type(length >> (i * 8));
+        }
+        return true;
+    }
+
+    inline bool fail(const string &error)
+    {
+        return fail_at(m_cur, error);
+    }
+    inline bool fail_at(const char* at, const string &error)
+    {
+        m_error = error;
+        m_error_at = at;
+        return false;
+    }
+
+    const char* m_begin;
+    const char* m_cur;
+    const char* m_end;
+    Buffer &m_out;
+
+    // The required fields given so far while parsing an object, and the length of their values.
+    vector<size_t> m_lengths;
+    vector<bool> m_seen;
+
+    string m_error;
+    const char* m_error_at;
+};
+
+template<typename Buffer, typename... Input>
+static bool parse_json_into(const char *json, size_t length, Buffer &out, string &err, size_t &offset,
+                            Input... input)
+{
+    JsonParser<Buffer> parser(json, length, out);
+    if(!parser.parse(input...)) {
+        err = parser.get_error();
+        offset = parser.get_error_offset();
+        return false;
+    }
+    return true;
+}
+
+bool parse_json(const DistributedType* dtype, const char *json, size_t length,
+                string &out, string &err, size_t &offset)
+{
+    return parse_json_into(json, length, out, err, offset, dtype);
+}
+bool parse_json(const DistributedType* dtype, const char *json, size_t length,
+                vector<uint8_t> &out, string &err, size_t &offset)
+{
+    return parse_json_into(json, length, out, err, offset, dtype);
+}
+bool parse_json(const Class* cls, bool owner, const char *json, size_t length,
+                string &out, string &err, size_t &offset)
+{
+    return parse_json_into(json, length, out, err, offset, cls, owner);
+}
+bool parse_json(const Class* cls, bool owner, const char *json, size_t length,
+                vector<uint8_t> &out, string &err, size_t &offset)
+{
+    return parse_json_into(json, length, out, err, offset, cls, owner);
+}
+
+
+} // close namespace dclass
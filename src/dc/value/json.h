@@ -0,0 +1,51 @@
+// Filename: json.h
+#pragma once
+#include <stdint.h> // uint8_t
+#include <stddef.h> // size_t
+#include <string> // std::string
+#include <vector> // std::vector
+namespace dclass   // open namespace dclass
+{
+
+
+// Forward declarations
+class DistributedType;
+class Class;
+
+// Values are written as JSON following the layout of their DistributedType:
+//     integers and floats are numbers, except 64-bit integers beyond 2^53 which are decimal
+//     strings so that JavaScript doesn't round them, and NaN or infinite floats which are null;
+//     chars and character arrays are strings, in UTF-8 with any other bytes as \u00XX escapes;
+//     blobs are strings of hexadecimal digits (without a length tag) if they have the "blob"
+//     alias, and arrays of numbers otherwise; arrays are arrays; and structs and methods are
+//     arrays of their fields or parameters, in order.
+
+// format_json appends the JSON for the value of the <length> bytes at <packed> to <out>,
+//     which can be cleared and reused between calls so that formatting doesn't have to allocate.
+//     Returns false if the packed data is shorter than the value's type requires.
+bool format_json(const DistributedType*, const uint8_t *packed, size_t length, std::string &out);
+// format_json appends a JSON object with the value of every required field of <cls> sent to a
+//     client (see Class::get_client_required_field), by field name, from the values packed back
+//     to back as in CLIENT_ENTER_OBJECT_REQUIRED, or CLIENT_ENTER_OBJECT_REQUIRED_OWNER if <owner>.
+bool format_json(const Class*, bool owner, const uint8_t *packed, size_t length, std::string &out);
+
+// parse_json reads the JSON value in the <length> characters at <json> and appends it in
+//     packed form to <out>.  Accepts what format_json writes, and also numbers for 64-bit
+//     integers, arrays for strings and blobs, and numbers with an exponent for integers if
+//     they are whole.  On error, false is returned with the reason in <err> and the position in
+//     <json> at which the error was found in <offset>; <out> is then left with a partially
+//     packed value, which should be discarded.
+bool parse_json(const DistributedType*, const char *json, size_t length,
+                std::string &out, std::string &err, size_t &offset);
+bool parse_json(const DistributedType*, const char *json, size_t length,
+                std::vector<uint8_t> &out, std::string &err, size_t &offset);
+// parse_json reads a JSON object with a value for every required field of <cls> sent to a
+//     client (or to its owner, if <owner>), in any order, and appends the values packed back to
+//     back in the order of those fields.
+bool parse_json(const Class*, bool owner, const char *json, size_t length,
+                std::string &out, std::string &err, size_t &offset);
+bool parse_json(const Class*, bool owner, const char *json, size_t length,
+                std::vector<uint8_t> &out, std::string &err, size_t &offset);
+
+
+} // close namespace dclass
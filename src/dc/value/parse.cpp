@@ -1,7 +1,17 @@
 // Filename: parse.cpp
-#include <sstream>  // std::istringstream
+#include <assert.h> // assert()
+#include <stdlib.h> // strtod()
+#include <string.h> // memcpy(), memchr()
+#include <limits>   // std::numeric_limits
+#include <iterator> // std::istreambuf_iterator
+#include <algorithm> // std::min
 #include "dc/DistributedType.h"
-#include "file/parserDefs.h"
+#include "dc/ArrayType.h"
+#include "dc/Struct.h"
+#include "dc/Field.h"
+#include "dc/Method.h"
+#include "dc/Parameter.h"
+#include "file/write.h" // format_type(Type);
 
 #include "parse.h"
 using namespace std;
@@ -9,34 +19,724 @@ namespace dclass   // open namespace dclass
 {
 
 
+// append_bytes adds <length> bytes to the end of a packed value.
+static inline void append_bytes(string &out, const char *data, size_t length)
+{
+    out.append(data, length);
+}
+static inline void append_bytes(vector<uint8_t> &out, const char *data, size_t length)
+{
+    out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + length);
+}
+
+// numeric_width returns the packed size in bytes of a numeric type, or 0 for any other type.
+static inline size_t numeric_width(Type type)
+{
+    switch(type) {
+    case T_INT8:
+    case T_UINT8:
+    case T_CHAR:
+        return 1;
+    case T_INT16:
+    case T_UINT16:
+        return 2;
+    case T_INT32:
+    case T_UINT32:
+    case T_FLOAT32:
+        return 4;
+    case T_INT64:
+    case T_UINT64:
+    case T_FLOAT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static inline int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// A ValueParser reads a .dc-formatted value by recursive descent, following the layout of the
+//     DistributedType it is read as, and packs each component into the output as it is read.
+//     It accepts the same values as the file parser, and reports the first error it finds.
+template<typename Buffer>
+class ValueParser
+{
+  public:
+    ValueParser(const char *formatted, size_t length, Buffer &out) :
+        m_begin(formatted), m_cur(formatted), m_end(formatted + length), m_out(out),
+        m_error_at(formatted)
+    {
+    }
+
+    // parse reads the whole of the text as a value of <dtype>.  Empty text is an empty value.
+    bool parse(const DistributedType* dtype)
+    {
+        skip_space();
+        if(m_cur == m_end) {
+            return true;
+        }
+        if(!parse_value(dtype)) {
+            return false;
+        }
+        skip_space();
+        if(m_cur != m_end) {
+            return fail("Unexpected text after the end of the value.");
+        }
+        return true;
+    }
+
+    inline const string& get_error() const
+    {
+        return m_error;
+    }
+    inline size_t get_error_offset() const
+    {
+        return m_error_at - m_begin;
+    }
+
+  private:
+    bool parse_value(const DistributedType* dtype)
+    {
+        skip_space();
+        if(dtype == nullptr) {
+            return fail("Value has no type to be parsed as.");
+        }
+        if(m_cur == m_end) {
+            return fail("Expected a value.");
+        }
+
+        switch(*m_cur) {
+        case '"':
+            return parse_string(dtype);
+        case '\'':
+            return parse_char(dtype);
+        case '<':
+            return parse_hex(dtype);
+        case '[':
+            return parse_array(dtype);
+        case '{':
+            return parse_struct(dtype);
+        case '(':
+            return parse_method(dtype);
+        default:
+            return parse_number(dtype);
+        }
+    }
+
+    bool parse_number(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        bool negative = false;
+        if(*m_cur == '-' || *m_cur == '+') {
+            negative = (*m_cur == '-');
+            ++m_cur;
+            skip_space();
+        }
+
+        if(m_end - m_cur > 1 && m_cur[0] == '0' && m_cur[1] == 'x') {
+            m_cur += 2;
+            uint64_t number = 0;
+            int digit;
+            while(m_cur != m_end && (digit = hex_digit(*m_cur)) >= 0) {
+                if(number >> 60) {
+                    return fail_at(start, "Number out of range.");
+                }
+                number = number * 16 + digit;
+                ++m_cur;
+            }
+            return pack_integer(dtype, negative, number, start);
+        }
+
+        const char* digits = m_cur;
+        while(m_cur != m_end && *m_cur >= '0' && *m_cur <= '9') {
+            ++m_cur;
+        }
+        if(m_cur != m_end && *m_cur == '.') {
+            return parse_real(dtype, start, digits);
+        }
+        if(m_cur == digits) {
+            return fail_at(start, "Expected a value.");
+        }
+        if(m_cur != m_end && (*m_cur == 'e' || *m_cur == 'E')) {
+            // format_value() writes large and small floats as %g does, such as "1e+300".
+            return parse_real(dtype, start, digits);
+        }
+
+        uint64_t number = 0;
+        for(const char* p = digits; p != m_cur; ++p) {
+            uint64_t digit = *p - '0';
+            if(number > (numeric_limits<uint64_t>::max() - digit) / 10) {
+                return fail_at(start, "Number out of range.");
+            }
+            number = number * 10 + digit;
+        }
+        return pack_integer(dtype, negative, number, start);
+    }
+
+    // parse_real reads a floating-point number, with <m_cur> at the decimal point or exponent.
+    bool parse_real(const DistributedType* dtype, const char* start, const char* digits)
+    {
+        bool whole = m_cur != digits;
+        if(*m_cur == '.') {
+            ++m_cur;
+            const char* fraction = m_cur;
+            while(m_cur != m_end && *m_cur >= '0' && *m_cur <= '9') {
+                ++m_cur;
+            }
+            if(!whole && m_cur == fraction) {
+                return fail_at(start, "Expected a value.");
+            }
+        }
+        if(m_cur != m_end && (*m_cur == 'e' || *m_cur == 'E')) {
+            const char* exponent = m_cur + 1;
+            if(exponent != m_end && (*exponent == '+' || *exponent == '-')) {
+                ++exponent;
+            }
+            if(exponent != m_end && *exponent >= '0' && *exponent <= '9') {
+                m_cur = exponent;
+                while(m_cur != m_end && *m_cur >= '0' && *m_cur <= '9') {
+                    ++m_cur;
+                }
+            }
+        }
+
+        // strtod needs a terminated string, and the text we're given might not be one.
+        double number;
+        size_t length = m_cur - digits;
+        if(length < 64) {
+            char text[64];
+            memcpy(text, digits, length);
+            text[length] = '\0';
+            number = strtod(text, nullptr);
+        } else {
+            number = strtod(string(digits, length).c_str(), nullptr);
+        }
+        if(*start == '-') {
+            number = -number;
+        }
+        return pack_float(dtype, number, start);
+    }
+
+    bool pack_integer(const DistributedType* dtype, bool negative, uint64_t number, const char* start)
+    {
+        Type type = dtype->get_type();
+        if(type == T_FLOAT32 || type == T_FLOAT64) {
+            return pack_float(dtype, negative ? -double(number) : double(number), start);
+        }
+
+        size_t width = numeric_width(type);
+        if(width == 0) {
+            return fail_at(start, "Cannot use integer value for non-numeric type '"
+                           + format_type(type) + "'.");
+        }
+
+        bool is_signed = (type == T_INT8 || type == T_INT16 || type == T_INT32 || type == T_INT64);
+        if(negative && number != 0) {
+            if(!is_signed) {
+                return fail_at(start, "Can't use negative value for unsigned integer datatype.");
+            }
+            if(number > (uint64_t(1) << (width * 8 - 1))) {
+                return fail_at(start, "Signed integer out of range for type '" + format_type(type) + "'.");
+            }
+            write_le(uint64_t(0) - number, width);
+            return true;
+        }
+
+        uint64_t max = (width == 8) ? numeric_limits<uint64_t>::max() : (uint64_t(1) << (width * 8)) - 1;
+        if(is_signed) {
+            max >>= 1;
+        }
+        if(number > max) {
+            return fail_at(start, string(is_signed ? "Signed" : "Unsigned")
+                           + " integer out of range for type '" + format_type(type) + "'.");
+        }
+        write_le(number, width);
+        return true;
+    }
+
+    bool pack_float(const DistributedType* dtype, double number, const char* start)
+    {
+        switch(dtype->get_type()) {
+        case T_FLOAT32: {
+            float v = float(number);
+            if(v == numeric_limits<float>::infinity() || v == -numeric_limits<float>::infinity()) {
+                return fail_at(start, "Value is out of range for type 'float32'.");
+            }
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            write_le(bits, sizeof(bits));
+            return true;
+        }
+        case T_FLOAT64: {
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            write_le(bits, sizeof(bits));
+            return true;
+        }
+        default:
+            if(numeric_width(dtype->get_type()) > 0) {
+                return fail_at(start, "Cannot use floating-point value for integer datatype.");
+            }
+            return fail_at(start, "Cannot use floating-point value for non-numeric type '"
+                           + format_type(dtype->get_type()) + "'.");
+        }
+    }
+
+    bool parse_string(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        Type type = dtype->get_type();
+        if(type == T_VARSTRING || type == T_VARBLOB) {
+            size_t tag = begin_length_tag();
+            return scan_quoted('"') && end_length_tag(tag, start);
+        } else if(type == T_STRING || type == T_BLOB) {
+            size_t mark = m_out.size();
+            if(!scan_quoted('"')) {
+                return false;
+            }
+            if(m_out.size() - mark != dtype->get_size()) {
+                return fail_at(start, "Value for fixed-length string has incorrect length.");
+            }
+            return true;
+        }
+        return fail("Cannot use string value for non-string type '" + format_type(type) + "'.");
+    }
+
+    bool parse_char(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        if(dtype->get_type() != T_CHAR) {
+            return fail("Cannot use char value for non-char type '" + format_type(dtype->get_type()) + "'.");
+        }
+        size_t mark = m_out.size();
+        if(!scan_quoted('\'')) {
+            return false;
+        }
+        if(m_out.size() - mark != 1) {
+            return fail_at(start, "Single character required.");
+        }
+        return true;
+    }
+
+    bool parse_hex(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        Type type = dtype->get_type();
+        if(type != T_BLOB && type != T_VARBLOB) {
+            return fail("Cannot use hex value for non-blob type '" + format_type(type) + "'.");
+        }
+
+        size_t mark = m_out.size();
+        ++m_cur; // '<'
+        for(;;) {
+            if(m_cur == m_end) {
+                return fail_at(start, "This hex string is unterminated.");
+            } else if(*m_cur == '>') {
+                break;
+            }
+            int high = hex_digit(*m_cur);
+            if(high < 0) {
+                return fail("Invalid hex digit.");
+            }
+            ++m_cur;
+            if(m_cur == m_end || *m_cur == '>') {
+                return fail_at(start, "Odd number of hex digits.");
+            }
+            int low = hex_digit(*m_cur);
+            if(low < 0) {
+                return fail("Invalid hex digit.");
+            }
+            ++m_cur;
+            m_out.push_back(typename Buffer::value_type((high << 4) | low));
+        }
+        ++m_cur; // '>'
+
+        // The hex value of a var blob includes its length tag, as written by format_value.
+        size_t length = m_out.size() - mark;
+        if(type == T_VARBLOB) {
+            uint64_t tagged = 0;
+            for(size_t i = 0; i < sizeof(sizetag_t) && i < length; ++i) {
+                tagged |= uint64_t(uint8_t(m_out[mark + i])) << (i * 8);
+            }
+            if(length < sizeof(sizetag_t) || tagged != length - sizeof(sizetag_t)) {
+                return fail_at(start, "Length tag of hex value for var blob doesn't match its length.");
+            }
+        } else if(length != dtype->get_size()) {
+            return fail_at(start, "Value for fixed-length blob has incorrect length.");
+        }
+        return true;
+    }
+
+    bool parse_array(const DistributedType* dtype)
+    {
+        const char* start = m_cur;
+        const ArrayType* array = dtype->as_array();
+        if(array == nullptr) {
+            return fail("Cannot use array-composition for non-array type '"
+                        + format_type(dtype->get_type()) + "'.");
+        }
+        ++m_cur; // '['
+
+        // A variable-sized array is prefixed with its length in bytes, as is an array of a fixed
+        //     number of variable-sized elements.
+        bool has_tag = !array->has_fixed_size();
+        size_t tag = has_tag ? begin_length_tag() : 0;
+
+        uint64_t max_size = numeric_limits<uint64_t>::max();
+        if(array->has_range()) {
+            max_size = array->get_range().max.uinteger;
+        }
+
+        const DistributedType* element = array->get_element_type();
+        uint64_t num_elements = 0;
+        skip_space();
+        if(m_cur != m_end && *m_cur == ']') {
+            ++m_cur;
+        } else {
+            for(;;) {
+                size_t mark = m_out.size();
+                if(!parse_value(element)) {
+                    return false;
+                }
+
+                skip_space();
+                uint64_t count = 1;
+                if(m_cur != m_end && *m_cur == '*') {
+                    ++m_cur;
+                    skip_space();
+                    if(!parse_repeat(count)) {
+                        return false;
+                    }
+                }
+                if(count > max_size - num_elements) {
+                    return fail_at(start, "Too many elements in array value, maximum "
+                                   + to_string(max_size) + ".");
+                }
+                repeat_element(mark, count);
+                num_elements += count;
+
+                skip_space();
+                if(m_cur != m_end && *m_cur == ',') {
+                    ++m_cur;
+                } else if(m_cur != m_end && *m_cur == ']') {
+                    ++m_cur;
+                    break;
+                } else {
+                    return fail("Expected ',' or ']' in array value.");
+                }
+            }
+        }
+
+        if(num_elements == 0 && array->get_array_size() > 0) {
+            return fail_at(start, "Fixed-sized array of size " + to_string(array->get_array_size())
+                           + " can't have 0 elements.");
+        } else if(array->has_range() && num_elements < array->get_range().min.uinteger) {
+            return fail_at(start, "Too few elements in array value, minimum "
+                           + to_string(array->get_range().min.uinteger) + ".");
+        }
+
+        return has_tag ? end_length_tag(tag, start) : true;
+    }
+
+    // parse_repeat reads the element count of an array expansion, as in "[0 * 10]".
+    bool parse_repeat(uint64_t &count)
+    {
+        const char* start = m_cur;
+        count = 0;
+        while(m_cur != m_end && *m_cur >= '0' && *m_cur <= '9') {
+            count = count * 10 + (*m_cur - '0');
+            if(count > numeric_limits<unsigned int>::max()) {
+                return fail_at(start, "Number out of range.");
+            }
+            ++m_cur;
+        }
+        if(m_cur == start) {
+            return fail("Expected an element count after '*'.");
+        }
+        return true;
+    }
+
+    // repeat_element makes <count> copies of the packed element at <mark> in the output.
+    void repeat_element(size_t mark, uint64_t count)
+    {
+        size_t length = m_out.size() - mark;
+        if(count == 0 || length == 0) {
+            m_out.resize(mark);
+            return;
+        }
+        m_out.resize(mark + length * count);
+        for(uint64_t n = 1; n < count; ++n) {
+            memcpy(&m_out[mark + length * n], &m_out[mark], length);
+        }
+    }
+
+    bool parse_struct(const DistributedType* dtype)
+    {
+        const Struct* dstruct = dtype->as_struct();
+        if(dstruct == nullptr) {
+            return fail("Cannot use struct-composition for non-struct type '"
+                        + format_type(dtype->get_type()) + "'.");
+        }
+        ++m_cur; // '{'
+
+        size_t num_fields = dstruct->get_num_fields();
+        for(unsigned int i = 0; i < num_fields; ++i) {
+            if(i > 0 && !expect(',')) {
+                return fail("Too few values in struct value, expected " + to_string(num_fields) + ".");
+            }
+            if(!parse_value(dstruct->get_field(i)->get_type())) {
+                return false;
+            }
+        }
+        if(!expect('}')) {
+            return fail("Too many values in struct value, expected " + to_string(num_fields) + ".");
+        }
+        return true;
+    }
+
+    bool parse_method(const DistributedType* dtype)
+    {
+        const Method* method = dtype->as_method();
+        if(method == nullptr) {
+            return fail("Cannot use method-value for non-method type '"
+                        + format_type(dtype->get_type()) + "'.");
+        }
+        ++m_cur; // '('
+
+        size_t num_params = method->get_num_parameters();
+        for(unsigned int i = 0; i < num_params; ++i) {
+            if(i > 0 && !expect(',')) {
+                return fail("Too few values in method value, expected " + to_string(num_params) + ".");
+            }
+            if(!parse_value(method->get_parameter(i)->get_type())) {
+                return false;
+            }
+        }
+        if(!expect(')')) {
+            return fail("Too many values in method value, expected " + to_string(num_params) + ".");
+        }
+        return true;
+    }
+
+    // scan_quoted reads a quoted string, with <m_cur> at the opening quote, and adds its
+    //     characters to the output after processing escapes.
+    bool scan_quoted(char quote_mark)
+    {
+        const char* start = m_cur;
+        ++m_cur;
+        const char* run = m_cur; // characters not yet added to the output
+        for(;;) {
+            if(m_cur == m_end || *m_cur == '\n') {
+                // A newline is not allowed within a string unless it is escaped.
+                return fail_at(start, "This quotation mark is unterminated.");
+            }
+
+            char c = *m_cur;
+            if(c == quote_mark) {
+                append_bytes(m_out, run, m_cur - run);
+                ++m_cur;
+                return true;
+            } else if(c != '\\') {
+                ++m_cur;
+                continue;
+            }
+
+            append_bytes(m_out, run, m_cur - run);
+            ++m_cur;
+            if(m_cur == m_end) {
+                return fail_at(start, "This quotation mark is unterminated.");
+            }
+            m_out.push_back(scan_escape());
+            run = m_cur;
+        }
+    }
+
+    // scan_escape reads the character after a backslash.  We also respect some C conventions.
+    char scan_escape()
+    {
+        char c = *m_cur++;
+        switch(c) {
+        case 'a':
+            return '\a';
+        case 'n':
+            return '\n';
+        case 'r':
+            return '\r';
+        case 't':
+            return '\t';
+        case 'x': {
+            int hex = 0, digit;
+            for(int i = 0; i < 2 && m_cur != m_end && (digit = hex_digit(*m_cur)) >= 0; ++i, ++m_cur) {
+                hex = hex * 16 + digit;
+            }
+            return char(hex);
+        }
+        case '0': {
+            int oct = 0;
+            for(int i = 0; i < 3 && m_cur != m_end && *m_cur >= '0' && *m_cur <= '7'; ++i, ++m_cur) {
+                oct = oct * 8 + (*m_cur - '0');
+            }
+            return char(oct);
+        }
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+        case '8':
+        case '9': {
+            int dec = c - '0';
+            for(int i = 1; i < 3 && m_cur != m_end && *m_cur >= '0' && *m_cur <= '9'; ++i, ++m_cur) {
+                dec = dec * 10 + (*m_cur - '0');
+            }
+            return char(dec);
+        }
+        default:
+            return c;
+        }
+    }
+
+    // skip_space skips whitespace and comments.
+    void skip_space()
+    {
+        while(m_cur != m_end) {
+            char c = *m_cur;
+            if(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                ++m_cur;
+            } else if(c == '/' && m_end - m_cur > 1 && m_cur[1] == '/') {
+                const char* eol = (const char*)memchr(m_cur, '\n', m_end - m_cur);
+                m_cur = eol ? eol : m_end;
+            } else if(c == '/' && m_end - m_cur > 1 && m_cur[1] == '*') {
+                const char* p = m_cur + 2;
+                while(p + 1 < m_end && !(p[0] == '*' && p[1] == '/')) {
+                    ++p;
+                }
+                m_cur = (p + 1 < m_end) ? p + 2 : m_end;
+            } else {
+                return;
+            }
+        }
+    }
+
+    // expect skips past the next character if it is <c>, returning false if it isn't.
+    bool expect(char c)
+    {
+        skip_space();
+        if(m_cur == m_end || *m_cur != c) {
+            return false;
+        }
+        ++m_cur;
+        return true;
+    }
+
+    void write_le(uint64_t value, size_t width)
+    {
+        char bytes[sizeof(uint64_t)] = {};
+        assert(width <= sizeof(bytes));
+        width = min(width, sizeof(bytes));
+        for(size_t i = 0; i < width; ++i) {
+            bytes[i] = char(value >> (i * 8));
+        }
+        append_bytes(m_out, bytes, width);
+    }
+
+    // begin_length_tag reserves space for a length tag, returning where it starts.
+    size_t begin_length_tag()
+    {
+        size_t tag = m_out.size();
+        write_le(0, sizeof(sizetag_t));
+        return tag;
+    }
+
+    // end_length_tag fills in the tag at <tag> with the length of everything packed after it.
+    bool end_length_tag(size_t tag, const char* start)
+    {
+        uint64_t length = m_out.size() - tag - sizeof(sizetag_t);
+        if(length > numeric_limits<sizetag_t>::max()) {
+            return fail_at(start, "Value is too long for its length tag.");
+        }
+        for(size_t i = 0; i < sizeof(sizetag_t); ++i) {
+            m_out[tag + i] = typename Buffer::value_type(length >> (i * 8));
+        }
+        return true;
+    }
+
+    inline bool fail(const string &error)
+    {
+        return fail_at(m_cur, error);
+    }
+    inline bool fail_at(const char* at, const string &error)
+    {
+        m_error = error;
+        m_error_at = at;
+        return false;
+    }
+
+    const char* m_begin;
+    const char* m_cur;
+    const char* m_end;
+    Buffer &m_out;
+
+    string m_error;
+    const char* m_error_at;
+};
+
 // parse_value reads a .dc-formatted parameter value and outputs the data in packed form matching
 //     the appropriate DistributedType and suitable for a default parameter value.
 //     If an error occurs, the error reason is returned instead of the parsed value.
 string parse_value(const DistributedType* dtype, const string &formatted, bool &err)
 {
-    istringstream strm(formatted);
-    return parse_value(dtype, strm, err);
+    string value, reason;
+    size_t offset;
+    err = !parse_value(dtype, formatted.data(), formatted.length(), value, reason, offset);
+    if(err) {
+        return "parse_value() error at offset " + to_string(offset) + ": " + reason;
+    }
+    return value;
 
 }
 string parse_value(const DistributedType* dtype, istream &in, bool &err)
 {
-    string value;
-    try {
-        init_value_parser(in, "parse_value()", dtype, value);
-        run_parser();
-        cleanup_parser();
-    } catch(const exception& e) {
-        err = true;
-        return string("parse_value() error: ") + e.what();
-    }
+    string formatted((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    return parse_value(dtype, formatted, err);
+}
 
-    if(parser_error_count() > 0) {
-        err = true;
-        return string("parse value(): unknown error");
+// parse_value reads the .dc-formatted value in the <length> characters at <formatted> and appends
+//     it in packed form to <out>.  On error, false is returned with the reason in <err> and the
+//     position in <formatted> at which the error was found in <offset>.
+bool parse_value(const DistributedType* dtype, const char *formatted, size_t length,
+                 string &out, string &err, size_t &offset)
+{
+    ValueParser<string> parser(formatted, length, out);
+    if(!parser.parse(dtype)) {
+        err = parser.get_error();
+        offset = parser.get_error_offset();
+        return false;
     }
-
-    err = false;
-    return value;
+    return true;
+}
+bool parse_value(const DistributedType* dtype, const char *formatted, size_t length,
+                 vector<uint8_t> &out, string &err, size_t &offset)
+{
+    ValueParser<vector<uint8_t> > parser(formatted, length, out);
+    if(!parser.parse(dtype)) {
+        err = parser.get_error();
+        offset = parser.get_error_offset();
+        return false;
+    }
+    return true;
 }
 
 
@@ -1,5 +1,7 @@
 // Filename: parse.h
 #pragma once
+#include <stdint.h> // uint8_t
+#include <stddef.h> // size_t
 #include <string> // std::string
 #include <vector> // std::vector
 namespace dclass   // open namespace dclass
@@ -15,5 +17,15 @@ class DistributedType;
 std::string parse_value(const DistributedType*, const std::string &formatted, bool &err);
 std::string parse_value(const DistributedType*, std::istream &in, bool &err);
 
+// parse_value reads the .dc-formatted value in the <length> characters at <formatted> and appends
+//     it in packed form to <out>.  The text is read directly, without the file parser, so this is
+//     the fast way to parse many values.  On error, false is returned with the reason in <err> and
+//     the position in <formatted> at which the error was found in <offset>; <out> is then left
+//     with a partially packed value, which should be discarded.
+bool parse_value(const DistributedType*, const char *formatted, size_t length,
+                 std::string &out, std::string &err, size_t &offset);
+bool parse_value(const DistributedType*, const char *formatted, size_t length,
+                 std::vector<uint8_t> &out, std::string &err, size_t &offset);
+
 
 } // close namespace dclass
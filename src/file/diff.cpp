@@ -0,0 +1,676 @@
+// Filename: diff.cpp
+#include <sstream>       // std::ostringstream
+#include <unordered_map> // std::unordered_map
+#include "dc/File.h"
+#include "dc/Class.h"
+#include "dc/Field.h"
+#include "dc/Method.h"
+#include "dc/Parameter.h"
+#include "dc/MolecularField.h"
+#include "dc/ArrayType.h"
+#include "dc/NumericType.h"
+#include "write.h"
+
+#include "diff.h"
+using namespace std;
+namespace dclass   // open namespace dclass
+{
+
+// A Layout is the result of comparing how two types pack their values.
+enum Layout {
+    LAYOUT_SAME,      // the types pack and accept the same values
+    LAYOUT_RANGE,     // the types pack the same way, but accept different values
+    LAYOUT_DIFFERENT, // the types pack differently
+};
+
+static const uint64_t KNOWN_KEYWORDS_MASK = (1ULL << NUM_KNOWN_KEYWORDS) - 1;
+
+static bool same_range(const NumericRange& a, const NumericRange& b)
+{
+    return a.type == b.type && a.min == b.min && a.max == b.max;
+}
+
+// type_name returns a short description of a type for the details of a change.
+static string type_name(const DistributedType* type)
+{
+    if(type->has_alias()) {
+        return type->get_alias();
+    }
+    if(type->as_struct() != nullptr) {
+        return type->as_struct()->get_name();
+    }
+    if(type->as_array() != nullptr && (type->get_type() == T_ARRAY || type->get_type() == T_VARARRAY)) {
+        const ArrayType* array = type->as_array();
+        string name = type_name(array->get_element_type()) + "[";
+        if(array->get_array_size() > 0) {
+            name += to_string(array->get_array_size());
+        }
+        return name + "]";
+    }
+    if(type->as_numeric() != nullptr && type->as_numeric()->get_divisor() > 1) {
+        return format_type(type->get_type()) + "/" + to_string(type->as_numeric()->get_divisor());
+    }
+    return format_type(type->get_type());
+}
+
+// keyword_names returns the keywords of a field, separated by spaces.
+static string keyword_names(const Field* field)
+{
+    string names;
+    for(size_t i = 0; i < field->get_num_keywords(); ++i) {
+        if(i > 0) {
+            names += " ";
+        }
+        names += field->get_keyword(i);
+    }
+    return names.empty() ? "(none)" : names;
+}
+
+// num_own_fields returns the number of fields declared directly in a struct or class,
+//     including the constructor of a class.
+static size_t num_own_fields(const Struct* strct)
+{
+    const Class* cls = strct->as_class();
+    if(cls == nullptr) {
+        return strct->get_num_fields();
+    }
+    return cls->get_num_base_fields() + (cls->has_constructor() ? 1 : 0);
+}
+// get_own_field returns the <n>th field declared directly in a struct or class.
+static const Field* get_own_field(const Struct* strct, unsigned int n)
+{
+    const Class* cls = strct->as_class();
+    if(cls == nullptr) {
+        return strct->get_field(n);
+    }
+    if(cls->has_constructor()) {
+        if(n == 0) {
+            return cls->get_constructor();
+        }
+        --n;
+    }
+    return cls->get_base_field(n);
+}
+
+// find_struct returns the struct or class called <name> in <file>, ignoring typedefs.
+static const Struct* find_struct(const File* file, const string& name)
+{
+    const DistributedType* type = file->get_type_by_name(name);
+    if(type == nullptr || type->as_struct() == nullptr || type->as_struct()->get_name() != name) {
+        return nullptr;
+    }
+    return type->as_struct();
+}
+
+// The Differ walks both files once, recording changes in the SchemaDiff.
+class Differ
+{
+  public:
+    Differ(const File* old_file, const File* new_file, SchemaDiff& diff) :
+        m_old(old_file), m_new(new_file), m_diff(diff)
+    {
+    }
+
+    void diff_keywords();
+    void diff_types();
+
+  private:
+    void add(ChangeKind kind, Compatibility compatibility, const string& path, const string& detail);
+
+    void diff_struct(const Struct* old_strct, const Struct* new_strct);
+    void diff_class(const Class* old_cls, const Class* new_cls);
+    void diff_field(const Field* old_field, const Field* new_field, const string& path);
+    void diff_added_fields(const Struct* old_strct, const Struct* new_strct);
+
+    // find_field returns the field of <strct> matching the <n>th own field of <other> by name.
+    const Field* find_field(const Struct* strct, const Struct* other, unsigned int n) const;
+    // find_renamed returns the field of <new_strct> renamed from <old_field> of <old_strct>, if any.
+    const Field* find_renamed(const Struct* old_strct, const Struct* new_strct, const Field* old_field);
+    // find_renamed_struct returns the struct or class of the new file renamed from <old_strct>, if any.
+    const Struct* find_renamed_struct(const Struct* old_strct) const;
+    // match_struct returns the struct or class of the new file matching <old_strct>.
+    const Struct* match_struct(const Struct* old_strct) const;
+    // same_field returns true if <new_field> is <old_field>, under the same name or renamed.
+    bool same_field(const Field* old_field, const Field* new_field);
+    string field_path(const Struct* strct, const Field* field, unsigned int n) const;
+
+    Layout compare_types(const DistributedType* a, const DistributedType* b, string& detail);
+    Layout compare_structs(const Struct* a, const Struct* b, string& detail);
+
+    const File* m_old;
+    const File* m_new;
+    SchemaDiff& m_diff;
+
+    // Struct layouts already compared, keyed by (old id << 32 | new id); structs appear as
+    //     parameter types many times, but are only walked once.
+    unordered_map<uint64_t, Layout> m_struct_layouts;
+};
+
+void Differ::add(ChangeKind kind, Compatibility compatibility, const string& path, const string& detail)
+{
+    SchemaChange change;
+    change.kind = kind;
+    change.compatibility = compatibility;
+    change.path = path;
+    change.detail = detail;
+    m_diff.changes.push_back(change);
+    if(compatibility > m_diff.compatibility) {
+        m_diff.compatibility = compatibility;
+    }
+}
+
+void Differ::diff_keywords()
+{
+    for(size_t i = 0; i < m_old->get_num_keywords(); ++i) {
+        if(!m_new->has_keyword(m_old->get_keyword(i))) {
+            add(CHANGE_KEYWORD_REMOVED, COMPAT_SAME_WIRE, m_old->get_keyword(i), "");
+        }
+    }
+    for(size_t i = 0; i < m_new->get_num_keywords(); ++i) {
+        if(!m_old->has_keyword(m_new->get_keyword(i))) {
+            add(CHANGE_KEYWORD_ADDED, COMPAT_SAME_WIRE, m_new->get_keyword(i), "");
+        }
+    }
+}
+
+void Differ::diff_types()
+{
+    for(size_t id = 0; id < m_old->get_num_types(); ++id) {
+        const Struct* old_strct = m_old->get_type_by_id(id)->as_struct();
+        if(old_strct == nullptr) {
+            continue;
+        }
+        const string& name = old_strct->get_name();
+        bool is_class = old_strct->as_class() != nullptr;
+
+        const Struct* new_strct = find_struct(m_new, name);
+        if(new_strct == nullptr) {
+            new_strct = find_renamed_struct(old_strct);
+            if(new_strct == nullptr) {
+                // An old peer can still send the removed class; struct users are reported by their fields.
+                add(CHANGE_TYPE_REMOVED, is_class ? COMPAT_BREAKING : COMPAT_SAME_WIRE, name, "");
+                continue;
+            }
+            // Only ids are sent, so the peers read the same messages.
+            add(CHANGE_TYPE_RENAMED, COMPAT_SAME_WIRE, name, name + " -> " + new_strct->get_name());
+        }
+        if(is_class != (new_strct->as_class() != nullptr)) {
+            add(CHANGE_TYPE_KIND, COMPAT_BREAKING, name, is_class ? "dclass -> struct" : "struct -> dclass");
+            continue;
+        }
+        if(old_strct->get_id() != new_strct->get_id()) {
+            // Class ids are sent in CLIENT_ENTER_OBJECT_*; struct ids are never sent.
+            add(CHANGE_TYPE_MOVED, is_class ? COMPAT_BREAKING : COMPAT_SAME_WIRE, name,
+                "id " + to_string(old_strct->get_id()) + " -> " + to_string(new_strct->get_id()));
+        }
+
+        if(is_class) {
+            diff_class(old_strct->as_class(), new_strct->as_class());
+        }
+        diff_struct(old_strct, new_strct);
+    }
+
+    for(size_t id = 0; id < m_new->get_num_types(); ++id) {
+        const Struct* new_strct = m_new->get_type_by_id(id)->as_struct();
+        if(new_strct == nullptr) {
+            continue;
+        }
+        bool is_class = new_strct->as_class() != nullptr;
+
+        const Struct* old_strct = find_struct(m_old, new_strct->get_name());
+        if(old_strct == nullptr) {
+            const DistributedType* type = m_old->get_type_by_id(new_strct->get_id());
+            old_strct = type != nullptr ? type->as_struct() : nullptr;
+            if(old_strct != nullptr && find_renamed_struct(old_strct) != new_strct) {
+                old_strct = nullptr;
+            }
+        }
+        if(old_strct == nullptr) {
+            // An old peer can't create objects of the new class, but reads everything else.
+            add(CHANGE_TYPE_ADDED, is_class ? COMPAT_BEHAVIOR : COMPAT_SAME_WIRE, new_strct->get_name(), "");
+        } else if(is_class == (old_strct->as_class() != nullptr)) {
+            diff_added_fields(old_strct, new_strct);
+        }
+    }
+}
+
+void Differ::diff_class(const Class* old_cls, const Class* new_cls)
+{
+    bool same_parents = old_cls->get_num_parents() == new_cls->get_num_parents();
+    for(size_t i = 0; same_parents && i < old_cls->get_num_parents(); ++i) {
+        same_parents = match_struct(old_cls->get_parent(i)) == new_cls->get_parent(i);
+    }
+    if(!same_parents) {
+        string detail;
+        for(const Class* cls : { old_cls, new_cls }) {
+            detail += detail.empty() ? "" : " -> ";
+            for(size_t i = 0; i < cls->get_num_parents(); ++i) {
+                detail += (i > 0 ? ", " : "") + cls->get_parent(i)->get_name();
+            }
+            if(cls->get_num_parents() == 0) {
+                detail += "(none)";
+            }
+        }
+        add(CHANGE_PARENTS, COMPAT_BREAKING, old_cls->get_name(), detail);
+    }
+
+    // The required fields are sent back to back when an object enters, without field ids.
+    bool same_required = old_cls->get_num_required_fields() == new_cls->get_num_required_fields();
+    for(size_t i = 0; same_required && i < old_cls->get_num_required_fields(); ++i) {
+        same_required = same_field(old_cls->get_required_field(i), new_cls->get_required_field(i));
+    }
+    if(!same_required) {
+        string detail;
+        for(const Class* cls : { old_cls, new_cls }) {
+            detail += detail.empty() ? "" : " -> ";
+            for(size_t i = 0; i < cls->get_num_required_fields(); ++i) {
+                detail += (i > 0 ? ", " : "") + cls->get_required_field(i)->get_name();
+            }
+            if(cls->get_num_required_fields() == 0) {
+                detail += "(none)";
+            }
+        }
+        add(CHANGE_REQUIRED, COMPAT_BREAKING, old_cls->get_name(), detail);
+    }
+}
+
+void Differ::diff_struct(const Struct* old_strct, const Struct* new_strct)
+{
+    bool is_class = old_strct->as_class() != nullptr;
+    size_t num_fields = num_own_fields(old_strct);
+    for(unsigned int n = 0; n < num_fields; ++n) {
+        const Field* old_field = get_own_field(old_strct, n);
+        const Field* new_field = find_field(new_strct, old_strct, n);
+        string path = field_path(old_strct, old_field, n);
+        if(new_field == nullptr) {
+            new_field = find_renamed(old_strct, new_strct, old_field);
+            if(new_field == nullptr) {
+                // Removing a struct field changes how the struct packs.
+                add(CHANGE_FIELD_REMOVED, COMPAT_BREAKING, path, "");
+                continue;
+            }
+            // Only field ids are sent, so the peers read the same messages.
+            add(CHANGE_FIELD_RENAMED, COMPAT_SAME_WIRE, path, old_field->get_name() + " -> " + new_field->get_name());
+        }
+
+        // Only class fields know their struct; a class field may now be inherited.
+        const Struct* owner = new_field->get_struct() != nullptr ? new_field->get_struct() : new_strct;
+        if(owner != new_strct) {
+            add(CHANGE_FIELD_MOVED, is_class ? COMPAT_BREAKING : COMPAT_SAME_WIRE, path,
+                "moved to " + owner->get_name());
+        } else if(old_field->get_id() != new_field->get_id()) {
+            // Field ids are sent with every update of a class field; struct field ids never are.
+            add(CHANGE_FIELD_MOVED, is_class ? COMPAT_BREAKING : COMPAT_SAME_WIRE, path,
+                "id " + to_string(old_field->get_id()) + " -> " + to_string(new_field->get_id()));
+        }
+        diff_field(old_field, new_field, path);
+    }
+}
+
+void Differ::diff_added_fields(const Struct* old_strct, const Struct* new_strct)
+{
+    bool is_class = old_strct->as_class() != nullptr;
+    size_t num_fields = num_own_fields(new_strct);
+    for(unsigned int n = 0; n < num_fields; ++n) {
+        if(find_field(old_strct, new_strct, n) != nullptr) {
+            continue;
+        }
+        const Field* new_field = get_own_field(new_strct, n);
+        const Field* old_field = old_strct->get_field_by_id(new_field->get_id());
+        if(old_field == nullptr || find_renamed(old_strct, new_strct, old_field) != new_field) {
+            // Adding a struct field changes how the struct packs; a new class field is just
+            //     unknown to old peers.
+            add(CHANGE_FIELD_ADDED, is_class ? COMPAT_BEHAVIOR : COMPAT_BREAKING,
+                field_path(new_strct, get_own_field(new_strct, n), n), "");
+        }
+    }
+}
+
+void Differ::diff_field(const Field* old_field, const Field* new_field, const string& path)
+{
+    const MolecularField* old_mol = old_field->as_molecular();
+    const MolecularField* new_mol = new_field->as_molecular();
+    if((old_mol == nullptr) != (new_mol == nullptr)) {
+        add(CHANGE_FIELD_TYPE, COMPAT_BREAKING, path, old_mol ? "molecular -> atomic" : "atomic -> molecular");
+    } else if(old_mol != nullptr) {
+        // A molecular field packs its atomic fields in order; those are compared on their own.
+        bool same_members = old_mol->get_num_fields() == new_mol->get_num_fields();
+        for(size_t i = 0; same_members && i < old_mol->get_num_fields(); ++i) {
+            same_members = same_field(old_mol->get_field(i), new_mol->get_field(i));
+        }
+        if(!same_members) {
+            string detail;
+            for(const MolecularField* mol : { old_mol, new_mol }) {
+                detail += detail.empty() ? "" : " -> ";
+                for(size_t i = 0; i < mol->get_num_fields(); ++i) {
+                    detail += (i > 0 ? ", " : "") + mol->get_field(i)->get_name();
+                }
+            }
+            add(CHANGE_FIELD_TYPE, COMPAT_BREAKING, path, detail);
+        }
+    } else {
+        string detail;
+        Layout layout = compare_types(old_field->get_type(), new_field->get_type(), detail);
+        if(layout == LAYOUT_DIFFERENT) {
+            add(CHANGE_FIELD_TYPE, COMPAT_BREAKING, path, detail);
+        } else if(layout == LAYOUT_RANGE) {
+            add(CHANGE_FIELD_RANGE, COMPAT_BEHAVIOR, path, detail);
+        }
+    }
+
+    if(!old_field->has_matching_keywords(*new_field)) {
+        // Astron's keywords decide who may send a field and who receives it; others only
+        //     matter to the application.
+        uint64_t known = (old_field->get_keyword_mask() ^ new_field->get_keyword_mask()) & KNOWN_KEYWORDS_MASK;
+        add(CHANGE_FIELD_KEYWORDS, known ? COMPAT_BEHAVIOR : COMPAT_SAME_WIRE, path,
+            keyword_names(old_field) + " -> " + keyword_names(new_field));
+    }
+}
+
+const Field* Differ::find_field(const Struct* strct, const Struct* other, unsigned int n) const
+{
+    const Field* field = get_own_field(other, n);
+    if(!field->get_name().empty()) {
+        return strct->get_field_by_name(field->get_name());
+    }
+
+    // Unnamed struct fields can only be matched by their position.
+    if(n >= num_own_fields(strct)) {
+        return nullptr;
+    }
+    const Field* match = get_own_field(strct, n);
+    return match->get_name().empty() ? match : nullptr;
+}
+
+const Field* Differ::find_renamed(const Struct* old_strct, const Struct* new_strct, const Field* old_field)
+{
+    // The field must keep its id, be declared in the same struct and pack the same way, and its
+    //     old and new names must each be missing from the other struct.
+    const Field* new_field = new_strct->get_field_by_id(old_field->get_id());
+    if(old_field->get_name().empty() || new_field == nullptr || new_field->get_name().empty()
+       || (old_field->get_struct() != nullptr && old_field->get_struct() != old_strct)
+       || (new_field->get_struct() != nullptr && new_field->get_struct() != new_strct)
+       || new_strct->get_field_by_name(old_field->get_name()) != nullptr
+       || old_strct->get_field_by_name(new_field->get_name()) != nullptr
+       || (old_field->as_molecular() == nullptr) != (new_field->as_molecular() == nullptr)) {
+        return nullptr;
+    }
+    string detail;
+    if(old_field->as_molecular() == nullptr
+       && compare_types(old_field->get_type(), new_field->get_type(), detail) == LAYOUT_DIFFERENT) {
+        return nullptr;
+    }
+    return new_field;
+}
+
+const Struct* Differ::find_renamed_struct(const Struct* old_strct) const
+{
+    // The type must keep its id and kind, and its old and new names must each be missing from
+    //     the other file.
+    const DistributedType* type = m_new->get_type_by_id(old_strct->get_id());
+    const Struct* new_strct = type != nullptr ? type->as_struct() : nullptr;
+    if(new_strct == nullptr || (new_strct->as_class() == nullptr) != (old_strct->as_class() == nullptr)
+       || find_struct(m_new, old_strct->get_name()) != nullptr
+       || find_struct(m_old, new_strct->get_name()) != nullptr) {
+        return nullptr;
+    }
+    return new_strct;
+}
+
+const Struct* Differ::match_struct(const Struct* old_strct) const
+{
+    const Struct* new_strct = find_struct(m_new, old_strct->get_name());
+    return new_strct != nullptr ? new_strct : find_renamed_struct(old_strct);
+}
+
+bool Differ::same_field(const Field* old_field, const Field* new_field)
+{
+    if(old_field->get_name() == new_field->get_name()) {
+        return true;
+    }
+    const Struct* old_owner = old_field->get_struct();
+    const Struct* new_owner = new_field->get_struct();
+    return old_owner != nullptr && new_owner != nullptr && match_struct(old_owner) == new_owner
+           && find_renamed(old_owner, new_owner, old_field) == new_field;
+}
+
+string Differ::field_path(const Struct* strct, const Field* field, unsigned int n) const
+{
+    if(field->get_name().empty()) {
+        return strct->get_name() + ".#" + to_string(n);
+    }
+    return strct->get_name() + "." + field->get_name();
+}
+
+Layout Differ::compare_types(const DistributedType* a, const DistributedType* b, string& detail)
+{
+    if(a->get_type() != b->get_type()) {
+        detail = type_name(a) + " -> " + type_name(b);
+        return LAYOUT_DIFFERENT;
+    }
+
+    switch(a->get_type()) {
+    case T_INT8:
+    case T_INT16:
+    case T_INT32:
+    case T_INT64:
+    case T_UINT8:
+    case T_UINT16:
+    case T_UINT32:
+    case T_UINT64:
+    case T_CHAR:
+    case T_FLOAT32:
+    case T_FLOAT64: {
+        const NumericType* x = a->as_numeric();
+        const NumericType* y = b->as_numeric();
+        if(x->get_divisor() != y->get_divisor()) {
+            detail = type_name(a) + " -> " + type_name(b);
+            return LAYOUT_DIFFERENT;
+        }
+        if(x->has_modulus() != y->has_modulus() || (x->has_modulus() && x->get_modulus() != y->get_modulus())) {
+            detail = "modulus of " + type_name(a) + " changed";
+            return LAYOUT_RANGE;
+        }
+        if(x->has_range() != y->has_range() || !same_range(x->get_range(), y->get_range())) {
+            detail = "range of " + type_name(a) + " changed";
+            return LAYOUT_RANGE;
+        }
+        return LAYOUT_SAME;
+    }
+
+    case T_STRING:
+    case T_BLOB:
+        if(a->get_size() != b->get_size()) {
+            detail = type_name(a) + "(" + to_string(a->get_size()) + ") -> " +
+                     type_name(b) + "(" + to_string(b->get_size()) + ")";
+            return LAYOUT_DIFFERENT;
+        }
+        return LAYOUT_SAME;
+
+    case T_VARSTRING:
+    case T_VARBLOB:
+    case T_ARRAY:
+    case T_VARARRAY: {
+        const ArrayType* x = a->as_array();
+        const ArrayType* y = b->as_array();
+        if(x->get_array_size() != y->get_array_size()) {
+            detail = type_name(a) + " -> " + type_name(b);
+            return LAYOUT_DIFFERENT;
+        }
+        Layout layout = LAYOUT_SAME;
+        if(a->get_type() == T_ARRAY || a->get_type() == T_VARARRAY) {
+            layout = compare_types(x->get_element_type(), y->get_element_type(), detail);
+            if(layout == LAYOUT_DIFFERENT) {
+                return layout;
+            }
+        }
+        if(x->has_range() != y->has_range() || !same_range(x->get_range(), y->get_range())) {
+            detail = "size range of " + type_name(a) + " changed";
+            return LAYOUT_RANGE;
+        }
+        return layout;
+    }
+
+    case T_STRUCT:
+        return compare_structs(a->as_struct(), b->as_struct(), detail);
+
+    case T_METHOD: {
+        const Method* x = a->as_method();
+        const Method* y = b->as_method();
+        if(x->get_num_parameters() != y->get_num_parameters()) {
+            detail = to_string(x->get_num_parameters()) + " parameters -> " + to_string(y->get_num_parameters());
+            return LAYOUT_DIFFERENT;
+        }
+        Layout worst = LAYOUT_SAME;
+        string param_detail;
+        for(unsigned int i = 0; i < x->get_num_parameters(); ++i) {
+            Layout layout = compare_types(x->get_parameter(i)->get_type(), y->get_parameter(i)->get_type(),
+                                          param_detail);
+            if(layout > worst) {
+                worst = layout;
+                detail = "parameter " + to_string(i + 1) + ": " + param_detail;
+                if(worst == LAYOUT_DIFFERENT) {
+                    break;
+                }
+            }
+        }
+        return worst;
+    }
+
+    default:
+        return LAYOUT_SAME;
+    }
+}
+
+Layout Differ::compare_structs(const Struct* a, const Struct* b, string& detail)
+{
+    uint64_t key = (uint64_t(a->get_id()) << 32) | b->get_id();
+    auto known = m_struct_layouts.find(key);
+    if(known != m_struct_layouts.end()) {
+        if(known->second != LAYOUT_SAME) {
+            detail = "layout of " + a->get_name() + " changed";
+        }
+        return known->second;
+    }
+    m_struct_layouts[key] = LAYOUT_SAME; // in case the struct refers back to itself
+
+    // Molecular fields pack nothing of their own, so only atomic fields are compared.
+    Layout worst = LAYOUT_SAME;
+    unsigned int i = 0, j = 0;
+    while(worst != LAYOUT_DIFFERENT) {
+        while(i < a->get_num_fields() && a->get_field(i)->as_molecular() != nullptr) {
+            ++i;
+        }
+        while(j < b->get_num_fields() && b->get_field(j)->as_molecular() != nullptr) {
+            ++j;
+        }
+        if(i == a->get_num_fields() || j == b->get_num_fields()) {
+            if(i != a->get_num_fields() || j != b->get_num_fields()) {
+                worst = LAYOUT_DIFFERENT;
+            }
+            break;
+        }
+
+        string field_detail;
+        Layout layout = compare_types(a->get_field(i)->get_type(), b->get_field(j)->get_type(), field_detail);
+        worst = layout > worst ? layout : worst;
+        ++i;
+        ++j;
+    }
+
+    m_struct_layouts[key] = worst;
+    if(worst != LAYOUT_SAME) {
+        detail = "layout of " + a->get_name() + " changed";
+    }
+    return worst;
+}
+
+// diff_files compares two versions of a .dc file.  Classes and structs are matched by name, and
+//     their fields by name (unnamed struct fields by position), or else as renames by id; the ids
+//     of matched classes and fields must be equal for messages to read the same.
+SchemaDiff diff_files(const File* old_file, const File* new_file)
+{
+    SchemaDiff diff;
+    diff.compatibility = COMPAT_SAME_WIRE;
+    diff.hashes_match = old_file->get_hash() == new_file->get_hash();
+
+    Differ differ(old_file, new_file, diff);
+    differ.diff_keywords();
+    differ.diff_types();
+    return diff;
+}
+
+// format_compatibility returns the name of a Compatibility, e.g. "breaking".
+string format_compatibility(Compatibility compatibility)
+{
+    switch(compatibility) {
+    case COMPAT_SAME_WIRE:
+        return "same wire";
+    case COMPAT_BEHAVIOR:
+        return "behavior";
+    case COMPAT_BREAKING:
+        return "breaking";
+    default:
+        return "error";
+    }
+}
+
+// format_change_kind returns a short description of a ChangeKind.
+static string format_change_kind(ChangeKind kind)
+{
+    switch(kind) {
+    case CHANGE_KEYWORD_ADDED:
+        return "keyword added";
+    case CHANGE_KEYWORD_REMOVED:
+        return "keyword removed";
+    case CHANGE_TYPE_ADDED:
+        return "added";
+    case CHANGE_TYPE_REMOVED:
+        return "removed";
+    case CHANGE_TYPE_MOVED:
+        return "id changed";
+    case CHANGE_TYPE_RENAMED:
+        return "renamed";
+    case CHANGE_TYPE_KIND:
+        return "kind changed";
+    case CHANGE_PARENTS:
+        return "parents changed";
+    case CHANGE_REQUIRED:
+        return "required fields changed";
+    case CHANGE_FIELD_ADDED:
+        return "field added";
+    case CHANGE_FIELD_REMOVED:
+        return "field removed";
+    case CHANGE_FIELD_MOVED:
+        return "field moved";
+    case CHANGE_FIELD_RENAMED:
+        return "field renamed";
+    case CHANGE_FIELD_TYPE:
+        return "type changed";
+    case CHANGE_FIELD_RANGE:
+        return "range changed";
+    case CHANGE_FIELD_KEYWORDS:
+        return "keywords changed";
+    default:
+        return "error";
+    }
+}
+
+// write_diff outputs the changes of <diff>, one per line, followed by the verdict.
+void write_diff(ostream& out, const SchemaDiff& diff)
+{
+    for(auto it = diff.changes.begin(); it != diff.changes.end(); ++it) {
+        out << "[" << format_compatibility(it->compatibility) << "] " << it->path << ": "
+            << format_change_kind(it->kind);
+        if(!it->detail.empty()) {
+            out << " (" << it->detail << ")";
+        }
+        out << "\n";
+    }
+    out << diff.changes.size() << " change(s); "
+        << (diff.is_wire_compatible() ? "wire compatible" : "NOT wire compatible")
+        << " (" << format_compatibility(diff.compatibility) << "); dc hashes "
+        << (diff.hashes_match ? "match" : "differ") << "\n";
+}
+
+} // close namespace dclass
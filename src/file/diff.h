@@ -0,0 +1,76 @@
+// Filename: diff.h
+#pragma once
+#include <stdint.h>
+#include <iostream> // std::ostream
+#include <string>   // std::string
+#include <vector>   // std::vector
+namespace dclass   // open namespace dclass
+{
+
+// Forward declarations
+class File;
+
+// A ChangeKind is one kind of difference between two versions of a .dc file.
+enum ChangeKind {
+    CHANGE_KEYWORD_ADDED,   // a keyword is declared only in the new file
+    CHANGE_KEYWORD_REMOVED, // a keyword is declared only in the old file
+    CHANGE_TYPE_ADDED,      // a class or struct exists only in the new file
+    CHANGE_TYPE_REMOVED,    // a class or struct exists only in the old file
+    CHANGE_TYPE_MOVED,      // a class or struct has a different id
+    CHANGE_TYPE_RENAMED,    // a class or struct has a different name, but the same id and kind
+    CHANGE_TYPE_KIND,       // a class became a struct, or a struct a class
+    CHANGE_PARENTS,         // a class inherits from different classes
+    CHANGE_REQUIRED,        // a class has different required fields
+    CHANGE_FIELD_ADDED,     // a field exists only in the new file
+    CHANGE_FIELD_REMOVED,   // a field exists only in the old file
+    CHANGE_FIELD_MOVED,     // a field has a different id, or belongs to another class
+    CHANGE_FIELD_RENAMED,   // a field has a different name, but the same id and packing
+    CHANGE_FIELD_TYPE,      // a field's values are packed differently
+    CHANGE_FIELD_RANGE,     // a field's values are packed the same way, but limited differently
+    CHANGE_FIELD_KEYWORDS,  // a field has different keywords
+};
+
+// A Compatibility rates how much a change matters between a peer using the old file and a
+//     peer using the new one.  Values are ordered from least to most severe.
+enum Compatibility {
+    COMPAT_SAME_WIRE, // every message reads the same; only the dc hash differs
+    COMPAT_BEHAVIOR,  // every message reads the same, but some may be routed or rejected differently
+    COMPAT_BREAKING,  // some messages can't be read by the other peer
+};
+
+// A SchemaChange is a single difference between two files.
+struct SchemaChange {
+    ChangeKind kind;
+    Compatibility compatibility;
+    std::string path;   // "Class", "Class.field", or "Struct.#n" for the nth unnamed field
+    std::string detail; // what changed, e.g. "uint16 -> uint32"
+};
+
+// A SchemaDiff is the list of changes between two files, and the verdict on their compatibility.
+struct SchemaDiff {
+    std::vector<SchemaChange> changes;
+    Compatibility compatibility; // the most severe compatibility of any change
+    bool hashes_match;           // the dc hashes are equal, so a Client Agent accepts the hello
+
+    // is_wire_compatible returns true if every message reads the same with either file.
+    inline bool is_wire_compatible() const
+    {
+        return compatibility != COMPAT_BREAKING;
+    }
+};
+
+// diff_files compares two versions of a .dc file.  Classes and structs are matched by name, and
+//     their fields by name (unnamed struct fields by position); the ids of matched classes
+//     and fields must be equal for messages to read the same.  A type or field whose name only
+//     one file has is matched as a rename if the other file has one of the same id and kind (and
+//     for fields, packed the same way) in its place.  Both files must be finalized.
+//     Runs in time linear in the number of types and fields of the two files.
+SchemaDiff diff_files(const File* old_file, const File* new_file);
+
+// format_compatibility returns the name of a Compatibility, e.g. "breaking".
+std::string format_compatibility(Compatibility compatibility);
+
+// write_diff outputs the changes of <diff>, one per line, followed by the verdict.
+void write_diff(std::ostream& out, const SchemaDiff& diff);
+
+} // close namespace dclass
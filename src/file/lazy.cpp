@@ -0,0 +1,322 @@
+// Filename: lazy.cpp
+#include <ctype.h>
+#include <fstream>       // std::ifstream
+#include <sstream>       // std::istringstream
+#include <iterator>      // std::istreambuf_iterator
+#include <algorithm>     // std::find
+#include <unordered_map> // std::unordered_map
+#include "dc/File.h"
+#include "parserDefs.h"
+
+#include "read.h"
+using namespace std;
+namespace dclass   // open namespace dclass
+{
+
+// A Token is a word or symbol of a .dc file, as far as the scanner is concerned.
+struct Token {
+    enum Kind {
+        IDENTIFIER, // a name or keyword
+        SYMBOL,     // a single character, e.g. '{'
+        OTHER,      // a number or a string
+    };
+
+    Kind kind;
+    size_t begin;
+    size_t end;
+    int line;
+};
+
+// A LazyLoader builds the classes of a .dc file read with read_lazy().  It keeps the text of the
+//     file, and where each class was declared in it.
+class LazyLoader : public ClassLoader
+{
+  public:
+    LazyLoader(istream &in, const string &filename);
+
+    // scan reads through the file, parsing everything but the classes into <file>, and
+    //     reserving the classes.  Returns false if the file has errors.
+    bool scan(File* file);
+
+    virtual const vector<unsigned int>& get_dependencies(unsigned int id);
+    virtual bool load_class(File* file, unsigned int id);
+
+  private:
+    // A LazyClass is where a class is declared in the text, and which classes it refers to.
+    struct LazyClass {
+        size_t begin;
+        size_t end;
+        int line;
+        vector<unsigned int> dependencies;
+    };
+
+    // next reads the token after the last one into <token>.  Returns false at the end of the text.
+    bool next(Token& token);
+    // add_dependency adds <token> to <dependencies> if it names a class reserved so far.
+    void add_dependency(const Token& token, vector<unsigned int>& dependencies);
+    // parse parses the part of the text from <begin> to <end> into <file>.
+    bool parse(File* file, size_t begin, size_t end, int line);
+    // scan_error reports an error found while scanning, at <line>.
+    void scan_error(int line, const string& msg);
+
+    inline bool is_symbol(const Token& token, char symbol) const
+    {
+        return token.kind == Token::SYMBOL && m_text[token.begin] == symbol;
+    }
+    inline string get_text(const Token& token) const
+    {
+        return m_text.substr(token.begin, token.end - token.begin);
+    }
+
+    string m_text;
+    string m_filename;
+    size_t m_pos;
+    int m_line;
+    string m_word; // reused by add_dependency
+
+    unordered_map<string, unsigned int> m_class_ids; // name -> type id, of the reserved classes
+    unordered_map<unsigned int, LazyClass> m_classes; // type id -> class
+};
+
+LazyLoader::LazyLoader(istream &in, const string &filename) :
+    m_text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>()),
+    m_filename(filename), m_pos(0), m_line(1)
+{
+}
+
+// next reads the token after the last one into <token>.  Returns false at the end of the text.
+bool LazyLoader::next(Token& token)
+{
+    const size_t length = m_text.size();
+    while(m_pos < length) {
+        char c = m_text[m_pos];
+        if(c == '\n') {
+            ++m_line;
+            ++m_pos;
+        } else if(c == ' ' || c == '\t' || c == '\r') {
+            ++m_pos;
+        } else if(c == '/' && m_pos + 1 < length && m_text[m_pos + 1] == '/') {
+            m_pos = m_text.find('\n', m_pos);
+            if(m_pos == string::npos) {
+                m_pos = length;
+            }
+        } else if(c == '/' && m_pos + 1 < length && m_text[m_pos + 1] == '*') {
+            size_t end = m_text.find("*/", m_pos + 2);
+            end = (end == string::npos) ? length : end + 2;
+            for(; m_pos < end; ++m_pos) {
+                if(m_text[m_pos] == '\n') {
+                    ++m_line;
+                }
+            }
+        } else {
+            break;
+        }
+    }
+    if(m_pos >= length) {
+        return false;
+    }
+
+    token.begin = m_pos;
+    token.line = m_line;
+    char c = m_text[m_pos++];
+    if(isalpha(c) || c == '_') {
+        token.kind = Token::IDENTIFIER;
+        while(m_pos < length && (isalnum(m_text[m_pos]) || m_text[m_pos] == '_')) {
+            ++m_pos;
+        }
+    } else if(isdigit(c)) {
+        token.kind = Token::OTHER;
+        while(m_pos < length && (isalnum(m_text[m_pos]) || m_text[m_pos] == '.')) {
+            ++m_pos;
+        }
+    } else if(c == '"' || c == '\'') {
+        token.kind = Token::OTHER;
+        while(m_pos < length && m_text[m_pos] != c) {
+            if(m_text[m_pos] == '\\' && m_pos + 1 < length) {
+                ++m_pos;
+            }
+            if(m_text[m_pos] == '\n') {
+                ++m_line;
+            }
+            ++m_pos;
+        }
+        if(m_pos < length) {
+            ++m_pos; // closing quote
+        }
+    } else {
+        token.kind = Token::SYMBOL;
+    }
+    token.end = m_pos;
+    return true;
+}
+
+// add_dependency adds <token> to <dependencies> if it names a class reserved so far.
+void LazyLoader::add_dependency(const Token& token, vector<unsigned int>& dependencies)
+{
+    if(token.kind != Token::IDENTIFIER) {
+        return;
+    }
+
+    m_word.assign(m_text, token.begin, token.end - token.begin);
+    auto class_ref = m_class_ids.find(m_word);
+    if(class_ref != m_class_ids.end()
+       && find(dependencies.begin(), dependencies.end(), class_ref->second) == dependencies.end()) {
+        dependencies.push_back(class_ref->second);
+    }
+}
+
+// parse parses the part of the text from <begin> to <end> into <file>.
+bool LazyLoader::parse(File* file, size_t begin, size_t end, int line)
+{
+    istringstream in(m_text.substr(begin, end - begin));
+    init_file_parser(in, m_filename, *file, line);
+    run_parser();
+    cleanup_parser();
+    return parser_error_count() == 0;
+}
+
+// scan_error reports an error found while scanning, at <line>.
+void LazyLoader::scan_error(int line, const string& msg)
+{
+    cerr << "\nError";
+    if(!m_filename.empty()) {
+        cerr << " in " << m_filename;
+    }
+    cerr << " at line " << line << ":\n" << msg << "\n\n";
+}
+
+// scan reads through the file, parsing everything but the classes into <file>, and
+//     reserving the classes.  Returns false if the file has errors.
+//     Everything between two classes is parsed as soon as the second class is reached, so that
+//     types get the same ids as if the file was read with read().
+bool LazyLoader::scan(File* file)
+{
+    size_t chunk_begin = 0;
+    int chunk_line = 1;
+    bool chunk_empty = true;
+    vector<unsigned int> chunk_dependencies;
+
+    Token token;
+    while(next(token)) {
+        if(token.kind != Token::IDENTIFIER
+           || m_text.compare(token.begin, token.end - token.begin, "dclass") != 0) {
+            // A class is usually followed by a ';', which doesn't need parsing on its own.
+            if(!is_symbol(token, ';')) {
+                add_dependency(token, chunk_dependencies);
+                chunk_empty = false;
+            }
+            continue;
+        }
+
+        // Parse what came before the class, after building the classes it refers to.
+        if(!chunk_empty) {
+            for(auto it = chunk_dependencies.begin(); it != chunk_dependencies.end(); ++it) {
+                file->get_type_by_id(*it);
+            }
+            if(!parse(file, chunk_begin, token.begin, chunk_line)) {
+                return false;
+            }
+        }
+
+        LazyClass cls;
+        cls.begin = token.begin;
+        cls.line = token.line;
+
+        Token name;
+        if(!next(name) || name.kind != Token::IDENTIFIER) {
+            scan_error(cls.line, "Expected the name of the dclass.");
+            return false;
+        }
+
+        // The parents of the class, up to its body.
+        while(next(token) && !is_symbol(token, '{')) {
+            add_dependency(token, cls.dependencies);
+        }
+
+        // The fields of the class are the statements at the top level of its body.
+        unsigned int num_fields = 0;
+        unsigned int depth = 1;
+        bool statement_empty = true;
+        while(depth > 0 && next(token)) {
+            if(is_symbol(token, '{')) {
+                ++depth;
+            } else if(is_symbol(token, '}')) {
+                --depth;
+            } else if(is_symbol(token, ';') && depth == 1) {
+                num_fields += statement_empty ? 0 : 1;
+                statement_empty = true;
+                continue;
+            }
+            add_dependency(token, cls.dependencies);
+            statement_empty = false;
+        }
+        if(depth > 0) {
+            scan_error(cls.line, "'dclass " + get_text(name) + "' is missing its closing '}'.");
+            return false;
+        }
+        cls.end = token.end;
+
+        unsigned int id = (unsigned int)file->get_num_types();
+        if(!file->reserve_class(get_text(name), num_fields)) {
+            scan_error(name.line, "Cannot add 'dclass " + get_text(name)
+                       + "' to file because a type was already declared with that name.");
+            return false;
+        }
+        m_class_ids[get_text(name)] = id;
+        m_classes[id] = cls;
+
+        chunk_begin = m_pos;
+        chunk_line = m_line;
+        chunk_empty = true;
+        chunk_dependencies.clear();
+    }
+
+    if(!chunk_empty) {
+        for(auto it = chunk_dependencies.begin(); it != chunk_dependencies.end(); ++it) {
+            file->get_type_by_id(*it);
+        }
+        return parse(file, chunk_begin, m_text.size(), chunk_line);
+    }
+    return true;
+}
+
+const vector<unsigned int>& LazyLoader::get_dependencies(unsigned int id)
+{
+    return m_classes[id].dependencies;
+}
+
+bool LazyLoader::load_class(File* file, unsigned int id)
+{
+    auto class_ref = m_classes.find(id);
+    if(class_ref == m_classes.end()) {
+        return false;
+    }
+    const LazyClass& cls = class_ref->second;
+    return parse(file, cls.begin, cls.end, cls.line);
+}
+
+// read_lazy reads a .dc file like read(), but builds each class only when it is first looked up.
+File* read_lazy(istream &in, const string &filename)
+{
+    File* f = new File();
+    LazyLoader* loader = new LazyLoader(in, filename);
+    f->set_loader(loader);
+    if(!loader->scan(f)) {
+        return nullptr;
+    }
+
+    f->finalize();
+    return f;
+}
+File* read_lazy(const string &filename)
+{
+    ifstream in;
+    in.open(filename.c_str());
+    if(!in) {
+        cerr << "Cannot open " << filename << " for reading.\n";
+        return nullptr;
+    }
+    return read_lazy(in, filename);
+}
+
+} // close namespace dclass
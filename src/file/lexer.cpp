@@ -552,6 +552,9 @@ extern YYSTYPE yyltype;
 // that we can report the position of an error.
 static int line_number = 0;
 static int col_number = 0;
+// line_offset is added to line_number when reporting, for input that doesn't start at the
+// beginning of the dc file.
+static int line_offset = 0;
 
 // current_line holds as much of the current line as will fit.  Its
 // only purpose is for printing it out to report an error to the user.
@@ -576,11 +579,12 @@ static int initial_token;
 // Defining the interface to the lexer.
 ////////////////////////////////////////////////////////////////////
 
-void dclass::init_file_lexer(std::istream& in, const std::string& filename)
+void dclass::init_file_lexer(std::istream& in, const std::string& filename, int first_line)
 {
     input_p = &in;
     dc_filename = filename;
     line_number = 0;
+    line_offset = first_line - 1;
     col_number = 0;
     error_count = 0;
     warning_count = 0;
@@ -618,7 +622,7 @@ void dclass::lexer_error(const std::string & msg)
     if(!dc_filename.empty()) {
         std::cerr << " in " << dc_filename;
     }
-    std::cerr << " at line " << line_number << ", column " << col_number
+    std::cerr << " at line " << line_offset + line_number << ", column " << col_number
               << ":\n" << current_line << "\n";
     indent(std::cerr, col_number - 1) << "^\n" << msg << "\n\n";
 
@@ -631,7 +635,7 @@ void dclass::lexer_warning(const std::string & msg)
     if(!dc_filename.empty()) {
         std::cerr << " in " << dc_filename;
     }
-    std::cerr << " at line " << line_number << ", column " << col_number
+    std::cerr << " at line " << line_offset + line_number << ", column " << col_number
               << ":\n" << current_line << "\n";
     indent(std::cerr, col_number - 1) << "^\n" << msg << "\n\n";
 
@@ -5,7 +5,9 @@
 namespace dclass   // open namespace dclass
 {
 
-void init_file_lexer(std::istream &in, const std::string &filename);
+// init_file_lexer sets up the lexer to read <in>; errors are reported as in <filename>,
+//     counting lines from <first_line>.
+void init_file_lexer(std::istream &in, const std::string &filename, int first_line = 1);
 void init_value_lexer(std::istream &in, const std::string &filename);
 
 int run_lexer();
@@ -143,10 +143,10 @@ static string number_value(Type type, uint64_t &number);
 // Defining the interface to the parser.
 ////////////////////////////////////////////////////////////////////
 
-void init_file_parser(istream& in, const string& filename, File& file)
+void init_file_parser(istream& in, const string& filename, File& file, int first_line)
 {
     parsed_file = &file;
-    init_file_lexer(in, filename);
+    init_file_lexer(in, filename, first_line);
 }
 
 void init_value_parser(istream& in, const string& source,
@@ -3135,7 +3135,7 @@ yyreduce:
                 }
             }
 
-            if(array->get_array_size() == 0) {
+            if(!array->has_fixed_size()) {
                 sizetag_t length = (yyvsp[-1].str).length();
                 (yyval.str) = string((char*)&length, sizeof(sizetag_t)) + (yyvsp[-1].str);
             } else {
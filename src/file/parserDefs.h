@@ -14,8 +14,9 @@ class Field;
 class MolecularField;
 class Parameter;
 
-// init_file_parser sets up a parsing session for reading an entire .dc file
-void init_file_parser(std::istream &in, const std::string &filename, File &file);
+// init_file_parser sets up a parsing session for reading an entire .dc file, or a part of
+//     one that starts at <first_line>.
+void init_file_parser(std::istream &in, const std::string &filename, File &file, int first_line = 1);
 // init_value_parser sets up a parsing session for reading a field or parameter value
 void init_value_parser(std::istream &in, const std::string &filename,
                        const DistributedType* dtype, std::string &output);
@@ -13,10 +13,18 @@ namespace dclass   // open namespace dclass
 //     When appending from a stream, a filename is optional only used to report errors.
 bool append(File* f, istream &in, const string &filename)
 {
+    // The parser can't build reserved classes while it is running, so build them first.
+    f->load_all_classes();
+
     init_file_parser(in, filename, *f);
     run_parser();
     cleanup_parser();
-    return (parser_error_count() == 0);
+    if(parser_error_count() > 0) {
+        return false;
+    }
+
+    f->finalize();
+    return true;
 }
 bool append(File* f, const string &filename)
 {
@@ -20,4 +20,11 @@ bool append(File* f, const std::string &filename);
 File* read(std::istream &in, const std::string &filename);
 File* read(const std::string &filename);
 
+// read_lazy reads a .dc file like read(), except that classes are only set aside with their
+//     ids; each class is parsed the first time it, or one of its fields, is looked up.
+//     Errors in the body of a class are reported when it is parsed, and the class is left
+//     out of lookups.  Generating the file's hash parses every class.
+File* read_lazy(std::istream &in, const std::string &filename);
+File* read_lazy(const std::string &filename);
+
 } // close namespace dclass
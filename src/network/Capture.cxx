@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file Capture.cxx
+ * @author Max Rodriguez
+ * @date 2023-06-29
+ */
+
+#include <string.h>
+#include "Capture.hxx"
+
+namespace astron   // open namespace
+{
+
+static const char CAPTURE_MAGIC[4] = {'A', 'C', 'A', 'P'};
+static const uint8_t CAPTURE_VERSION = 1;
+static const uint64_t CAPTURE_MAX_FRAME = 1 << 26; // bigger frames are taken as a corrupt file
+
+CaptureWriter::CaptureWriter() : m_file(nullptr), m_start_time(0.0), m_last_micros(0), m_frames(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+bool CaptureWriter::open(const std::string &path)
+{
+    close();
+    m_file = fopen(path.c_str(), "wb");
+    if(m_file == nullptr) {
+        return false;
+    }
+    fwrite(CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC), m_file);
+    fputc(CAPTURE_VERSION, m_file);
+    m_start_time = -1.0;
+    m_last_micros = 0;
+    m_frames = 0;
+    return true;
+}
+
+void CaptureWriter::close()
+{
+    if(m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void CaptureWriter::write(CaptureDirection direction, double time, const uint8_t *data, size_t length)
+{
+    if(m_file == nullptr) {
+        return;
+    }
+    if(m_start_time < 0.0) {
+        m_start_time = time; // the first frame starts the capture
+    }
+
+    // Times are stored as deltas, so most records spend one or two bytes on them.
+    double elapsed = (time - m_start_time) * 1000.0;
+    uint64_t micros = elapsed > 0.0 ? uint64_t(elapsed) : 0;
+    if(micros < m_last_micros) {
+        micros = m_last_micros;
+    }
+
+    fputc(direction, m_file);
+    write_varint(micros - m_last_micros);
+    write_varint(length);
+    fwrite(data, 1, length, m_file);
+    m_last_micros = micros;
+    ++m_frames;
+}
+
+void CaptureWriter::write_varint(uint64_t value)
+{
+    uint8_t buf[10];
+    size_t n = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buf[n++] = value ? (byte | 0x80) : byte;
+    } while(value);
+    fwrite(buf, 1, n, m_file);
+}
+
+CaptureReader::CaptureReader() : m_file(nullptr), m_micros(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+bool CaptureReader::open(const std::string &path)
+{
+    close();
+    m_file = fopen(path.c_str(), "rb");
+    if(m_file == nullptr) {
+        return false;
+    }
+
+    char magic[sizeof(CAPTURE_MAGIC)];
+    if(fread(magic, 1, sizeof(magic), m_file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0 ||
+       fgetc(m_file) != CAPTURE_VERSION) {
+        close();
+        return false;
+    }
+    m_micros = 0;
+    return true;
+}
+
+void CaptureReader::close()
+{
+    if(m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool CaptureReader::next(CaptureFrame &frame)
+{
+    if(m_file == nullptr) {
+        return false;
+    }
+
+    int direction = fgetc(m_file);
+    uint64_t delta, length;
+    if(direction == EOF || !read_varint(delta) || !read_varint(length) || length > CAPTURE_MAX_FRAME) {
+        return false;
+    }
+    frame.data.resize(length);
+    if(length > 0 && fread(&frame.data[0], 1, length, m_file) != length) {
+        return false;
+    }
+
+    m_micros += delta;
+    frame.direction = CaptureDirection(direction);
+    frame.time = m_micros / 1000.0;
+    return true;
+}
+
+bool CaptureReader::read_varint(uint64_t &value)
+{
+    value = 0;
+    for(unsigned int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(m_file);
+        if(byte == EOF) {
+            return false;
+        }
+        value |= uint64_t(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // close namespace astron
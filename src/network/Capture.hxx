@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file Capture.hxx
+ * @author Max Rodriguez
+ * @date 2023-06-29
+ */
+
+#ifndef ASTRON_LIBWASM_CAPTURE_HXX
+#define ASTRON_LIBWASM_CAPTURE_HXX
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace astron   // open namespace
+{
+
+// A capture file records the websocket messages of a connection, as they crossed the transport:
+//
+//     header: "ACAP" [uint8 version]
+//     record: [uint8 direction] [varint microseconds since the previous record] [varint length] [data]
+//
+// Varints are unsigned LEB128. Times come from a monotonic clock (emscripten_get_now).
+enum CaptureDirection : uint8_t {
+    CAPTURE_INBOUND = 0,  // received from the server, as passed to on_message
+    CAPTURE_OUTBOUND = 1  // sent to the server, including the length tag
+};
+
+// A CaptureFrame is one recorded websocket message.
+struct CaptureFrame {
+    CaptureDirection direction;
+    double time; // milliseconds since the start of the capture
+    std::vector<uint8_t> data;
+};
+
+// A CaptureWriter appends frames to a capture file.
+class CaptureWriter
+{
+  public:
+    CaptureWriter();
+    ~CaptureWriter();
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    // open creates (or truncates) the capture file at <path>. Returns false if it can't be written.
+    bool open(const std::string &path);
+    void close();
+    inline bool is_open() const
+    {
+        return m_file != nullptr;
+    }
+
+    // write records <data> as sent or received at <time>, in milliseconds of a monotonic clock.
+    void write(CaptureDirection direction, double time, const uint8_t *data, size_t length);
+
+    inline uint64_t get_num_frames() const
+    {
+        return m_frames;
+    }
+
+  private:
+    void write_varint(uint64_t value);
+
+    FILE *m_file;
+    double m_start_time;
+    uint64_t m_last_micros; // time of the last record, since the start
+    uint64_t m_frames;
+};
+
+// A CaptureReader reads the frames of a capture file in order.
+class CaptureReader
+{
+  public:
+    CaptureReader();
+    ~CaptureReader();
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    // open opens the capture file at <path>. Returns false if it can't be read or isn't a capture.
+    bool open(const std::string &path);
+    void close();
+    inline bool is_open() const
+    {
+        return m_file != nullptr;
+    }
+
+    // next reads the next frame into <frame>, reusing its buffer. Returns false at the end of
+    // the file, or if the rest of the file is truncated.
+    bool next(CaptureFrame &frame);
+
+  private:
+    bool read_varint(uint64_t &value);
+
+    FILE *m_file;
+    uint64_t m_micros;
+};
+} // close namespace astron
+
+#endif //ASTRON_LIBWASM_CAPTURE_HXX
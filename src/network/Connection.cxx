@@ -15,8 +15,11 @@
 #endif // __EMSCRIPTEN__
 
 #include <vector>
+#include <algorithm>
+#include <emscripten/emscripten.h>
 #include <emscripten/websocket.h>
 #include "Connection.hxx"
+#include "LoopbackPeer.hxx"
 #include "Datagram.hxx"
 #include "DatagramIterator.hxx"
 
@@ -30,7 +33,6 @@ Connection::Connection() : m_log("connection", "Connection") // constructor; cre
 
     if(!ws_support) {
         logger().error() << "WebSocket is not supported in your browser. Please upgrade your browser!";
-        g_logger->js_flush();
         emscripten_force_exit(1); // exit w/ code 1 (error)
     }
 }
@@ -38,7 +40,9 @@ Connection::Connection() : m_log("connection", "Connection") // constructor; cre
 Connection::~Connection() // destructor
 {
     logger().debug() << "Connection destructor called.";
-    g_logger->js_flush();
+#ifdef ASTRON_THREADED_DECODE
+    stop_decode_thread();
+#endif
     if(m_socket) {
         disconnect(1000, "Connection instance destructor called with open web socket.");
     }
@@ -48,12 +52,27 @@ void Connection::em_main_loop(void *arg)
 {
     Connection* self = static_cast<Connection*>(arg);
 
-    // if socket is not ready, don't do anything this 'frame'
-    unsigned short socket_ready_state;
-    emscripten_websocket_get_ready_state(self->get_em_socket(), &socket_ready_state);
-    if(!socket_ready_state) return;
+    // if socket is not open, don't do anything this 'frame' (but show what was logged meanwhile)
+    if(!self->m_socket_open) {
+        if(g_logger->get_auto_flush()) {
+            g_logger->flush();
+        }
+        return;
+    }
 
-    self->handle_datagram();
+    self->poll(self->m_frame_budget, self->m_frame_max_messages);
+}
+
+void Connection::em_event_poll(void *arg)
+{
+    Connection* self = static_cast<Connection*>(arg);
+    self->m_poll_scheduled = false;
+    if(!self->m_is_forever || self->m_loop_mode != LOOP_EVENT_DRIVEN) return;
+
+    self->poll(self->m_frame_budget, self->m_frame_max_messages);
+    if(self->has_pending_input()) {
+        self->schedule_poll(); // the rest is handled next frame
+    }
 }
 
 /* Polls datagrams forever using an emscripten loop.
@@ -66,20 +85,139 @@ void Connection::em_main_loop(void *arg)
 void Connection::poll_forever()
 {
     m_is_forever = true;
-    emscripten_set_main_loop_arg(this->em_main_loop, this, m_em_loop_fps, m_em_simulate_infinite_loop);
+    start_loop();
+}
+
+void Connection::set_loop_mode(LoopMode mode, int fps)
+{
+    m_loop_mode = mode;
+    m_em_loop_fps = fps;
+    if(m_is_forever) {
+        start_loop();
+    }
+}
+
+void Connection::start_loop()
+{
+    if(m_loop_mode == LOOP_EVENT_DRIVEN) {
+        if(m_main_loop_set) {
+            emscripten_cancel_main_loop();
+            m_main_loop_set = false;
+        }
+        if(has_pending_input()) {
+            schedule_poll();
+        }
+        return;
+    }
+
+    // A frame rate of 0 makes emscripten use requestAnimationFrame.
+    int fps = (m_loop_mode == LOOP_ANIMATION_FRAME) ? 0 : m_em_loop_fps;
+    if(m_main_loop_set) {
+        if(fps == 0) {
+            emscripten_set_main_loop_timing(EM_TIMING_RAF, 1);
+        } else {
+            emscripten_set_main_loop_timing(EM_TIMING_SETTIMEOUT, 1000 / fps);
+        }
+        return;
+    }
+    m_main_loop_set = true;
+    emscripten_set_main_loop_arg(this->em_main_loop, this, fps, m_em_simulate_infinite_loop);
+}
+
+void Connection::request_poll()
+{
+    if(m_is_forever && m_loop_mode == LOOP_EVENT_DRIVEN) {
+        schedule_poll();
+    }
+}
+
+void Connection::schedule_poll()
+{
+    if(m_poll_scheduled) return;
+    m_poll_scheduled = true;
+    emscripten_async_call(this->em_event_poll, this, -1); // -1: on the next animation frame
+}
+
+bool Connection::has_pending_input() const
+{
+#ifdef ASTRON_THREADED_DECODE
+    if(!m_frame_backlog.empty() || !m_frames.empty() || !m_decoded.empty() || !m_decode_idle.load()) {
+        return true;
+    }
+#endif
+    return m_backlog > 0 || m_replay.is_open() || m_loopback != nullptr || has_pending_output();
+}
+
+bool Connection::has_pending_output() const
+{
+    // Subclasses that hold back outgoing messages override this method. (i.e. ClientRepository)
+    return false;
 }
 
 void Connection::poll_till_empty()
 {
-    while(!m_received_datagrams.empty()) {
-        handle_datagram();
+    if(m_replay.is_open()) {
+        feed_replay();
+    }
+    if(m_loopback != nullptr) {
+        m_loopback->update(*this);
+    }
+#ifdef ASTRON_THREADED_DECODE
+    collect_decoded();
+#endif
+    while(m_backlog > 0) {
+        dispatch_datagram(next_queue());
+    }
+    handle_poll_end();
+    if(g_logger->get_auto_flush()) {
+        g_logger->flush();
+    }
+}
+
+size_t Connection::poll(double max_micros, size_t max_messages)
+{
+    double start = emscripten_get_now();
+    double deadline = start + max_micros / 1000.0;
+    if(m_replay.is_open()) {
+        feed_replay();
+    }
+    if(m_loopback != nullptr) {
+        m_loopback->update(*this);
+    }
+#ifdef ASTRON_THREADED_DECODE
+    collect_decoded();
+#endif
+
+    size_t handled = 0;
+    double now = start;
+    while(m_backlog > 0 && (max_messages == 0 || handled < max_messages) && now < deadline) {
+        Lane *lane = next_queue();
+        ++m_poll_stats.handled[lane - m_received_datagrams];
+        dispatch_datagram(lane);
+        ++handled;
+        now = emscripten_get_now();
+    }
+    handle_poll_end();
+    if(g_logger->get_auto_flush()) {
+        g_logger->flush();
+    }
+
+    PollStats &stats = m_poll_stats;
+    ++stats.polls;
+    stats.messages += handled;
+    stats.last_time = now - start;
+    stats.max_time = std::max(stats.max_time, stats.last_time);
+    stats.last_backlog = m_backlog;
+    stats.max_backlog = std::max(stats.max_backlog, m_backlog);
+    if(m_backlog > 0) {
+        ++stats.over_budget;
     }
+    return handled;
 }
 
 void Connection::connect_socket(std::string url)
 {
     logger().info() << "Initializing WebSocket connection.";
-    g_logger->js_flush();
 
     // create a new emscripten websocket
     EmscriptenWebSocketCreateAttributes ws_attributes;
@@ -92,10 +230,12 @@ void Connection::connect_socket(std::string url)
     ws_attributes.protocols = "binary";
     ws_attributes.createOnMainThread = EM_TRUE;
     m_socket = emscripten_websocket_new(&ws_attributes); // returns EMSCRIPTEN_WEBSOCKET_T
+#ifdef ASTRON_THREADED_DECODE
+    start_decode_thread();
+#endif
 
     if(m_socket < 0) {  // if < 0, creation failed
         logger().fatal() << "Failed to create new WebSocket. API returned: " << std::to_string(m_socket);
-        g_logger->js_flush();
     }
 
     // Set callbacks for the websocket states
@@ -106,17 +246,31 @@ void Connection::connect_socket(std::string url)
 
     if(err_res < 0 || msg_res < 0 || open_res < 0 || close_res < 0) {
         logger().fatal() << "Failed to create Emscripten callbacks for WebSocket states.";
-        g_logger->js_flush();
         emscripten_websocket_deinitialize();
         emscripten_force_exit(1); // exit w/ code 1 (error)
     }
 }
 
+void Connection::connect_loopback(LoopbackPeer *peer)
+{
+    logger().info() << "Connecting to an in-process loopback peer.";
+    m_loopback = peer;
+    m_socket_open = true;
+#ifdef ASTRON_THREADED_DECODE
+    start_decode_thread(); // the peer's messages are decoded like the socket's
+#endif
+    request_poll();
+}
+
 EMSCRIPTEN_RESULT Connection::disconnect(unsigned short code, const char *reason)
 {
+    if(m_loopback != nullptr) {
+        m_loopback = nullptr;
+        m_socket_open = (m_socket != 0);
+        return EMSCRIPTEN_RESULT_SUCCESS;
+    }
     if(!m_socket) {
         logger().warning() << "Connection::disconnect() called, but m_socket is 0 (no socket).";
-        g_logger->js_flush();
         return EMSCRIPTEN_RESULT_SUCCESS;
     }
     // check ready state. only close if ready
@@ -127,18 +281,20 @@ EMSCRIPTEN_RESULT Connection::disconnect(unsigned short code, const char *reason
         EMSCRIPTEN_RESULT res = emscripten_websocket_close(m_socket, code, reason);
         if(res != EMSCRIPTEN_RESULT_SUCCESS) {
             logger().fatal() << "Failed to close a ready websocket.";
-            g_logger->js_flush();
             return res; // EMSCRIPTEN_RESULT_SUCCESS == 0
         }
     }
     EMSCRIPTEN_RESULT res = emscripten_websocket_delete(m_socket); // free socket handle from memory
     m_socket = 0; // reset m_socket value
+    m_socket_open = false;
     return res;
 }
 
 void Connection::send_datagram(const DatagramPtr &dg)
 {
-    const DatagramPtr packet_dg = Datagram::create();
+    // The packet buffer is reused; emscripten copies the data before returning.
+    const DatagramPtr &packet_dg = m_packet_dg;
+    packet_dg->clear();
     packet_dg->add_uint16(dg->size()); // add uint16_t dg size header
     packet_dg->add_data(dg->get_data(), dg->size());
 
@@ -146,14 +302,185 @@ void Connection::send_datagram(const DatagramPtr &dg)
     uint8_t* dg_data = const_cast<uint8_t*>(packet_dg->get_data());
     void* packet_data = static_cast<void*>(dg_data); // ^^ so many casts ... necessary.
 
-    emscripten_websocket_send_binary(m_socket, packet_data, packet_len);
+    if(m_capture.is_open()) {
+        m_capture.write(CAPTURE_OUTBOUND, emscripten_get_now(), dg_data, packet_len);
+    }
+    if(m_loopback != nullptr) {
+        m_loopback->handle_datagram(*this, dg);
+    } else if(!m_replay.is_open()) {
+        emscripten_websocket_send_binary(m_socket, packet_data, packet_len);
+    }
+#ifdef ASTRON_METRICS
+    uint16_t msg_type = dg->size() >= sizeof(uint16_t) ? uint16_t(dg->get_data()[0] | dg->get_data()[1] << 8) : 0;
+    m_metrics.record_sent(msg_type, packet_len);
+#endif
 }
 
+DatagramPtr Connection::get_send_datagram()
+{
+    m_send_dg->clear();
+    return m_send_dg;
+}
+
+void Connection::dispatch_datagram(Lane *lane)
+{
+#ifdef ASTRON_METRICS
+    if(lane != nullptr) {
+        const std::vector<uint8_t> &front = lane->front().data;
+        uint16_t msg_type = front.size() >= sizeof(uint16_t) ? uint16_t(front[0] | front[1] << 8) : 0;
+        size_t length = front.size();
+        m_metrics.record_queue_depth(m_backlog);
+
+        double start = emscripten_get_now();
+        handle_datagram();
+        m_metrics.record_received(msg_type, length, emscripten_get_now() - start);
+        return;
+    }
+#endif // ASTRON_METRICS
+    handle_datagram();
+}
+
+#ifdef ASTRON_METRICS
+void Connection::export_metrics()
+{
+    std::string json = m_metrics.to_json();
+    EM_ASM({ Module['astronMetrics'] = JSON.parse(UTF8ToString($0)); }, json.c_str());
+}
+#endif // ASTRON_METRICS
+
 void Connection::handle_datagram()
 {
     // Subclasses of `Connection` override this method. (i.e. ClientRepository)
 }
 
+bool Connection::validate_datagram(const uint8_t *data, size_t length)
+{
+    // Subclasses that know the message layouts override this method. (i.e. ObjectRepository)
+    return true;
+}
+
+template <typename F>
+void Connection::decode_frame(const uint8_t *data, size_t length, F ready)
+{
+    // A websocket message holds one or more [uint16 length][datagram] frames.
+    const uint8_t *end = data + length;
+    if(!m_partial_datagram.empty()) {
+        m_partial_datagram.insert(m_partial_datagram.end(), data, end);
+        data = &m_partial_datagram[0];
+        end = data + m_partial_datagram.size();
+    }
+
+    std::vector<uint8_t> remainder;
+    while(data != end) {
+        uint16_t dg_size = 0;
+        if(end - data >= 2) {
+            dg_size = uint16_t(data[0] | data[1] << 8);
+        }
+        if(end - data < 2 || size_t(end - data) < sizeof(uint16_t) + dg_size) {
+            remainder.assign(data, end); // wait for the rest of the datagram
+            break;
+        }
+
+        const uint8_t *dg_data = data + sizeof(uint16_t);
+        data = dg_data + dg_size;
+        if(!validate_datagram(dg_data, dg_size)) {
+            logger().error() << "Dropped a received datagram that could not be read.";
+            continue;
+        }
+        std::vector<uint8_t> dg(dg_data, dg_data + dg_size);
+        ready(dg);
+    }
+    m_partial_datagram.swap(remainder);
+}
+
+#ifdef ASTRON_THREADED_DECODE
+void Connection::start_decode_thread()
+{
+    if(m_decode_running.load()) return;
+    m_decode_running.store(true);
+    m_decode_idle.store(false); // until the thread finds nothing to decode
+    m_decode_thread = std::thread(&Connection::decode_loop, this);
+}
+
+void Connection::stop_decode_thread()
+{
+    if(!m_decode_running.exchange(false)) return;
+    {
+        std::lock_guard<std::mutex> guard(m_decode_lock);
+    }
+    m_decode_cond.notify_one();
+    m_decode_thread.join();
+    m_decode_idle.store(true);
+}
+
+void Connection::decode_loop()
+{
+    std::vector<uint8_t> frame;
+    while(m_decode_running.load(std::memory_order_acquire)) {
+        if(!m_frames.pop(frame)) {
+            std::unique_lock<std::mutex> lock(m_decode_lock);
+            m_decode_idle.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_decode_cond.wait(lock, [this]() {
+                return !m_frames.empty() || !m_decode_running.load(std::memory_order_acquire);
+            });
+            m_decode_idle.store(false);
+            continue;
+        }
+
+        decode_frame(frame.data(), frame.size(), [this](std::vector<uint8_t> &dg) {
+            // The main thread only ever waits on the network, so wait for it to catch up.
+            while(!m_decoded.push(dg) && m_decode_running.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        });
+    }
+}
+
+void Connection::queue_frame(std::vector<uint8_t> &frame)
+{
+    // The main thread must never block, so messages that don't fit wait in a backlog.
+    if(!m_frame_backlog.empty() || !m_frames.push(frame)) {
+        m_frame_backlog.push_back(std::move(frame));
+        flush_frame_backlog();
+    }
+    notify_decode_thread();
+}
+
+void Connection::flush_frame_backlog()
+{
+    while(!m_frame_backlog.empty() && m_frames.push(m_frame_backlog.front())) {
+        m_frame_backlog.pop_front();
+    }
+}
+
+void Connection::notify_decode_thread()
+{
+    // Only wake the decode thread if it's waiting; a busy one will see the new message.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!m_decode_idle.load()) return;
+
+    // Taking the lock orders the push before the decode thread's check of the queue.
+    {
+        std::lock_guard<std::mutex> guard(m_decode_lock);
+    }
+    m_decode_cond.notify_one();
+}
+
+void Connection::collect_decoded()
+{
+    if(!m_frame_backlog.empty()) {
+        flush_frame_backlog();
+        notify_decode_thread();
+    }
+
+    std::vector<uint8_t> dg;
+    while(m_decoded.pop(dg)) {
+        _add_datagram_data(std::move(dg));
+    }
+}
+#endif // ASTRON_THREADED_DECODE
+
 EM_BOOL Connection::on_error(int eventType, const EmscriptenWebSocketErrorEvent *websocketEvent, void *userData)
 {
     /* Since callback functions have to be static, we have no access to our class instance.
@@ -163,31 +490,119 @@ EM_BOOL Connection::on_error(int eventType, const EmscriptenWebSocketErrorEvent
      */
     Connection* self = static_cast<Connection*>(userData);
     self->logger().fatal() << "Received Emscripten WebSocket error event!";
-    g_logger->js_flush();
     return EM_TRUE;
 }
 
 EM_BOOL Connection::on_message(int eventType, const EmscriptenWebSocketMessageEvent *websocketEvent, void *userData)
 {
     Connection* self = static_cast<Connection*>(userData);
-    const uint8_t* data = websocketEvent->data;
-    uint32_t length = websocketEvent->numBytes;
+    self->receive_message(websocketEvent->data, websocketEvent->numBytes);
+    return EM_TRUE;
+}
+
+void Connection::receive_message(const uint8_t *data, size_t length)
+{
+    if(m_capture.is_open()) {
+        m_capture.write(CAPTURE_INBOUND, emscripten_get_now(), data, length);
+    }
+    receive_frame(data, length);
 
-    DatagramPtr dg = Datagram::create(); // store binary data into datagram
-    dg->add_blob(data, static_cast<dgsize_t>(length));
+    request_poll();
+}
 
-    DatagramIterator dgi = DatagramIterator(dg, 0); // create dgi to read data easily
-    uint16_t dg_size_tag = dgi.read_uint16(); // TODO: Use dg_size_tag to determine if multiple dgs were received.
+void Connection::receive_frame(const uint8_t *data, size_t length)
+{
+#ifdef ASTRON_METRICS
+    m_metrics.record_frame(length);
+#endif
+
+#ifdef ASTRON_THREADED_DECODE
+    std::vector<uint8_t> frame(data, data + length);
+    queue_frame(frame);
+#else
+    decode_frame(data, length, [this](std::vector<uint8_t> &dg) {
+        _add_datagram_data(std::move(dg));
+    });
+#endif // ASTRON_THREADED_DECODE
+}
 
-    self->_add_datagram_data(dgi.read_remainder()); // add datagram data to m_received_datagrams
-    return EM_TRUE;
+bool Connection::start_capture(const std::string &path)
+{
+    if(!m_capture.open(path)) {
+        logger().error() << "Failed to open capture file '" << path << "' for writing.";
+        return false;
+    }
+    logger().info() << "Capturing websocket messages to '" << path << "'.";
+    return true;
+}
+
+void Connection::stop_capture()
+{
+    if(m_capture.is_open()) {
+        logger().info() << "Captured " << m_capture.get_num_frames() << " websocket messages.";
+        m_capture.close();
+    }
+}
+
+bool Connection::start_replay(const std::string &path, ReplaySpeed speed)
+{
+    if(!m_replay.open(path)) {
+        logger().error() << "Failed to open capture file '" << path << "' for replay.";
+        return false;
+    }
+    logger().info() << "Replaying websocket messages from '" << path << "'.";
+    m_replay_speed = speed;
+    m_replay_start = emscripten_get_now();
+    m_replay_frame_ready = false;
+    m_socket_open = true; // let the main loop poll
+#ifdef ASTRON_THREADED_DECODE
+    start_decode_thread(); // without a socket, nothing has started it
+#endif
+
+    request_poll();
+    return true;
+}
+
+void Connection::stop_replay()
+{
+    m_replay.close();
+    m_replay_frame_ready = false;
+    if(!m_socket) {
+        m_socket_open = false;
+    }
+}
+
+void Connection::feed_replay()
+{
+    double elapsed = emscripten_get_now() - m_replay_start;
+    unsigned int delivered = 0;
+    while(m_replay_speed == REPLAY_RECORDED || delivered < REPLAY_BATCH) {
+        if(!m_replay_frame_ready && !m_replay.next(m_replay_frame)) {
+            logger().info() << "Finished replaying the capture.";
+            m_replay.close(); // the socket stays "open", so whatever was replayed can still be polled
+            return;
+        }
+        m_replay_frame_ready = true;
+        if(m_replay_frame.direction != CAPTURE_INBOUND) {
+            m_replay_frame_ready = false;
+            continue;
+        }
+        if(m_replay_speed == REPLAY_RECORDED && m_replay_frame.time > elapsed) {
+            return; // not due yet
+        }
+
+        m_replay_frame_ready = false;
+        const std::vector<uint8_t> &data = m_replay_frame.data;
+        receive_frame(data.empty() ? nullptr : &data[0], data.size());
+        ++delivered;
+    }
 }
 
 EM_BOOL Connection::on_open(int eventType, const EmscriptenWebSocketOpenEvent *websocketEvent, void *userData)
 {
     Connection* self = static_cast<Connection*>(userData);
     self->logger().debug() << "Received Emscripten WebSocket open event!";
-    g_logger->js_flush();
+    self->m_socket_open = true;
     return EM_TRUE;
 }
 
@@ -195,7 +610,7 @@ EM_BOOL Connection::on_close(int eventType, const EmscriptenWebSocketCloseEvent
 {
     Connection* self = static_cast<Connection*>(userData);
     self->logger().debug() << "Received Emscripten WebSocket close event.";
-    g_logger->js_flush();
+    self->m_socket_open = false;
     self->_call_handle_disconnect();
     return EM_TRUE;
 }
@@ -205,10 +620,175 @@ void Connection::handle_disconnect()
     // Called after disconnect occurs. Can be overridden by the user.
 }
 
+void Connection::handle_poll_end()
+{
+    // Called after each poll. Subclasses use this to flush anything batched during the poll.
+}
+
 /* static callback for message event needs to access this method */
 void Connection::_add_datagram_data(std::vector<uint8_t> bytes)
 {
-    m_received_datagrams.push_back(std::move(bytes));
+    Classification c;
+    if(!bytes.empty()) {
+        classify_datagram(&bytes[0], bytes.size(), c);
+    }
+    if(c.drop) {
+        ++m_poll_stats.dropped;
+        return;
+    }
+    unsigned int lane = c.priority < NUM_PRIORITIES ? c.priority : unsigned(PRIORITY_NORMAL);
+    uint64_t sequence = m_next_sequence++;
+
+    if(c.order_key != 0) {
+        OrderState &state = m_order_states[c.order_key];
+        if(c.retires) {
+            // The retired datagrams stay in their lanes until they reach the front, where
+            // next_queue() throws them away.
+            for(unsigned int n = 0; n < NUM_PRIORITIES; ++n) {
+                uint32_t retired = state.droppable[n];
+                state.queued[n] -= retired;
+                state.droppable[n] = 0;
+                state.stale += retired;
+                m_lane_depth[n] -= retired;
+                m_backlog -= retired;
+                m_stale += retired;
+                m_poll_stats.dropped += retired;
+            }
+            state.stale_before = sequence;
+        }
+
+        // Never overtake an earlier datagram with the same key.
+        for(unsigned int n = NUM_PRIORITIES - 1; n > lane; --n) {
+            if(state.queued[n] > 0) {
+                lane = n;
+                break;
+            }
+        }
+        ++state.queued[lane];
+        if(c.droppable) {
+            ++state.droppable[lane];
+        }
+    }
+    if(c.group_key != 0) {
+        // Counted in the lane it was queued in, and never retired by the group key.
+        ++m_order_states[c.group_key].queued[lane];
+    }
+
+    QueuedDatagram entry = {std::move(bytes), c.order_key, c.group_key, sequence, c.droppable};
+    m_received_datagrams[lane].push_back(std::move(entry));
+    ++m_lane_depth[lane];
+    ++m_backlog;
+}
+
+void Connection::classify_datagram(const uint8_t *data, size_t length, Classification &c)
+{
+    // Subclasses that know the message types override this method. (i.e. ClientRepository)
+}
+
+bool Connection::is_order_key_queued(uint64_t order_key, bool include_droppable) const
+{
+    auto it = m_order_states.find(order_key);
+    if(it == m_order_states.end()) {
+        return false;
+    }
+    const OrderState &state = it->second;
+    for(unsigned int n = 0; n < NUM_PRIORITIES; ++n) {
+        if(state.queued[n] > (include_droppable ? 0 : state.droppable[n])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Connection::release_order_key(const QueuedDatagram &entry, unsigned int lane, bool stale)
+{
+    if(entry.order_key == 0) {
+        return;
+    }
+    auto it = m_order_states.find(entry.order_key);
+    if(it == m_order_states.end()) {
+        return;
+    }
+    OrderState &state = it->second;
+    if(stale) {
+        --state.stale;
+    } else {
+        --state.queued[lane];
+        if(entry.droppable) {
+            --state.droppable[lane];
+        }
+    }
+    forget_order_state(it);
+}
+
+void Connection::release_group_key(const QueuedDatagram &entry, unsigned int lane)
+{
+    if(entry.group_key == 0) {
+        return;
+    }
+    auto it = m_order_states.find(entry.group_key);
+    if(it == m_order_states.end()) {
+        return;
+    }
+    --it->second.queued[lane];
+    forget_order_state(it);
+}
+
+void Connection::forget_order_state(std::unordered_map<uint64_t, OrderState>::iterator it)
+{
+    const OrderState &state = it->second;
+    if(state.stale > 0) {
+        return;
+    }
+    for(unsigned int n = 0; n < NUM_PRIORITIES; ++n) {
+        if(state.queued[n] > 0) {
+            return;
+        }
+    }
+    m_order_states.erase(it);
+}
+
+Connection::Lane* Connection::next_queue()
+{
+    if(m_backlog == 0) {
+        return nullptr;
+    }
+    for(unsigned int priority = 0; priority < NUM_PRIORITIES; ++priority) {
+        Lane &lane = m_received_datagrams[priority];
+        // Only look up the order keys while something has been retired.
+        while(m_stale > 0 && !lane.empty() && lane.front().droppable) {
+            const QueuedDatagram &front = lane.front();
+            auto it = m_order_states.find(front.order_key);
+            if(it == m_order_states.end() || front.sequence >= it->second.stale_before) {
+                break;
+            }
+            release_order_key(front, priority, true);
+            release_group_key(front, priority);
+            lane.pop_front();
+            --m_stale;
+        }
+        if(!lane.empty()) {
+            return &lane;
+        }
+    }
+    return nullptr;
+}
+
+DatagramPtr Connection::next_datagram()
+{
+    Lane *lane = next_queue();
+    if(lane == nullptr) {
+        return nullptr;
+    }
+    QueuedDatagram &entry = lane->front();
+    unsigned int priority = unsigned(lane - m_received_datagrams);
+    DatagramPtr dg = Datagram::create(entry.data);
+    release_order_key(entry, priority, false);
+    release_group_key(entry, priority);
+    lane->pop_front();
+    --m_lane_depth[priority];
+    --m_backlog;
+    return dg;
 }
 
 /* static callback needs to access handle_disconnect() via this method */
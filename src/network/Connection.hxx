@@ -18,16 +18,84 @@
 #endif // __EMSCRIPTEN__
 
 #include <vector>
+#include <deque>
+#include <limits>
+#include <unordered_map>
 #include <emscripten/websocket.h>
 #include "../util/Logger.hxx"
 #include "Datagram.hxx"
+#include "Capture.hxx"
+#ifdef ASTRON_METRICS
+#include "ConnectionMetrics.hxx"
+#endif
+#ifdef ASTRON_THREADED_DECODE
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "../util/SpscQueue.hxx"
+#endif
 
 namespace astron   // open namespace
 {
 
+class LoopbackPeer; // forward declaration
+
 class Connection
 {
   public:
+    // Received datagrams are queued in a lane per priority, and the lanes are handled in order
+    // of priority; see classify_datagram().
+    enum MessagePriority : unsigned int {
+        PRIORITY_CONTROL,  // connection state, such as CLIENT_EJECT
+        PRIORITY_INTEREST, // objects entering, and interest completions
+        PRIORITY_NORMAL,   // everything else
+        PRIORITY_LOW,      // cosmetic updates, which can wait behind everything else
+        NUM_PRIORITIES
+    };
+
+    // A Classification tells the scheduler how to queue a received datagram.
+    struct Classification {
+        unsigned int priority = PRIORITY_NORMAL;
+        // Datagrams with the same non-zero order key (such as a doid) are handled in the order
+        // they were received: a datagram is queued in its own lane, or in the least important
+        // lane still holding an earlier datagram with its key, whichever is less important.
+        uint64_t order_key = 0;
+        // A datagram with a non-zero group key is also counted as a datagram with that order key,
+        // so the datagrams later ordered by the group key wait behind it (it doesn't wait itself).
+        uint64_t group_key = 0;
+        bool droppable = false; // may be dropped by a later datagram with the same key that retires it
+        bool retires = false;   // drops the earlier droppable datagrams with the same key still queued
+        bool drop = false;      // drop the datagram without queueing it
+    };
+
+    // A LoopMode selects what drives poll_forever().
+    enum LoopMode {
+        LOOP_ANIMATION_FRAME, // poll once per browser frame (requestAnimationFrame)
+        LOOP_FIXED_RATE,      // poll at a fixed number of times per second
+        LOOP_EVENT_DRIVEN     // poll only after messages arrive; no work at all while idle
+    };
+
+    // A ReplaySpeed selects how fast start_replay() delivers the messages of a capture.
+    enum ReplaySpeed {
+        REPLAY_RECORDED, // each message once the time it was recorded at has elapsed
+        REPLAY_MAX_SPEED // as fast as they are handled; up to REPLAY_BATCH messages per poll
+    };
+    static const unsigned int REPLAY_BATCH = 256;
+
+    // PollStats describes the work done by poll().
+    struct PollStats {
+        uint64_t polls = 0;
+        uint64_t messages = 0;
+        uint64_t handled[NUM_PRIORITIES] = {}; // messages, by priority
+        uint64_t over_budget = 0; // polls that stopped with messages left over
+        uint64_t dropped = 0;     // messages dropped by classify_datagram() or retired before being handled
+        double last_time = 0.0;   // milliseconds spent by the last poll
+        double max_time = 0.0;
+        size_t last_backlog = 0;  // messages left over by the last poll
+        size_t max_backlog = 0;
+    };
+
     Connection();
     ~Connection();
 
@@ -38,18 +106,97 @@ class Connection
     }
 
     void send_datagram(const DatagramPtr &dg);
+
+    // get_send_datagram returns a cleared datagram that is reused for every call, to build
+    // frequently sent messages without allocating. It must be sent before it is requested again.
+    DatagramPtr get_send_datagram();
     void poll_forever();
     void poll_till_empty();
 
+    // set_loop_mode selects how poll_forever() polls; <fps> is only used by LOOP_FIXED_RATE.
+    // The default is LOOP_FIXED_RATE at 60 fps. Can be changed while polling forever.
+    void set_loop_mode(LoopMode mode, int fps = 60);
+    inline LoopMode get_loop_mode() const
+    {
+        return m_loop_mode;
+    }
+    // set_frame_budget sets the budget of each poll made by poll_forever(); see poll().
+    // By default every waiting message is handled.
+    inline void set_frame_budget(double max_micros, size_t max_messages = 0)
+    {
+        m_frame_budget = max_micros;
+        m_frame_max_messages = max_messages;
+    }
+
+    // poll handles received messages, most important first, until <max_micros> microseconds
+    // or <max_messages> messages (0 is unlimited) have been spent. Messages left over are
+    // handled by the next poll. Returns the number of messages handled.
+    size_t poll(double max_micros, size_t max_messages = 0);
+
+    // get_backlog returns the number of received messages waiting to be handled.
+    inline size_t get_backlog() const
+    {
+        return m_backlog;
+    }
+    // get_lane_depth returns the number of received messages waiting in the lane of <priority>.
+    inline size_t get_lane_depth(unsigned int priority) const
+    {
+        return priority < NUM_PRIORITIES ? m_lane_depth[priority] : 0;
+    }
+    inline const PollStats& get_poll_stats() const
+    {
+        return m_poll_stats;
+    }
+    inline void reset_poll_stats()
+    {
+        m_poll_stats = PollStats();
+    }
+
+    // start_capture records every websocket message received and sent to the capture file at
+    // <path>, with timestamps; see Capture.hxx. Under Emscripten the path is in its file system
+    // (in memory unless a real one, such as NODEFS, is mounted). Returns false if it can't be written.
+    bool start_capture(const std::string &path);
+    void stop_capture();
+    inline bool is_capturing() const
+    {
+        return m_capture.is_open();
+    }
+
+    // start_replay feeds the received messages of a capture file to this connection, in place of a
+    // websocket, at the recorded or maximum speed. They are decoded, queued and handled exactly like
+    // messages from the socket. Messages sent while replaying are discarded (or captured, if capturing).
+    // Returns false if the file can't be read.
+    bool start_replay(const std::string &path, ReplaySpeed speed = REPLAY_RECORDED);
+    void stop_replay();
+    // is_replaying returns true until every message of the capture has been delivered.
+    inline bool is_replaying() const
+    {
+        return m_replay.is_open();
+    }
+
     virtual void handle_datagram(); // over-ridden by child classes (i.e. ClientRepository)
     void _add_datagram_data(std::vector<uint8_t> bytes); // static callback needs to access this
 
     /* WebSocket Operations */
     void connect_socket(std::string url); // does not send Astron messages, just connects the websocket
     EMSCRIPTEN_RESULT disconnect(unsigned short code, const char *reason);
+    // connect_loopback connects to <peer>, an in-process stand-in for the server (such as
+    // LoopbackAgent), instead of opening a websocket. Sent datagrams are passed to the peer,
+    // and the peer delivers its messages at the start of every poll. disconnect() detaches it.
+    void connect_loopback(LoopbackPeer *peer);
     EMSCRIPTEN_WEBSOCKET_T get_em_socket();
     void _call_handle_disconnect(); // needed for static callback to access this function
 
+#ifdef ASTRON_METRICS
+    // get_metrics returns the message counters of this connection; copy it to take a snapshot.
+    inline ConnectionMetrics& get_metrics()
+    {
+        return m_metrics;
+    }
+    // export_metrics sets `Module.astronMetrics` to the current metrics, as a JS object.
+    void export_metrics();
+#endif // ASTRON_METRICS
+
   protected:
     LogCategory m_log;
     bool m_secure_websocket = false; // default ws://
@@ -58,19 +205,154 @@ class Connection
         m_secure_websocket = value;
     }
     virtual void handle_disconnect();
+    // handle_poll_end is called after each poll (each main loop tick, or poll_till_empty() call).
+    virtual void handle_poll_end();
+    // has_pending_output returns true if handle_poll_end() has outgoing messages to send, so that
+    // the event-driven loop keeps polling until they are sent.
+    virtual bool has_pending_output() const;
+    // request_poll has the LOOP_EVENT_DRIVEN loop poll on the next frame, e.g. after queueing
+    // an outgoing message for handle_poll_end(). The other loop modes poll every frame anyway.
+    void request_poll();
+
+    // next_datagram removes and returns the oldest received datagram of the highest priority,
+    // or nullptr if there is none.
+    DatagramPtr next_datagram();
+
+    // classify_datagram fills in how a received datagram is queued; <c> starts out as the default
+    // Classification, which queues the datagram with PRIORITY_NORMAL and no order key.
+    virtual void classify_datagram(const uint8_t *data, size_t length, Classification &c);
+
+    // is_order_key_queued returns true if a received datagram with <order_key> is waiting to be
+    // handled. If <include_droppable> is false, only datagrams that can't be retired are counted.
+    bool is_order_key_queued(uint64_t order_key, bool include_droppable = true) const;
+
+    // validate_datagram is called for every received datagram before it is queued for
+    // handle_datagram(), to check that it can be read safely; invalid datagrams are dropped.
+    // With ASTRON_THREADED_DECODE it runs on the decode thread, so it must only use state
+    // that doesn't change while connected (such as the dc file).
+    virtual bool validate_datagram(const uint8_t *data, size_t length);
+
+#ifdef ASTRON_THREADED_DECODE
+    // stop_decode_thread stops the decode thread. Subclasses overriding validate_datagram
+    // call this in their destructor, so the thread never sees them half-destroyed.
+    void stop_decode_thread();
+#endif // ASTRON_THREADED_DECODE
 
   private:
+    // A QueuedDatagram is a received datagram waiting in a lane.
+    struct QueuedDatagram {
+        std::vector<uint8_t> data;
+        uint64_t order_key;
+        uint64_t group_key;
+        uint64_t sequence;
+        bool droppable;
+    };
+    typedef std::deque<QueuedDatagram> Lane;
+
+    // An OrderState tracks the queued datagrams of one order key.
+    struct OrderState {
+        uint32_t queued[NUM_PRIORITIES] = {};    // datagrams to handle, by lane
+        uint32_t droppable[NUM_PRIORITIES] = {}; // of which droppable
+        uint32_t stale = 0;         // retired datagrams not yet removed from their lane
+        uint64_t stale_before = 0;  // droppable datagrams sequenced before this are retired
+    };
+
+    // next_queue returns the lane of the next datagram to handle, or nullptr if there is none.
+    // Retired datagrams at the front of the lanes are removed on the way.
+    Lane* next_queue();
+    // dispatch_datagram calls handle_datagram() for the next received datagram, at the front of
+    // <lane> (from next_queue()), recording metrics.
+    void dispatch_datagram(Lane *lane);
+    // release_order_key forgets a datagram taken off <lane>.
+    void release_order_key(const QueuedDatagram &entry, unsigned int lane, bool stale);
+    // release_group_key forgets a datagram taken off <lane> under its group key.
+    void release_group_key(const QueuedDatagram &entry, unsigned int lane);
+    // forget_order_state drops the state of <it> once nothing with its key is queued.
+    void forget_order_state(std::unordered_map<uint64_t, OrderState>::iterator it);
+
+    friend class LoopbackPeer;
+
+    // receive_message handles a websocket message from the socket or a loopback peer.
+    void receive_message(const uint8_t *data, size_t length);
+    // receive_frame queues the datagrams of a websocket message, from the socket or a replay.
+    void receive_frame(const uint8_t *data, size_t length);
+    // feed_replay delivers the replayed messages that are due.
+    void feed_replay();
+
+    // decode_frame splits the datagrams out of a received websocket message (keeping an
+    // incomplete one until the rest arrives), validates them and passes them to <ready>.
+    template <typename F>
+    void decode_frame(const uint8_t *data, size_t length, F ready);
+
     bool m_is_forever = false;
+    LoopMode m_loop_mode = LOOP_FIXED_RATE;
     int m_em_loop_fps = 60;
     int m_em_simulate_infinite_loop = 0;
+    bool m_main_loop_set = false;
+    bool m_poll_scheduled = false; // LOOP_EVENT_DRIVEN: a poll is waiting to run
+    bool m_socket_open = false;    // set by the open event, so the loop doesn't ask every tick
+    double m_frame_budget = std::numeric_limits<double>::infinity(); // microseconds
+    size_t m_frame_max_messages = 0;
     EMSCRIPTEN_WEBSOCKET_T m_socket = 0; // int
 
+    // reused buffers for outgoing messages; see get_send_datagram()
+    DatagramPtr m_send_dg = Datagram::create();
+    DatagramPtr m_packet_dg = Datagram::create();
+
     // every time a socket message is received, the raw bytes of the
-    // datagram(s) received are stored in this vector. Each datagram is cleared after polled.
-    std::vector<std::vector<uint8_t>> m_received_datagrams;
+    // datagram(s) received are stored in these lanes. Each datagram is cleared after polled.
+    Lane m_received_datagrams[NUM_PRIORITIES];
+    size_t m_lane_depth[NUM_PRIORITIES] = {}; // datagrams to handle in each lane
+    size_t m_backlog = 0; // total datagrams to handle
+    size_t m_stale = 0;   // retired datagrams still in a lane
+    uint64_t m_next_sequence = 1;
+    std::unordered_map<uint64_t, OrderState> m_order_states; // by order key
+    PollStats m_poll_stats;
+    std::vector<uint8_t> m_partial_datagram; // start of a datagram split across messages
+
+    LoopbackPeer *m_loopback = nullptr;
+    CaptureWriter m_capture;
+    CaptureReader m_replay;
+    CaptureFrame m_replay_frame;        // the next message to replay
+    bool m_replay_frame_ready = false;  // m_replay_frame has been read and not yet delivered
+    ReplaySpeed m_replay_speed = REPLAY_RECORDED;
+    double m_replay_start = 0.0;
+
+#ifdef ASTRON_THREADED_DECODE
+    // With ASTRON_THREADED_DECODE, websocket messages are passed to a decode thread which
+    // reassembles and validates the datagrams, and passes them back to the main thread.
+    void start_decode_thread();
+    void decode_loop();
+    void collect_decoded();
+    void queue_frame(std::vector<uint8_t> &frame);
+    void flush_frame_backlog();
+    void notify_decode_thread();
+
+    SpscQueue<std::vector<uint8_t>> m_frames{1024};  // main thread -> decode thread
+    SpscQueue<std::vector<uint8_t>> m_decoded{4096}; // decode thread -> main thread
+    std::deque<std::vector<uint8_t>> m_frame_backlog; // messages that didn't fit in m_frames
+    std::thread m_decode_thread;
+    std::mutex m_decode_lock;
+    std::condition_variable m_decode_cond;
+    std::atomic<bool> m_decode_running{false};
+    std::atomic<bool> m_decode_idle{true}; // the decode thread is waiting for messages, or not started
+#endif // ASTRON_THREADED_DECODE
+
+#ifdef ASTRON_METRICS
+    ConnectionMetrics m_metrics;
+#endif
 
     // Used only if `poll_forever()` is called; Is set as the Emscripten main loop.
     static void em_main_loop(void *arg);
+    // Used by LOOP_EVENT_DRIVEN; scheduled for the next frame when messages arrive.
+    static void em_event_poll(void *arg);
+    // start_loop starts polling forever with the current loop mode.
+    void start_loop();
+    // schedule_poll schedules em_event_poll for the next frame, unless it already is.
+    void schedule_poll();
+    // has_pending_input returns true if messages are waiting, or still being decoded, or if
+    // outgoing messages are waiting for handle_poll_end().
+    bool has_pending_input() const;
 
     /* Emscripten Websocket event callbacks */
 
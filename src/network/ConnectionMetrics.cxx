@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file ConnectionMetrics.cxx
+ * @author Max Rodriguez
+ * @date 2023-06-24
+ */
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#endif
+
+#include <sstream>
+#include "ConnectionMetrics.hxx"
+
+namespace astron   // open namespace
+{
+
+ConnectionMetrics::ConnectionMetrics()
+{
+    reset();
+}
+
+double ConnectionMetrics::get_elapsed() const
+{
+    return emscripten_get_now() - m_start_time;
+}
+
+void ConnectionMetrics::reset()
+{
+    for(unsigned int i = 0; i < MAX_MSGTYPES; ++i) {
+        m_msgtypes[i] = MsgTypeStats();
+    }
+    m_bytes_in = 0;
+    m_bytes_out = 0;
+    m_queue_depth_total = 0;
+    m_queue_depth_samples = 0;
+    m_max_queue_depth = 0;
+    m_start_time = emscripten_get_now();
+}
+
+std::string ConnectionMetrics::to_json() const
+{
+    std::ostringstream out;
+    out << "{\"elapsed_ms\":" << get_elapsed()
+        << ",\"bytes_in\":" << m_bytes_in
+        << ",\"bytes_out\":" << m_bytes_out
+        << ",\"max_queue_depth\":" << m_max_queue_depth
+        << ",\"avg_queue_depth\":" << get_average_queue_depth()
+        << ",\"time_buckets_us\":[0";
+    for(unsigned int n = 1; n < NUM_TIME_BUCKETS; ++n) {
+        out << ',' << (1u << (n - 1));
+    }
+    out << "],\"msgtypes\":{";
+
+    bool first = true;
+    for(unsigned int i = 0; i < MAX_MSGTYPES; ++i) {
+        const MsgTypeStats &stats = m_msgtypes[i];
+        if(stats.received == 0 && stats.sent == 0) {
+            continue;
+        }
+        if(!first) {
+            out << ',';
+        }
+        first = false;
+
+        // The last slot collects every message type that doesn't have its own.
+        out << '"' << (i < MAX_MSGTYPES - 1 ? std::to_string(i) : std::string("other")) << "\":{"
+            << "\"received\":" << stats.received
+            << ",\"received_bytes\":" << stats.received_bytes
+            << ",\"sent\":" << stats.sent
+            << ",\"sent_bytes\":" << stats.sent_bytes
+            << ",\"handler_ms\":" << stats.handler_time
+            << ",\"max_handler_ms\":" << stats.max_handler_time
+            << ",\"time_buckets\":[";
+        for(unsigned int n = 0; n < NUM_TIME_BUCKETS; ++n) {
+            out << (n ? "," : "") << stats.time_buckets[n];
+        }
+        out << "]}";
+    }
+    out << "}}";
+    return out.str();
+}
+
+} // close namespace astron
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file ConnectionMetrics.hxx
+ * @author Max Rodriguez
+ * @date 2023-06-24
+ */
+
+#ifndef ASTRON_LIBWASM_CONNECTIONMETRICS_HXX
+#define ASTRON_LIBWASM_CONNECTIONMETRICS_HXX
+
+#include <string>
+#include <stdint.h>
+
+namespace astron   // open namespace
+{
+
+// ConnectionMetrics counts the messages a Connection receives and sends, by message type.
+// It is only compiled into Connection when ASTRON_METRICS is defined (-DUSE_METRICS=ON);
+// recording is a few array updates, so it can be left on in release builds.
+class ConnectionMetrics
+{
+  public:
+    // Message types are counted individually below MAX_MSGTYPES; all others share the last slot.
+    static const unsigned int MAX_MSGTYPES = 256;
+    // Handler times are counted in power-of-two buckets of microseconds: bucket 0 is < 1us,
+    // bucket n is [2^(n-1), 2^n) us, and the last bucket holds everything slower.
+    static const unsigned int NUM_TIME_BUCKETS = 16;
+
+    struct MsgTypeStats {
+        uint64_t received = 0;
+        uint64_t received_bytes = 0;
+        uint64_t sent = 0;
+        uint64_t sent_bytes = 0;
+        double handler_time = 0.0; // total, in milliseconds
+        double max_handler_time = 0.0;
+        uint32_t time_buckets[NUM_TIME_BUCKETS] = {};
+    };
+
+    ConnectionMetrics();
+
+    inline void record_received(uint16_t msg_type, size_t bytes, double handler_ms)
+    {
+        MsgTypeStats &stats = m_msgtypes[slot(msg_type)];
+        ++stats.received;
+        stats.received_bytes += bytes;
+        stats.handler_time += handler_ms;
+        if(handler_ms > stats.max_handler_time) {
+            stats.max_handler_time = handler_ms;
+        }
+        ++stats.time_buckets[time_bucket(handler_ms)];
+    }
+
+    inline void record_sent(uint16_t msg_type, size_t bytes)
+    {
+        MsgTypeStats &stats = m_msgtypes[slot(msg_type)];
+        ++stats.sent;
+        stats.sent_bytes += bytes;
+        m_bytes_out += bytes;
+    }
+
+    // record_frame counts the raw bytes of a websocket message as it arrives.
+    inline void record_frame(size_t bytes)
+    {
+        m_bytes_in += bytes;
+    }
+
+    // record_queue_depth samples the number of received datagrams waiting to be handled.
+    inline void record_queue_depth(size_t depth)
+    {
+        m_queue_depth_total += depth;
+        ++m_queue_depth_samples;
+        if(depth > m_max_queue_depth) {
+            m_max_queue_depth = depth;
+        }
+    }
+
+    // get_msgtype returns the stats of <msg_type>; see MAX_MSGTYPES.
+    inline const MsgTypeStats& get_msgtype(uint16_t msg_type) const
+    {
+        return m_msgtypes[slot(msg_type)];
+    }
+
+    inline uint64_t get_bytes_in() const
+    {
+        return m_bytes_in;
+    }
+    inline uint64_t get_bytes_out() const
+    {
+        return m_bytes_out;
+    }
+    inline size_t get_max_queue_depth() const
+    {
+        return m_max_queue_depth;
+    }
+    inline double get_average_queue_depth() const
+    {
+        return m_queue_depth_samples ? double(m_queue_depth_total) / m_queue_depth_samples : 0.0;
+    }
+    // get_elapsed returns the milliseconds covered by these metrics, for computing rates.
+    double get_elapsed() const;
+
+    // reset clears all counters and restarts the elapsed time.
+    void reset();
+
+    // to_json formats the metrics as a JSON object; message types that were never seen are left out.
+    std::string to_json() const;
+
+  private:
+    static inline unsigned int slot(uint16_t msg_type)
+    {
+        return msg_type < MAX_MSGTYPES - 1 ? msg_type : MAX_MSGTYPES - 1;
+    }
+
+    static inline unsigned int time_bucket(double ms)
+    {
+        double micros = ms * 1000.0;
+        if(micros < 1.0) {
+            return 0;
+        }
+        if(micros >= double(1u << (NUM_TIME_BUCKETS - 2))) {
+            return NUM_TIME_BUCKETS - 1;
+        }
+        return 32 - __builtin_clz(uint32_t(micros));
+    }
+
+    MsgTypeStats m_msgtypes[MAX_MSGTYPES];
+    uint64_t m_bytes_in;
+    uint64_t m_bytes_out;
+    uint64_t m_queue_depth_total;
+    uint64_t m_queue_depth_samples;
+    size_t m_max_queue_depth;
+    double m_start_time;
+};
+} // close namespace astron
+
+#endif //ASTRON_LIBWASM_CONNECTIONMETRICS_HXX
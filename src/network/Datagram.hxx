@@ -14,6 +14,7 @@
 #ifndef ASTRON_LIBWASM_DATAGRAM_HXX
 #define ASTRON_LIBWASM_DATAGRAM_HXX
 
+#include <algorithm>
 #include <unordered_set>
 #include <string>
 #include <vector>
@@ -119,7 +120,7 @@ class Datagram
     Datagram(const uint8_t *data, dgsize_t length) : buf(new uint8_t[length]), buf_cap(length),
         buf_offset(length)
     {
-        memcpy(buf, data, length);
+        std::copy(data, data + length, buf); // unlike memcpy, accepts no data at nullptr
     }
 
     // binary-constructor(vector):
@@ -127,7 +128,7 @@ class Datagram
     Datagram(const std::vector <uint8_t> &data) : buf(new uint8_t[data.size()]),
         buf_cap(data.size()), buf_offset(data.size())
     {
-        memcpy(buf, &data[0], data.size());
+        std::copy(data.begin(), data.end(), buf);
     }
 
     // binary-constructor(string):
@@ -467,6 +468,20 @@ class Datagram
         return buf_start;
     }
 
+    // overwrite_size replaces a length-tag previously added at <offset>; this is used when the
+    // length of the data following the tag is only known once that data has been added.
+    void overwrite_size(size_t offset, const dgsize_t &v)
+    {
+        if(offset + sizeof(dgsize_t) > buf_offset) {
+#ifndef PANDA_WASM_COMPATIBLE // exceptions disabled when building for linking with panda
+            throw DatagramOverflow("dg tried to overwrite a length tag past the end of the datagram");
+#else
+            return;
+#endif
+        }
+        *(dgsize_t *)(buf + offset) = swap_le(v);
+    }
+
     // add_server_header prepends a generic header for messages that are supposed to be routed
     // to one or more role instances within the server cluster. The method is provided entirely
     // for convenience.
@@ -507,6 +522,13 @@ class Datagram
         add_uint16(message_type);
     }
 
+    // clear removes all data from the datagram while keeping its allocated buffer,
+    // so that the datagram can be reused to build another message without reallocating.
+    void clear()
+    {
+        buf_offset = 0;
+    }
+
     // size returns the amount of data added to the datagram in bytes.
     dgsize_t size() const
     {
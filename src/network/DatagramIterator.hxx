@@ -350,11 +350,24 @@ class DatagramIterator
 
             if(dtype->get_type() == T_VARARRAY) {
                 // We handle variable-length arrays in a slightly different manner, as we have to check for value constraints.
-                size_t cur_ptr = buffer.size();
+                // The elements must fill the array exactly, as skip_dtype() skips the length at once.
+                check_read_length(len);
+                size_t array_end = m_offset + len;
 
-                while(buffer.size() - cur_ptr < len) {
+                while(m_offset < array_end) {
+                    size_t elem_start = m_offset;
                     unpack_dtype(array->get_element_type(), buffer);
                     ++elem_cnt;
+
+                    if(m_offset > array_end || m_offset == elem_start) {
+                        std::stringstream error;
+                        error << "Failed to unpack variable-length field of type " << array->get_alias()
+                              << " because its elements don't fit its length (" << len << ")";
+#ifndef PANDA_WASM_COMPATIBLE // exceptions disabled when building for linking with panda
+                        throw FieldConstraintViolation(error.str());
+#endif
+                        break;
+                    }
                 }
             } else if(dtype->get_type() == T_VARSTRING) {
                 // We're dealing with a string, so elem_cnt == len (and we need to validate it is truly a string).
@@ -515,6 +528,13 @@ class DatagramIterator
         return m_offset;
     }
 
+    // get_read_pointer returns a pointer to the unread bytes, for reading a value in place.
+    //     Does not advance the offset.
+    const uint8_t *get_read_pointer() const
+    {
+        return m_dg->get_data() + m_offset;
+    }
+
     // get_remaining returns the number of unread bytes left
     dgsize_t get_remaining() const
     {
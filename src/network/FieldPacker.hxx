@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file FieldPacker.hxx
+ * @author Max Rodriguez
+ * @date 2023-06-20
+ */
+
+#ifndef ASTRON_LIBWASM_FIELDPACKER_HXX
+#define ASTRON_LIBWASM_FIELDPACKER_HXX
+
+#include <math.h>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include "Datagram.hxx"
+#include "../dc/Field.h"
+#include "../dc/MolecularField.h"
+#include "../dc/Struct.h"
+#include "../dc/Method.h"
+#include "../dc/Parameter.h"
+#include "../dc/ArrayType.h"
+#include "../dc/NumericType.h"
+
+namespace astron   // open namespace
+{
+
+// is_packable is true for the C++ types that a FieldPacker can pack as a dclass value.
+template <typename T>
+struct is_packable : std::integral_constant<bool, std::is_arithmetic<T>::value> {};
+template <>
+struct is_packable<std::string> : std::true_type {};
+template <>
+struct is_packable<const char*> : std::true_type {};
+template <>
+struct is_packable<char*> : std::true_type {};
+template <std::size_t N>
+struct is_packable<char[N]> : std::true_type {};
+template <typename T>
+struct is_packable<std::vector<T>> : std::integral_constant<bool, is_packable<T>::value> {};
+
+// A FieldPacker packs C++ values straight into a Datagram according to the layout of a dclass Field.
+// Every value is checked against the type of the parameter it is packed as (including any
+// range constraints) as it is added, so no intermediate buffers are built. If a value does not
+// fit, packing stops and get_error() describes the problem; the datagram should then be discarded.
+class FieldPacker
+{
+  public:
+    FieldPacker(Datagram &dg) : m_dg(dg), m_error(nullptr), m_molecular(nullptr), m_method(nullptr),
+        m_single(nullptr), m_field_index(0), m_param_index(0)
+    {
+    }
+
+    // pack_field packs <args> as the parameters of <field>. Returns false if the arguments don't
+    // match the parameters of the field, in number or in type.
+    template <typename... Args>
+    bool pack_field(const dclass::Field *field, const Args&... args)
+    {
+        static_assert(all_packable<Args...>::value, "send_update: argument type can't be packed as a dclass value");
+
+        m_molecular = field->as_molecular();
+        m_method = nullptr;
+        m_single = nullptr;
+        m_field_index = 0;
+        m_param_index = 0;
+        if(m_molecular == nullptr) {
+            const dclass::DistributedType *type = field->get_type();
+            m_method = type->as_method();
+            m_single = (m_method == nullptr) ? type : nullptr;
+        }
+
+        if(!pack_args(args...)) {
+            return false;
+        }
+        if(next_type() != nullptr) {
+            return fail("too few arguments for field");
+        }
+        return true;
+    }
+
+    // get_error returns a description of why packing failed, or nullptr if it didn't.
+    inline const char* get_error() const
+    {
+        return m_error;
+    }
+
+  private:
+    template <typename... Args>
+    struct all_packable : std::true_type {};
+    template <typename T, typename... Args>
+    struct all_packable<T, Args...> : std::integral_constant<bool,
+        is_packable<typename std::decay<T>::type>::value && all_packable<Args...>::value> {};
+
+    inline bool fail(const char *error)
+    {
+        m_error = error;
+        return false;
+    }
+
+    // next_type returns the type of the next parameter to pack, or nullptr after the last one.
+    const dclass::DistributedType* next_type()
+    {
+        if(m_single != nullptr) {
+            const dclass::DistributedType *type = m_single;
+            m_single = nullptr;
+            return type;
+        }
+
+        while(m_method == nullptr || m_param_index >= m_method->get_num_parameters()) {
+            // Step into the next atomic field of a molecular field
+            if(m_molecular == nullptr || m_field_index >= m_molecular->get_num_fields()) {
+                return nullptr;
+            }
+            m_method = m_molecular->get_field(m_field_index++)->get_type()->as_method();
+            m_param_index = 0;
+            if(m_method == nullptr) {
+                return nullptr;
+            }
+        }
+        return m_method->get_parameter(m_param_index++)->get_type();
+    }
+
+    inline bool pack_args()
+    {
+        return true;
+    }
+
+    template <typename T, typename... Args>
+    bool pack_args(const T &value, const Args&... args)
+    {
+        const dclass::DistributedType *type = next_type();
+        if(type == nullptr) {
+            return fail("too many arguments for field");
+        }
+        return pack(type, value) && pack_args(args...);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, bool>::type
+    pack(const dclass::DistributedType *type, T value)
+    {
+        using namespace dclass;
+        const NumericType *num = type->as_numeric();
+        if(num == nullptr) {
+            return fail("expected a non-numeric value");
+        }
+
+        // Ranges are declared in the .dc file before scaling by the divisor.
+        if(num->has_range() && !num->get_range().contains(Number(double(value)))) {
+            return fail("value is outside of the range of the parameter");
+        }
+
+        unsigned int divisor = num->get_divisor();
+        switch(type->get_type()) {
+        case T_INT8:
+            if(!fits<int8_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_int8(int8_t(scale(value, divisor)));
+            return true;
+        case T_INT16:
+            if(!fits<int16_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_int16(int16_t(scale(value, divisor)));
+            return true;
+        case T_INT32:
+            if(!fits<int32_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_int32(int32_t(scale(value, divisor)));
+            return true;
+        case T_INT64:
+            if(!fits<int64_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_int64(int64_t(scale(value, divisor)));
+            return true;
+        case T_CHAR:
+        case T_UINT8:
+            if(!fits<uint8_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_uint8(uint8_t(scale(value, divisor)));
+            return true;
+        case T_UINT16:
+            if(!fits<uint16_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_uint16(uint16_t(scale(value, divisor)));
+            return true;
+        case T_UINT32:
+            if(!fits<uint32_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_uint32(uint32_t(scale(value, divisor)));
+            return true;
+        case T_UINT64:
+            if(!fits<uint64_t>(value, divisor)) {
+                return false;
+            }
+            m_dg.add_uint64(uint64_t(scale(value, divisor)));
+            return true;
+        case T_FLOAT32:
+            m_dg.add_float32(float(double(value) * divisor));
+            return true;
+        case T_FLOAT64:
+            m_dg.add_float64(double(value) * divisor);
+            return true;
+        default:
+            return fail("invalid numeric parameter type");
+        }
+    }
+
+    // scale applies the divisor of a fixed-point parameter to a value, rounding floating-point values.
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value, double>::type scale(T value, unsigned int divisor)
+    {
+        return floor(double(value) * divisor + 0.5);
+    }
+    template <typename T>
+    static typename std::enable_if<std::is_signed<T>::value && std::is_integral<T>::value, int64_t>::type
+    scale(T value, unsigned int divisor)
+    {
+        return int64_t(value) * divisor;
+    }
+    template <typename T>
+    static typename std::enable_if<std::is_unsigned<T>::value, uint64_t>::type scale(T value, unsigned int divisor)
+    {
+        return uint64_t(value) * divisor;
+    }
+
+    // fits checks that the scaled value is representable by the integer type W on the wire.
+    // Integers are compared against the limits of W divided by the divisor, so nothing can overflow.
+    template <typename W, typename T>
+    typename std::enable_if<std::is_integral<T>::value, bool>::type fits(T value, unsigned int divisor)
+    {
+        bool ok;
+        if(std::is_signed<T>::value && int64_t(value) < 0) {
+            ok = std::is_signed<W>::value &&
+                 int64_t(value) >= int64_t(std::numeric_limits<W>::min()) / int64_t(divisor);
+        } else {
+            ok = uint64_t(value) <= uint64_t(std::numeric_limits<W>::max()) / divisor;
+        }
+        return ok || fail("value does not fit in the parameter's type");
+    }
+    // Floating-point values are compared against max() + 1, which is a power of two and so exact
+    // as a double; max() of a 64-bit type would round up to it. NaN fails both comparisons.
+    template <typename W, typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, bool>::type fits(T value, unsigned int divisor)
+    {
+        double scaled = scale(value, divisor);
+        double limit = double(std::numeric_limits<W>::max() / 2 + 1) * 2.0;
+        if(!(scaled >= double(std::numeric_limits<W>::min()) && scaled < limit)) {
+            return fail("value does not fit in the parameter's type");
+        }
+        return true;
+    }
+
+    bool pack(const dclass::DistributedType *type, const std::string &value)
+    {
+        return pack_bytes(type, (const uint8_t*)value.data(), value.length());
+    }
+
+    bool pack(const dclass::DistributedType *type, const char *value)
+    {
+        return pack_bytes(type, (const uint8_t*)value, strlen(value));
+    }
+
+    // A byte vector is copied as it is into a string or a blob. It is packed element by element into
+    // any other array, including a uint8[] whose elements have a range or a divisor to apply.
+    bool pack(const dclass::DistributedType *type, const std::vector<uint8_t> &value)
+    {
+        using namespace dclass;
+        const ArrayType *array = type->as_array();
+        bool bytes = type->get_type() == T_STRING || type->get_type() == T_VARSTRING;
+        if(type->get_type() == T_BLOB || type->get_type() == T_VARBLOB) {
+            const NumericType *element = array->get_element_type()->as_numeric();
+            bytes = element == nullptr || (!element->has_range() && element->get_divisor() == 1);
+        }
+        if(array != nullptr && !bytes) {
+            return pack_array(type, value);
+        }
+        return pack_bytes(type, value.empty() ? nullptr : &value[0], value.size());
+    }
+
+    template <typename T>
+    bool pack(const dclass::DistributedType *type, const std::vector<T> &value)
+    {
+        return pack_array(type, value);
+    }
+
+    // pack_array packs an array value, checking each element against the element type.
+    // Arrays of uint8 are blobs (see dclass::ArrayType), with the same layout.
+    template <typename T>
+    bool pack_array(const dclass::DistributedType *type, const std::vector<T> &value)
+    {
+        using namespace dclass;
+        Type kind = type->get_type();
+        if(kind != T_ARRAY && kind != T_VARARRAY && kind != T_BLOB && kind != T_VARBLOB) {
+            return fail("expected a non-array value");
+        }
+        const ArrayType *array = type->as_array();
+        if(!array->within_range(nullptr, value.size())) {
+            return fail("array length is outside of the range of the parameter");
+        }
+
+        if(kind == T_VARARRAY || kind == T_VARBLOB) {
+            // The length tag is in bytes, so fill it in once the elements are packed.
+            size_t tag_offset = m_dg.size();
+            m_dg.add_size(0);
+            for(auto it = value.begin(); it != value.end(); ++it) {
+                if(!pack(array->get_element_type(), *it)) {
+                    return false;
+                }
+            }
+            m_dg.overwrite_size(tag_offset, dgsize_t(m_dg.size() - tag_offset - sizeof(dgsize_t)));
+            return true;
+        }
+
+        for(auto it = value.begin(); it != value.end(); ++it) {
+            if(!pack(array->get_element_type(), *it)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // pack_bytes packs a string or blob value.
+    bool pack_bytes(const dclass::DistributedType *type, const uint8_t *data, size_t length)
+    {
+        using namespace dclass;
+        switch(type->get_type()) {
+        case T_STRING:
+        case T_BLOB:
+            if(length != type->get_size()) {
+                return fail("value length does not match the fixed length of the parameter");
+            }
+            m_dg.add_data(data, dgsize_t(length));
+            return true;
+        case T_VARSTRING:
+        case T_VARBLOB:
+            if(length > DGSIZE_MAX || !type->as_array()->within_range(nullptr, length)) {
+                return fail("value length is outside of the range of the parameter");
+            }
+            m_dg.add_size(dgsize_t(length));
+            m_dg.add_data(data, dgsize_t(length));
+            return true;
+        default:
+            return fail("expected a non-string value");
+        }
+    }
+
+    Datagram &m_dg;
+    const char *m_error;
+
+    // The position in the parameter list of the field being packed.
+    const dclass::Struct *m_molecular;
+    const dclass::Method *m_method;
+    const dclass::DistributedType *m_single;
+    unsigned int m_field_index;
+    unsigned int m_param_index;
+};
+} // close namespace astron
+
+#endif //ASTRON_LIBWASM_FIELDPACKER_HXX
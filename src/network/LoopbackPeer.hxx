@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file LoopbackPeer.hxx
+ * @author Max Rodriguez
+ * @date 2023-06-30
+ */
+
+#ifndef ASTRON_LIBWASM_LOOPBACKPEER_HXX
+#define ASTRON_LIBWASM_LOOPBACKPEER_HXX
+
+#include <vector>
+#include "Connection.hxx"
+#include "Datagram.hxx"
+
+namespace astron   // open namespace
+{
+
+// A LoopbackPeer stands in for the server of a Connection in the same process; see
+// Connection::connect_loopback(). It sees every datagram the connection sends, and delivers
+// its own messages when the connection polls.
+class LoopbackPeer
+{
+  public:
+    virtual ~LoopbackPeer()
+    {
+    }
+
+    // handle_datagram is called with every datagram sent by <conn>.
+    virtual void handle_datagram(Connection &conn, const DatagramPtr &dg) = 0;
+
+    // update is called at the start of every poll of <conn>, to deliver whatever is due.
+    virtual void update(Connection &conn) = 0;
+
+  protected:
+    // deliver passes a websocket message of one or more [uint16 length][datagram] frames to
+    // <conn>, as if it had been received from the socket.
+    inline void deliver(Connection &conn, const uint8_t *data, size_t length)
+    {
+        conn.receive_message(data, length);
+    }
+
+    // deliver passes <dg> to <conn> as a websocket message of its own.
+    inline void deliver(Connection &conn, const DatagramPtr &dg)
+    {
+        m_frame->clear();
+        m_frame->add_uint16(uint16_t(dg->size()));
+        m_frame->add_data(dg);
+        deliver(conn, m_frame->get_data(), m_frame->size());
+    }
+
+  private:
+    DatagramPtr m_frame = Datagram::create();
+};
+} // close namespace astron
+
+#endif //ASTRON_LIBWASM_LOOPBACKPEER_HXX
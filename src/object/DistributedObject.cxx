@@ -11,6 +11,10 @@
  */
 
 #include "DistributedObject.hxx"
+#include "ObjectRepository.hxx"
+#include "../client/messageTypes.hxx"
+#include "../dc/Class.h"
+#include "../network/DatagramIterator.hxx"
 
 namespace astron { // open namespace
 
@@ -20,4 +24,54 @@ namespace astron { // open namespace
     DistributedObject::~DistributedObject() {
     }
 
-} // close namespace astron
\ No newline at end of file
+    void DistributedObject::handle_update(const dclass::Field *field, DatagramIterator &dgi) {
+        dgi.skip_field(field); // no handler for this field; seek past its data
+    }
+
+    void DistributedObject::announce_generate() {
+    }
+
+    void DistributedObject::disable() {
+    }
+
+    void DistributedObject::set_location(doid_t parent, zone_t zone) {
+        m_parent = parent;
+        m_zone = zone;
+    }
+
+    const dclass::Field* DistributedObject::get_field(const std::string &field_name) const {
+        return m_dclass ? m_dclass->get_field_by_name(field_name) : nullptr;
+    }
+
+    DatagramPtr DistributedObject::begin_update(const dclass::Field *field) {
+        if(m_repository == nullptr) {
+            return nullptr; // not generated by a repository; nowhere to send to
+        }
+        if(field == nullptr || m_dclass->get_field_by_id(field->get_id()) != field) {
+            m_repository->logger().error() << "Tried to send an update for a field that doesn't belong to "
+                                           << m_dclass_name << " (doid " << m_doid << ").";
+            return nullptr;
+        }
+        if(!m_repository->may_send_field(this, field)) {
+            m_repository->logger().error() << "Tried to send update for field " << field->get_name()
+                                           << ", which the client is not allowed to send (doid " << m_doid << ").";
+            return nullptr;
+        }
+
+        DatagramPtr dg = m_repository->get_send_datagram();
+        dg->add_uint16(CLIENT_OBJECT_SET_FIELD);
+        dg->add_doid(m_doid);
+        dg->add_uint16(field->get_id());
+        return dg;
+    }
+
+    void DistributedObject::fail_update(const dclass::Field *field, const char *error) {
+        m_repository->logger().error() << "Failed to pack update for field " << field->get_name()
+                                       << " (doid " << m_doid << "): " << error;
+    }
+
+    void DistributedObject::finish_update(const dclass::Field *field, const DatagramPtr &dg) {
+        m_repository->send_field_update(this, field, dg);
+    }
+
+} // close namespace astron
@@ -14,23 +14,107 @@
 #define ASTRON_LIBWASM_DISTRIBUTEDOBJECT_HXX
 
 #include <string>
+#include "../util/types.hxx"
+#include "../network/FieldPacker.hxx"
+
+namespace dclass { // forward declarations
+    class Class;
+    class Field;
+}
 
 namespace astron { // open namespace
 
+    class DatagramIterator; // forward declarations
+    class ObjectRepository;
+
     class DistributedObject {
     public:
-        ~DistributedObject();
+        virtual ~DistributedObject();
 
         inline std::string get_dclass_name() {
             return m_dclass_name;
         }
 
+        inline doid_t get_doid() const {
+            return m_doid;
+        }
+
+        inline doid_t get_parent() const {
+            return m_parent;
+        }
+
+        inline zone_t get_zone() const {
+            return m_zone;
+        }
+
+        inline const dclass::Class* get_dclass() const {
+            return m_dclass;
+        }
+
+        // is_owner_view returns true if this object is the owner view of its distributed object.
+        inline bool is_owner_view() const {
+            return m_owner_view;
+        }
+
+        // send_update sends a CLIENT_OBJECT_SET_FIELD for <field> with <args> as its parameters.
+        // The arguments are packed straight into a reused datagram and validated against the
+        // field's parameter types and ranges as they are packed. Returns false (and logs why)
+        // if the client may not send the field or the arguments don't match its parameters.
+        template <typename... Args>
+        bool send_update(const dclass::Field *field, const Args&... args) {
+            DatagramPtr dg = begin_update(field);
+            if(dg == nullptr) {
+                return false;
+            }
+
+            FieldPacker packer(*dg);
+            if(!packer.pack_field(field, args...)) {
+                fail_update(field, packer.get_error());
+                return false;
+            }
+            finish_update(field, dg);
+            return true;
+        }
+
+        template <typename... Args>
+        bool send_update(const std::string &field_name, const Args&... args) {
+            return send_update(get_field(field_name), args...);
+        }
+
+        // handle_update is called for every field update received for this object,
+        // including the required fields sent when the object enters interest.
+        // The default implementation skips the field data. Override this in your subclass.
+        virtual void handle_update(const dclass::Field *field, DatagramIterator &dgi);
+
+        // announce_generate is called once all required fields have been applied.
+        virtual void announce_generate();
+
+        // disable is called right before the object is deleted by the repository.
+        virtual void disable();
+
     protected:
         DistributedObject(std::string dclass_name);
 
     private:
+        friend class ObjectRepository;
+        void set_location(doid_t parent, zone_t zone);
+
+        const dclass::Field* get_field(const std::string &field_name) const;
+        // begin_update checks that the field may be sent and writes the message header into
+        // the repository's reused datagram, or returns nullptr if the update can't be sent.
+        DatagramPtr begin_update(const dclass::Field *field);
+        void fail_update(const dclass::Field *field, const char *error);
+        void finish_update(const dclass::Field *field, const DatagramPtr &dg);
+
+        ObjectRepository *m_repository = nullptr;
+
         std::string m_dclass_name;
+        const dclass::Class *m_dclass = nullptr;
+        doid_t m_doid = INVALID_DO_ID;
+        doid_t m_parent = INVALID_DO_ID;
+        zone_t m_zone = 0;
+        bool m_owner_view = false;
     };
 } // close namespace
 
-#endif //ASTRON_LIBWASM_DISTRIBUTEDOBJECT_HXX
\ No newline at end of file
+#endif //ASTRON_LIBWASM_DISTRIBUTEDOBJECT_HXX
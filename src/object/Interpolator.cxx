@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file Interpolator.cxx
+ * @author Max Rodriguez
+ * @date 2023-06-28
+ */
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#else
+#include <chrono>
+#endif
+
+#include <math.h>
+#include <algorithm>
+#include "Interpolator.hxx"
+#include "../dc/Field.h"
+#include "../dc/Method.h"
+#include "../dc/Parameter.h"
+#include "../dc/NumericType.h"
+#include "../network/DatagramIterator.hxx"
+
+namespace astron { // open namespace
+
+    Interpolator::Interpolator(const dclass::Field *field, unsigned int history, double delay_ms) :
+        m_field(field), m_history(2), m_delay(delay_ms) {
+        while(m_history < history) {
+            m_history <<= 1;
+        }
+
+        const dclass::DistributedType *type = field->get_type();
+        const dclass::Method *method = type ? type->as_method() : nullptr;
+        if(method == nullptr) {
+            return; // molecular fields aren't supported
+        }
+        for(unsigned int i = 0; i < method->get_num_parameters(); ++i) {
+            const dclass::NumericType *numeric = method->get_parameter(i)->get_type()->as_numeric();
+            if(numeric == nullptr) {
+                m_params.clear();
+                return;
+            }
+            m_params.push_back(numeric);
+        }
+
+        m_channels = (unsigned int)m_params.size();
+        m_wrap.assign(m_channels, 0.0f);
+        m_values.resize(m_channels);
+        m_output.resize(m_channels);
+        m_scratch.resize(m_channels);
+    }
+
+    void Interpolator::set_wrap(unsigned int channel, float period) {
+        if(channel < m_channels) {
+            m_wrap[channel] = period;
+        }
+    }
+
+    void Interpolator::handle_update(doid_t doid, DatagramIterator &dgi) {
+        using namespace dclass;
+        for(unsigned int i = 0; i < m_channels; ++i) {
+            const NumericType *numeric = m_params[i];
+            double value;
+            switch(numeric->get_type()) {
+            case T_INT8: value = dgi.read_int8(); break;
+            case T_INT16: value = dgi.read_int16(); break;
+            case T_INT32: value = dgi.read_int32(); break;
+            case T_INT64: value = double(dgi.read_int64()); break;
+            case T_CHAR:
+            case T_UINT8: value = dgi.read_uint8(); break;
+            case T_UINT16: value = dgi.read_uint16(); break;
+            case T_UINT32: value = dgi.read_uint32(); break;
+            case T_UINT64: value = double(dgi.read_uint64()); break;
+            case T_FLOAT32: value = dgi.read_float32(); break;
+            case T_FLOAT64: value = dgi.read_float64(); break;
+            default: value = 0.0; break;
+            }
+            m_scratch[i] = float(value / numeric->get_divisor());
+        }
+#ifdef __EMSCRIPTEN__
+        double now = emscripten_get_now();
+#else
+        // Natively (e.g. in the benchmarks), any monotonic clock in milliseconds will do.
+        double now = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif // __EMSCRIPTEN__
+        add_snapshot(doid, now, m_scratch.data());
+    }
+
+    size_t Interpolator::add_object(doid_t doid) {
+        size_t index = m_doids.size();
+        m_doids.push_back(doid);
+        m_index[doid] = index;
+
+        m_count.push_back(0);
+        m_newest.push_back(0);
+        m_times.resize(m_times.size() + m_history, 0.0);
+        for(unsigned int c = 0; c < m_channels; ++c) {
+            m_values[c].resize(m_values[c].size() + m_history, 0.0f);
+            m_output[c].push_back(0.0f);
+        }
+        m_from.push_back(0);
+        m_to.push_back(0);
+        m_weight.push_back(0.0f);
+        return index;
+    }
+
+    void Interpolator::add_snapshot(doid_t doid, double time, const float *values) {
+        auto it = m_index.find(doid);
+        size_t index = (it != m_index.end()) ? it->second : add_object(doid);
+
+        size_t base = index * m_history;
+        uint32_t pos = m_count[index] ? ((m_newest[index] + 1) & (m_history - 1)) : 0;
+        m_newest[index] = pos;
+        if(m_count[index] < m_history) {
+            ++m_count[index];
+        }
+
+        m_times[base + pos] = time;
+        for(unsigned int c = 0; c < m_channels; ++c) {
+            m_values[c][base + pos] = values[c];
+        }
+        if(m_count[index] == 1) {
+            // Until the next snapshot, the object is sampled at this one.
+            for(unsigned int c = 0; c < m_channels; ++c) {
+                m_output[c][index] = values[c];
+            }
+        }
+    }
+
+    void Interpolator::remove(doid_t doid) {
+        auto it = m_index.find(doid);
+        if(it == m_index.end()) {
+            return;
+        }
+        size_t index = it->second;
+        size_t last = m_doids.size() - 1;
+        m_index.erase(it);
+
+        // Move the last object into the hole, so the arrays stay dense.
+        if(index != last) {
+            m_doids[index] = m_doids[last];
+            m_index[m_doids[index]] = index;
+            m_count[index] = m_count[last];
+            m_newest[index] = m_newest[last];
+            std::copy(m_times.begin() + last * m_history, m_times.end(), m_times.begin() + index * m_history);
+            for(unsigned int c = 0; c < m_channels; ++c) {
+                std::vector<float> &values = m_values[c];
+                std::copy(values.begin() + last * m_history, values.end(), values.begin() + index * m_history);
+                m_output[c][index] = m_output[c][last];
+            }
+        }
+
+        m_doids.pop_back();
+        m_count.pop_back();
+        m_newest.pop_back();
+        m_times.resize(last * m_history);
+        for(unsigned int c = 0; c < m_channels; ++c) {
+            m_values[c].resize(last * m_history);
+            m_output[c].pop_back();
+        }
+        m_from.pop_back();
+        m_to.pop_back();
+        m_weight.pop_back();
+    }
+
+    void Interpolator::clear() {
+        m_doids.clear();
+        m_index.clear();
+        m_count.clear();
+        m_newest.clear();
+        m_times.clear();
+        for(unsigned int c = 0; c < m_channels; ++c) {
+            m_values[c].clear();
+            m_output[c].clear();
+        }
+        m_from.clear();
+        m_to.clear();
+        m_weight.clear();
+    }
+
+    void Interpolator::sample(double time) {
+        double render_time = time - m_delay;
+        size_t count = m_doids.size();
+        uint32_t mask = m_history - 1;
+
+        // First pass: pick the snapshots on either side of the render time for each object.
+        const double *times = m_times.data();
+        for(size_t i = 0; i < count; ++i) {
+            uint32_t base = uint32_t(i * m_history);
+            uint32_t to = m_newest[i];
+            uint32_t held = m_count[i];
+            uint32_t from = to;
+            float weight = 0.0f;
+
+            // Walk back from the newest snapshot; the history is only a few entries long.
+            for(uint32_t n = 1; n < held && render_time < times[base + from]; ++n) {
+                to = from;
+                from = (from - 1) & mask;
+            }
+            double t0 = times[base + from];
+            double t1 = times[base + to];
+            if(render_time > t0 && t1 > t0) {
+                weight = float((render_time < t1 ? render_time - t0 : t1 - t0) / (t1 - t0));
+            }
+            m_from[i] = base + from;
+            m_to[i] = base + to;
+            m_weight[i] = weight;
+        }
+
+        // Second pass: blend each channel over all objects.
+        const uint32_t *from = m_from.data();
+        const uint32_t *to = m_to.data();
+        const float *weight = m_weight.data();
+        for(unsigned int c = 0; c < m_channels; ++c) {
+            const float *values = m_values[c].data();
+            float *out = m_output[c].data();
+            float period = m_wrap[c];
+            if(period == 0.0f) {
+                for(size_t i = 0; i < count; ++i) {
+                    float v0 = values[from[i]];
+                    out[i] = v0 + (values[to[i]] - v0) * weight[i];
+                }
+                continue;
+            }
+            for(size_t i = 0; i < count; ++i) {
+                float v0 = values[from[i]];
+                float delta = values[to[i]] - v0;
+                delta -= period * floorf(delta / period + 0.5f); // the short way around
+                float v = v0 + delta * weight[i];
+                out[i] = v - period * floorf(v / period);
+            }
+        }
+    }
+
+    size_t Interpolator::find(doid_t doid) const {
+        auto it = m_index.find(doid);
+        return it != m_index.end() ? it->second : m_doids.size();
+    }
+
+    float Interpolator::get_value(doid_t doid, unsigned int channel) const {
+        size_t index = find(doid);
+        if(index == m_doids.size() || channel >= m_channels) {
+            return 0.0f;
+        }
+        return m_output[channel][index];
+    }
+
+} // close namespace astron
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file Interpolator.hxx
+ * @author Max Rodriguez
+ * @date 2023-06-28
+ */
+
+#ifndef ASTRON_LIBWASM_INTERPOLATOR_HXX
+#define ASTRON_LIBWASM_INTERPOLATOR_HXX
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include "../util/types.hxx"
+
+namespace dclass { // forward declarations
+    class Field;
+    class NumericType;
+}
+
+namespace astron { // open namespace
+
+    class DatagramIterator; // forward declaration
+
+    // An Interpolator keeps the last few received values of a numeric field (such as setXYH)
+    // for every object, and samples them at render time. Each parameter of the field is a channel.
+    //
+    // Snapshots are stored as structure-of-arrays for all objects together, so sample() computes
+    // the value of every object in one pass over contiguous arrays each frame. Values are sampled
+    // <delay> milliseconds in the past, so there is usually a snapshot on either side to blend.
+    //
+    // Register it with ObjectRepository::add_interpolator() to have every received update of the
+    // field recorded; the object's handle_update() is still called as usual.
+    class Interpolator {
+    public:
+        // <field> must be an atomic field whose parameters are all numeric.
+        // <history> snapshots are kept per object, rounded up to a power of two.
+        Interpolator(const dclass::Field *field, unsigned int history = 4, double delay_ms = 100.0);
+
+        // is_valid returns false if the field can't be interpolated.
+        inline bool is_valid() const {
+            return m_channels > 0;
+        }
+        inline const dclass::Field* get_field() const {
+            return m_field;
+        }
+        inline unsigned int get_num_channels() const {
+            return m_channels;
+        }
+
+        inline void set_delay(double delay_ms) {
+            m_delay = delay_ms;
+        }
+        inline double get_delay() const {
+            return m_delay;
+        }
+        // set_wrap makes <channel> wrap around at <period> (such as 360 for a heading in degrees),
+        // so it's interpolated the short way around. A period of 0 turns wrapping off.
+        void set_wrap(unsigned int channel, float period);
+
+        // handle_update reads an update of the field from <dgi> and adds it as a snapshot
+        // of <doid>, timestamped with the current time.
+        void handle_update(doid_t doid, DatagramIterator &dgi);
+        // add_snapshot adds <values> (one per channel) as the snapshot of <doid> at <time>, in milliseconds.
+        // Snapshots of an object must be added in order of time.
+        void add_snapshot(doid_t doid, double time, const float *values);
+        // remove forgets the snapshots of <doid>.
+        void remove(doid_t doid);
+        void clear();
+
+        // sample computes the value of every object at <time> minus the delay, in milliseconds
+        // of emscripten_get_now(). Values are held at the oldest or newest snapshot outside of the history.
+        void sample(double time);
+
+        // size returns the number of objects with snapshots.
+        inline size_t size() const {
+            return m_doids.size();
+        }
+        // get_doid returns the doid of the object at <index>, in [0, size()).
+        // The order changes when objects are removed.
+        inline doid_t get_doid(size_t index) const {
+            return m_doids[index];
+        }
+        // get_output returns the values of <channel> computed by the last sample(), in object order.
+        inline const float* get_output(unsigned int channel) const {
+            return m_output[channel].data();
+        }
+        // find returns the index of <doid>, or size() if it has no snapshots.
+        size_t find(doid_t doid) const;
+        // get_value returns the last sampled value of <channel> for <doid>, or 0 if it has no snapshots.
+        float get_value(doid_t doid, unsigned int channel) const;
+
+    private:
+        size_t add_object(doid_t doid);
+
+        const dclass::Field *m_field;
+        std::vector<const dclass::NumericType*> m_params;
+        unsigned int m_channels = 0;
+        unsigned int m_history; // snapshots per object, a power of two
+        double m_delay;
+        std::vector<float> m_wrap; // by channel
+
+        std::vector<doid_t> m_doids; // by object
+        std::unordered_map<doid_t, size_t> m_index;
+
+        // Snapshot rings, [object * m_history + n]; m_newest is the position of the newest snapshot.
+        std::vector<uint32_t> m_count;
+        std::vector<uint32_t> m_newest;
+        std::vector<double> m_times;
+        std::vector<std::vector<float>> m_values; // by channel
+
+        // The pair of snapshots and blend weight chosen for each object by sample().
+        std::vector<uint32_t> m_from;
+        std::vector<uint32_t> m_to;
+        std::vector<float> m_weight;
+        std::vector<std::vector<float>> m_output; // by channel
+        std::vector<float> m_scratch;
+    };
+
+} // close namespace
+
+#endif //ASTRON_LIBWASM_INTERPOLATOR_HXX
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file JsonBridge.cxx
+ * @author Max Rodriguez
+ * @date 2023-07-02
+ */
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+
+#include "JsonBridge.hxx"
+#include "../dc/File.h"
+#include "../dc/Class.h"
+#include "../dc/Field.h"
+#include "../dc/value/json.h"
+#include "../network/DatagramIterator.hxx"
+
+namespace astron { // open namespace
+
+    JsonBridge::JsonBridge(const dclass::File *dcfile) : m_dcfile(dcfile) {
+    }
+
+    const char* JsonBridge::field_to_json(const dclass::Field *field, const uint8_t *packed, size_t length) {
+        m_json.clear();
+        return finish_json(dclass::format_json(field->get_type(), packed, length, m_json));
+    }
+
+    const char* JsonBridge::field_to_json(const dclass::Field *field, DatagramIterator &dgi) {
+        const uint8_t *packed = dgi.get_read_pointer();
+        size_t length = dgi.get_remaining();
+        m_json.clear();
+        if(!dclass::format_json(field->get_type(), packed, length, m_json)) {
+            return finish_json(false);
+        }
+        dgi.skip_field(field);
+        return finish_json(true);
+    }
+
+    const char* JsonBridge::object_to_json(const dclass::Class *cls, bool owner, const uint8_t *packed,
+                                           size_t length) {
+        m_json.clear();
+        return finish_json(dclass::format_json(cls, owner, packed, length, m_json));
+    }
+
+    const uint8_t* JsonBridge::field_from_json(const dclass::Field *field, const char *json, size_t length) {
+        std::string error;
+        size_t offset = 0;
+        m_packed.clear();
+        bool ok = dclass::parse_json(field->get_type(), json, length, m_packed, error, offset);
+        return finish_packed(ok, error, offset);
+    }
+
+    const uint8_t* JsonBridge::object_from_json(const dclass::Class *cls, bool owner, const char *json,
+                                                size_t length) {
+        std::string error;
+        size_t offset = 0;
+        m_packed.clear();
+        bool ok = dclass::parse_json(cls, owner, json, length, m_packed, error, offset);
+        return finish_packed(ok, error, offset);
+    }
+
+    char* JsonBridge::get_input(size_t length) {
+        if(m_input.size() < length) {
+            m_input.resize(length);
+        }
+        return m_input.data();
+    }
+
+    const char* JsonBridge::finish_json(bool ok) {
+        if(!ok) {
+            set_error("Packed value is shorter than its type requires.");
+            return nullptr;
+        }
+        m_length = m_json.size();
+        return m_json.c_str();
+    }
+
+    const uint8_t* JsonBridge::finish_packed(bool ok, const std::string &error, size_t offset) {
+        if(!ok) {
+            set_error("JSON error at offset " + std::to_string(offset) + ": " + error);
+            return nullptr;
+        }
+        m_length = m_packed.size();
+        return m_packed.data();
+    }
+} // close namespace
+
+extern "C" {
+    EMSCRIPTEN_KEEPALIVE
+    const char* astron_field_to_json(astron::JsonBridge *bridge, unsigned int field_id,
+                                     const uint8_t *packed, size_t length) {
+        const dclass::Field *field = bridge->get_dcfile()->get_field_by_id(field_id);
+        if(field == nullptr) {
+            bridge->set_error("No field with id " + std::to_string(field_id) + ".");
+            return nullptr;
+        }
+        return bridge->field_to_json(field, packed, length);
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    const char* astron_object_to_json(astron::JsonBridge *bridge, unsigned int class_id, bool owner,
+                                      const uint8_t *packed, size_t length) {
+        const dclass::Class *cls = bridge->get_dcfile()->get_class_by_id(class_id);
+        if(cls == nullptr) {
+            bridge->set_error("No dclass with id " + std::to_string(class_id) + ".");
+            return nullptr;
+        }
+        return bridge->object_to_json(cls, owner, packed, length);
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    const uint8_t* astron_field_from_json(astron::JsonBridge *bridge, unsigned int field_id,
+                                          const char *json, size_t length) {
+        const dclass::Field *field = bridge->get_dcfile()->get_field_by_id(field_id);
+        if(field == nullptr) {
+            bridge->set_error("No field with id " + std::to_string(field_id) + ".");
+            return nullptr;
+        }
+        return bridge->field_from_json(field, json, length);
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    const uint8_t* astron_object_from_json(astron::JsonBridge *bridge, unsigned int class_id, bool owner,
+                                           const char *json, size_t length) {
+        const dclass::Class *cls = bridge->get_dcfile()->get_class_by_id(class_id);
+        if(cls == nullptr) {
+            bridge->set_error("No dclass with id " + std::to_string(class_id) + ".");
+            return nullptr;
+        }
+        return bridge->object_from_json(cls, owner, json, length);
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    size_t astron_json_length(astron::JsonBridge *bridge) {
+        return bridge->get_length();
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    const char* astron_json_error(astron::JsonBridge *bridge) {
+        return bridge->get_error().c_str();
+    }
+
+    EMSCRIPTEN_KEEPALIVE
+    char* astron_json_input(astron::JsonBridge *bridge, size_t length) {
+        return bridge->get_input(length);
+    }
+}
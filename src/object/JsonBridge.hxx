@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file JsonBridge.hxx
+ * @author Max Rodriguez
+ * @date 2023-07-02
+ */
+
+#ifndef ASTRON_LIBWASM_JSONBRIDGE_HXX
+#define ASTRON_LIBWASM_JSONBRIDGE_HXX
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace dclass { // forward declarations
+    class File;
+    class Class;
+    class Field;
+}
+
+namespace astron { // open namespace
+
+    class DatagramIterator; // forward declaration
+
+    // A JsonBridge converts field values between their packed form and JSON, so that JavaScript
+    // code (such as the game's UI) can use them with JSON.parse() and JSON.stringify() instead of
+    // parsing the text of dclass::format_value(). The JSON follows the types of the field, as
+    // described in dc/value/json.h. Results are written into buffers in wasm memory that are
+    // reused between calls, so a conversion doesn't allocate once they have grown to fit.
+    //
+    // From JavaScript, hand the bridge's address over (e.g. with EM_ASM({ Module.jsonBridge = $0; },
+    // &bridge)) and call the exported functions below:
+    //
+    //     const ptr = Module._astron_field_to_json(Module.jsonBridge, fieldId, dataPtr, length);
+    //     const value = JSON.parse(UTF8ToString(ptr, Module._astron_json_length(Module.jsonBridge)));
+    //
+    // To convert JSON from JavaScript, write it into the bridge's input buffer first:
+    //
+    //     const size = lengthBytesUTF8(json);
+    //     const input = Module._astron_json_input(Module.jsonBridge, size + 1);
+    //     stringToUTF8(json, input, size + 1);
+    //     const packed = Module._astron_field_from_json(Module.jsonBridge, fieldId, input, size);
+    class JsonBridge {
+    public:
+        // <dcfile> must have been finalized, and must outlive the bridge.
+        JsonBridge(const dclass::File *dcfile);
+
+        // field_to_json returns the value of <field> packed in the <length> bytes at <packed> as
+        // null-terminated JSON, valid until the next call, or nullptr if the data is too short.
+        const char* field_to_json(const dclass::Field *field, const uint8_t *packed, size_t length);
+        // field_to_json reads the value of <field> at the position of <dgi>, e.g. in
+        // DistributedObject::handle_update(), and advances past it.
+        const char* field_to_json(const dclass::Field *field, DatagramIterator &dgi);
+        // object_to_json returns a JSON object with the value of every required field of <cls> sent
+        // to a client, from the values packed back to back as in CLIENT_ENTER_OBJECT_REQUIRED, or
+        // CLIENT_ENTER_OBJECT_REQUIRED_OWNER (which also has the ownrecv fields) if <owner>.
+        const char* object_to_json(const dclass::Class *cls, bool owner, const uint8_t *packed,
+                                   size_t length);
+
+        // field_from_json returns the JSON value of <field> in the <length> characters at <json>
+        // packed, valid until the next call, or nullptr (see get_error()) if it isn't a valid value.
+        const uint8_t* field_from_json(const dclass::Field *field, const char *json, size_t length);
+        // object_from_json packs a JSON object with the value of every required field of <cls>
+        // sent to a client, or to its owner if <owner>.
+        const uint8_t* object_from_json(const dclass::Class *cls, bool owner, const char *json,
+                                        size_t length);
+
+        // get_length returns the length of the last result, in characters or bytes.
+        inline size_t get_length() const {
+            return m_length;
+        }
+        // get_error returns why the last conversion failed.
+        inline const std::string& get_error() const {
+            return m_error;
+        }
+        inline void set_error(const std::string &error) {
+            m_error = error;
+            m_length = 0;
+        }
+
+        // get_input returns a buffer of at least <length> bytes for the next call's input,
+        // so JavaScript can pass values without allocating.
+        char* get_input(size_t length);
+
+        inline const dclass::File* get_dcfile() const {
+            return m_dcfile;
+        }
+
+    private:
+        const char* finish_json(bool ok);
+        const uint8_t* finish_packed(bool ok, const std::string &error, size_t offset);
+
+        const dclass::File *m_dcfile;
+        std::string m_json;
+        std::vector<uint8_t> m_packed;
+        std::vector<char> m_input;
+        std::string m_error;
+        size_t m_length = 0;
+    };
+} // close namespace
+
+// The functions exported to JavaScript, which look up fields and classes by id.
+// Each returns nullptr on failure, with the reason in astron_json_error().
+extern "C" {
+    const char* astron_field_to_json(astron::JsonBridge *bridge, unsigned int field_id,
+                                     const uint8_t *packed, size_t length);
+    const char* astron_object_to_json(astron::JsonBridge *bridge, unsigned int class_id, bool owner,
+                                      const uint8_t *packed, size_t length);
+    const uint8_t* astron_field_from_json(astron::JsonBridge *bridge, unsigned int field_id,
+                                          const char *json, size_t length);
+    const uint8_t* astron_object_from_json(astron::JsonBridge *bridge, unsigned int class_id, bool owner,
+                                           const char *json, size_t length);
+    size_t astron_json_length(astron::JsonBridge *bridge);
+    const char* astron_json_error(astron::JsonBridge *bridge);
+    char* astron_json_input(astron::JsonBridge *bridge, size_t length);
+}
+
+#endif //ASTRON_LIBWASM_JSONBRIDGE_HXX
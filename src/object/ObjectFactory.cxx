@@ -22,17 +22,74 @@ namespace astron { // open namespace
         ObjectFactory::singleton.add_object_type(name, this);
     }
 
+    BaseObjectType::BaseObjectType(const std::string &name, bool owner_view)
+    {
+        if(owner_view) {
+            ObjectFactory::singleton.add_owner_type(name, this);
+        } else {
+            ObjectFactory::singleton.add_object_type(name, this);
+        }
+    }
+
+    std::unordered_map<std::string, BaseObjectType*>& ObjectFactory::factories()
+    {
+        static std::unordered_map<std::string, BaseObjectType*> registry;
+        return registry;
+    }
+
+    std::unordered_map<std::string, BaseObjectType*>& ObjectFactory::owner_factories()
+    {
+        static std::unordered_map<std::string, BaseObjectType*> registry;
+        return registry;
+    }
+
     void ObjectFactory::add_object_type(const std::string &name, BaseObjectType *factory)
     {
-        m_factories[name] = factory;
+        factories()[name] = factory;
+    }
+
+    void ObjectFactory::add_owner_type(const std::string &name, BaseObjectType *factory)
+    {
+        owner_factories()[name] = factory;
+    }
+
+    BaseObjectType* ObjectFactory::get_object_type(const std::string &dclass_name)
+    {
+        auto it = factories().find(dclass_name);
+        if(it != factories().end())
+        {
+            return it->second;
+        }
+        return NULL;
+    }
+
+    BaseObjectType* ObjectFactory::get_owner_type(const std::string &dclass_name)
+    {
+        auto it = owner_factories().find(dclass_name + OWNER_VIEW_SUFFIX);
+        if(it != owner_factories().end())
+        {
+            return it->second;
+        }
+        return NULL;
     }
 
     DistributedObject* ObjectFactory::instantiate_object(const std::string &dclass_name)
     {
-        if(m_factories.find(dclass_name) != m_factories.end())
+        BaseObjectType *factory = get_object_type(dclass_name);
+        if(factory != NULL)
+        {
+            return factory->instantiate(dclass_name);
+        }
+        return NULL;
+    }
+
+    DistributedObject* ObjectFactory::instantiate_owner_object(const std::string &dclass_name)
+    {
+        BaseObjectType *factory = get_owner_type(dclass_name);
+        if(factory != NULL)
         {
-            return m_factories[dclass_name]->instantiate(dclass_name);
+            return factory->instantiate(dclass_name);
         }
         return NULL;
     }
-} // close namespace
\ No newline at end of file
+} // close namespace
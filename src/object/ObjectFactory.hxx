@@ -19,11 +19,16 @@
 
 namespace astron { // open namespace
 
+    // Owner views are registered under the name of their dclass followed by this suffix,
+    // i.e. the owner view of `DistributedAvatar` is registered as `DistributedAvatarOV`.
+    const char* const OWNER_VIEW_SUFFIX = "OV";
+
     class BaseObjectType {
     public:
         virtual DistributedObject* instantiate(std::string name) = 0;
     protected:
         BaseObjectType(const std::string &name);
+        BaseObjectType(const std::string &name, bool owner_view);
     };
 
     template <class T>
@@ -37,14 +42,38 @@ namespace astron { // open namespace
         }
     };
 
+    // An OwnerObjectType registers the owner view of a distributed class. The name given
+    // should be the name of the view class itself (dclass name + OWNER_VIEW_SUFFIX).
+    template <class T>
+    class OwnerObjectType : public BaseObjectType {
+    public:
+        OwnerObjectType(const std::string &name) : BaseObjectType(name, true) {
+        }
+
+        virtual DistributedObject* instantiate(std::string name) {
+            return new T(name);
+        }
+    };
+
     class ObjectFactory {
     public:
         DistributedObject* instantiate_object(const std::string &dclass_name);
+        DistributedObject* instantiate_owner_object(const std::string &dclass_name);
         static ObjectFactory singleton;
 
         void add_object_type(const std::string &name, BaseObjectType *factory);
+        void add_owner_type(const std::string &name, BaseObjectType *factory);
+
+        // get_object_type returns the factory registered for a dclass, or nullptr if none.
+        BaseObjectType* get_object_type(const std::string &dclass_name);
+        // get_owner_type returns the owner view factory of a dclass (resolving the "OV" suffix),
+        // or nullptr if none. Meant to be resolved once when the dc file is loaded.
+        BaseObjectType* get_owner_type(const std::string &dclass_name);
     private:
-        std::unordered_map<std::string, BaseObjectType*> m_factories;
+        // The registries are function-local statics so that ObjectTypes defined as globals
+        // in other translation units can register before the singleton is initialized.
+        static std::unordered_map<std::string, BaseObjectType*>& factories();
+        static std::unordered_map<std::string, BaseObjectType*>& owner_factories();
     };
 
 } // close namespace
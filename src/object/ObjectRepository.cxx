@@ -13,8 +13,10 @@
 #include "ObjectRepository.hxx"
 #include "ObjectFactory.hxx"
 #include "DistributedObject.hxx"
+#include "../dc/Class.h"
 #include "../network/Datagram.hxx"
 #include "../network/DatagramIterator.hxx"
+#include "../client/messageTypes.hxx"
 
 namespace astron { // open namespace
 
@@ -22,6 +24,345 @@ namespace astron { // open namespace
     }
 
     ObjectRepository::~ObjectRepository() {
+#ifdef ASTRON_THREADED_DECODE
+        stop_decode_thread(); // validate_datagram uses this repository's state
+#endif
+        for(auto it = m_doid2ov.begin(); it != m_doid2ov.end(); ++it) {
+            delete it->second;
+        }
+        for(auto it = m_doid2do.begin(); it != m_doid2do.end(); ++it) {
+            delete it->second;
+        }
     }
 
-} // close namespace astron
\ No newline at end of file
+    void ObjectRepository::set_dcfile(dclass::File *dcfile) {
+        m_dcfile = dcfile;
+        m_classes.clear();
+        m_classes.resize(dcfile->get_num_types());
+        m_resolved.clear();
+
+#ifdef ASTRON_THREADED_DECODE
+        // validate_datagram runs on the decode thread, where classes can't be built or resolved.
+        dcfile->load_all_classes();
+#else
+        if(dcfile->is_lazy()) return; // see get_class_entry
+#endif
+
+        for(unsigned int i = 0; i < dcfile->get_num_classes(); ++i) {
+            const dclass::Class *cls = dcfile->get_class(i);
+            if(cls != nullptr) {
+                resolve_class(cls);
+            }
+        }
+    }
+
+    void ObjectRepository::resolve_class(const dclass::Class *cls) {
+        ClassEntry &entry = m_classes[cls->get_id()];
+        entry.dclass = cls;
+        entry.object_type = ObjectFactory::singleton.get_object_type(cls->get_name());
+        entry.owner_type = ObjectFactory::singleton.get_owner_type(cls->get_name());
+
+        for(int owner = 0; owner < 2; ++owner) {
+            for(unsigned int n = 0; n < cls->get_num_client_required_fields(owner); ++n) {
+                entry.required_fields[owner].push_back(cls->get_client_required_field(n, owner));
+            }
+        }
+        m_resolved.push_back(cls);
+        class_resolved(cls);
+    }
+
+    // With ASTRON_THREADED_DECODE every dclass is resolved by set_dcfile, so this doesn't change
+    // anything and is safe on the decode thread.
+    const ObjectRepository::ClassEntry* ObjectRepository::get_class_entry(uint16_t dclass_id) {
+        if(m_dcfile == nullptr || dclass_id >= m_classes.size()) return nullptr;
+        if(m_classes[dclass_id].dclass == nullptr) {
+            const dclass::Class *cls = m_dcfile->get_class_by_id(dclass_id);
+            if(cls == nullptr) return nullptr;
+            resolve_class(cls);
+        }
+        return &m_classes[dclass_id];
+    }
+
+    DistributedObject* ObjectRepository::get_object(doid_t doid) {
+        auto it = m_doid2do.find(doid);
+        return it != m_doid2do.end() ? it->second : nullptr;
+    }
+
+    DistributedObject* ObjectRepository::get_owner_view(doid_t doid) {
+        auto it = m_doid2ov.find(doid);
+        return it != m_doid2ov.end() ? it->second : nullptr;
+    }
+
+    bool ObjectRepository::add_interpolator(Interpolator *interpolator) {
+        const dclass::Field *field = interpolator->get_field();
+        if(!interpolator->is_valid()) {
+            logger().error() << "Can't interpolate field " << field->get_name() << "; its parameters must be numeric.";
+            return false;
+        }
+        if(field->get_id() >= m_interpolators.size()) {
+            m_interpolators.resize(field->get_id() + 1, nullptr);
+        }
+        m_interpolators[field->get_id()] = interpolator;
+        return true;
+    }
+
+    void ObjectRepository::remove_interpolator(Interpolator *interpolator) {
+        unsigned int field_id = interpolator->get_field()->get_id();
+        if(field_id < m_interpolators.size() && m_interpolators[field_id] == interpolator) {
+            m_interpolators[field_id] = nullptr;
+        }
+    }
+
+    void ObjectRepository::record_snapshot(doid_t doid, const dclass::Field *field, DatagramIterator &dgi) {
+        if(field->get_id() >= m_interpolators.size() || m_interpolators[field->get_id()] == nullptr) {
+            return;
+        }
+        dgsize_t offset = dgi.tell();
+        m_interpolators[field->get_id()]->handle_update(doid, dgi);
+        dgi.seek(offset);
+    }
+
+    void ObjectRepository::send_field_update(DistributedObject *obj, const dclass::Field *field,
+                                             const DatagramPtr &dg) {
+        send_datagram(dg);
+    }
+
+    // A PackedReader walks the values packed in a received datagram without reading past its end.
+    struct PackedReader {
+        const uint8_t *data;
+        size_t length;
+        size_t offset;
+
+        bool skip(size_t n) {
+            if(n > length - offset) return false;
+            offset += n;
+            return true;
+        }
+
+        template <typename T>
+        bool read(T &value) {
+            if(sizeof(T) > length - offset) return false;
+            memcpy(&value, data + offset, sizeof(T));
+            value = T(swap_le(value));
+            offset += sizeof(T);
+            return true;
+        }
+
+        // skip_dtype mirrors DatagramIterator::skip_dtype.
+        bool skip_dtype(const dclass::DistributedType *dtype) {
+            using namespace dclass;
+            if(dtype->has_fixed_size()) {
+                return skip(dtype->get_size());
+            }
+
+            switch(dtype->get_type()) {
+            case T_VARSTRING:
+            case T_VARBLOB:
+            case T_VARARRAY: {
+                dgsize_t size;
+                return read(size) && skip(size);
+            }
+            case T_STRUCT: {
+                const Struct *dstruct = dtype->as_struct();
+                for(unsigned int i = 0; i < dstruct->get_num_fields(); ++i) {
+                    if(!skip_dtype(dstruct->get_field(i)->get_type())) return false;
+                }
+                return true;
+            }
+            case T_METHOD: {
+                const Method *dmethod = dtype->as_method();
+                for(unsigned int i = 0; i < dmethod->get_num_parameters(); ++i) {
+                    if(!skip_dtype(dmethod->get_parameter(i)->get_type())) return false;
+                }
+                return true;
+            }
+            default:
+                return true;
+            }
+        }
+    };
+
+    bool ObjectRepository::validate_datagram(const uint8_t *data, size_t length) {
+        PackedReader reader = {data, length, 0};
+        uint16_t msg_type;
+        if(!reader.read(msg_type)) return false;
+
+        switch(msg_type) {
+        case CLIENT_OBJECT_SET_FIELD: {
+            uint16_t field_id;
+            if(!reader.skip(sizeof(doid_t)) || !reader.read(field_id)) return false;
+            const dclass::Field *field = m_dcfile ? m_dcfile->get_field_by_id(field_id) : nullptr;
+            return field == nullptr || reader.skip_dtype(field->get_type());
+        }
+        case CLIENT_ENTER_OBJECT_REQUIRED:
+        case CLIENT_ENTER_OBJECT_REQUIRED_OTHER:
+        case CLIENT_ENTER_OBJECT_REQUIRED_OWNER:
+        case CLIENT_ENTER_OBJECT_REQUIRED_OTHER_OWNER: {
+            uint16_t dclass_id;
+            if(!reader.skip(2 * sizeof(doid_t) + sizeof(zone_t)) || !reader.read(dclass_id)) return false;
+            const ClassEntry *entry = get_class_entry(dclass_id);
+            if(entry == nullptr) return true;
+
+            bool owner = msg_type == CLIENT_ENTER_OBJECT_REQUIRED_OWNER ||
+                         msg_type == CLIENT_ENTER_OBJECT_REQUIRED_OTHER_OWNER;
+            const std::vector<const dclass::Field*> &required = entry->required_fields[owner];
+            for(auto it = required.begin(); it != required.end(); ++it) {
+                if(!reader.skip_dtype((*it)->get_type())) return false;
+            }
+            if(msg_type == CLIENT_ENTER_OBJECT_REQUIRED || msg_type == CLIENT_ENTER_OBJECT_REQUIRED_OWNER) {
+                return true;
+            }
+
+            uint16_t num_fields;
+            if(!reader.read(num_fields)) return false;
+            for(uint16_t i = 0; i < num_fields; ++i) {
+                uint16_t field_id;
+                if(!reader.read(field_id)) return false;
+                const dclass::Field *field = m_dcfile ? m_dcfile->get_field_by_id(field_id) : nullptr;
+                if(field == nullptr) return true;
+                if(!reader.skip_dtype(field->get_type())) return false;
+            }
+            return true;
+        }
+        default:
+            return true;
+        }
+    }
+
+    void ObjectRepository::handle_enter_object(DatagramIterator &dgi, bool owner, bool other) {
+        doid_t doid = dgi.read_doid();
+        doid_t parent = dgi.read_doid();
+        zone_t zone = dgi.read_zone();
+        uint16_t dclass_id = dgi.read_uint16();
+
+        const ClassEntry *entry = get_class_entry(dclass_id);
+        if(entry == nullptr) {
+            logger().error() << "Received enter object for doid " << doid << " with unknown dclass id " << dclass_id;
+            return;
+        }
+
+        DistributedObject *obj = create_object(*entry, doid, parent, zone, owner, dgi);
+        if(obj == nullptr) {
+            return;
+        }
+        if(other) {
+            apply_other_fields(obj, dgi);
+        }
+        obj->announce_generate();
+    }
+
+    DistributedObject* ObjectRepository::generate_local_object(doid_t doid, doid_t parent, zone_t zone,
+                                                               uint16_t dclass_id, bool owner) {
+        const ClassEntry *entry = get_class_entry(dclass_id);
+        if(entry == nullptr) {
+            logger().error() << "Can't generate local object " << doid << " with unknown dclass id " << dclass_id;
+            return nullptr;
+        }
+
+        // The defaults of the required fields are packed as the server would send them.
+        DatagramIterator dgi(Datagram::create(entry->dclass->get_client_required_defaults(owner)));
+        DistributedObject *obj = create_object(*entry, doid, parent, zone, owner, dgi);
+        if(obj != nullptr) {
+            obj->announce_generate();
+        }
+        return obj;
+    }
+
+    DistributedObject* ObjectRepository::create_object(const ClassEntry &entry, doid_t doid, doid_t parent,
+                                                       zone_t zone, bool owner, DatagramIterator &dgi) {
+        std::unordered_map<doid_t, DistributedObject*> &objects = owner ? m_doid2ov : m_doid2do;
+        if(objects.find(doid) != objects.end()) {
+            logger().warning() << "Received enter object for doid " << doid << " which already exists.";
+            return nullptr;
+        }
+
+        BaseObjectType *type = owner ? entry.owner_type : entry.object_type;
+        if(type == nullptr) {
+            logger().error() << "No " << (owner ? "owner view" : "object") << " type registered for dclass '"
+                             << entry.dclass->get_name() << "'.";
+            return nullptr;
+        }
+
+        DistributedObject *obj = type->instantiate(entry.dclass->get_name());
+        obj->m_dclass = entry.dclass;
+        obj->m_doid = doid;
+        obj->m_owner_view = owner;
+        obj->m_repository = this;
+        obj->set_location(parent, zone);
+        objects[doid] = obj;
+
+        const std::vector<const dclass::Field*> &required = entry.required_fields[owner];
+        for(auto it = required.begin(); it != required.end(); ++it) {
+            record_snapshot(doid, *it, dgi);
+            obj->handle_update(*it, dgi);
+        }
+        return obj;
+    }
+
+    void ObjectRepository::apply_other_fields(DistributedObject *obj, DatagramIterator &dgi) {
+        uint16_t num_fields = dgi.read_uint16();
+        for(uint16_t i = 0; i < num_fields; ++i) {
+            uint16_t field_id = dgi.read_uint16();
+            const dclass::Field *field = m_dcfile ? m_dcfile->get_field_by_id(field_id) : nullptr;
+            if(field == nullptr) {
+                logger().error() << "Received unknown field id " << field_id << " for doid " << obj->get_doid();
+                return; // can't know the size of the field, so the rest of the message is unreadable
+            }
+            record_snapshot(obj->get_doid(), field, dgi);
+            obj->handle_update(field, dgi);
+        }
+    }
+
+    void ObjectRepository::handle_object_leaving(doid_t doid, bool owner) {
+        std::unordered_map<doid_t, DistributedObject*> &objects = owner ? m_doid2ov : m_doid2do;
+        auto it = objects.find(doid);
+        if(it == objects.end()) {
+            logger().warning() << "Received object leaving for unknown doid " << doid;
+            return;
+        }
+
+        DistributedObject *obj = it->second;
+        objects.erase(it);
+        obj->disable();
+        delete obj;
+
+        if(get_object(doid) == nullptr && get_owner_view(doid) == nullptr) {
+            for(auto it = m_interpolators.begin(); it != m_interpolators.end(); ++it) {
+                if(*it != nullptr) {
+                    (*it)->remove(doid);
+                }
+            }
+        }
+    }
+
+    void ObjectRepository::handle_set_field(DatagramIterator &dgi) {
+        doid_t doid = dgi.read_doid();
+        uint16_t field_id = dgi.read_uint16();
+
+        const dclass::Field *field = m_dcfile ? m_dcfile->get_field_by_id(field_id) : nullptr;
+        if(field == nullptr) {
+            logger().error() << "Received set field for doid " << doid << " with unknown field id " << field_id;
+            return;
+        }
+
+        DistributedObject *ov = get_owner_view(doid);
+        DistributedObject *obj = get_object(doid);
+        if(ov == nullptr && obj == nullptr) {
+            logger().warning() << "Received set field for unknown doid " << doid;
+            return;
+        }
+
+        record_snapshot(doid, field, dgi);
+
+        // Both views may handle the same update, so remember where the field data starts.
+        dgsize_t offset = dgi.tell();
+        if(ov != nullptr && field->has_keywords(dclass::KW_OWNRECV)) {
+            ov->handle_update(field, dgi);
+            dgi.seek(offset);
+        }
+        if(obj != nullptr) {
+            obj->handle_update(field, dgi);
+        }
+    }
+
+} // close namespace astron
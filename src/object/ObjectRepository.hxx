@@ -13,15 +13,122 @@
 #ifndef ASTRON_LIBWASM_OBJECTREPOSITORY_HXX
 #define ASTRON_LIBWASM_OBJECTREPOSITORY_HXX
 
+#include <unordered_map>
+#include <vector>
 #include "../network/Connection.hxx"
+#include "../dc/File.h"
+#include "../dc/Field.h"
+#include "DistributedObject.hxx"
+#include "ObjectFactory.hxx"
+#include "Interpolator.hxx"
 
 namespace astron { // open namespace
 
+    class DatagramIterator; // forward declaration
+
     class ObjectRepository : public Connection {
     public:
         ObjectRepository();
         ~ObjectRepository();
+
+        // set_dcfile sets the distributed class definitions used by this repository.
+        // The object type and owner view type ("OV" suffix) of every dclass are resolved
+        // once here instead of per message. The file must have been finalized.
+        // If the file was read with dclass::read_lazy(), each dclass is instead resolved when
+        // the first object of it enters, so classes the client never sees are never parsed.
+        virtual void set_dcfile(dclass::File *dcfile);
+
+        inline dclass::File* get_dcfile() {
+            return m_dcfile;
+        }
+
+        // get_object returns the visible object with the given doid, or nullptr if none.
+        DistributedObject* get_object(doid_t doid);
+        // get_owner_view returns the owner view with the given doid, or nullptr if none.
+        DistributedObject* get_owner_view(doid_t doid);
+
+        // generate_local_object creates an object of the dclass <dclass_id> that exists only on this
+        // client, as if it had entered with the default values of its required fields.
+        // Returns nullptr if the dclass is unknown or has no registered type, or if <doid> is taken.
+        DistributedObject* generate_local_object(doid_t doid, doid_t parent, zone_t zone, uint16_t dclass_id,
+                                                 bool owner = false);
+
+        // add_interpolator records every received update of the interpolator's field
+        // (when objects enter, and by CLIENT_OBJECT_SET_FIELD) as a snapshot in <interpolator>.
+        // Objects are removed from it when they leave. The interpolator is not owned by the
+        // repository, and must outlive it or be removed. Returns false if the field can't be interpolated.
+        bool add_interpolator(Interpolator *interpolator);
+        void remove_interpolator(Interpolator *interpolator);
+
+        // may_send_field returns true if the client is allowed to send an update of <field>
+        // for <obj>: clsend fields always, ownsend fields only from an owner view.
+        inline bool may_send_field(const DistributedObject *obj, const dclass::Field *field) const {
+            uint64_t allowed = obj->is_owner_view() ? (dclass::KW_CLSEND | dclass::KW_OWNSEND) : dclass::KW_CLSEND;
+            return (field->get_keyword_mask() & allowed) != 0;
+        }
+
+    protected:
+        friend class DistributedObject;
+
+        // send_field_update is called by DistributedObject::send_update with a complete
+        // CLIENT_OBJECT_SET_FIELD message. The default implementation sends it right away.
+        virtual void send_field_update(DistributedObject *obj, const dclass::Field *field, const DatagramPtr &dg);
+
+        // validate_datagram checks that the fields in CLIENT_OBJECT_SET_FIELD and
+        // CLIENT_ENTER_OBJECT_REQUIRED[_OTHER][_OWNER] messages don't run past the end of the
+        // datagram, so the handlers can read them without further checks. Unknown dclasses and
+        // fields are let through; their handlers report them. The dc file must be set before connecting.
+        virtual bool validate_datagram(const uint8_t *data, size_t length);
+
+        // handle_enter_object handles any of the CLIENT_ENTER_OBJECT_REQUIRED[_OTHER][_OWNER] messages.
+        void handle_enter_object(DatagramIterator &dgi, bool owner, bool other);
+        // handle_object_leaving handles CLIENT_OBJECT_LEAVING and CLIENT_OBJECT_LEAVING_OWNER.
+        void handle_object_leaving(doid_t doid, bool owner);
+        // handle_set_field handles CLIENT_OBJECT_SET_FIELD, dispatching the update to the owner
+        // view (if the field is ownrecv) and to the visible object (if any).
+        // Field permissions are checked against the keyword mask of the field.
+        void handle_set_field(DatagramIterator &dgi);
+
+        // class_resolved is called once for each dclass when it is resolved (see set_dcfile).
+        virtual void class_resolved(const dclass::Class *cls) {}
+        // get_resolved_classes returns the dclasses resolved so far, in the order they were resolved.
+        inline const std::vector<const dclass::Class*>& get_resolved_classes() const {
+            return m_resolved;
+        }
+
+    private:
+        // A ClassEntry holds everything resolved for a dclass when the dc file is set.
+        struct ClassEntry {
+            const dclass::Class *dclass = nullptr;
+            BaseObjectType *object_type = nullptr;
+            BaseObjectType *owner_type = nullptr;
+            // The required fields sent when an object enters: visible (broadcast or clrecv),
+            // and for the _OWNER messages, visible or ownrecv. Indexed by the owner flag.
+            std::vector<const dclass::Field*> required_fields[2];
+        };
+
+        // get_class_entry returns the entry of the dclass <dclass_id>, resolving it if needed,
+        // or nullptr if there is no such dclass.
+        const ClassEntry* get_class_entry(uint16_t dclass_id);
+        void resolve_class(const dclass::Class *cls);
+
+        // create_object instantiates an object and applies its required fields from <dgi>; the caller
+        // announces the generate. Returns nullptr if the object can't be created.
+        DistributedObject* create_object(const ClassEntry &entry, doid_t doid, doid_t parent, zone_t zone,
+                                         bool owner, DatagramIterator &dgi);
+        void apply_other_fields(DistributedObject *obj, DatagramIterator &dgi);
+        // record_snapshot passes an update of <field> to its interpolator, if any, leaving <dgi> where it was.
+        void record_snapshot(doid_t doid, const dclass::Field *field, DatagramIterator &dgi);
+
+        dclass::File *m_dcfile = nullptr;
+        std::vector<ClassEntry> m_classes; // indexed by dclass id
+        std::vector<const dclass::Class*> m_resolved;
+
+        std::vector<Interpolator*> m_interpolators; // indexed by field id
+
+        std::unordered_map<doid_t, DistributedObject*> m_doid2do;
+        std::unordered_map<doid_t, DistributedObject*> m_doid2ov; // owner views
     };
 } // close namespace
 
-#endif //ASTRON_LIBWASM_OBJECTREPOSITORY_HXX
\ No newline at end of file
+#endif //ASTRON_LIBWASM_OBJECTREPOSITORY_HXX
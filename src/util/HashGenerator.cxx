@@ -19,27 +19,50 @@ namespace dclass   // open namespace dclass
 // computing large prime numbers unnecessarily), and we also truncate
 // the result to the low-order 32 bits.
 
-#define MAX_PRIME_NUMBERS 10000
-#define PRIMES PrimeNumberGenerator::singleton
+#define MAX_PRIME_NUMBERS PrimeNumberGenerator::NUM_PRIMES
 
 // constructor
-HashGenerator::HashGenerator() : m_hash(0), m_index(0)
+HashGenerator::HashGenerator() : m_primes(PrimeNumberGenerator::get_primes()), m_hash(0), m_index(0)
 {
 }
 
 // add_int adds another integer to the hash so far.
 void HashGenerator::add_int(int num)
 {
-    m_hash += PRIMES[m_index] * num;
-    m_index = (m_index + 1) % MAX_PRIME_NUMBERS;
+    m_hash += m_primes[m_index] * num;
+    if(++m_index == MAX_PRIME_NUMBERS) {
+        m_index = 0;
+    }
 }
 
 // add_string adds a string to the hash, by breaking it down into a sequence of integers.
 void HashGenerator::add_string(const std::string& str)
 {
     add_int(str.length());
-    for(auto it = str.begin(); it != str.end(); ++it) {
-        add_int(*it);
+
+    // The same as calling add_int() for each character, but summed over runs of the prime
+    //     table that don't wrap around, in a loop the compiler can vectorize.
+    const char* chars = str.data();
+    size_t remaining = str.length();
+    while(remaining > 0) {
+        size_t count = MAX_PRIME_NUMBERS - m_index;
+        if(count > remaining) {
+            count = remaining;
+        }
+
+        const unsigned int* primes = m_primes + m_index;
+        uint32_t sum = 0;
+        for(size_t i = 0; i < count; ++i) {
+            sum += primes[i] * (unsigned int)int(chars[i]);
+        }
+        m_hash += sum;
+
+        m_index += (unsigned int)count;
+        if(m_index == MAX_PRIME_NUMBERS) {
+            m_index = 0;
+        }
+        chars += count;
+        remaining -= count;
     }
 }
 
@@ -28,6 +28,7 @@ class HashGenerator
     uint32_t get_hash() const;
 
   private:
+    const unsigned int* m_primes;
     uint32_t m_hash;
     unsigned int m_index;
 };
@@ -13,28 +13,66 @@
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/emscripten.h>
+#include <emscripten/threading.h>
 #else
 #define EMSCRIPTEN_KEEPALIVE
 #endif
 
 #include <time.h>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <chrono>
 #include "Logger.hxx"
 
 NullStream null_stream; // used to print nothing by compiling out the unwanted messages
 NullBuffer null_buffer; // used to print nothing by ignoring the unwanted messages
 
+// The size of the ring of unflushed log records, in bytes.
+static const size_t LOG_RING_SIZE = 64 * 1024;
+
+// next_generation returns a severity generation no Logger has used, so that a LogCategory never
+// keeps what it resolved from a Logger which g_logger has since replaced.
+static uint32_t next_generation()
+{
+    static std::atomic<uint32_t> generations(0);
+    return generations.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
 Logger::Logger(const std::string &log_file, LogSeverity sev, bool console_output) :
-    m_buf(&m_buffer, log_file, console_output), m_severity(sev), m_output(&m_buf)
+    m_ring(LOG_RING_SIZE), m_buf(&m_buffer, log_file, console_output), m_severity(sev), m_severity_generation(next_generation()),
+    m_output(&m_buf), m_color_enabled(true), m_auto_flush(true),
+    m_flush_threshold(16 * 1024), m_unflushed_bytes(0), m_flush_requested(false), m_last_time(-1)
 {
+    get_category_id(std::string()); // id 0: no category
+#ifndef __EMSCRIPTEN__
+    m_flush_thread_running = false;
+#endif // __EMSCRIPTEN__
 }
 
 #ifdef ASTRON_DEBUG_MESSAGES
-Logger::Logger() : m_buf(&m_buffer), m_severity(LSEVERITY_DEBUG), m_output(&m_buf), m_color_enabled(true) { }
+Logger::Logger() : m_ring(LOG_RING_SIZE), m_buf(&m_buffer), m_severity(LSEVERITY_DEBUG),
+    m_severity_generation(next_generation()), m_output(&m_buf), m_color_enabled(true), m_auto_flush(true),
+    m_flush_threshold(16 * 1024), m_unflushed_bytes(0), m_flush_requested(false), m_last_time(-1)
 #else
-Logger::Logger() : m_buf(&m_buffer), m_severity(LSEVERITY_INFO), m_output(&m_buf), m_color_enabled(true) { }
+Logger::Logger() : m_ring(LOG_RING_SIZE), m_buf(&m_buffer), m_severity(LSEVERITY_INFO),
+    m_severity_generation(next_generation()), m_output(&m_buf), m_color_enabled(true), m_auto_flush(true),
+    m_flush_threshold(16 * 1024), m_unflushed_bytes(0), m_flush_requested(false), m_last_time(-1)
 #endif // ASTRON_DEBUG_MESSAGES
+{
+    get_category_id(std::string()); // id 0: no category
+#ifndef __EMSCRIPTEN__
+    m_flush_thread_running = false;
+#endif // __EMSCRIPTEN__
+}
+
+Logger::~Logger()
+{
+#ifndef __EMSCRIPTEN__
+    stop_flush_thread();
+#endif // __EMSCRIPTEN__
+    flush();
+}
 
 /* Reset code */
 static const char* ANSI_RESET = "\x1b[0m";
@@ -81,69 +119,285 @@ const char* Logger::get_severity_color(LogSeverity sev)
     }
 }
 
-// log returns an output stream for C++ style stream operations.
-LockedLogOutput Logger::log(LogSeverity sev)
+static const char* get_severity_label(LogSeverity sev)
 {
-    const char *severity_label;
-
-    if(sev < m_severity) {
-        LockedLogOutput null_out(nullptr, nullptr);
-        return null_out;
-    }
-
     switch(sev) {
     case LSEVERITY_PACKET:
-        severity_label = "PACKET";
-        break;
+        return "PACKET";
     case LSEVERITY_TRACE:
-        severity_label = "TRACE";
-        break;
+        return "TRACE";
     case LSEVERITY_DEBUG:
-        severity_label = "DEBUG";
-        break;
+        return "DEBUG";
     case LSEVERITY_INFO:
-        severity_label = "INFO";
-        break;
+        return "INFO";
     case LSEVERITY_WARNING:
-        severity_label = "WARNING";
-        break;
+        return "WARNING";
     case LSEVERITY_SECURITY:
-        severity_label = "SECURITY";
-        break;
+        return "SECURITY";
     case LSEVERITY_ERROR:
-        severity_label = "ERROR";
-        break;
+        return "ERROR";
     case LSEVERITY_FATAL:
-        severity_label = "FATAL";
-        break;
+        return "FATAL";
     default:
-        severity_label = "UNKNOWN";
-        break;
+        return "UNKNOWN";
+    }
+}
+
+// log returns an output stream for C++ style stream operations.
+LogLine Logger::log(LogSeverity sev)
+{
+    return log(sev, std::string());
+}
+
+LogLine Logger::log(LogSeverity sev, const std::string &category)
+{
+    if(sev < m_severity) {
+        return LogLine();
+    }
+    return LogLine(this, sev, get_category_id(category));
+}
+
+uint16_t Logger::get_category_id(const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(m_category_lock);
+    auto it = m_category_ids.find(name);
+    if(it != m_category_ids.end()) {
+        return it->second;
+    }
+    if(m_category_names.size() > UINT16_MAX) {
+        return 0; // out of ids; log without the name
+    }
+    uint16_t id = uint16_t(m_category_names.size());
+    m_category_names.push_back(name);
+    m_category_ids[name] = id;
+    return id;
+}
+
+void Logger::write_record(const uint8_t *data, size_t length)
+{
+    // If the ring is full, make room by flushing it here rather than dropping the message.
+    if(!m_ring.write(data, length)) {
+        flush();
+        if(!m_ring.write(data, length)) {
+            // Other threads filled it again, or hold up the drain with a record they are still
+            // writing: output this message on its own, ahead of theirs.
+            std::lock_guard<std::mutex> guard(m_flush_lock);
+            format_record(data, length);
+            output_buffer();
+            return;
+        }
+    }
+
+    if(m_auto_flush) {
+        LogSeverity sev = LogSeverity(data[0]);
+        size_t unflushed = m_unflushed_bytes.fetch_add(length, std::memory_order_relaxed) + length;
+        if(sev >= LSEVERITY_ERROR) {
+            flush();
+        } else if(unflushed >= m_flush_threshold) {
+            request_flush();
+        }
+#ifdef __EMSCRIPTEN__
+        else if(unflushed == length) {
+            // The first message since the last flush is output once the current event is handled,
+            // even if no poll follows it (as with an idle LOOP_EVENT_DRIVEN loop).
+            request_flush();
+        }
+#endif // __EMSCRIPTEN__
+    }
+}
+
+void Logger::request_flush()
+{
+    if(m_flush_requested.load(std::memory_order_relaxed) || m_flush_requested.exchange(true)) {
+        return; // until the requested flush runs
+    }
+#ifdef __EMSCRIPTEN__
+    // Only the main thread returns to the browser's event loop; the other threads' messages
+    // wait for the flush after the next poll.
+    if(emscripten_is_main_runtime_thread()) {
+        emscripten_async_call(Logger::deferred_flush, nullptr, 0);
+    }
+#else
+    {
+        std::lock_guard<std::mutex> guard(m_flush_thread_lock);
+        if(m_flush_thread_running) {
+            m_flush_cond.notify_one();
+            return;
+        }
+    }
+    flush();
+#endif // __EMSCRIPTEN__
+}
+
+#ifdef __EMSCRIPTEN__
+void Logger::deferred_flush(void *arg)
+{
+    // g_logger rather than the Logger that requested it, which may have been replaced since.
+    if(g_logger) {
+        g_logger->flush();
+    }
+}
+#endif // __EMSCRIPTEN__
+
+void Logger::set_auto_flush(bool enabled, size_t threshold)
+{
+    m_auto_flush = enabled;
+    m_flush_threshold = threshold;
+}
+
+void Logger::flush()
+{
+    std::lock_guard<std::mutex> guard(m_flush_lock);
+    m_unflushed_bytes.store(0, std::memory_order_relaxed);
+    m_flush_requested.store(false, std::memory_order_relaxed);
+    m_ring.drain([this](const uint8_t *data, size_t length) {
+        format_record(data, length);
+    });
+    output_buffer();
+}
+
+void Logger::output_buffer()
+{
+#ifdef __EMSCRIPTEN__
+    // Every message flushed is output with a single emscripten_log() call.
+    if(m_buffer.empty()) return;
+    int length = int(m_buffer.length());
+    if(m_buffer[length - 1] == '\n') {
+        --length;
     }
+    emscripten_log(EM_LOG_CONSOLE, "%.*s", length, m_buffer.c_str());
+    m_buffer.clear();
+#else
+    m_output.flush();
+#endif // __EMSCRIPTEN__
+}
 
-    time_t rawtime;
-    time(&rawtime);
-    char timetext[1024];
-    strftime(timetext, 1024, "%Y-%m-%d %H:%M:%S", localtime(&rawtime));
+// format_record formats a record written by a LogLine into the output stream.
+void Logger::format_record(const uint8_t *data, size_t length)
+{
+    const uint8_t *end = data + length;
+    LogSeverity sev = LogSeverity(*data++);
+    int64_t timestamp;
+    memcpy(&timestamp, data, sizeof(timestamp));
+    data += sizeof(timestamp);
+    uint16_t category;
+    memcpy(&category, data, sizeof(category));
+    data += sizeof(category);
 
-    LockedLogOutput out(&m_output, &m_lock);
+    if(timestamp != m_last_time) {
+        time_t rawtime = time_t(timestamp);
+        strftime(m_time_text, sizeof(m_time_text), "%Y-%m-%d %H:%M:%S", localtime(&rawtime));
+        m_last_time = timestamp;
+    }
 
     if(m_color_enabled) {
-        out << ANSI_DARK_GREY
-            << "[" << timetext << "] "
-            << get_severity_color(sev)
-            << severity_label
-            << ": "
-            << ANSI_RESET;
+        m_output << ANSI_DARK_GREY
+                 << "[" << m_time_text << "] "
+                 << get_severity_color(sev)
+                 << get_severity_label(sev)
+                 << ": "
+                 << ANSI_RESET;
     } else {
-        out << "[" << timetext << "] "
-            << severity_label
-            << ": ";
+        m_output << "[" << m_time_text << "] "
+                 << get_severity_label(sev)
+                 << ": ";
     }
 
-    return out;
+    {
+        std::lock_guard<std::mutex> guard(m_category_lock);
+        const std::string &name = m_category_names[category];
+        if(!name.empty()) {
+            m_output << name << ": ";
+        }
+    }
+
+    while(data < end) {
+        LogLine::Tag tag = LogLine::Tag(*data++);
+        switch(tag) {
+        case LogLine::TAG_STRING: {
+            uint16_t str_length;
+            memcpy(&str_length, data, sizeof(str_length));
+            data += sizeof(str_length);
+            m_output.write((const char*)data, str_length);
+            data += str_length;
+            break;
+        }
+        case LogLine::TAG_CHAR:
+            m_output.put(char(*data));
+            data += sizeof(char);
+            break;
+        case LogLine::TAG_BOOL:
+            m_output << bool(*data);
+            data += sizeof(uint8_t);
+            break;
+        case LogLine::TAG_INT: {
+            int64_t value;
+            memcpy(&value, data, sizeof(value));
+            m_output << value;
+            data += sizeof(value);
+            break;
+        }
+        case LogLine::TAG_UINT: {
+            uint64_t value;
+            memcpy(&value, data, sizeof(value));
+            m_output << value;
+            data += sizeof(value);
+            break;
+        }
+        case LogLine::TAG_DOUBLE: {
+            double value;
+            memcpy(&value, data, sizeof(value));
+            m_output << value;
+            data += sizeof(value);
+            break;
+        }
+        case LogLine::TAG_POINTER: {
+            uint64_t value;
+            memcpy(&value, data, sizeof(value));
+            m_output << (const void*)uintptr_t(value);
+            data += sizeof(value);
+            break;
+        }
+        case LogLine::TAG_TRUNCATED:
+        default:
+            m_output << "...";
+            data = end;
+            break;
+        }
+    }
+    m_output << '\n';
+}
+
+#ifndef __EMSCRIPTEN__
+void Logger::start_flush_thread(unsigned int interval_ms)
+{
+    std::lock_guard<std::mutex> guard(m_flush_thread_lock);
+    if(m_flush_thread_running) return;
+    m_flush_thread_running = true;
+
+    m_flush_thread = std::thread([this, interval_ms]() {
+        std::unique_lock<std::mutex> lock(m_flush_thread_lock);
+        while(m_flush_thread_running) {
+            m_flush_cond.wait_for(lock, std::chrono::milliseconds(interval_ms));
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    });
 }
 
+void Logger::stop_flush_thread()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_flush_thread_lock);
+        if(!m_flush_thread_running) return;
+        m_flush_thread_running = false;
+    }
+    m_flush_cond.notify_all();
+    m_flush_thread.join();
+}
+#endif // __EMSCRIPTEN__
+
 // set_color_enabled turns ANSI colorized output on or off.
 void Logger::set_color_enabled(bool enabled)
 {
@@ -154,7 +408,9 @@ void Logger::set_color_enabled(bool enabled)
 // Messages with lower severity levels will be discarded.
 void Logger::set_min_severity(LogSeverity sev)
 {
+    std::lock_guard<std::mutex> guard(m_severity_lock);
     m_severity = sev;
+    m_severity_generation.store(next_generation(), std::memory_order_release);
 }
 
 // get_min_severity returns the current minimum severity that will be logged by the logger.
@@ -163,6 +419,27 @@ LogSeverity Logger::get_min_severity()
     return m_severity;
 }
 
+void Logger::set_category_severity(const std::string &category, LogSeverity sev)
+{
+    std::lock_guard<std::mutex> guard(m_severity_lock);
+    m_category_severities[category] = sev;
+    m_severity_generation.store(next_generation(), std::memory_order_release);
+}
+
+void Logger::clear_category_severity(const std::string &category)
+{
+    std::lock_guard<std::mutex> guard(m_severity_lock);
+    m_category_severities.erase(category);
+    m_severity_generation.store(next_generation(), std::memory_order_release);
+}
+
+LogSeverity Logger::get_category_severity(const std::string &category)
+{
+    std::lock_guard<std::mutex> guard(m_severity_lock);
+    auto it = m_category_severities.find(category);
+    return it != m_category_severities.end() ? it->second : m_severity;
+}
+
 LoggerBuf::LoggerBuf(std::string *buffer) :
     std::streambuf(), m_buffer(buffer), m_has_file(false), m_output_to_console(true)
 {
@@ -189,7 +466,9 @@ int LoggerBuf::overflow(int c)
 {
     if(m_output_to_console) {
 #ifdef __EMSCRIPTEN__
-        m_buffer->append(std::to_string(c).c_str());
+        if(c != EOF) {
+            m_buffer->push_back(char(c));
+        }
 #else
         std::cout.put(c);
 #endif // __EMSCRIPTEN__
@@ -205,7 +484,7 @@ std::streamsize LoggerBuf::xsputn(const char* s, std::streamsize n)
 {
     if(m_output_to_console) {
 #ifdef __EMSCRIPTEN__
-        m_buffer->append(s);
+        m_buffer->append(s, size_t(n));
 #else
         std::cout.write(s, n);
 #endif // __EMSCRIPTEN__
@@ -216,24 +495,106 @@ std::streamsize LoggerBuf::xsputn(const char* s, std::streamsize n)
     return n;
 }
 
-#ifdef __EMSCRIPTEN__
-/*
- * We have to explicitly call the `js_flush()` method to make the `emscripten_log()` call.
- * The original Astron logger makes continuous writes to the `std::cout` stream as it
- * forms the log output. Targeting Web Assembly with Emscripten, `std::cout` isn't printed
- * to the Javascript console unless we call `emscripten_log()` via the Emscripten API ("emscripten.h").
- *
- * The astron.libwasm implementation uses a modified Logger module that, instead of writing directly
- * to the `std::cout` stream, it writes into a `std::string` buffer. Then, once `js_flush()` is
- * called, `emscripten_log()` is called (passing the string buffer) and clears the string buffer.
- */
-void Logger::js_flush()
+LogRing::LogRing(size_t capacity) : m_head(0), m_tail(0)
 {
-    if(m_buffer.empty()) return;  // make sure m_buffer isn't empty
-    emscripten_log(EM_LOG_CONSOLE, m_buffer.c_str());
-    m_buffer.clear();
+    size_t size = 1024;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    m_buffer.resize(size, 0);
+    m_mask = size - 1;
+}
+
+bool LogRing::write(const uint8_t *data, size_t length)
+{
+    size_t total = (HEADER_SIZE + length + 7) & ~size_t(7);
+    size_t capacity = m_mask + 1;
+    if(total > capacity / 2) {
+        return false;
+    }
+
+    // Reserve space for the record. A record never wraps around the end of the ring;
+    // the space left at the end is reserved too, and filled with a padding record.
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    size_t padding;
+    do {
+        size_t pos = size_t(head & m_mask);
+        padding = (pos + total > capacity) ? capacity - pos : 0;
+        if(head + padding + total - m_tail.load(std::memory_order_acquire) > capacity) {
+            return false;
+        }
+    } while(!m_head.compare_exchange_weak(head, head + padding + total,
+                                          std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    if(padding) {
+        uint8_t *filler = &m_buffer[head & m_mask];
+        ((uint32_t*)filler)[1] = PADDING;
+        __atomic_store_n((uint32_t*)filler, uint32_t(padding), __ATOMIC_RELEASE);
+    }
+
+    // The total size is set last; it tells the reader that the record is complete.
+    uint8_t *record = &m_buffer[(head + padding) & m_mask];
+    ((uint32_t*)record)[1] = uint32_t(length);
+    memcpy(record + HEADER_SIZE, data, length);
+    __atomic_store_n((uint32_t*)record, uint32_t(total), __ATOMIC_RELEASE);
+    return true;
+}
+
+// A record is [uint8 severity][int64 time][uint16 category][values...], where each value is a Tag
+// followed by its raw bytes (strings are [uint16 length][data]).
+LogLine::LogLine(Logger *logger, LogSeverity sev, uint16_t category) :
+    m_logger(logger), m_length(0), m_truncated(false)
+{
+    m_data[m_length++] = uint8_t(sev);
+    int64_t timestamp = int64_t(time(nullptr));
+    memcpy(&m_data[m_length], &timestamp, sizeof(timestamp));
+    m_length += sizeof(timestamp);
+    memcpy(&m_data[m_length], &category, sizeof(category));
+    m_length += sizeof(category);
+}
+
+LogLine::~LogLine()
+{
+    if(m_logger) {
+        m_logger->write_record(m_data, m_length);
+    }
+}
+
+void LogLine::add_string(const char *str, size_t length)
+{
+    if(m_truncated) return;
+    size_t space = MAX_LENGTH - RESERVED - m_length;
+    if(space <= 1 + sizeof(uint16_t)) {
+        truncate();
+        return;
+    }
+
+    uint16_t str_length = uint16_t(std::min(length, space - 1 - sizeof(uint16_t)));
+    m_data[m_length++] = TAG_STRING;
+    memcpy(&m_data[m_length], &str_length, sizeof(str_length));
+    m_length += sizeof(str_length);
+    memcpy(&m_data[m_length], str, str_length);
+    m_length += str_length;
+
+    if(str_length < length) {
+        truncate();
+    }
+}
+
+void LogLine::truncate()
+{
+    m_data[m_length++] = TAG_TRUNCATED;
+    m_truncated = true;
+}
+
+LogLine& LogLine::operator<<(std::ostream & (*pf)(std::ostream&))
+{
+    typedef std::ostream& (*manipulator)(std::ostream&);
+    if(pf == static_cast<manipulator>(std::endl)) {
+        add_value(TAG_CHAR, '\n');
+    }
+    return *this;
 }
-#endif // __EMSCRIPTEN__
 
 // In the Astron daemon source, this is defined in `src/global.cpp`.
 std::unique_ptr<Logger> g_logger(new Logger());
\ No newline at end of file
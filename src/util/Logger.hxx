@@ -15,12 +15,22 @@
 #define ASTRON_LIBWASM_LOGGER_HXX
 
 #include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <type_traits>
+#ifndef __EMSCRIPTEN__
+#include <thread>
+#include <condition_variable>
+#endif // __EMSCRIPTEN__
 
 // The LogSeverity represents the importance and usage of a log message.
 // LogSeverities advance numerically such that a more important severity is
@@ -57,6 +67,16 @@ enum LogSeverity {
     LSEVERITY_FATAL
 };
 
+// ASTRON_MIN_LOG_LEVEL is the lowest LogSeverity (as a number) compiled into the program;
+// log sites below it are removed entirely. Defaults to LSEVERITY_INFO in release builds.
+#ifndef ASTRON_MIN_LOG_LEVEL
+#ifdef NDEBUG
+#define ASTRON_MIN_LOG_LEVEL 3 // LSEVERITY_INFO
+#else
+#define ASTRON_MIN_LOG_LEVEL 0 // LSEVERITY_PACKET
+#endif // NDEBUG
+#endif // ASTRON_MIN_LOG_LEVEL
+
 // Forward declarations
 class NullStream;
 class NullBuffer;
@@ -84,72 +104,208 @@ class LoggerBuf : public std::streambuf
     bool m_output_to_console;
 };
 
-class LockedLogOutput
+// A LogRing is a lock-free ring buffer of binary log records. Any number of threads may write
+// records; a single consumer (serialized by the Logger) drains them in the order they were reserved.
+class LogRing
 {
   public:
-    LockedLogOutput(std::ostream *stream, std::recursive_mutex *lock) : m_stream(stream), m_lock(lock)
+    // <capacity> is rounded up to a power of two.
+    LogRing(size_t capacity);
+
+    // write copies a record of <length> bytes into the ring.
+    // Returns false if there isn't room for it until the ring is drained.
+    bool write(const uint8_t *data, size_t length);
+
+    // drain calls <fn>(data, length) for each committed record, oldest first, and frees it.
+    // Stops at the first record that has been reserved but not yet committed by its writer.
+    template <typename F>
+    size_t drain(F fn)
     {
-        if(m_lock) {
-            m_lock->lock();
+        size_t count = 0;
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        for(;;) {
+            uint8_t *record = &m_buffer[tail & m_mask];
+            uint32_t total = __atomic_load_n((uint32_t*)record, __ATOMIC_ACQUIRE);
+            if(total == 0) {
+                break;
+            }
+            uint32_t length = ((uint32_t*)record)[1];
+            if(length != PADDING) {
+                fn(record + HEADER_SIZE, size_t(length));
+                ++count;
+            }
+            // Writers only set the header once the record is complete, so the space
+            // must be zeroed before it is handed back to them.
+            memset(record, 0, total);
+            tail += total;
+            m_tail.store(tail, std::memory_order_release);
         }
+        return count;
     }
 
-    LockedLogOutput(const LockedLogOutput& other) : m_stream(other.m_stream), m_lock(other.m_lock)
+  private:
+    // Each record is [uint32 total size][uint32 length][data], aligned to 8 bytes.
+    static const size_t HEADER_SIZE = 8;
+    static const uint32_t PADDING = 0xFFFFFFFF; // length of the filler record before a wrap
+
+    std::vector<uint8_t> m_buffer;
+    size_t m_mask;
+    std::atomic<uint64_t> m_head; // end of the reserved records
+    std::atomic<uint64_t> m_tail; // end of the drained records
+};
+
+// A LogLine is the output stream of one log message. Arguments are not formatted as they are
+// added; they are stored as tagged binary values in a fixed buffer, and the record is handed to
+// the Logger's ring when the LogLine goes out of scope. Formatting happens when the ring is flushed.
+class LogLine
+{
+  public:
+    // Messages longer than MAX_LENGTH bytes (after encoding) are truncated.
+    static const size_t MAX_LENGTH = 512;
+
+    enum Tag : uint8_t {
+        TAG_STRING,
+        TAG_CHAR,
+        TAG_BOOL,
+        TAG_INT,
+        TAG_UINT,
+        TAG_DOUBLE,
+        TAG_POINTER,
+        TAG_TRUNCATED
+    };
+
+    // An inactive LogLine, for filtered messages. Arguments are discarded.
+    LogLine() : m_logger(nullptr), m_length(0), m_truncated(false)
     {
-        if(m_lock) {
-            m_lock->lock();
-        }
     }
+    // <category> is the id of the category name, from Logger::get_category_id().
+    LogLine(Logger *logger, LogSeverity sev, uint16_t category);
+    LogLine(LogLine &&other) : m_logger(other.m_logger), m_length(other.m_length), m_truncated(other.m_truncated)
+    {
+        memcpy(m_data, other.m_data, m_length);
+        other.m_logger = nullptr;
+    }
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+    ~LogLine();
 
-    LockedLogOutput& operator=(const LockedLogOutput&) = delete;   // non copyable
-
-    ~LockedLogOutput()
+    LogLine& operator<<(const std::string &x)
     {
-        if(m_lock) {
-            m_lock->unlock();
+        if(m_logger) {
+            add_string(x.data(), x.length());
         }
+        return *this;
+    }
+    LogLine& operator<<(const char *x)
+    {
+        if(m_logger) {
+            add_string(x, strlen(x));
+        }
+        return *this;
+    }
+    LogLine& operator<<(char x)
+    {
+        return add_value(TAG_CHAR, x);
+    }
+    // Like std::ostream, signed and unsigned chars are output as characters.
+    LogLine& operator<<(signed char x)
+    {
+        return add_value(TAG_CHAR, char(x));
+    }
+    LogLine& operator<<(unsigned char x)
+    {
+        return add_value(TAG_CHAR, char(x));
+    }
+    LogLine& operator<<(bool x)
+    {
+        return add_value(TAG_BOOL, uint8_t(x));
+    }
+
+    template <typename T>
+    typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value) || std::is_enum<T>::value,
+                            LogLine&>::type operator<<(T x)
+    {
+        return add_value(TAG_INT, int64_t(x));
+    }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, LogLine&>::type operator<<(T x)
+    {
+        return add_value(TAG_UINT, uint64_t(x));
+    }
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, LogLine&>::type operator<<(T x)
+    {
+        return add_value(TAG_DOUBLE, double(x));
+    }
+    LogLine& operator<<(const void *x)
+    {
+        return add_value(TAG_POINTER, uint64_t(uintptr_t(x)));
     }
 
+    // Any other printable type is formatted right away, so it can't refer to freed memory later.
     template <typename T>
-    LockedLogOutput &operator<<(const T &x)
+    typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value &&
+                            !std::is_pointer<T>::value && !std::is_array<T>::value &&
+                            !std::is_convertible<const T&, std::string>::value, LogLine&>::type
+    operator<<(const T &x)
     {
-        if(m_stream) {
-            *m_stream << x;
+        if(m_logger) {
+            std::ostringstream ss;
+            ss << x;
+            const std::string str = ss.str();
+            add_string(str.data(), str.length());
         }
         return *this;
     }
 
-    LockedLogOutput& operator<<(std::ostream & (*pf)(std::ostream&))
+    // Stream manipulators have no effect, except for std::endl which adds a newline.
+    LogLine& operator<<(std::ostream & (*pf)(std::ostream&));
+    LogLine& operator<<(std::basic_ios<char>& (*pf)(std::basic_ios<char>&))
     {
-        if(m_stream) {
-            *m_stream << pf;
-        }
         return *this;
     }
 
-    LockedLogOutput& operator<<(std::basic_ios<char>& (*pf)(std::basic_ios<char>&))
+  private:
+    // The space kept free for the TAG_TRUNCATED marker.
+    static const size_t RESERVED = 1;
+
+    void add_string(const char *str, size_t length);
+
+    template <typename T>
+    LogLine& add_value(Tag tag, T value)
     {
-        if(m_stream) {
-            *m_stream << pf;
+        if(m_logger && !m_truncated) {
+            if(m_length + 1 + sizeof(T) > MAX_LENGTH - RESERVED) {
+                truncate();
+                return *this;
+            }
+            m_data[m_length++] = tag;
+            memcpy(&m_data[m_length], &value, sizeof(T));
+            m_length += sizeof(T);
         }
         return *this;
     }
 
-  private:
-    std::ostream *m_stream;
-    std::recursive_mutex *m_lock;
+    void truncate();
+
+    Logger *m_logger; // nullptr when inactive
+    size_t m_length;
+    bool m_truncated;
+    uint8_t m_data[MAX_LENGTH];
 };
 
 // A Logger is an object that allows configuration of the output destination of log messages.
-// It provides a stream as an output mechanism.
+// Messages are written to a ring of binary records, which is formatted and output by flush().
 class Logger
 {
   public:
     Logger(const std::string &log_file, LogSeverity sev, bool console_output = true);
     Logger();
+    ~Logger();
 
     // log returns an output stream for C++ style stream operations.
-    LockedLogOutput log(LogSeverity sev);
+    LogLine log(LogSeverity sev);
+    LogLine log(LogSeverity sev, const std::string &category);
 
     // set_color_enabled turns ANSI colorized output on or off.
     void set_color_enabled(bool enabled);
@@ -161,19 +317,94 @@ class Logger
     // get_min_severity returns the current minimum severity that will be logged by the logger.
     LogSeverity get_min_severity();
 
+    // set_category_severity sets the lowest severity output for the LogCategory with id <category>,
+    // instead of the logger's minimum severity. It may be lower, e.g. to see "connection" packets.
+    void set_category_severity(const std::string &category, LogSeverity sev);
+    // clear_category_severity makes the category use the logger's minimum severity again.
+    void clear_category_severity(const std::string &category);
+    // get_category_severity returns the lowest severity output for the category with id <category>.
+    LogSeverity get_category_severity(const std::string &category);
+
+    // get_category_id returns the id log records use for the category named <name>, adding it
+    // on first use. Records store this id rather than a copy of the name.
+    uint16_t get_category_id(const std::string &name);
+
+    // get_severity_generation returns a number that changes whenever any severity is changed.
+    inline uint32_t get_severity_generation() const
+    {
+        return m_severity_generation.load(std::memory_order_acquire);
+    }
+
+    // flush formats the messages logged since the last flush and outputs them.
+    void flush();
+
+    // set_auto_flush turns the auto-flush policy on or off (default: on). With it on, the log
+    // is flushed right away after an ERROR or FATAL message, and once <threshold> bytes of
+    // messages are waiting, a flush is requested: natively, it is run by the flush thread if it
+    // is started (or else right away). With Emscripten, the first message after a flush already
+    // requests one, which runs once the current event is handled.
+    // Connection also flushes the log after each poll.
+    // With it off, messages are only output by flush() (or if the ring fills up).
+    void set_auto_flush(bool enabled, size_t threshold = 16 * 1024);
+    inline bool get_auto_flush() const
+    {
+        return m_auto_flush;
+    }
+
 #ifdef __EMSCRIPTEN__
-    void js_flush();
+    // js_flush outputs the logged messages to the JS console; same as flush().
+    inline void js_flush()
+    {
+        flush();
+    }
+#else
+    // start_flush_thread flushes the log from a background thread every <interval_ms>.
+    void start_flush_thread(unsigned int interval_ms = 50);
+    void stop_flush_thread();
 #endif // __EMSCRIPTEN__
 
+    // write_record adds an encoded LogLine to the ring; called by LogLine.
+    void write_record(const uint8_t *data, size_t length);
+
   private:
     const char* get_severity_color(LogSeverity sev);
+    void format_record(const uint8_t *data, size_t length);
+    // output_buffer outputs what format_record() wrote; called with m_flush_lock held.
+    void output_buffer();
+    // request_flush has the log flushed off the logging thread's path; see set_auto_flush().
+    void request_flush();
+#ifdef __EMSCRIPTEN__
+    static void deferred_flush(void *arg);
+#endif // __EMSCRIPTEN__
 
+    LogRing m_ring;
     LoggerBuf m_buf;
     LogSeverity m_severity;
+    std::unordered_map<std::string, LogSeverity> m_category_severities;
+    std::mutex m_severity_lock;
+    std::atomic<uint32_t> m_severity_generation;
+    std::vector<std::string> m_category_names; // by id
+    std::unordered_map<std::string, uint16_t> m_category_ids;
+    std::mutex m_category_lock;
     std::string m_buffer;
     std::ostream m_output;
-    std::recursive_mutex m_lock;
+    std::mutex m_flush_lock; // only one thread formats records at a time
     bool m_color_enabled;
+    bool m_auto_flush;
+    size_t m_flush_threshold;
+    std::atomic<size_t> m_unflushed_bytes;
+    std::atomic<bool> m_flush_requested; // cleared by flush()
+
+    // The formatted time of the last flushed record, reused while the second doesn't change.
+    int64_t m_last_time;
+    char m_time_text[32];
+
+#ifndef __EMSCRIPTEN__
+    std::thread m_flush_thread;
+    std::condition_variable m_flush_cond;
+    std::mutex m_flush_thread_lock;
+    bool m_flush_thread_running;
+#endif // __EMSCRIPTEN__
 };
 
 // A LogCategory is a wrapper for a Logger object that specially formats the output
@@ -196,70 +427,131 @@ class LogCategory
     void set_name(const std::string &name)
     {
         m_name = name;
+        m_resolved.store(0, std::memory_order_relaxed); // resolve the id of the new name
+    }
+
+    // is_enabled returns true if messages of severity <sev> are output for this category.
+    // The severity (and the id of the name) is resolved from the Logger once, and again only
+    // after a severity changes. It is cached together with the generation it was resolved at in a
+    // single atomic word, so that a category used by several threads (e.g. the decode thread)
+    // always reads a matching set.
+    inline bool is_enabled(LogSeverity sev)
+    {
+        if(sev < LogSeverity(ASTRON_MIN_LOG_LEVEL)) {
+            return false;
+        }
+        uint32_t generation = g_logger->get_severity_generation();
+        uint64_t resolved = m_resolved.load(std::memory_order_relaxed);
+        if(uint32_t(resolved >> 24) != generation) {
+            resolved = uint64_t(generation) << 24 | uint64_t(g_logger->get_category_id(m_name)) << 8
+                       | uint8_t(g_logger->get_category_severity(m_id));
+            m_resolved.store(resolved, std::memory_order_relaxed);
+        }
+        return sev >= LogSeverity(resolved & 0xff);
+    }
+
+    // log returns a stream for a message of severity <sev>; see also ASTRON_LOG.
+    inline LogLine log(LogSeverity sev)
+    {
+        if(!is_enabled(sev)) {
+            return LogLine();
+        }
+        uint16_t name_id = uint16_t(m_resolved.load(std::memory_order_relaxed) >> 8);
+        return LogLine(g_logger.get(), sev, name_id);
     }
 
 #define F(level, severity) \
-	LockedLogOutput level() \
+	LogLine level() \
+	{ \
+		return log(severity); \
+	}
+#define N(level) \
+	inline NullStream &level() \
 	{ \
-		LockedLogOutput out = g_logger->log(severity); \
-		out << m_name << ": "; \
-		return out; \
+		return null_stream; \
 	}
 
-#ifndef NDEBUG
+    // Severities below ASTRON_MIN_LOG_LEVEL are compiled out, returning a NullStream.
+#if ASTRON_MIN_LOG_LEVEL <= 0
     // packet() provides a stream with the time and "PACKET" severity preprended to the message.
     // packet messages are only output when compiled with -DCMAKE_BUILD_TYPE=Debug.
     F(packet, LSEVERITY_PACKET)
+#else
+    N(packet)
+#endif
+#if ASTRON_MIN_LOG_LEVEL <= 1
     // trace() provides a stream with the time and "TRACE" severity preprended to the message.
     // trace messages are only output when compiled with -DCMAKE_BUILD_TYPE=Debug.
     F(trace, LSEVERITY_TRACE)
-    // debug() provides a stream with the time and "DEBUG" severity preprended to the message.
-    // trace messages are only output when compiled with -DCMAKE_BUILD_TYPE=Debug.
-    F(debug, LSEVERITY_DEBUG)
 #else
-    // packet() provides a stream with the time and "PACKET" severity preprended to the message.
-    // packet messages are only output when compiled with -DCMAKE_BUILD_TYPE=Debug.
-    inline NullStream &packet()
-    {
-        return null_stream;
-    }
-    // trace() provides a stream with the time and "TRACE" severity preprended to the message.
-    // trace messages are only output when compiled with -DCMAKE_BUILD_TYPE=Debug.
-    inline NullStream &trace()
-    {
-        return null_stream;
-    }
+    N(trace)
+#endif
+#if ASTRON_MIN_LOG_LEVEL <= 2
     // debug() provides a stream with the time and "DEBUG" severity preprended to the message.
     // debug messages are only output when compiled with -DCMAKE_BUILD_TYPE=Debug.
-    inline NullStream &debug()
-    {
-        return null_stream;
-    }
-
+    F(debug, LSEVERITY_DEBUG)
+#else
+    N(debug)
 #endif
+#if ASTRON_MIN_LOG_LEVEL <= 3
     // info() provides a stream with the time and "INFO" severity preprended to the message.
     // info messages are filtered with severity LSEVERITY_INFO.
     F(info, LSEVERITY_INFO)
+#else
+    N(info)
+#endif
+#if ASTRON_MIN_LOG_LEVEL <= 4
     // warning() provides a stream with the time and "WARNING" severity preprended to the message.
     // warning messages are filtered with severity LSEVERITY_WARNING.
     F(warning, LSEVERITY_WARNING)
+#else
+    N(warning)
+#endif
+#if ASTRON_MIN_LOG_LEVEL <= 5
     // security() provides a stream with the time and "SECURITY" severity preprended to the message.
     // secutity messages are filtered with severity LSEVERITY_SECURITY.
     F(security, LSEVERITY_SECURITY)
+#else
+    N(security)
+#endif
+#if ASTRON_MIN_LOG_LEVEL <= 6
     // error() provides a stream with the time and "ERROR" severity preprended to the message.
     // error messages are filtered with severity LSEVERITY_ERROR.
     F(error, LSEVERITY_ERROR)
+#else
+    N(error)
+#endif
     // fatal() provides a stream with the time and "FATAL" severity preprended to the message.
     // fatal messages are filtered with severity LSEVERITY_FATAL.
     F(fatal, LSEVERITY_FATAL)
 
 #undef F
+#undef N
 
   private:
     std::string m_id;
     std::string m_name;
+    // The Logger severity generation the category was resolved at (shifted left by 24), the id
+    // of its name (by 8) and its severity. Generations are never 0, so it is resolved on first use.
+    std::atomic<uint64_t> m_resolved{0};
 };
 
+// ASTRON_LOG streams a message to <category> (a LogCategory) with severity <sev>, like
+// `ASTRON_LOG(logger(), LSEVERITY_DEBUG) << "Datagram: " << dump(dg);`. The severity is checked
+// before the streamed values are evaluated, so they cost nothing when the message is filtered.
+// Severities below ASTRON_MIN_LOG_LEVEL are removed at compile time.
+#define ASTRON_LOG(category, sev) \
+    if(!(category).is_enabled(sev)) {} else (category).log(sev)
+
+#define ASTRON_LOG_PACKET(category) ASTRON_LOG(category, LSEVERITY_PACKET)
+#define ASTRON_LOG_TRACE(category) ASTRON_LOG(category, LSEVERITY_TRACE)
+#define ASTRON_LOG_DEBUG(category) ASTRON_LOG(category, LSEVERITY_DEBUG)
+#define ASTRON_LOG_INFO(category) ASTRON_LOG(category, LSEVERITY_INFO)
+#define ASTRON_LOG_WARNING(category) ASTRON_LOG(category, LSEVERITY_WARNING)
+#define ASTRON_LOG_SECURITY(category) ASTRON_LOG(category, LSEVERITY_SECURITY)
+#define ASTRON_LOG_ERROR(category) ASTRON_LOG(category, LSEVERITY_ERROR)
+#define ASTRON_LOG_FATAL(category) ASTRON_LOG(category, LSEVERITY_FATAL)
+
 /* ========================== *
  *       HELPER CLASSES       *
  * ========================== */
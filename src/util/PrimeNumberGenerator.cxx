@@ -6,44 +6,43 @@
 //
 
 #include "PrimeNumberGenerator.h"
+#include <vector> // std::vector
 namespace dclass   // open namespace dclass
 {
 
-PrimeNumberGenerator PrimeNumberGenerator::singleton = PrimeNumberGenerator();
+// The NUM_PRIMES-th prime number, which bounds the sieve.
+static const unsigned int LARGEST_PRIME = 104729;
 
 // constructor
 PrimeNumberGenerator::PrimeNumberGenerator()
 {
-    m_primes.push_back(2);
-}
-
-// the indexing operator returns the nth prime number.  this[0] returns 2, this[1] returns 3;
-//     successively larger values of n return larger prime numbers, up to the largest prime
-//     number that can be represented in an int.
-unsigned int PrimeNumberGenerator::operator [](unsigned int n)
-{
-    // Compute the prime numbers between the last-computed prime number and n.
-    unsigned int candidate = m_primes.back() + 1;
-    while(m_primes.size() <= n) {
-        // Is candidate prime?  It is not if any one of the already-found
-        // prime numbers (up to its square root) divides it evenly.
-        bool maybe_prime = true;
-        unsigned int j = 0;
-        while(maybe_prime && m_primes[j] * m_primes[j] <= candidate) {
-            if((m_primes[j] * (candidate / m_primes[j])) == candidate) {
-                // This one is not prime.
-                maybe_prime = false;
-            }
-            j++;
+    // Sieve of Eratosthenes over the odd numbers; composite[i] stands for 2 * i + 1.
+    std::vector<bool> composite(LARGEST_PRIME / 2 + 1, false);
+    for(unsigned int i = 1; (2 * i + 1) * (2 * i + 1) <= LARGEST_PRIME; ++i) {
+        if(composite[i]) {
+            continue;
+        }
+        unsigned int step = 2 * i + 1;
+        for(unsigned int j = (step * step) / 2; j < composite.size(); j += step) {
+            composite[j] = true;
         }
-        if(maybe_prime) {
-            // Hey, we found a prime!
-            m_primes.push_back(candidate);
+    }
+
+    unsigned int count = 0;
+    m_primes[count++] = 2;
+    for(unsigned int i = 1; count < NUM_PRIMES; ++i) {
+        if(!composite[i]) {
+            m_primes[count++] = 2 * i + 1;
         }
-        candidate++;
     }
+}
 
-    return m_primes[n];
+// get_primes returns the table of prime numbers; [0] is 2, [1] is 3, and so on up to
+//     [NUM_PRIMES - 1].
+const unsigned int* PrimeNumberGenerator::get_primes()
+{
+    static const PrimeNumberGenerator generator; // why would we ever need more than one?
+    return generator.m_primes;
 }
 
 } // close namespace dclass
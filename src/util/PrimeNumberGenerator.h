@@ -8,28 +8,25 @@
 #ifndef ASTRON_LIBWASM_PRIMENUMBERGENERATOR_H
 #define ASTRON_LIBWASM_PRIMENUMBERGENERATOR_H
 
-#include <vector> // std::vector
 namespace dclass   // open namespace dclass
 {
 
-// A PrimeNumberGenerator this class generates a table of prime numbers, up to the limit of an int.
-//     For a given integer n, it will return the nth prime number.  This will involve a recompute
-//     step only if n is greater than any previous n.
+// A PrimeNumberGenerator holds a table of the first NUM_PRIMES prime numbers.  The table is
+//     computed once, on first use, by sieving all the numbers up to the largest of them.
 class PrimeNumberGenerator
 {
   public:
-    static PrimeNumberGenerator singleton; // why would we ever need more than one?
+    static const unsigned int NUM_PRIMES = 10000;
 
-    // the indexing operator returns the nth prime number.  this[0] returns 2, this[1] returns 3;
-    //     successively larger values of n return larger prime numbers, up to the largest prime
-    //     number that can be represented in an int.
-    unsigned int operator [](unsigned int n);
+    // get_primes returns the table of prime numbers; [0] is 2, [1] is 3, and so on up to
+    //     [NUM_PRIMES - 1].
+    static const unsigned int* get_primes();
 
   private:
     PrimeNumberGenerator();
-    std::vector<unsigned int> m_primes;
+    unsigned int m_primes[NUM_PRIMES];
 };
 
 } // close namespace dclass
 
-#endif // ASTRON_LIBWASM_PRIMENUMBERGENERATOR_H
\ No newline at end of file
+#endif // ASTRON_LIBWASM_PRIMENUMBERGENERATOR_H
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2023, Max Rodriguez. All rights reserved.
+ *
+ * All use of this software is subject to the terms of the revised BSD
+ * license. You should have received a copy of this license along
+ * with this source code in a file named "COPYING".
+ *
+ * @file SpscQueue.hxx
+ * @author Max Rodriguez
+ * @date 2023-06-26
+ */
+
+#ifndef ASTRON_LIBWASM_SPSCQUEUE_HXX
+#define ASTRON_LIBWASM_SPSCQUEUE_HXX
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <utility>
+
+namespace astron   // open namespace
+{
+
+// An SpscQueue is a bounded, lock-free queue between exactly one producer thread
+// and one consumer thread. Values are moved in and out of preallocated slots.
+template <typename T>
+class SpscQueue
+{
+  public:
+    // <capacity> is rounded up to a power of two.
+    explicit SpscQueue(size_t capacity) : m_head(0), m_tail(0)
+    {
+        size_t size = 2;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // push moves <value> to the back of the queue. Returns false if the queue is full,
+    // in which case <value> is left untouched. Only called by the producer.
+    bool push(T &value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if(tail - m_head.load(std::memory_order_acquire) > m_mask) {
+            return false;
+        }
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // pop moves the front of the queue into <value>. Returns false if the queue is empty.
+    // Only called by the consumer.
+    bool pop(T &value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if(head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // size returns the number of values in the queue. It may be stale by the time it is used,
+    // unless called from the thread that can't change it in that direction.
+    inline size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    inline bool empty() const
+    {
+        return size() == 0;
+    }
+
+  private:
+    std::vector<T> m_slots;
+    size_t m_mask;
+
+    // The indices are kept on separate cache lines, so the threads don't contend for one.
+    alignas(64) std::atomic<size_t> m_head; // next slot to pop
+    alignas(64) std::atomic<size_t> m_tail; // next slot to push
+};
+} // close namespace astron
+
+#endif //ASTRON_LIBWASM_SPSCQUEUE_HXX